@@ -74,6 +74,7 @@
 #include "meta-background-actor-private.h"
 #include "window-private.h" /* to check window->hidden */
 #include "display-private.h" /* for meta_display_lookup_x_window() */
+#include "roundtrips.h"
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xcomposite.h>
 
@@ -226,6 +227,7 @@ get_output_window (MetaScreen *screen)
 
   output = XCompositeGetOverlayWindow (xdisplay, xroot);
 
+  meta_roundtrip_note (META_ROUNDTRIP_GET_ATTRIBUTES);
   if (XGetWindowAttributes (xdisplay, output, &attr))
       {
         event_mask |= attr.your_event_mask;
@@ -566,6 +568,7 @@ meta_compositor_manage_screen (MetaCompositor *compositor,
     {
       meta_error_trap_push_with_return (display);
       XCompositeRedirectSubwindows (xdisplay, xroot, CompositeRedirectManual);
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
       XSync (xdisplay, FALSE);
 
       if (!meta_error_trap_pop_with_return (display))
@@ -619,6 +622,7 @@ meta_compositor_manage_screen (MetaCompositor *compositor,
                KeyPressMask | KeyReleaseMask |
                StructureNotifyMask;
 
+  meta_roundtrip_note (META_ROUNDTRIP_GET_ATTRIBUTES);
   if (XGetWindowAttributes (xdisplay, xwin, &attr))
       {
         event_mask |= attr.your_event_mask;
@@ -809,6 +813,25 @@ meta_compositor_window_shape_changed (MetaCompositor *compositor,
   meta_window_actor_update_shape (window_actor);
 }
 
+/**
+ * meta_compositor_queue_frame_redraw: (skip)
+ *
+ * Redraws the decorations of a window whose frame is drawn by the
+ * compositor.
+ */
+void
+meta_compositor_queue_frame_redraw (MetaCompositor *compositor,
+                                    MetaWindow     *window)
+{
+  MetaWindowActor *window_actor;
+
+  window_actor = META_WINDOW_ACTOR (meta_window_get_compositor_private (window));
+
+  /* The actor is created after the frame */
+  if (window_actor)
+    meta_window_actor_queue_frame_redraw (window_actor);
+}
+
 /**
  * meta_compositor_process_event: (skip)
  *
@@ -1294,6 +1317,8 @@ meta_repaint_func (gpointer data)
       pre_paint_windows (info);
     }
 
+  meta_startup_phase_end (META_STARTUP_PHASE_FIRST_PAINT);
+
   return TRUE;
 }
 
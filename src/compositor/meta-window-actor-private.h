@@ -35,6 +35,8 @@ void meta_window_actor_pre_paint      (MetaWindowActor    *self);
 
 void meta_window_actor_invalidate_shadow (MetaWindowActor *self);
 
+void meta_window_actor_queue_frame_redraw (MetaWindowActor *self);
+
 void meta_window_actor_set_redirected (MetaWindowActor *self, gboolean state);
 
 gboolean meta_window_actor_should_unredirect (MetaWindowActor *self);
@@ -26,8 +26,10 @@
 #include <meta/window.h>
 #include <meta/meta-shaped-texture.h>
 #include "xprops.h"
+#include "roundtrips.h"
 
 #include "compositor-private.h"
+#include "cogl-utils.h"
 #include "meta-shadow-factory-private.h"
 #include "meta-window-actor-private.h"
 
@@ -81,6 +83,12 @@ struct _MetaWindowActorPrivate
   /* Extracted size-invariant shape used for shadows */
   MetaWindowShape  *shadow_shape;
 
+  /* Decorations of a composited frame, painted over the window */
+  CoglHandle        frame_texture;
+  CoglHandle        frame_material;
+  int               frame_width;
+  int               frame_height;
+
   gint              last_width;
   gint              last_height;
   MetaFrameBorders  last_borders;
@@ -112,6 +120,7 @@ struct _MetaWindowActorPrivate
 
   guint		    needs_pixmap           : 1;
   guint             needs_reshape          : 1;
+  guint             needs_frame_render     : 1;
   guint             recompute_focused_shadow   : 1;
   guint             recompute_unfocused_shadow : 1;
   guint		    size_changed           : 1;
@@ -169,6 +178,7 @@ static gboolean meta_window_actor_has_shadow (MetaWindowActor *self);
 static void meta_window_actor_clear_shape_region    (MetaWindowActor *self);
 static void meta_window_actor_clear_bounding_region (MetaWindowActor *self);
 static void meta_window_actor_clear_shadow_clip     (MetaWindowActor *self);
+static void meta_window_actor_clear_frame_texture   (MetaWindowActor *self);
 
 static void check_needs_reshape (MetaWindowActor *self);
 
@@ -322,6 +332,7 @@ window_decorated_notify (MetaWindow *mw,
    * from scratch, as everything has changed.
    */
   priv->redecorating = TRUE;
+  priv->needs_frame_render = TRUE;
 
   if (frame)
     new_xwindow = meta_frame_get_xwindow (frame);
@@ -451,6 +462,7 @@ meta_window_actor_dispose (GObject *object)
   meta_window_actor_clear_shape_region (self);
   meta_window_actor_clear_bounding_region (self);
   meta_window_actor_clear_shadow_clip (self);
+  meta_window_actor_clear_frame_texture (self);
 
   if (priv->shadow_class != NULL)
     {
@@ -744,6 +756,16 @@ meta_window_actor_paint (ClutterActor *actor)
     }
 
   CLUTTER_ACTOR_CLASS (meta_window_actor_parent_class)->paint (actor);
+
+  if (priv->frame_material != COGL_INVALID_HANDLE)
+    {
+      guint8 opacity = clutter_actor_get_paint_opacity (priv->actor);
+
+      cogl_material_set_color4ub (priv->frame_material,
+                                  opacity, opacity, opacity, opacity);
+      cogl_set_source (priv->frame_material);
+      cogl_rectangle (0, 0, priv->frame_width, priv->frame_height);
+    }
 }
 
 static gboolean
@@ -1268,6 +1290,10 @@ meta_window_actor_should_unredirect (MetaWindowActor *self)
   if (meta_window_requested_dont_bypass_compositor (metaWindow))
     return FALSE;
 
+  /* Only the compositor can show a composited frame */
+  if (metaWindow->frame && meta_frame_is_composited (metaWindow->frame))
+    return FALSE;
+
   if (priv->opacity != 0xff)
     return FALSE;
 
@@ -1713,6 +1739,24 @@ meta_window_actor_clear_shadow_clip (MetaWindowActor *self)
     }
 }
 
+static void
+meta_window_actor_clear_frame_texture (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+
+  if (priv->frame_material != COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (priv->frame_material);
+      priv->frame_material = COGL_INVALID_HANDLE;
+    }
+
+  if (priv->frame_texture != COGL_INVALID_HANDLE)
+    {
+      cogl_handle_unref (priv->frame_texture);
+      priv->frame_texture = COGL_INVALID_HANDLE;
+    }
+}
+
 static void
 meta_window_actor_update_bounding_region_and_borders (MetaWindowActor *self,
                                                       int              width,
@@ -2345,8 +2389,30 @@ check_needs_reshape (MetaWindowActor *self)
     }
 #endif
 
-  meta_shaped_texture_set_shape_region (META_SHAPED_TEXTURE (priv->actor),
-                                        region);
+  if (priv->window->frame && meta_frame_is_composited (priv->window->frame))
+    {
+      /* Nothing is drawn into a composited frame's window, so only
+       * show the client from it; the frame texture covers the rest.
+       */
+      cairo_region_t *client_region;
+      cairo_rectangle_int_t client_area;
+
+      client_area.x = borders.total.left;
+      client_area.y = borders.total.top;
+      client_area.width = priv->window->rect.width;
+      client_area.height = priv->window->rect.height;
+
+      client_region = cairo_region_copy (region);
+      cairo_region_intersect_rectangle (client_region, &client_area);
+      meta_shaped_texture_set_shape_region (META_SHAPED_TEXTURE (priv->actor),
+                                            client_region);
+      cairo_region_destroy (client_region);
+    }
+  else
+    {
+      meta_shaped_texture_set_shape_region (META_SHAPED_TEXTURE (priv->actor),
+                                            region);
+    }
 
   meta_window_actor_update_shape_region (self, region);
 
@@ -2358,6 +2424,61 @@ check_needs_reshape (MetaWindowActor *self)
   meta_window_actor_invalidate_shadow (self);
 }
 
+/* Draws a composited frame into a texture when it has changed or
+ * been resized; this replaces painting the frame window and picking
+ * it up through its pixmap.
+ */
+static void
+check_needs_frame (MetaWindowActor *self)
+{
+  MetaWindowActorPrivate *priv = self->priv;
+  MetaFrame *frame = priv->window->frame;
+  cairo_surface_t *surface;
+
+  if (frame == NULL || !meta_frame_is_composited (frame))
+    {
+      meta_window_actor_clear_frame_texture (self);
+      return;
+    }
+
+  if (!priv->needs_frame_render &&
+      priv->frame_texture != COGL_INVALID_HANDLE &&
+      priv->frame_width == frame->rect.width &&
+      priv->frame_height == frame->rect.height)
+    return;
+
+  priv->needs_frame_render = FALSE;
+
+  meta_window_actor_clear_frame_texture (self);
+
+  surface = meta_frame_render (frame);
+  if (surface == NULL)
+    return;
+
+  priv->frame_width = cairo_image_surface_get_width (surface);
+  priv->frame_height = cairo_image_surface_get_height (surface);
+
+  priv->frame_texture =
+    meta_cogl_texture_new_from_data_wrapper (priv->frame_width,
+                                             priv->frame_height,
+                                             COGL_TEXTURE_NONE,
+                                             CLUTTER_CAIRO_FORMAT_ARGB32,
+                                             COGL_PIXEL_FORMAT_ANY,
+                                             cairo_image_surface_get_stride (surface),
+                                             cairo_image_surface_get_data (surface));
+  cairo_surface_destroy (surface);
+
+  if (priv->frame_texture != COGL_INVALID_HANDLE)
+    priv->frame_material = meta_create_texture_material (priv->frame_texture);
+}
+
+LOCAL_SYMBOL void
+meta_window_actor_queue_frame_redraw (MetaWindowActor *self)
+{
+  self->priv->needs_frame_render = TRUE;
+  clutter_actor_queue_redraw (CLUTTER_ACTOR (self));
+}
+
 LOCAL_SYMBOL void
 meta_window_actor_update_shape (MetaWindowActor *self)
 {
@@ -2418,6 +2539,7 @@ meta_window_actor_pre_paint (MetaWindowActor *self)
        * before writing events or responses to the client, so any round trip
        * request at this point is sufficient to flush the GLX buffers.
        */
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
       XSync (xdisplay, False);
 
       priv->received_damage = FALSE;
@@ -2426,6 +2548,7 @@ meta_window_actor_pre_paint (MetaWindowActor *self)
   check_needs_pixmap (self);
   check_needs_reshape (self);
   check_needs_shadow (self);
+  check_needs_frame (self);
 }
 
 LOCAL_SYMBOL void
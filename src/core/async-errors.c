@@ -0,0 +1,322 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin asynchronous X error traps */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "async-errors.h"
+#include <X11/Xlibint.h>
+
+/* A push notes the sequence number of the next request, a pop the last
+ * one sent; the trap then sits in a queue (ordered by that last
+ * sequence number, since pops happen in request order) until the
+ * server has been seen to process it.
+ *
+ * With XCB underneath, Xlib's async handlers only ever see replies, so
+ * errors are caught with wire-to-error hooks instead: _XError() runs
+ * the hook for the error's code on every error it handles, with the
+ * serial already widened, before it calls the global error handler.
+ * We hook every core and extension error code, remember whatever hook
+ * was there before and chain to it.
+ */
+#define N_ERROR_CODES 256
+
+typedef Bool (* ErrorHookFunc) (Display     *xdisplay,
+                                XErrorEvent *event,
+                                xError      *wire);
+
+typedef struct
+{
+  guint id;
+  gulong start_sequence;
+  gulong end_sequence;
+  int error_code;
+  MetaAsyncErrorFunc func;
+  gpointer user_data;
+} MetaAsyncErrorTrap;
+
+struct _MetaAsyncErrors
+{
+  Display *xdisplay;
+  gpointer owner;
+
+  GSList *open;     /* pushed and not popped yet, innermost first */
+  GQueue *pending;  /* popped, waiting for the server */
+  guint last_id;
+
+  ErrorHookFunc old_hooks[N_ERROR_CODES];
+};
+
+/* Every MetaAsyncErrors, to find the one for a display from its hooks */
+static GSList *all_errors = NULL;
+
+static void
+note_error (MetaAsyncErrorTrap *trap,
+            gulong              serial,
+            gboolean            open,
+            int                 error_code)
+{
+  if (trap->error_code == Success &&
+      serial >= trap->start_sequence &&
+      (open || serial <= trap->end_sequence))
+    trap->error_code = error_code;
+}
+
+static Bool
+error_hook (Display     *xdisplay,
+            XErrorEvent *event,
+            xError      *wire)
+{
+  MetaAsyncErrors *errors = NULL;
+  ErrorHookFunc old_hook;
+  GSList *tmp;
+  GList *l;
+
+  for (tmp = all_errors; tmp; tmp = tmp->next)
+    if (((MetaAsyncErrors *) tmp->data)->xdisplay == xdisplay)
+      {
+        errors = tmp->data;
+        break;
+      }
+
+  /* Can't happen: the hooks go away with the last MetaAsyncErrors */
+  if (errors == NULL)
+    return True;
+
+  for (tmp = errors->open; tmp; tmp = tmp->next)
+    note_error (tmp->data, event->serial, TRUE, wire->errorCode);
+
+  for (l = errors->pending->head; l; l = l->next)
+    note_error (l->data, event->serial, FALSE, wire->errorCode);
+
+  old_hook = errors->old_hooks[wire->errorCode];
+  if (old_hook)
+    return (* old_hook) (xdisplay, event, wire);
+
+  return True;
+}
+
+/**
+ * meta_async_errors_new: (skip)
+ * @xdisplay: the connection to trap errors on
+ * @owner: passed to the callbacks
+ *
+ * Starts watching @xdisplay for errors. Extensions that install their
+ * own error conversion later replace our hook for their codes, so this
+ * is best called once every extension in use has been initialised.
+ *
+ * Returns: a new #MetaAsyncErrors
+ */
+LOCAL_SYMBOL MetaAsyncErrors*
+meta_async_errors_new (Display  *xdisplay,
+                       gpointer  owner)
+{
+  MetaAsyncErrors *errors;
+  int code;
+
+  errors = g_new0 (MetaAsyncErrors, 1);
+  errors->xdisplay = xdisplay;
+  errors->owner = owner;
+  errors->pending = g_queue_new ();
+
+  /* Error code 0 is Success, never an error */
+  for (code = 1; code < N_ERROR_CODES; code++)
+    errors->old_hooks[code] = XESetWireToError (xdisplay, code, error_hook);
+
+  all_errors = g_slist_prepend (all_errors, errors);
+
+  return errors;
+}
+
+static void
+free_trap (gpointer data)
+{
+  g_slice_free (MetaAsyncErrorTrap, data);
+}
+
+/**
+ * meta_async_errors_free: (skip)
+ * @errors: a #MetaAsyncErrors
+ *
+ * Puts the previous error hooks back and drops every trap, without
+ * running callbacks; use meta_async_errors_process() after a sync
+ * first to resolve them.
+ */
+LOCAL_SYMBOL void
+meta_async_errors_free (MetaAsyncErrors *errors)
+{
+  int code;
+
+  for (code = 1; code < N_ERROR_CODES; code++)
+    {
+      ErrorHookFunc hook;
+
+      hook = XESetWireToError (errors->xdisplay, code,
+                               errors->old_hooks[code]);
+
+      /* Leave alone whatever replaced us in the meantime */
+      if (hook != error_hook)
+        XESetWireToError (errors->xdisplay, code, hook);
+    }
+
+  all_errors = g_slist_remove (all_errors, errors);
+
+  g_slist_free_full (errors->open, free_trap);
+  g_queue_free_full (errors->pending, free_trap);
+  g_free (errors);
+}
+
+/**
+ * meta_async_errors_push: (skip)
+ * @errors: a #MetaAsyncErrors
+ *
+ * Starts trapping errors for requests made from here on. Must be
+ * paired with meta_async_errors_pop().
+ */
+LOCAL_SYMBOL void
+meta_async_errors_push (MetaAsyncErrors *errors)
+{
+  MetaAsyncErrorTrap *trap;
+
+  trap = g_slice_new0 (MetaAsyncErrorTrap);
+  trap->start_sequence = NextRequest (errors->xdisplay);
+  trap->error_code = Success;
+
+  errors->open = g_slist_prepend (errors->open, trap);
+}
+
+/**
+ * meta_async_errors_pop: (skip)
+ * @errors: a #MetaAsyncErrors
+ * @func: (allow-none): called once the outcome of the trapped requests
+ *   is known
+ * @user_data: data for @func
+ *
+ * Stops trapping errors. @func is called exactly once later, from
+ * meta_async_errors_process(), with the code of the first error any of
+ * the trapped requests caused, or Success. It is never called from
+ * inside this function, so @user_data must stay valid until then or
+ * the trap must be cancelled with meta_async_errors_cancel().
+ *
+ * Returns: a handle for meta_async_errors_cancel(), or 0 if @func was
+ *   %NULL
+ */
+LOCAL_SYMBOL guint
+meta_async_errors_pop (MetaAsyncErrors    *errors,
+                       MetaAsyncErrorFunc  func,
+                       gpointer            user_data)
+{
+  MetaAsyncErrorTrap *trap;
+
+  g_return_val_if_fail (errors->open != NULL, 0);
+
+  trap = errors->open->data;
+  errors->open = g_slist_delete_link (errors->open, errors->open);
+
+  if (func == NULL)
+    {
+      free_trap (trap);
+      return 0;
+    }
+
+  trap->end_sequence = NextRequest (errors->xdisplay) - 1;
+  trap->func = func;
+  trap->user_data = user_data;
+  trap->id = ++errors->last_id;
+  if (trap->id == 0)
+    trap->id = ++errors->last_id;
+
+  g_queue_push_tail (errors->pending, trap);
+
+  return trap->id;
+}
+
+/**
+ * meta_async_errors_cancel: (skip)
+ * @errors: a #MetaAsyncErrors
+ * @trap_id: a handle from meta_async_errors_pop()
+ *
+ * Drops a trap whose callback has not run yet, e.g. because its user
+ * data is about to be freed.
+ */
+LOCAL_SYMBOL void
+meta_async_errors_cancel (MetaAsyncErrors *errors,
+                          guint            trap_id)
+{
+  GList *l;
+
+  if (trap_id == 0)
+    return;
+
+  for (l = errors->pending->head; l; l = l->next)
+    {
+      MetaAsyncErrorTrap *trap = l->data;
+
+      if (trap->id == trap_id)
+        {
+          g_queue_delete_link (errors->pending, l);
+          free_trap (trap);
+          break;
+        }
+    }
+}
+
+/**
+ * meta_async_errors_pending: (skip)
+ * @errors: a #MetaAsyncErrors
+ *
+ * Returns: whether any popped trap is still waiting for its callback
+ */
+LOCAL_SYMBOL gboolean
+meta_async_errors_pending (MetaAsyncErrors *errors)
+{
+  return !g_queue_is_empty (errors->pending);
+}
+
+/**
+ * meta_async_errors_process: (skip)
+ * @errors: a #MetaAsyncErrors
+ *
+ * Runs the callbacks of all traps the server is known to have
+ * processed every request of. Any event, reply or error with a later
+ * sequence number proves that, so calling this for every event is
+ * enough to resolve traps without ever waiting on the server.
+ */
+LOCAL_SYMBOL void
+meta_async_errors_process (MetaAsyncErrors *errors)
+{
+  gulong processed;
+
+  processed = LastKnownRequestProcessed (errors->xdisplay);
+
+  while (!g_queue_is_empty (errors->pending))
+    {
+      MetaAsyncErrorTrap *trap;
+
+      trap = g_queue_peek_head (errors->pending);
+      if (trap->end_sequence > processed)
+        break;
+
+      /* Off the queue first; the callback may push and pop traps */
+      g_queue_pop_head (errors->pending);
+
+      (* trap->func) (errors->owner, trap->error_code, trap->user_data);
+      free_trap (trap);
+    }
+}
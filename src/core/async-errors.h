@@ -0,0 +1,64 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/**
+ * \file async-errors.h  Error traps that don't wait for the X server
+ *
+ * meta_async_errors_push() and meta_async_errors_pop() bracket a
+ * run of requests like an error trap, but instead of syncing, the pop
+ * hands back a callback that runs once the server is known to have
+ * processed the last request, with the first error any of them caused
+ * or Success.
+ *
+ * Errors are recorded from Xlib's wire-to-error hooks, which _XError()
+ * runs for every error before the global error handler, whichever one
+ * that happens to be. The hooks never swallow an error, so the global
+ * handler still needs its own way of ignoring them.
+ *
+ * Plain Xlib and GLib only, so that testasyncerrors can use it without
+ * the rest of muffin.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_ASYNC_ERRORS_H
+#define META_ASYNC_ERRORS_H
+
+#include <glib.h>
+#include <X11/Xlib.h>
+
+typedef struct _MetaAsyncErrors MetaAsyncErrors;
+
+typedef void (* MetaAsyncErrorFunc) (gpointer owner,
+                                     int      error_code,
+                                     gpointer user_data);
+
+MetaAsyncErrors* meta_async_errors_new     (Display            *xdisplay,
+                                            gpointer            owner);
+void             meta_async_errors_free    (MetaAsyncErrors    *errors);
+
+void             meta_async_errors_push    (MetaAsyncErrors    *errors);
+guint            meta_async_errors_pop     (MetaAsyncErrors    *errors,
+                                            MetaAsyncErrorFunc  func,
+                                            gpointer            user_data);
+void             meta_async_errors_cancel  (MetaAsyncErrors    *errors,
+                                            guint               trap_id);
+
+gboolean         meta_async_errors_pending (MetaAsyncErrors    *errors);
+void             meta_async_errors_process (MetaAsyncErrors    *errors);
+
+#endif
@@ -53,11 +53,15 @@ typedef struct _AgPerDisplayData AgPerDisplayData;
 struct _ListNode
 {
   ListNode *next;
+  ListNode *prev;
 };
 
 struct _AgGetPropertyTask
 {
   ListNode node;
+
+  /* next task in the same pending bucket */
+  AgGetPropertyTask *next_pending;
   
   AgPerDisplayData *dd;
   Window window;
@@ -82,8 +86,8 @@ struct _AgPerDisplayData
   _XAsyncHandler async;
   
   Display *display;
-  ListNode *pending_tasks;
-  ListNode *pending_tasks_tail;
+  AgGetPropertyTask **pending_buckets;
+  unsigned long n_pending_buckets; /* always a power of two */
   ListNode *completed_tasks;
   ListNode *completed_tasks_tail;
   int n_tasks_pending;
@@ -99,6 +103,7 @@ append_to_list (ListNode **head,
                 ListNode  *task)
 {
   task->next = NULL;
+  task->prev = *tail;
   
   if (*tail == NULL)
     {
@@ -118,49 +123,120 @@ remove_from_list (ListNode **head,
                   ListNode **tail,
                   ListNode  *task)
 {
-  ListNode *prev;
-  ListNode *node;
+  if (task->prev)
+    task->prev->next = task->next;
+  else
+    {
+      /* can't remove what's not there */
+      assert (*head == task);
+      *head = task->next;
+    }
 
-  prev = NULL;
-  node = *head;
-  while (node != NULL)
+  if (task->next)
+    task->next->prev = task->prev;
+  else
     {
-      if (node == task)
+      assert (*tail == task);
+      *tail = task->prev;
+    }
+
+  task->next = NULL;
+  task->prev = NULL;
+}
+
+/* The async handler sees every reply and error on the connection,
+ * most of them not ours, so finding the task for a sequence number
+ * has to be cheap however many tasks are outstanding. Pending tasks
+ * are kept in a table indexed by the low bits of their request
+ * sequence. Outstanding sequence numbers are mostly consecutive, so
+ * the table behaves like a ring buffer; it is doubled whenever
+ * there are more pending tasks than buckets, which keeps the chains
+ * short.
+ */
+#define INITIAL_PENDING_BUCKETS 64
+
+#define PENDING_BUCKET(dd, seq) \
+  ((dd)->pending_buckets[(seq) & ((dd)->n_pending_buckets - 1)])
+
+static void
+grow_pending (AgPerDisplayData *dd)
+{
+  AgGetPropertyTask **old_buckets;
+  unsigned long old_n_buckets;
+  unsigned long i;
+
+  old_buckets = dd->pending_buckets;
+  old_n_buckets = dd->n_pending_buckets;
+
+  dd->pending_buckets = Xcalloc (old_n_buckets * 2,
+                                 sizeof (AgGetPropertyTask*));
+  if (dd->pending_buckets == NULL)
+    {
+      /* Longer chains, but still correct */
+      dd->pending_buckets = old_buckets;
+      return;
+    }
+  dd->n_pending_buckets = old_n_buckets * 2;
+
+  for (i = 0; i < old_n_buckets; i++)
+    {
+      AgGetPropertyTask *task;
+      AgGetPropertyTask *next;
+
+      for (task = old_buckets[i]; task != NULL; task = next)
         {
-          if (prev)
-            prev->next = node->next;
-          else
-            *head = node->next;
-
-          if (node == *tail)
-            *tail = prev;
-          
-          break;
+          next = task->next_pending;
+          task->next_pending = PENDING_BUCKET (dd, task->request_seq);
+          PENDING_BUCKET (dd, task->request_seq) = task;
         }
-      
-      prev = node;
-      node = node->next;
     }
 
-  /* can't remove what's not there */
-  assert (node != NULL);
+  XFree (old_buckets);
+}
+
+static void
+add_pending (AgPerDisplayData  *dd,
+             AgGetPropertyTask *task)
+{
+  if ((unsigned long) dd->n_tasks_pending >= dd->n_pending_buckets)
+    grow_pending (dd);
 
-  node->next = NULL;
+  task->next_pending = PENDING_BUCKET (dd, task->request_seq);
+  PENDING_BUCKET (dd, task->request_seq) = task;
+
+  dd->n_tasks_pending += 1;
+}
+
+static void
+remove_pending (AgPerDisplayData  *dd,
+                AgGetPropertyTask *task)
+{
+  AgGetPropertyTask **link;
+
+  link = &PENDING_BUCKET (dd, task->request_seq);
+  while (*link != task)
+    {
+      /* can't remove what's not there */
+      assert (*link != NULL);
+      link = &(*link)->next_pending;
+    }
+
+  *link = task->next_pending;
+  task->next_pending = NULL;
+
+  dd->n_tasks_pending -= 1;
 }
 
 static void
 move_to_completed (AgPerDisplayData  *dd,
                    AgGetPropertyTask *task)
 {
-  remove_from_list (&dd->pending_tasks,
-                    &dd->pending_tasks_tail,
-                    &task->node);
+  remove_pending (dd, task);
   
   append_to_list (&dd->completed_tasks,
                   &dd->completed_tasks_tail,
                   &task->node);
 
-  dd->n_tasks_pending -= 1;
   dd->n_tasks_completed += 1;
 }
 
@@ -168,38 +244,18 @@ static AgGetPropertyTask*
 find_pending_by_request_sequence (AgPerDisplayData *dd,
                                   unsigned long     request_seq)
 {
-  ListNode *node;
+  AgGetPropertyTask *task;
 
-  /* if the sequence is after our last pending task, we
-   * aren't going to find a match
-   */
-  {
-    AgGetPropertyTask *task = (AgGetPropertyTask*) dd->pending_tasks_tail;
-    if (task != NULL)
-      {
-        if (task->request_seq < request_seq)
-          return NULL;
-        else if (task->request_seq == request_seq)
-          return task; /* why not check this */
-      }
-  }
-
-  /* Generally we should get replies in the order we sent
-   * requests, so we should usually be using the task
-   * at the head of the list, if we use any task at all.
-   * I'm not sure this is 100% guaranteed, if it is,
-   * it would be a big speedup.
-   */
-  
-  node = dd->pending_tasks;
-  while (node != NULL)
+  if (dd->n_tasks_pending == 0)
+    return NULL;
+
+  task = PENDING_BUCKET (dd, request_seq);
+  while (task != NULL)
     {
-      AgGetPropertyTask *task = (AgGetPropertyTask*) node;
-      
       if (task->request_seq == request_seq)
         return task;
       
-      node = node->next;
+      task = task->next_pending;
     }
   
   return NULL;
@@ -490,6 +546,15 @@ get_display_data (Display *display,
   if (dd == NULL)
     return NULL;
 
+  dd->pending_buckets = Xcalloc (INITIAL_PENDING_BUCKETS,
+                                 sizeof (AgGetPropertyTask*));
+  if (dd->pending_buckets == NULL)
+    {
+      XFree (dd);
+      return NULL;
+    }
+  dd->n_pending_buckets = INITIAL_PENDING_BUCKETS;
+
   dd->display = display;
   dd->async.next = display->async_handlers;
   dd->async.handler = async_get_property_handler;
@@ -506,12 +571,13 @@ get_display_data (Display *display,
 static void
 maybe_free_display_data (AgPerDisplayData *dd)
 {
-  if (dd->pending_tasks == NULL &&
+  if (dd->n_tasks_pending == 0 &&
       dd->completed_tasks == NULL)
     {
       DeqAsyncHandler (dd->display, &dd->async);
       remove_from_list (&display_datas, &display_datas_tail,
                         &dd->node);
+      XFree (dd->pending_buckets);
       XFree (dd);
     }
 }
@@ -560,10 +626,7 @@ ag_task_create (Display *dpy,
   task->property = property;
   task->request_seq = dpy->request;
 
-  append_to_list (&dd->pending_tasks,
-                  &dd->pending_tasks_tail,
-                  &task->node);
-  dd->n_tasks_pending += 1;
+  add_pending (dd, task);
   
   UnlockDisplay (dpy);
 
@@ -575,6 +638,9 @@ ag_task_create (Display *dpy,
 static void
 free_task (AgGetPropertyTask *task)
 {
+  /* pending tasks can't be freed, their reply would go unclaimed */
+  assert (task->have_reply);
+
   remove_from_list (&task->dd->completed_tasks,
                     &task->dd->completed_tasks_tail,
                     &task->node);
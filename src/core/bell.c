@@ -52,6 +52,7 @@
 #include <config.h>
 #include "bell.h"
 #include "screen-private.h"
+#include "roundtrips.h"
 #include <meta/prefs.h>
 #ifdef HAVE_LIBCANBERRA
 #include <canberra-gtk.h>
@@ -106,6 +107,7 @@ bell_flash_screen (MetaDisplay *display,
 					    &xswa);
       XSelectInput (display->xdisplay, screen->flash_window, ExposureMask);
       XMapWindow (display->xdisplay, screen->flash_window);
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
       XSync (display->xdisplay, False);
       XFlush (display->xdisplay);
       XUnmapWindow (display->xdisplay, screen->flash_window);
@@ -126,6 +128,7 @@ bell_flash_screen (MetaDisplay *display,
       XFillRectangle (display->xdisplay, screen->flash_window, gc,
 		      0, 0, width, height);
       XFlush (display->xdisplay);
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
       XSync (display->xdisplay, False);
       XUnmapWindow (display->xdisplay, screen->flash_window);
       XFreeGC (display->xdisplay, gc);
@@ -30,6 +30,7 @@
 #include "place.h"
 #include <meta/prefs.h>
 #include "xprops.h"
+#include "restart-state.h"
 #include <stdlib.h>
 #include <math.h>
 
@@ -609,13 +610,34 @@ place_window_if_needed(MetaWindow     *window,
         {
           window->tile_after_placement = FALSE;
 
+          const MetaRestartWindowInfo *restart_info;
           gulong *tile_info = NULL;
           int nitems;
 
-          if (meta_prop_get_cardinal_list (window->display,
-                                           window->xwindow,
-                                           window->display->atom__NET_WM_WINDOW_TILE_INFO,
-                                           &tile_info, &nitems))
+          /* The window manager we replaced may already have told us,
+           * which saves asking the client window.
+           */
+          restart_info = meta_restart_state_lookup (window->screen,
+                                                    window->xwindow);
+          if (restart_info != NULL && restart_info->tiled)
+            {
+              window->tile_mode = (MetaTileMode) restart_info->tile_mode;
+              meta_window_move_resize_frame (window,
+                                             TRUE,
+                                             restart_info->tile_rect.x,
+                                             restart_info->tile_rect.y,
+                                             restart_info->tile_rect.width,
+                                             restart_info->tile_rect.height);
+              window->custom_snap_size = restart_info->custom_snap_size;
+              window->tile_monitor_number = restart_info->tile_monitor_number;
+              window->snap_queued =
+                restart_info->tile_type == META_WINDOW_TILE_TYPE_SNAPPED;
+              meta_window_real_tile (window, TRUE);
+            }
+          else if (meta_prop_get_cardinal_list (window->display,
+                                                window->xwindow,
+                                                window->display->atom__NET_WM_WINDOW_TILE_INFO,
+                                                &tile_info, &nitems))
             {
               if (nitems == 8)
                 {
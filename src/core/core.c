@@ -173,6 +173,26 @@ meta_core_queue_frame_resize (Display *xdisplay,
   meta_window_queue (window, META_QUEUE_MOVE_RESIZE);
 }
 
+LOCAL_SYMBOL void
+meta_core_queue_frame_redraw (Display *xdisplay,
+                              Window   frame_xwindow)
+{
+  MetaDisplay *display;
+  MetaWindow *window;
+
+  /* Frames get invalidated while windows are being framed and
+   * unframed, so a frame we don't know (yet) is not a bug here.
+   */
+  display = meta_display_for_x_display (xdisplay);
+  window = meta_display_lookup_x_window (display, frame_xwindow);
+
+  if (window == NULL || window->frame == NULL)
+    return;
+
+  if (display->compositor)
+    meta_compositor_queue_frame_redraw (display->compositor, window);
+}
+
 LOCAL_SYMBOL void
 meta_core_user_move (Display *xdisplay,
                      Window   frame_xwindow,
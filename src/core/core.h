@@ -100,6 +100,10 @@ void meta_core_get (Display *xdisplay,
 void meta_core_queue_frame_resize (Display *xdisplay,
                                    Window frame_xwindow);
 
+/* Composited frames only; asks the compositor to draw the frame again */
+void meta_core_queue_frame_redraw (Display *xdisplay,
+                                   Window   frame_xwindow);
+
 /* Move as a result of user operation */
 void meta_core_user_move    (Display *xdisplay,
                              Window   frame_xwindow,
@@ -34,9 +34,11 @@
 #include <glib.h>
 #include <X11/Xlib.h>
 #include "eventqueue.h"
+#include "async-errors.h"
 #include <meta/common.h>
 #include <meta/boxes.h>
 #include <meta/display.h>
+#include <meta/errors.h>
 #include "keybindings-private.h"
 #include <meta/prefs.h>
 
@@ -137,8 +139,31 @@ struct _MetaDisplay
   int error_traps;
   int (* error_trap_handler) (Display     *display,
                               XErrorEvent *error);  
+
+  /* Asynchronous error traps, see errors.c */
+  MetaAsyncErrors *async_errors;
+  GHashTable *sync_error_trap_counts;
+
+  /* Properties requested ahead of time, see meta_prop_prefetch() */
+  GHashTable *prefetched_props;
+  GSList *orphaned_prefetches;
   int server_grab_count;
 
+  /* Decoded _NET_WM_ICON images shared between windows, see iconcache.c */
+  GHashTable *shared_icons;
+  guint shared_icon_hits;
+  guint shared_icon_misses;
+  guint shared_icon_unchanged;
+  GSList *icon_loads;
+  GSource *icon_load_source;
+
+  /* Windows with coalesced property reloads pending, see window-props.c */
+  GSList *property_reload_windows;
+  GSList *property_reload_waiting;
+  guint property_reload_later;
+  guint property_reload_timeout;
+  GArray *property_notify_history;
+
   /* serials of leave/unmap events that may
    * correspond to an enter event we should
    * ignore
@@ -216,6 +241,15 @@ struct _MetaDisplay
   /* Keybindings stuff */
   MetaKeyBinding *key_bindings;
   int             n_key_bindings;
+  /* (keycode, devirtualized mask) -> GSList of MetaKeyBinding *,
+   * in binding table order */
+  GHashTable     *key_bindings_index;
+  /* Passive grabs the binding table calls for; see grab_keys() */
+  GHashTable     *global_key_grabs;
+  GHashTable     *per_window_key_grabs;
+  unsigned int    key_grabs_ignored_mask;
+  guint           n_key_grab_requests;
+  guint           n_key_ungrab_requests;
   int             min_keycode;
   int             max_keycode;
   KeySym *keymap;
@@ -428,4 +462,28 @@ void meta_display_remove_autoraise_callback (MetaDisplay *display);
 /* In above-tab-keycode.c */
 guint meta_display_get_above_tab_keycode (MetaDisplay *display);
 
+/* In errors.c */
+typedef void (* MetaErrorTrapFunc) (MetaDisplay *display,
+                                    int          error_code,
+                                    gpointer     user_data);
+
+void  meta_error_trap_push_async        (MetaDisplay       *display);
+guint meta_error_trap_pop_async         (MetaDisplay       *display,
+                                         MetaErrorTrapFunc  func,
+                                         gpointer           user_data);
+void  meta_error_trap_cancel_async      (MetaDisplay       *display,
+                                         guint              trap_id);
+void  meta_error_trap_process_async     (MetaDisplay       *display);
+void  meta_error_trap_free_async        (MetaDisplay       *display);
+
+/* Counts every synchronous pop by call site; see
+ * meta_error_trap_dump_sync_counts().
+ */
+int   meta_error_trap_pop_with_return_at (MetaDisplay *display,
+                                          const char  *strloc);
+void  meta_error_trap_dump_sync_counts   (MetaDisplay *display);
+
+#define meta_error_trap_pop_with_return(display) \
+  meta_error_trap_pop_with_return_at ((display), G_STRLOC)
+
 #endif
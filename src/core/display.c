@@ -50,6 +50,8 @@
 #include "xprops.h"
 #include "workspace-private.h"
 #include "bell.h"
+#include "iconcache.h"
+#include "roundtrips.h"
 #include <meta/compositor.h>
 #include <X11/Xatom.h>
 #include <X11/cursorfont.h>
@@ -168,6 +170,10 @@ static void   meta_spew_event           (MetaDisplay    *display,
 
 static gboolean event_callback          (XEvent         *event,
                                          gpointer        data);
+static gboolean filter_event            (XEvent         *event,
+                                         gpointer        data);
+static void   dispatch_queued_event     (XEvent         *event,
+                                         gpointer        data);
 static Window event_get_modified_window (MetaDisplay    *display,
                                          XEvent         *event);
 static guint32 event_get_time           (MetaDisplay    *display,
@@ -417,6 +423,7 @@ enable_compositor (MetaDisplay *display,
       
       meta_compositor_manage_screen (screen->display->compositor,
 				     screen);
+      meta_ui_set_frames_composited (screen->ui, TRUE);
 
       if (composite_windows)
         meta_screen_composite_all_windows (screen);
@@ -493,7 +500,22 @@ meta_display_open (void)
   the_display->error_trap_synced_at_last_pop = TRUE;
   the_display->error_traps = 0;
   the_display->error_trap_handler = NULL;
+  the_display->async_errors = NULL;
+  the_display->sync_error_trap_counts = NULL;
+  the_display->prefetched_props = NULL;
+  the_display->orphaned_prefetches = NULL;
   the_display->server_grab_count = 0;
+  the_display->shared_icons = NULL;
+  the_display->shared_icon_hits = 0;
+  the_display->shared_icon_misses = 0;
+  the_display->shared_icon_unchanged = 0;
+  the_display->icon_loads = NULL;
+  the_display->icon_load_source = NULL;
+  the_display->property_reload_windows = NULL;
+  the_display->property_reload_waiting = NULL;
+  the_display->property_reload_later = 0;
+  the_display->property_reload_timeout = 0;
+  the_display->property_notify_history = NULL;
   the_display->display_opening = TRUE;
 
   the_display->pending_pings = NULL;
@@ -561,11 +583,16 @@ meta_display_open (void)
                                         sn_error_trap_pop);
 #endif
   
-  the_display->events = NULL;
+  /* Hold back and fold together bursts of events, see filter_event() */
+  if (g_getenv ("MUFFIN_BATCH_EVENTS"))
+    the_display->events = meta_event_queue_new (dispatch_queued_event,
+                                                the_display);
+  else
+    the_display->events = NULL;
 
   /* Get events */
   meta_ui_add_event_func (the_display->xdisplay,
-                          event_callback,
+                          the_display->events ? filter_event : event_callback,
                           the_display);
   
   the_display->window_ids = g_hash_table_new (meta_unsigned_long_hash,
@@ -731,6 +758,10 @@ meta_display_open (void)
     else
       the_display->have_damage = TRUE;
 
+    if (the_display->events && the_display->have_damage)
+      meta_event_queue_set_damage_event_base (the_display->events,
+                                              the_display->damage_event_base);
+
     meta_verbose ("Attempted to init Damage, found error base %d event base %d\n",
                   the_display->damage_error_base, 
                   the_display->damage_event_base);
@@ -866,6 +897,7 @@ meta_display_open (void)
   meta_display_grab (the_display);
   
   /* Now manage all existing windows */
+  meta_startup_phase_begin ("window adoption");
   tmp = the_display->screens;
   while (tmp != NULL)
     {
@@ -875,6 +907,7 @@ meta_display_open (void)
 
       tmp = tmp->next;
     }
+  meta_startup_phase_end ("window adoption");
 
   {
     Window focus;
@@ -919,6 +952,9 @@ meta_display_open (void)
   /* Done opening new display */
   the_display->display_opening = FALSE;
 
+  /* Ended by the compositor's first repaint */
+  meta_startup_phase_begin (META_STARTUP_PHASE_FIRST_PAINT);
+
   return TRUE;
 }
 
@@ -1033,8 +1069,26 @@ meta_display_close (MetaDisplay *display,
   
   /* Stop caring about events */
   meta_ui_remove_event_func (display->xdisplay,
-                             event_callback,
+                             display->events ? filter_event : event_callback,
                              display);
+
+  if (display->events)
+    {
+      guint64 n_received, n_dispatched;
+      gint64 mean_latency, max_latency;
+
+      meta_event_queue_get_stats (display->events,
+                                  &n_received, &n_dispatched);
+      meta_event_queue_get_latency (display->events,
+                                    &mean_latency, &max_latency);
+      meta_verbose ("Batched events: %" G_GUINT64_FORMAT " queued, %"
+                    G_GUINT64_FORMAT " dispatched, waited %" G_GINT64_FORMAT
+                    " us on average and at most %" G_GINT64_FORMAT " us\n",
+                    n_received, n_dispatched, mean_latency, max_latency);
+
+      meta_event_queue_free (display->events);
+      display->events = NULL;
+    }
   
   /* Free all screens */
   tmp = display->screens;
@@ -1066,6 +1120,14 @@ meta_display_close (MetaDisplay *display,
 
   XFlush (display->xdisplay);
 
+  meta_error_trap_dump_sync_counts (display);
+  meta_roundtrip_report ();
+  meta_display_free_property_reloads (display);
+  meta_display_report_property_notifies (display);
+  meta_error_trap_free_async (display);
+  meta_prop_prefetch_free (display);
+  meta_icon_cache_free_shared (display);
+
   meta_display_free_window_prop_hooks (display);
   meta_display_free_group_prop_hooks (display);
   
@@ -1120,6 +1182,7 @@ meta_display_screen_for_xwindow (MetaDisplay *display,
   
   meta_error_trap_push (display);
   attr.screen = NULL;
+  meta_roundtrip_note (META_ROUNDTRIP_GET_ATTRIBUTES);
   result = XGetWindowAttributes (display->xdisplay, xwindow, &attr);
   meta_error_trap_pop (display);
 
@@ -1413,6 +1476,7 @@ meta_display_get_current_time_roundtrip (MetaDisplay *display)
                        display->timestamp_pinging_window,
                        XA_PRIMARY, XA_STRING, 8,
                        PropModeAppend, NULL, 0);
+      meta_roundtrip_note (META_ROUNDTRIP_TIMESTAMP);
       XWindowEvent (display->xdisplay,
                     display->timestamp_pinging_window,
                     PropertyChangeMask,
@@ -1534,6 +1598,7 @@ window_raise_with_delay_callback (void *data)
       gboolean point_in_window;
 
       meta_error_trap_push (window->display);
+      meta_roundtrip_note (META_ROUNDTRIP_QUERY_POINTER);
       same_screen = XQueryPointer (window->display->xdisplay,
 				   window->xwindow,
 				   &root, &child,
@@ -1649,6 +1714,9 @@ event_callback (XEvent   *event,
   gboolean filter_out_event;
 
   display = data;
+
+  /* Any event moves the last processed request forward */
+  meta_error_trap_process_async (display);
   
 #ifdef WITH_VERBOSE_MODE
   if (dump_events)
@@ -2717,6 +2785,69 @@ event_callback (XEvent   *event,
   return filter_out_event;
 }
 
+/* Whether @event can be held back in display->events: the kinds that
+ * come in bursts and that the queue knows how to fold together, on
+ * windows GDK doesn't know about. GDK has to hear about events on its
+ * own windows as they come, since it is told there and then whether
+ * we handled them.
+ */
+static gboolean
+event_can_wait (MetaDisplay *display,
+                XEvent      *event)
+{
+  switch (event->type)
+    {
+    case MotionNotify:
+    case ConfigureNotify:
+    case PropertyNotify:
+      break;
+    default:
+      if (display->have_damage &&
+          event->type == display->damage_event_base + XDamageNotify)
+        break;
+      return FALSE;
+    }
+
+  return !meta_ui_window_is_gdk (display->xdisplay, event->xany.window);
+}
+
+/**
+ * Event filter used instead of event_callback() when MUFFIN_BATCH_EVENTS
+ * is set. Bursts of motion, configure, property and damage events on
+ * windows that are only ours are queued, and the queue dispatches them
+ * once the main loop gets round to it, after dropping the ones later
+ * events make redundant. Everything else is handled right away, after
+ * whatever was queued before it.
+ *
+ * \param event The event that just happened
+ * \param data  The MetaDisplay, cast to a gpointer
+ *
+ * \ingroup main
+ */
+static gboolean
+filter_event (XEvent   *event,
+              gpointer  data)
+{
+  MetaDisplay *display = data;
+
+  if (event_can_wait (display, event))
+    {
+      meta_event_queue_push (display->events, event);
+      return TRUE;
+    }
+
+  meta_event_queue_flush (display->events);
+
+  return event_callback (event, display);
+}
+
+static void
+dispatch_queued_event (XEvent   *event,
+                       gpointer  data)
+{
+  event_callback (event, data);
+}
+
 /* Return the window this has to do with, if any, rather
  * than the frame or root window that was selecting
  * for substructure
@@ -3490,6 +3621,40 @@ xcursor_for_op (MetaDisplay *display,
   return meta_display_create_x_cursor (display, cursor);
 }
 
+static void
+change_pointer_grab_trapped (MetaDisplay *display,
+                             int          error_code,
+                             gpointer     user_data)
+{
+  if (error_code == Success)
+    return;
+
+  meta_topic (META_DEBUG_WINDOW_OPS,
+              "Error trapped from XChangeActivePointerGrab()\n");
+  if (display->grab_have_pointer)
+    display->grab_have_pointer = FALSE;
+}
+
+#ifdef HAVE_XSYNC
+static void
+sync_request_alarm_trapped (MetaDisplay *display,
+                            int          error_code,
+                            gpointer     user_data)
+{
+  XSyncAlarm alarm = GPOINTER_TO_UINT (user_data);
+
+  if (error_code == Success)
+    return;
+
+  meta_topic (META_DEBUG_RESIZING,
+              "Failed to create update alarm 0x%lx\n", alarm);
+
+  /* The grab may have ended, or another started, in the meantime */
+  if (display->grab_sync_request_alarm == alarm)
+    display->grab_sync_request_alarm = None;
+}
+#endif
+
 LOCAL_SYMBOL void
 meta_display_set_grab_op_cursor (MetaDisplay *display,
                                  MetaScreen  *screen,
@@ -3508,7 +3673,7 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
 
   if (change_pointer)
     {
-      meta_error_trap_push_with_return (display);
+      meta_error_trap_push_async (display);
       XChangeActivePointerGrab (display->xdisplay,
                                 GRAB_MASK,
                                 cursor,
@@ -3517,13 +3682,7 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
       meta_topic (META_DEBUG_WINDOW_OPS,
                   "Changed pointer with XChangeActivePointerGrab()\n");
 
-      if (meta_error_trap_pop_with_return (display) != Success)
-        {
-          meta_topic (META_DEBUG_WINDOW_OPS,
-                      "Error trapped from XChangeActivePointerGrab()\n");
-          if (display->grab_have_pointer)
-            display->grab_have_pointer = FALSE;
-        }
+      meta_error_trap_pop_async (display, change_pointer_grab_trapped, NULL);
     }
   else
     {
@@ -3559,18 +3718,18 @@ meta_display_set_grab_op_cursor (MetaDisplay *display,
     XFreeCursor (display->xdisplay, cursor);
 }
 
-gboolean
-meta_display_begin_grab_op (MetaDisplay *display,
-			    MetaScreen  *screen,
-                            MetaWindow  *window,
-                            MetaGrabOp   op,
-                            gboolean     pointer_already_grabbed,
-                            gboolean     frame_action,
-                            int          button,
-                            gulong       modmask,
-                            guint32      timestamp,
-                            int          root_x,
-                            int          root_y)
+static gboolean
+meta_display_begin_grab_op_internal (MetaDisplay *display,
+                                     MetaScreen  *screen,
+                                     MetaWindow  *window,
+                                     MetaGrabOp   op,
+                                     gboolean     pointer_already_grabbed,
+                                     gboolean     frame_action,
+                                     int          button,
+                                     gulong       modmask,
+                                     guint32      timestamp,
+                                     int          root_x,
+                                     int          root_y)
 {
   MetaWindow *grab_window = NULL;
   Window grab_xwindow;
@@ -3709,7 +3868,7 @@ meta_display_begin_grab_op (MetaDisplay *display,
           XSyncAlarmAttributes values;
 	  XSyncValue init;
 
-          meta_error_trap_push_with_return (display);
+          meta_error_trap_push_async (display);
 
 	  /* Set the counter to 0, so we know that the application's
 	   * responses to the client messages will always trigger
@@ -3747,8 +3906,8 @@ meta_display_begin_grab_op (MetaDisplay *display,
                                                          XSyncCAEvents,
                                                          &values);
 
-          if (meta_error_trap_pop_with_return (display) != Success)
-	    display->grab_sync_request_alarm = None;
+          meta_error_trap_pop_async (display, sync_request_alarm_trapped,
+                                     GUINT_TO_POINTER (display->grab_sync_request_alarm));
 
           meta_topic (META_DEBUG_RESIZING,
                       "Created update alarm 0x%lx\n",
@@ -3785,6 +3944,31 @@ meta_display_begin_grab_op (MetaDisplay *display,
   return TRUE;
 }
 
+gboolean
+meta_display_begin_grab_op (MetaDisplay *display,
+			    MetaScreen  *screen,
+                            MetaWindow  *window,
+                            MetaGrabOp   op,
+                            gboolean     pointer_already_grabbed,
+                            gboolean     frame_action,
+                            int          button,
+                            gulong       modmask,
+                            guint32      timestamp,
+                            int          root_x,
+                            int          root_y)
+{
+  gboolean result;
+
+  meta_roundtrip_scope_begin (G_STRFUNC);
+  result = meta_display_begin_grab_op_internal (display, screen, window, op,
+                                                pointer_already_grabbed,
+                                                frame_action, button, modmask,
+                                                timestamp, root_x, root_y);
+  meta_roundtrip_scope_end (G_STRFUNC);
+
+  return result;
+}
+
 void
 meta_display_end_grab_op (MetaDisplay *display,
                           guint32      timestamp)
@@ -3919,6 +4103,16 @@ meta_display_check_threshold_reached (MetaDisplay *display,
     display->grab_threshold_movement_reached = TRUE;
 }
 
+static void
+button_grab_trapped (MetaDisplay *display,
+                     int          error_code,
+                     gpointer     user_data)
+{
+  if (error_code != Success)
+    meta_verbose ("Failed to change button grabs for window 0x%lx error code %d\n",
+                  (Window) GPOINTER_TO_UINT (user_data), error_code);
+}
+
 static void
 meta_change_button_grab (MetaDisplay *display,
                          Window       xwindow,
@@ -3934,7 +4128,7 @@ meta_change_button_grab (MetaDisplay *display,
                 xwindow,
                 sync, button, modmask);
   
-  meta_error_trap_push (display);
+  meta_error_trap_push_async (display);
   
   ignored_mask = 0;
   while (ignored_mask <= display->ignored_modifier_mask)
@@ -3948,9 +4142,6 @@ meta_change_button_grab (MetaDisplay *display,
           continue;
         }
 
-      if (meta_is_debugging ())
-        meta_error_trap_push_with_return (display);
-
       /* GrabModeSync means freeze until XAllowEvents */
       
       if (grab)
@@ -3965,22 +4156,12 @@ meta_change_button_grab (MetaDisplay *display,
         XUngrabButton (display->xdisplay, button, modmask | ignored_mask,
                        xwindow);
 
-      if (meta_is_debugging ())
-        {
-          int result;
-          
-          result = meta_error_trap_pop_with_return (display);
-          
-          if (result != Success)
-            meta_verbose ("Failed to %s button %d with mask 0x%x for window 0x%lx error code %d\n",
-                          grab ? "grab" : "ungrab",
-                          button, modmask | ignored_mask, xwindow, result);
-        }
-      
       ++ignored_mask;
     }
 
-  meta_error_trap_pop (display);
+  meta_error_trap_pop_async (display,
+                             meta_is_debugging () ? button_grab_trapped : NULL,
+                             GUINT_TO_POINTER (xwindow));
 }
 
 LOCAL_SYMBOL void
@@ -4969,6 +5150,7 @@ convert_property (MetaDisplay *display,
    */
   /* FIXME the error trap pop synced anyway, right? */
   meta_topic (META_DEBUG_SYNC, "Syncing on %s\n", G_STRFUNC);
+  meta_roundtrip_note (META_ROUNDTRIP_SYNC);
   XSync (display->xdisplay, False);
 
   return TRUE;
@@ -5021,6 +5203,7 @@ process_selection_request (MetaDisplay   *display,
           unsigned char *data;
 
           meta_error_trap_push_with_return (display);
+          meta_roundtrip_note (META_ROUNDTRIP_GET_PROPERTY);
           if (XGetWindowProperty (display->xdisplay,
                                   event->xselectionrequest.requestor,
                                   event->xselectionrequest.property, 0, 256, False,
@@ -5270,6 +5453,29 @@ update_mouse_zoom_modifiers (MetaDisplay *display)
   display->mouse_zoom_modifiers = mods;
 }
 
+static gboolean
+button_grab_pref_is_first_in_batch (MetaPreference pref)
+{
+  static const MetaPreference button_grab_prefs[] = {
+    META_PREF_MOUSE_BUTTON_MODS,
+    META_PREF_FOCUS_MODE,
+    META_PREF_MOUSE_BUTTON_ZOOM_MODS,
+    META_PREF_MOUSE_ZOOM_ENABLED
+  };
+  unsigned int i;
+
+  for (i = 0; i < G_N_ELEMENTS (button_grab_prefs); i++)
+    {
+      if (button_grab_prefs[i] == pref)
+        return TRUE;
+
+      if (meta_prefs_changed_in_batch (button_grab_prefs[i]))
+        return FALSE;
+    }
+
+  return FALSE;
+}
+
 static void
 prefs_changed_callback (MetaPreference pref,
                         void          *data)
@@ -5279,11 +5485,11 @@ prefs_changed_callback (MetaPreference pref,
   /* It may not be obvious why we regrab on focus mode
    * change; it's because we handle focus clicks a
    * bit differently for the different focus modes.
+   *
+   * All of these share one regrab; when several change in the same
+   * batch, only the first of them in this order does it.
    */
-  if (pref == META_PREF_MOUSE_BUTTON_MODS ||
-      pref == META_PREF_FOCUS_MODE ||
-      pref == META_PREF_MOUSE_BUTTON_ZOOM_MODS ||
-      pref == META_PREF_MOUSE_ZOOM_ENABLED)
+  if (button_grab_pref_is_first_in_batch (pref))
     {
       MetaDisplay *display = data;
       GSList *windows;
@@ -5301,12 +5507,9 @@ prefs_changed_callback (MetaPreference pref,
           tmp = tmp->next;
         }
 
-      /* change our modifier */
-      if (pref == META_PREF_MOUSE_BUTTON_MODS)
-        update_window_grab_modifiers (display);
-
-      if (pref == META_PREF_MOUSE_BUTTON_ZOOM_MODS)
-        update_mouse_zoom_modifiers (display);
+      /* change our modifiers */
+      update_window_grab_modifiers (display);
+      update_mouse_zoom_modifiers (display);
 
       display->mouse_zoom_enabled = meta_prefs_get_mouse_zoom_enabled ();
 
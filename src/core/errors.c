@@ -31,9 +31,11 @@
 #include <config.h>
 #include <meta/errors.h>
 #include "display-private.h"
+#include "roundtrips.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <gdk/gdk.h>
+#include <X11/Xlibint.h>
 
 /* In GTK+-3.0, the error trapping code was significantly rewritten. The new code
  * has some neat features (like knowing automatically if a sync is needed or not
@@ -65,8 +67,191 @@ meta_error_trap_push_with_return (MetaDisplay *display)
   gdk_error_trap_push ();
 }
 
+/**
+ * meta_error_trap_pop_with_return_at: (skip)
+ * @display: a #MetaDisplay
+ * @strloc: the call site, as given by %G_STRLOC
+ *
+ * Like meta_error_trap_pop_with_return(), but records against @strloc
+ * whether the pop had to wait for a round trip. Inside muffin
+ * meta_error_trap_pop_with_return() is a macro for this function.
+ *
+ * Returns: the X error code of the first error trapped, or Success
+ */
+LOCAL_SYMBOL int
+meta_error_trap_pop_with_return_at (MetaDisplay *display,
+                                    const char  *strloc)
+{
+  Display *xdisplay;
+
+  /* gdk_error_trap_pop() only syncs if the server might not have
+   * processed every request in the trap yet; count the ones that do.
+   */
+  xdisplay = display ? display->xdisplay : NULL;
+  if (xdisplay != NULL &&
+      NextRequest (xdisplay) - 1 > LastKnownRequestProcessed (xdisplay))
+    {
+      gpointer count;
+
+      if (display->sync_error_trap_counts == NULL)
+        display->sync_error_trap_counts = g_hash_table_new (g_str_hash,
+                                                            g_str_equal);
+
+      if (strloc == NULL)
+        strloc = "(unknown)";
+
+      meta_roundtrip_note (META_ROUNDTRIP_ERROR_TRAP);
+
+      count = g_hash_table_lookup (display->sync_error_trap_counts, strloc);
+      g_hash_table_replace (display->sync_error_trap_counts,
+                            (char *) strloc,
+                            GUINT_TO_POINTER (GPOINTER_TO_UINT (count) + 1));
+    }
+
+  return gdk_error_trap_pop ();
+}
+
+#undef meta_error_trap_pop_with_return
+
 int
 meta_error_trap_pop_with_return  (MetaDisplay *display)
 {
-  return gdk_error_trap_pop ();
+  return meta_error_trap_pop_with_return_at (display, NULL);
+}
+
+/**
+ * meta_error_trap_dump_sync_counts: (skip)
+ * @display: a #MetaDisplay
+ *
+ * Logs, under %META_DEBUG_SYNC, how many times each call site of
+ * meta_error_trap_pop_with_return() had to round trip to the server.
+ */
+LOCAL_SYMBOL void
+meta_error_trap_dump_sync_counts (MetaDisplay *display)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (display->sync_error_trap_counts == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, display->sync_error_trap_counts);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    meta_topic (META_DEBUG_SYNC,
+                "%u synchronous error trap(s) at %s\n",
+                GPOINTER_TO_UINT (value), (const char *) key);
+}
+
+/* Asynchronous error traps.
+ *
+ * The bookkeeping lives in async-errors.c, which spots errors from
+ * Xlib's wire-to-error hooks without consuming them; we push a GDK trap
+ * underneath every async trap so that GDK's handler still swallows the
+ * error, and nested synchronous traps still see it.
+ *
+ * Resolution happens from meta_error_trap_process_async(), which the
+ * event callback runs for every event; any event or reply past the end
+ * of the range proves no more errors can arrive for it.
+ */
+
+/**
+ * meta_error_trap_push_async: (skip)
+ * @display: a #MetaDisplay
+ *
+ * Starts trapping errors for requests made from here on, without
+ * needing a round trip to find out about them. Must be paired with
+ * meta_error_trap_pop_async().
+ */
+LOCAL_SYMBOL void
+meta_error_trap_push_async (MetaDisplay *display)
+{
+  if (display->async_errors == NULL)
+    display->async_errors = meta_async_errors_new (display->xdisplay,
+                                                   display);
+
+  meta_async_errors_push (display->async_errors);
+  gdk_error_trap_push ();
+}
+
+/**
+ * meta_error_trap_pop_async: (skip)
+ * @display: a #MetaDisplay
+ * @func: (allow-none): called once the outcome of the trapped requests
+ *   is known
+ * @user_data: data for @func
+ *
+ * Stops trapping errors. @func is called exactly once later, from the
+ * event callback or when the display closes, with the code of the
+ * first error any of the trapped requests caused, or Success. It is
+ * never called from inside this function, so @user_data must stay
+ * valid until then or the trap must be cancelled with
+ * meta_error_trap_cancel_async().
+ *
+ * Returns: a handle for meta_error_trap_cancel_async(), or 0 if @func
+ *   was %NULL
+ */
+LOCAL_SYMBOL guint
+meta_error_trap_pop_async (MetaDisplay       *display,
+                           MetaErrorTrapFunc  func,
+                           gpointer           user_data)
+{
+  g_return_val_if_fail (display->async_errors != NULL, 0);
+
+  gdk_error_trap_pop_ignored ();
+
+  return meta_async_errors_pop (display->async_errors,
+                                (MetaAsyncErrorFunc) func, user_data);
+}
+
+/**
+ * meta_error_trap_cancel_async: (skip)
+ * @display: a #MetaDisplay
+ * @trap_id: a handle from meta_error_trap_pop_async()
+ *
+ * Drops a trap whose callback has not run yet, e.g. because its
+ * user data is about to be freed. Errors it would have reported are
+ * still ignored.
+ */
+LOCAL_SYMBOL void
+meta_error_trap_cancel_async (MetaDisplay *display,
+                              guint        trap_id)
+{
+  if (display->async_errors)
+    meta_async_errors_cancel (display->async_errors, trap_id);
+}
+
+/**
+ * meta_error_trap_process_async: (skip)
+ * @display: a #MetaDisplay
+ *
+ * Runs the callbacks of all asynchronous traps the server is known to
+ * have processed every request of.
+ */
+LOCAL_SYMBOL void
+meta_error_trap_process_async (MetaDisplay *display)
+{
+  if (display->async_errors)
+    meta_async_errors_process (display->async_errors);
+}
+
+/**
+ * meta_error_trap_free_async: (skip)
+ * @display: a #MetaDisplay
+ *
+ * Resolves any outstanding asynchronous traps, with one last round
+ * trip, and frees the trap state; used when closing the display.
+ */
+LOCAL_SYMBOL void
+meta_error_trap_free_async (MetaDisplay *display)
+{
+  if (display->async_errors &&
+      meta_async_errors_pending (display->async_errors))
+    {
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
+      XSync (display->xdisplay, False);
+      meta_async_errors_process (display->async_errors);
+    }
+
+  g_clear_pointer (&display->async_errors, meta_async_errors_free);
+  g_clear_pointer (&display->sync_error_trap_counts, g_hash_table_destroy);
 }
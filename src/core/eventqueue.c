@@ -27,6 +27,7 @@
 
 #include "eventqueue.h"
 #include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
 
 static gboolean eq_prepare  (GSource     *source,
                              gint        *timeout);
@@ -43,45 +44,136 @@ static GSourceFuncs eq_funcs = {
   eq_destroy
 };
 
+typedef struct
+{
+  XEvent event;
+  gint64 read_time; /* monotonic time it was pushed */
+} MetaQueuedEvent;
+
+/* Events waiting for dispatch, oldest at @head.  The capacity is
+ * always a power of two so that indices wrap with a mask.
+ */
+typedef struct
+{
+  MetaQueuedEvent *slots;
+  guint            head;
+  guint            length;
+  guint            capacity;
+} MetaEventRing;
+
 struct _MetaEventQueue
 {
   GSource source;
 
-  Display *display;
-  GPollFD poll_fd;
-  int connection_fd;
-  GQueue *events;
+  MetaEventQueueFunc func;
+  gpointer data;
+
+  MetaEventRing events;
+
+  int damage_event_base;
+  GHashTable *last_for_window; /* scratch for eq_coalesce_events() */
+
+  guint64 n_received;
+  guint64 n_dispatched;
+
+  /* time between pushing an event and dispatching it */
+  guint64 n_latency_samples;
+  gint64  total_latency;
+  gint64  max_latency;
 };
 
+#define RING_SLOT(ring, i) (&(ring)->slots[((ring)->head + (i)) & ((ring)->capacity - 1)])
+
+static void
+ring_init (MetaEventRing *ring)
+{
+  ring->capacity = 64;
+  ring->slots = g_new (MetaQueuedEvent, ring->capacity);
+  ring->head = 0;
+  ring->length = 0;
+}
+
+static void
+ring_push_tail (MetaEventRing         *ring,
+                const MetaQueuedEvent *event)
+{
+  if (ring->length == ring->capacity)
+    {
+      MetaQueuedEvent *slots;
+      guint i;
+
+      slots = g_new (MetaQueuedEvent, ring->capacity * 2);
+      for (i = 0; i < ring->length; i++)
+        slots[i] = *RING_SLOT (ring, i);
+
+      g_free (ring->slots);
+      ring->slots = slots;
+      ring->head = 0;
+      ring->capacity *= 2;
+    }
+
+  ring->length += 1;
+  *RING_SLOT (ring, ring->length - 1) = *event;
+}
+
+static void
+ring_pop_head (MetaEventRing   *ring,
+               MetaQueuedEvent *event)
+{
+  g_assert (ring->length > 0);
+
+  *event = *RING_SLOT (ring, 0);
+  ring->head = (ring->head + 1) & (ring->capacity - 1);
+  ring->length -= 1;
+}
+
+/**
+ * meta_event_queue_new: (skip)
+ * @func: called for every event that is dispatched
+ * @data: passed to @func
+ *
+ * Creates a queue that holds back the events pushed into it with
+ * meta_event_queue_push() until the main loop is idle enough to run
+ * it, folds redundant ones together (see eq_coalesce_events()) and
+ * then passes everything left to @func in order.  The queue doesn't
+ * read the connection itself; GDK does, and the display's event
+ * filter decides what can wait.
+ */
 LOCAL_SYMBOL MetaEventQueue*
-meta_event_queue_new (Display *display, MetaEventQueueFunc func, gpointer data)
+meta_event_queue_new (MetaEventQueueFunc func, gpointer data)
 {
   GSource *source;
   MetaEventQueue *eq;
 
   source = g_source_new (&eq_funcs, sizeof (MetaEventQueue));
   eq = (MetaEventQueue*) source;
-  
-  eq->connection_fd = ConnectionNumber (display);
-  eq->poll_fd.fd = eq->connection_fd;
-  eq->poll_fd.events = G_IO_IN;
 
-  eq->events = g_queue_new ();
-
-  eq->display = display;
+  ring_init (&eq->events);
+
+  eq->func = func;
+  eq->data = data;
+  eq->damage_event_base = -1;
+  eq->last_for_window = g_hash_table_new (NULL, NULL);
+  eq->n_received = 0;
+  eq->n_dispatched = 0;
+  eq->n_latency_samples = 0;
+  eq->total_latency = 0;
+  eq->max_latency = 0;
   
   g_source_set_priority (source, G_PRIORITY_DEFAULT);
-  g_source_add_poll (source, &eq->poll_fd);
   g_source_set_can_recurse (source, TRUE);
-
-  g_source_set_callback (source, (GSourceFunc) func, data, NULL);
   
   g_source_attach (source, NULL);
-  g_source_unref (source);
 
   return eq;
 }
 
+/**
+ * meta_event_queue_free: (skip)
+ * @eq: a #MetaEventQueue
+ *
+ * Destroys @eq, dropping whatever it still holds.
+ */
 LOCAL_SYMBOL void
 meta_event_queue_free (MetaEventQueue *eq)
 {
@@ -90,30 +182,265 @@ meta_event_queue_free (MetaEventQueue *eq)
   source = (GSource*) eq;
   
   g_source_destroy (source);
+  g_source_unref (source);
+}
+
+/**
+ * meta_event_queue_push: (skip)
+ * @eq: a #MetaEventQueue
+ * @event: an event that can be handled later
+ *
+ * Queues a copy of @event.  Everything pushed is dispatched in order,
+ * either from the queue's own source or by meta_event_queue_flush().
+ */
+LOCAL_SYMBOL void
+meta_event_queue_push (MetaEventQueue *eq,
+                       XEvent         *event)
+{
+  MetaQueuedEvent queued;
+
+  queued.event = *event;
+  queued.read_time = g_get_monotonic_time ();
+
+  ring_push_tail (&eq->events, &queued);
+  eq->n_received += 1;
 }
 
+/**
+ * meta_event_queue_set_damage_event_base: (skip)
+ * @eq: a #MetaEventQueue
+ * @base: the DAMAGE extension's first event code, or -1
+ *
+ * Lets the queue recognise DamageNotify events, which are merged by
+ * taking the union of their areas.
+ */
+LOCAL_SYMBOL void
+meta_event_queue_set_damage_event_base (MetaEventQueue *eq,
+                                        int             base)
+{
+  eq->damage_event_base = base;
+}
+
+/**
+ * meta_event_queue_get_stats: (skip)
+ * @eq: a #MetaEventQueue
+ * @n_received: (out) (allow-none): events pushed
+ * @n_dispatched: (out) (allow-none): events passed to the callback
+ *
+ * The difference between the two is the number of events that were
+ * folded away.
+ */
+LOCAL_SYMBOL void
+meta_event_queue_get_stats (MetaEventQueue *eq,
+                            guint64        *n_received,
+                            guint64        *n_dispatched)
+{
+  if (n_received)
+    *n_received = eq->n_received;
+  if (n_dispatched)
+    *n_dispatched = eq->n_dispatched;
+}
+
+/**
+ * meta_event_queue_get_latency: (skip)
+ * @eq: a #MetaEventQueue
+ * @mean_us: (out) (allow-none): mean time between pushing an event and
+ *   dispatching it, in microseconds
+ * @max_us: (out) (allow-none): the longest such time
+ */
+LOCAL_SYMBOL void
+meta_event_queue_get_latency (MetaEventQueue *eq,
+                              gint64         *mean_us,
+                              gint64         *max_us)
+{
+  if (mean_us)
+    *mean_us = eq->n_latency_samples ?
+      eq->total_latency / (gint64) eq->n_latency_samples : 0;
+  if (max_us)
+    *max_us = eq->max_latency;
+}
+
+static void
+eq_dispatch_one (MetaEventQueue *eq)
+{
+  MetaQueuedEvent queued;
+  gint64 latency;
+
+  ring_pop_head (&eq->events, &queued);
+
+  latency = g_get_monotonic_time () - queued.read_time;
+  eq->n_latency_samples += 1;
+  eq->total_latency += latency;
+  eq->max_latency = MAX (eq->max_latency, latency);
+
+  eq->n_dispatched += 1;
+  (* eq->func) (&queued.event, eq->data);
+}
+
+static gboolean
+eq_is_damage_event (MetaEventQueue *eq,
+                    XEvent         *event)
+{
+  return eq->damage_event_base >= 0 &&
+         event->type == eq->damage_event_base + XDamageNotify;
+}
+
+/* The window an event is about; for ConfigureNotify received through
+ * SubstructureNotify this is the child, not the event window.
+ */
+static Window
+event_subject (XEvent *event)
+{
+  if (event->type == ConfigureNotify)
+    return event->xconfigure.window;
+
+  return event->xany.window;
+}
+
+/* Whether @later makes @earlier redundant.  Both are known to be
+ * about the same window with nothing else about it in between.
+ */
 static gboolean
-eq_events_pending (MetaEventQueue *eq)
+eq_event_supersedes (MetaEventQueue *eq,
+                     XEvent         *earlier,
+                     XEvent         *later)
 {
-  return eq->events->length > 0 || XPending (eq->display);
+  if (earlier->type != later->type ||
+      earlier->xany.send_event || later->xany.send_event)
+    return FALSE;
+
+  switch (later->type)
+    {
+    case MotionNotify:
+      /* same pointer position source and button state */
+      return earlier->xmotion.state == later->xmotion.state &&
+             earlier->xmotion.subwindow == later->xmotion.subwindow;
+
+    case ConfigureNotify:
+      return earlier->xconfigure.event == later->xconfigure.event;
+
+    case PropertyNotify:
+      /* listeners re-read the property, so only the last state counts */
+      return earlier->xproperty.atom == later->xproperty.atom;
+
+    default:
+      if (eq_is_damage_event (eq, later))
+        {
+          XDamageNotifyEvent *a = (XDamageNotifyEvent *) earlier;
+          XDamageNotifyEvent *b = (XDamageNotifyEvent *) later;
+
+          return a->damage == b->damage;
+        }
+      return FALSE;
+    }
+}
+
+static void
+merge_damage (XDamageNotifyEvent *earlier,
+              XDamageNotifyEvent *later)
+{
+  int x1, y1, x2, y2;
+
+  x1 = MIN (earlier->area.x, later->area.x);
+  y1 = MIN (earlier->area.y, later->area.y);
+  x2 = MAX (earlier->area.x + earlier->area.width,
+            later->area.x + later->area.width);
+  y2 = MAX (earlier->area.y + earlier->area.height,
+            later->area.y + later->area.height);
+
+  later->area.x = x1;
+  later->area.y = y1;
+  later->area.width = x2 - x1;
+  later->area.height = y2 - y1;
 }
 
+/* Drop every pending event that a later one about the same window
+ * makes redundant.  Only directly consecutive events about a window are
+ * considered, so the relative order of everything that remains, and of
+ * different kinds of events for one window, is unchanged; events about
+ * other windows may sit in between.
+ */
 static void
-eq_queue_events (MetaEventQueue *eq)
+eq_coalesce_events (MetaEventQueue *eq)
 {
-  XEvent xevent;
+  MetaEventRing *ring;
+  gboolean *dropped;
+  guint i, kept;
+
+  ring = &eq->events;
+  if (ring->length < 2)
+    return;
 
-  while (XPending (eq->display))
+  dropped = g_new0 (gboolean, ring->length);
+  g_hash_table_remove_all (eq->last_for_window);
+
+  for (i = 0; i < ring->length; i++)
     {
-      XEvent *copy;
-      
-      XNextEvent (eq->display, &xevent);
+      MetaQueuedEvent *queued = RING_SLOT (ring, i);
+      XEvent *event = &queued->event;
+      gpointer key = GSIZE_TO_POINTER (event_subject (event));
+      gpointer value;
+
+      if (key == NULL)
+        continue;
+
+      if (g_hash_table_lookup_extended (eq->last_for_window, key,
+                                        NULL, &value))
+        {
+          guint j = GPOINTER_TO_UINT (value);
+          MetaQueuedEvent *earlier = RING_SLOT (ring, j);
+
+          if (eq_event_supersedes (eq, &earlier->event, event))
+            {
+              if (eq_is_damage_event (eq, event))
+                merge_damage ((XDamageNotifyEvent *) &earlier->event,
+                              (XDamageNotifyEvent *) event);
+              /* the surviving event has been waiting since the first */
+              queued->read_time = earlier->read_time;
+              dropped[j] = TRUE;
+            }
+        }
+
+      g_hash_table_insert (eq->last_for_window, key, GUINT_TO_POINTER (i));
+    }
 
-      copy = g_new (XEvent, 1);
-      *copy = xevent;
+  /* Compact in place, keeping order */
+  kept = 0;
+  for (i = 0; i < ring->length; i++)
+    {
+      if (dropped[i])
+        continue;
 
-      g_queue_push_tail (eq->events, copy);
+      if (kept != i)
+        *RING_SLOT (ring, kept) = *RING_SLOT (ring, i);
+      kept++;
     }
+  ring->length = kept;
+
+  g_free (dropped);
+}
+
+/**
+ * meta_event_queue_flush: (skip)
+ * @eq: a #MetaEventQueue
+ *
+ * Dispatches everything queued so far, after folding redundant events
+ * together.  Called before handling an event that can't wait, so that
+ * it is seen after the ones queued before it.
+ */
+LOCAL_SYMBOL void
+meta_event_queue_flush (MetaEventQueue *eq)
+{
+  guint n;
+
+  eq_coalesce_events (eq);
+
+  /* Only what is queued now belongs to this batch; the callback may
+   * recurse into the main loop and queue more behind it.
+   */
+  n = eq->events.length;
+  while (n-- > 0 && eq->events.length > 0)
+    eq_dispatch_one (eq);
 }
 
 static gboolean  
@@ -125,7 +452,7 @@ eq_prepare (GSource *source, gint *timeout)
   
   *timeout = -1;
 
-  return eq_events_pending (eq);
+  return eq->events.length > 0;
 }
 
 static gboolean  
@@ -135,33 +462,13 @@ eq_check (GSource  *source)
 
   eq = (MetaEventQueue*) source;
 
-  if (eq->poll_fd.revents & G_IO_IN)
-    return eq_events_pending (eq);
-  else
-    return FALSE;
+  return eq->events.length > 0;
 }
 
 static gboolean  
 eq_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
 {
-  MetaEventQueue *eq;
-
-  eq = (MetaEventQueue*) source;
-  
-  eq_queue_events (eq);
-
-  if (eq->events->length > 0)
-    {
-      XEvent *event;
-      MetaEventQueueFunc func;
-
-      event = g_queue_pop_head (eq->events);
-      func = (MetaEventQueueFunc) callback;
-      
-      (* func) (event, user_data);
-
-      g_free (event);
-    }
+  meta_event_queue_flush ((MetaEventQueue*) source);
   
   return TRUE;
 }
@@ -173,16 +480,8 @@ eq_destroy (GSource *source)
 
   eq = (MetaEventQueue*) source;
 
-  while (eq->events->length > 0)
-    {
-      XEvent *event;
-      
-      event = g_queue_pop_head (eq->events);
-
-      g_free (event);
-    }
-
-  g_queue_free (eq->events);
+  g_free (eq->events.slots);
+  g_hash_table_destroy (eq->last_for_window);
 
   /* source itself is freed by glib */
 }
@@ -32,9 +32,20 @@ typedef struct _MetaEventQueue MetaEventQueue;
 typedef void   (* MetaEventQueueFunc) (XEvent         *event,
                                        gpointer        data);
 
-MetaEventQueue* meta_event_queue_new  (Display            *display,
-                                       MetaEventQueueFunc  func,
+MetaEventQueue* meta_event_queue_new  (MetaEventQueueFunc  func,
                                        gpointer            data);
 void            meta_event_queue_free (MetaEventQueue     *eq);
 
+void            meta_event_queue_push                 (MetaEventQueue *eq,
+                                                       XEvent         *event);
+void            meta_event_queue_flush                (MetaEventQueue *eq);
+void            meta_event_queue_set_damage_event_base (MetaEventQueue *eq,
+                                                        int             base);
+void            meta_event_queue_get_stats            (MetaEventQueue *eq,
+                                                       guint64        *n_received,
+                                                       guint64        *n_dispatched);
+void            meta_event_queue_get_latency          (MetaEventQueue *eq,
+                                                       gint64         *mean_us,
+                                                       gint64         *max_us);
+
 #endif
@@ -428,6 +428,38 @@ meta_frame_queue_draw (MetaFrame *frame)
                             frame->xwindow);
 }
 
+/**
+ * meta_frame_is_composited: (skip)
+ * @frame: a frame
+ *
+ * Whether the contents of the frame are painted by the compositor,
+ * from meta_frame_render(), rather than into the frame window. Only
+ * ever the case while a compositor manages the screen. The frame
+ * window is still there, for input and to parent the client.
+ *
+ * Returns: %TRUE if the compositor paints the frame
+ */
+LOCAL_SYMBOL gboolean
+meta_frame_is_composited (MetaFrame *frame)
+{
+  return meta_ui_frames_are_composited (frame->window->screen->ui);
+}
+
+/**
+ * meta_frame_render: (skip)
+ * @frame: a composited frame
+ *
+ * Draws the decorations at the frame's current size.
+ *
+ * Returns: (transfer full): an ARGB32 image surface the size of the
+ *   frame, transparent over the client, or %NULL
+ */
+LOCAL_SYMBOL cairo_surface_t *
+meta_frame_render (MetaFrame *frame)
+{
+  return meta_ui_render_frame (frame->window->screen->ui, frame->xwindow);
+}
+
 LOCAL_SYMBOL void
 meta_frame_set_screen_cursor (MetaFrame	*frame,
 			      MetaCursor cursor)
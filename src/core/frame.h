@@ -57,6 +57,9 @@ void     meta_window_ensure_frame           (MetaWindow *window);
 void     meta_window_destroy_frame          (MetaWindow *window);
 void     meta_frame_queue_draw              (MetaFrame  *frame);
 
+gboolean         meta_frame_is_composited (MetaFrame *frame);
+cairo_surface_t *meta_frame_render        (MetaFrame *frame);
+
 MetaFrameFlags meta_frame_get_flags   (MetaFrame *frame);
 Window         meta_frame_get_xwindow (MetaFrame *frame);
 
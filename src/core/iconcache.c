@@ -24,9 +24,18 @@
 #include <config.h>
 #include "iconcache.h"
 #include "ui.h"
+#include "roundtrips.h"
+#include "window-private.h"
+#include "async-getprop.h"
 #include <meta/errors.h>
 
 #include <X11/Xatom.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* The icon-reading code is also in libwnck, please sync bugfixes */
 
@@ -174,115 +183,58 @@ find_best_size (gulong  *data,
     return FALSE;
 }
 
+/* Converts _NET_WM_ICON pixels (ARGB, one per long) to RGBA bytes,
+ * which in memory order is swapping the red and blue bytes of each
+ * 32 bit value on little-endian machines. Safe to call from any
+ * thread.
+ */
 static void
-argbdata_to_pixdata (gulong *argb_data, int len, guchar **pixdata)
+argbdata_to_pixdata (const gulong *argb_data, int len, guchar **pixdata)
 {
-  guchar *p;
+  guint32 *p;
   int i;
 
   *pixdata = g_new (guchar, len * 4);
-  p = *pixdata;
-
-  /* One could speed this up a lot. */
+  p = (guint32 *) *pixdata;
   i = 0;
-  while (i < len)
-    {
-      guint argb;
-      guint rgba;
-
-      argb = argb_data[i];
-      rgba = (argb << 8) | (argb >> 24);
-
-      *p = rgba >> 24;
-      ++p;
-      *p = (rgba >> 16) & 0xff;
-      ++p;
-      *p = (rgba >> 8) & 0xff;
-      ++p;
-      *p = rgba & 0xff;
-      ++p;
-
-      ++i;
-    }
-}
-
-static gboolean
-read_rgb_icon (MetaDisplay   *display,
-               Window         xwindow,
-               int            ideal_width,
-               int            ideal_height,
-               int            ideal_mini_width,
-               int            ideal_mini_height,
-               int           *width,
-               int           *height,
-               guchar       **pixdata,
-               int           *mini_width,
-               int           *mini_height,
-               guchar       **mini_pixdata)
-{
-  Atom type;
-  int format;
-  gulong nitems;
-  gulong bytes_after;
-  int result, err;
-  guchar *data;
-  gulong *best;
-  int w, h;
-  gulong *best_mini;
-  int mini_w, mini_h;
-  gulong *data_as_long;
-
-  meta_error_trap_push_with_return (display);
-  type = None;
-  data = NULL;
-  result = XGetWindowProperty (display->xdisplay,
-			       xwindow,
-                               display->atom__NET_WM_ICON,
-			       0, G_MAXLONG,
-			       False, XA_CARDINAL, &type, &format, &nitems,
-			       &bytes_after, &data);
-  err = meta_error_trap_pop_with_return (display);
 
-  if (err != Success ||
-      result != Success)
-    return FALSE;
-
-  if (type != XA_CARDINAL)
-    {
-      XFree (data);
-      return FALSE;
-    }
-
-  data_as_long = (gulong *)data;
+#if defined (__SSE2__) && GLIB_SIZEOF_LONG == 8 && G_BYTE_ORDER == G_LITTLE_ENDIAN
+  {
+    const __m128i ag_mask = _mm_set1_epi32 ((int) 0xff00ff00);
+    const __m128i low_mask = _mm_set1_epi32 (0x000000ff);
+
+    /* Four pixels at a time; only the low half of each long matters */
+    for (; i + 4 <= len; i += 4)
+      {
+        __m128i lo, hi, v;
+
+        lo = _mm_loadu_si128 ((const __m128i *) (argb_data + i));
+        hi = _mm_loadu_si128 ((const __m128i *) (argb_data + i + 2));
+        lo = _mm_shuffle_epi32 (lo, _MM_SHUFFLE (3, 1, 2, 0));
+        hi = _mm_shuffle_epi32 (hi, _MM_SHUFFLE (3, 1, 2, 0));
+        v = _mm_unpacklo_epi64 (lo, hi);
+
+        v = _mm_or_si128 (_mm_and_si128 (v, ag_mask),
+                          _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (v, 16),
+                                                       low_mask),
+                                        _mm_slli_epi32 (_mm_and_si128 (v, low_mask),
+                                                        16)));
+
+        _mm_storeu_si128 ((__m128i *) (p + i), v);
+      }
+  }
+#endif
 
-  if (!find_best_size (data_as_long, nitems,
-                       ideal_width, ideal_height,
-                       &w, &h, &best))
+  for (; i < len; i++)
     {
-      XFree (data);
-      return FALSE;
-    }
+      guint32 argb = argb_data[i];
 
-  if (!find_best_size (data_as_long, nitems,
-                       ideal_mini_width, ideal_mini_height,
-                       &mini_w, &mini_h, &best_mini))
-    {
-      XFree (data);
-      return FALSE;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+      p[i] = (argb & 0xff00ff00) | ((argb >> 16) & 0xff) | ((argb & 0xff) << 16);
+#else
+      p[i] = (argb << 8) | (argb >> 24);
+#endif
     }
-
-  *width = w;
-  *height = h;
-
-  *mini_width = mini_w;
-  *mini_height = mini_h;
-
-  argbdata_to_pixdata (best, w * h, pixdata);
-  argbdata_to_pixdata (best_mini, mini_w * mini_h, mini_pixdata);
-
-  XFree (data);
-
-  return TRUE;
 }
 
 static void
@@ -311,6 +263,7 @@ get_pixmap_geometry (MetaDisplay *display,
   if (d)
     *d = 1;
 
+  meta_roundtrip_note (META_ROUNDTRIP_GET_GEOMETRY);
   XGetGeometry (display->xdisplay,
                 pixmap, &root_ignored, &x_ignored, &y_ignored,
                 &width, &height, &border_width_ignored, &depth);
@@ -508,6 +461,7 @@ get_kwm_win_icon (MetaDisplay *display,
 
   meta_error_trap_push_with_return (display);
   icons = NULL;
+  meta_roundtrip_note (META_ROUNDTRIP_GET_PROPERTY);
   result = XGetWindowProperty (display->xdisplay, xwindow,
                                display->atom__KWM_WIN_ICON,
 			       0, G_MAXLONG,
@@ -556,6 +510,12 @@ meta_icon_cache_init (MetaIconCache *icon_cache)
   icon_cache->wm_hints_dirty = TRUE;
   icon_cache->kwm_win_icon_dirty = TRUE;
   icon_cache->net_wm_icon_dirty = TRUE;
+  icon_cache->net_wm_icon = NULL;
+  icon_cache->net_wm_mini_icon = NULL;
+  icon_cache->net_wm_icon_load = NULL;
+  icon_cache->loaded_icon = NULL;
+  icon_cache->loaded_mini_icon = NULL;
+  icon_cache->net_wm_icon_loaded = FALSE;
 }
 
 static void
@@ -573,6 +533,8 @@ clear_icon_cache (MetaIconCache *icon_cache,
 #endif
   
   icon_cache->origin = USING_NO_ICON;
+  icon_cache->net_wm_icon = NULL;
+  icon_cache->net_wm_mini_icon = NULL;
 
   if (dirty_all)
     {
@@ -586,6 +548,26 @@ LOCAL_SYMBOL void
 meta_icon_cache_free (MetaIconCache *icon_cache)
 {
   clear_icon_cache (icon_cache, FALSE);
+
+  /* An icon that is being or has been loaded was never seen, so it
+   * has to be read again if the cache is reused
+   */
+  if (icon_cache->net_wm_icon_load != NULL)
+    {
+      icon_cache->net_wm_icon_load->icon_cache = NULL;
+      icon_cache->net_wm_icon_load = NULL;
+      icon_cache->net_wm_icon_dirty = TRUE;
+    }
+  if (icon_cache->net_wm_icon_loaded)
+    icon_cache->net_wm_icon_dirty = TRUE;
+
+  if (icon_cache->loaded_icon)
+    g_object_unref (G_OBJECT (icon_cache->loaded_icon));
+  if (icon_cache->loaded_mini_icon)
+    g_object_unref (G_OBJECT (icon_cache->loaded_mini_icon));
+  icon_cache->loaded_icon = NULL;
+  icon_cache->loaded_mini_icon = NULL;
+  icon_cache->net_wm_icon_loaded = FALSE;
 }
 
 LOCAL_SYMBOL void
@@ -604,8 +586,10 @@ meta_icon_cache_property_changed (MetaIconCache *icon_cache,
 LOCAL_SYMBOL gboolean
 meta_icon_cache_get_icon_invalidated (MetaIconCache *icon_cache)
 {
-  if (icon_cache->origin <= USING_KWM_WIN_ICON &&
-      icon_cache->kwm_win_icon_dirty)
+  if (icon_cache->net_wm_icon_loaded)
+    return TRUE;
+  else if (icon_cache->origin <= USING_KWM_WIN_ICON &&
+           icon_cache->kwm_win_icon_dirty)
     return TRUE;
   else if (icon_cache->origin <= USING_WM_HINTS &&
            icon_cache->wm_hints_dirty)
@@ -704,6 +688,560 @@ scaled_from_pixdata (guchar *pixdata,
   return dest;
 }
 
+/* Applications tend to set the same _NET_WM_ICON on all their
+ * windows, so decoded and scaled images are interned display-wide,
+ * keyed by the source image and the size asked for. The table holds
+ * no references: windows do, and an entry goes away when the last
+ * of them drops its pixbuf. Shared pixbufs must not be modified.
+ */
+typedef struct
+{
+  MetaDisplay *display;
+  guint hash;
+  int width;
+  int height;
+  int ideal_width;
+  int ideal_height;
+  gulong *argb;
+  GdkPixbuf *pixbuf; /* not a reference */
+} SharedIcon;
+
+static guint
+shared_icon_hash (gconstpointer key)
+{
+  return ((const SharedIcon *) key)->hash;
+}
+
+static gboolean
+shared_icon_equal (gconstpointer a,
+                   gconstpointer b)
+{
+  const SharedIcon *icon_a = a;
+  const SharedIcon *icon_b = b;
+
+  return icon_a->hash == icon_b->hash &&
+         icon_a->width == icon_b->width &&
+         icon_a->height == icon_b->height &&
+         icon_a->ideal_width == icon_b->ideal_width &&
+         icon_a->ideal_height == icon_b->ideal_height &&
+         memcmp (icon_a->argb, icon_b->argb,
+                 icon_a->width * icon_a->height * sizeof (gulong)) == 0;
+}
+
+static void
+shared_icon_init (SharedIcon *icon,
+                  gulong     *argb,
+                  int         w,
+                  int         h,
+                  int         ideal_width,
+                  int         ideal_height)
+{
+  guint hash;
+  int i;
+
+  /* FNV-1a over the 32 bits that matter of each pixel */
+  hash = 2166136261u;
+  hash = (hash ^ (guint) w) * 16777619u;
+  hash = (hash ^ (guint) h) * 16777619u;
+  hash = (hash ^ (guint) ideal_width) * 16777619u;
+  hash = (hash ^ (guint) ideal_height) * 16777619u;
+  for (i = 0; i < w * h; i++)
+    hash = (hash ^ (guint32) argb[i]) * 16777619u;
+
+  icon->hash = hash;
+  icon->width = w;
+  icon->height = h;
+  icon->ideal_width = ideal_width;
+  icon->ideal_height = ideal_height;
+  icon->argb = argb;
+  icon->pixbuf = NULL;
+}
+
+static void
+shared_icon_finalized (gpointer  data,
+                       GObject  *where_the_object_was)
+{
+  SharedIcon *icon = data;
+
+  g_hash_table_remove (icon->display->shared_icons, icon);
+  g_free (icon->argb);
+  g_free (icon);
+}
+
+static GdkPixbuf*
+lookup_shared_icon (MetaDisplay *display,
+                    gulong      *argb,
+                    int          w,
+                    int          h,
+                    int          ideal_width,
+                    int          ideal_height)
+{
+  SharedIcon probe;
+  SharedIcon *icon;
+
+  if (display->shared_icons == NULL)
+    display->shared_icons = g_hash_table_new (shared_icon_hash,
+                                              shared_icon_equal);
+
+  shared_icon_init (&probe, argb, w, h, ideal_width, ideal_height);
+
+  icon = g_hash_table_lookup (display->shared_icons, &probe);
+  if (icon == NULL)
+    {
+      display->shared_icon_misses += 1;
+      return NULL;
+    }
+
+  display->shared_icon_hits += 1;
+  return g_object_ref (icon->pixbuf);
+}
+
+/* Takes over @pixbuf, decoded from @argb, and returns the shared
+ * copy; that is @pixbuf itself unless an identical icon was interned
+ * while it was being decoded.
+ */
+static GdkPixbuf*
+intern_shared_icon (MetaDisplay *display,
+                    gulong      *argb,
+                    int          w,
+                    int          h,
+                    int          ideal_width,
+                    int          ideal_height,
+                    GdkPixbuf   *pixbuf)
+{
+  SharedIcon probe;
+  SharedIcon *icon;
+
+  shared_icon_init (&probe, argb, w, h, ideal_width, ideal_height);
+
+  icon = g_hash_table_lookup (display->shared_icons, &probe);
+  if (icon != NULL)
+    {
+      g_object_unref (pixbuf);
+      return g_object_ref (icon->pixbuf);
+    }
+
+  icon = g_memdup (&probe, sizeof (SharedIcon));
+  icon->display = display;
+  icon->argb = g_memdup (argb, w * h * sizeof (gulong));
+  icon->pixbuf = pixbuf;
+
+  g_object_weak_ref (G_OBJECT (pixbuf), shared_icon_finalized, icon);
+  g_hash_table_add (display->shared_icons, icon);
+
+  return pixbuf;
+}
+
+/* _NET_WM_ICON can be megabytes, so it is fetched asynchronously and
+ * decoded and scaled on a worker thread; the window keeps the icon
+ * it has (or gets the fallback) until the result is delivered to its
+ * icon cache and an icon update is queued. A load whose icon cache
+ * goes away or starts a newer load runs to completion and is then
+ * dropped; its request can't be abandoned before the reply arrives.
+ */
+struct _MetaIconLoad
+{
+  MetaDisplay *display;       /* NULL once the display is closed */
+  MetaIconCache *icon_cache;  /* NULL once nobody wants the result */
+  Window xwindow;
+  AgGetPropertyTask *task;    /* NULL once the reply is in */
+
+  int ideal_width;
+  int ideal_height;
+  int ideal_mini_width;
+  int ideal_mini_height;
+
+  /* The whole property, and the images picked from it */
+  guchar *property;
+  gulong *argb;
+  int w, h;
+  gulong *mini_argb;
+  int mini_w, mini_h;
+
+  GdkPixbuf *icon;
+  GdkPixbuf *mini_icon;
+  guint decode_icon : 1;
+  guint decode_mini_icon : 1;
+  guint synchronous : 1;      /* decode on the main thread */
+};
+
+static void
+finish_icon_load (MetaIconLoad *load)
+{
+  MetaIconCache *icon_cache = load->icon_cache;
+
+  if (load->display != NULL)
+    load->display->icon_loads = g_slist_remove (load->display->icon_loads,
+                                                load);
+
+  if (icon_cache != NULL && load->display != NULL)
+    {
+      MetaWindow *window;
+
+      icon_cache->net_wm_icon_load = NULL;
+
+      if (load->icon != NULL && load->mini_icon != NULL)
+        {
+          icon_cache->loaded_icon = load->icon;
+          icon_cache->loaded_mini_icon = load->mini_icon;
+          load->icon = NULL;
+          load->mini_icon = NULL;
+        }
+      icon_cache->net_wm_icon_loaded = TRUE;
+
+      window = meta_display_lookup_x_window (load->display, load->xwindow);
+      if (window != NULL)
+        meta_window_queue (window, META_QUEUE_UPDATE_ICON);
+    }
+
+  if (load->icon)
+    g_object_unref (G_OBJECT (load->icon));
+  if (load->mini_icon)
+    g_object_unref (G_OBJECT (load->mini_icon));
+  if (load->property)
+    XFree (load->property);
+
+  g_free (load);
+}
+
+static void
+decode_icons (MetaIconLoad *load)
+{
+  guchar *pixdata;
+
+  if (load->decode_icon)
+    {
+      argbdata_to_pixdata (load->argb, load->w * load->h, &pixdata);
+      load->icon = scaled_from_pixdata (pixdata, load->w, load->h,
+                                        load->ideal_width,
+                                        load->ideal_height);
+    }
+
+  if (load->decode_mini_icon)
+    {
+      argbdata_to_pixdata (load->mini_argb, load->mini_w * load->mini_h,
+                           &pixdata);
+      load->mini_icon = scaled_from_pixdata (pixdata,
+                                             load->mini_w, load->mini_h,
+                                             load->ideal_mini_width,
+                                             load->ideal_mini_height);
+    }
+}
+
+static void
+decode_icon_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+  decode_icons (task_data);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+icon_load_decoded (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  MetaIconLoad *load = user_data;
+
+  if (load->display != NULL)
+    {
+      if (load->decode_icon && load->icon != NULL)
+        load->icon = intern_shared_icon (load->display,
+                                         load->argb, load->w, load->h,
+                                         load->ideal_width,
+                                         load->ideal_height,
+                                         load->icon);
+
+      if (load->decode_mini_icon && load->mini_icon != NULL)
+        load->mini_icon = intern_shared_icon (load->display,
+                                              load->mini_argb,
+                                              load->mini_w, load->mini_h,
+                                              load->ideal_mini_width,
+                                              load->ideal_mini_height,
+                                              load->mini_icon);
+    }
+
+  finish_icon_load (load);
+}
+
+static void
+icon_load_got_reply (MetaIconLoad *load)
+{
+  MetaDisplay *display = load->display;
+  Atom type;
+  int format;
+  gulong nitems;
+  gulong bytes_after;
+  guchar *data;
+  GTask *task;
+  int status;
+
+  data = NULL;
+  status = ag_task_get_reply_and_free (load->task, &type, &format,
+                                       &nitems, &bytes_after, &data);
+  load->task = NULL;
+
+  if (status != Success || type != XA_CARDINAL || load->icon_cache == NULL)
+    {
+      if (data)
+        XFree (data);
+      finish_icon_load (load);
+      return;
+    }
+
+  load->property = data;
+
+  if (!find_best_size ((gulong *) data, nitems,
+                       load->ideal_width, load->ideal_height,
+                       &load->w, &load->h, &load->argb) ||
+      !find_best_size ((gulong *) data, nitems,
+                       load->ideal_mini_width, load->ideal_mini_height,
+                       &load->mini_w, &load->mini_h, &load->mini_argb))
+    {
+      finish_icon_load (load);
+      return;
+    }
+
+  /* Picking the sizes only looks at the headers, and the shared icons
+   * often save decoding altogether
+   */
+  load->icon = lookup_shared_icon (display, load->argb, load->w, load->h,
+                                   load->ideal_width, load->ideal_height);
+  load->mini_icon = lookup_shared_icon (display, load->mini_argb,
+                                        load->mini_w, load->mini_h,
+                                        load->ideal_mini_width,
+                                        load->ideal_mini_height);
+
+  load->decode_icon = load->icon == NULL;
+  load->decode_mini_icon = load->mini_icon == NULL;
+
+  if (!load->decode_icon && !load->decode_mini_icon)
+    {
+      finish_icon_load (load);
+      return;
+    }
+
+  if (load->synchronous)
+    {
+      decode_icons (load);
+      icon_load_decoded (NULL, NULL, load);
+      return;
+    }
+
+  task = g_task_new (NULL, NULL, icon_load_decoded, load);
+  g_task_set_task_data (task, load, NULL);
+  g_task_run_in_thread (task, decode_icon_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+icon_loads_replied (MetaDisplay *display)
+{
+  GSList *l;
+
+  for (l = display->icon_loads; l != NULL; l = l->next)
+    {
+      MetaIconLoad *load = l->data;
+
+      if (load->task != NULL && ag_task_have_reply (load->task))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+typedef struct
+{
+  GSource source;
+  MetaDisplay *display;
+} IconLoadSource;
+
+/* Replies are read off the connection by whoever reads events, and
+ * nothing tells us when that happens, so look before every poll.
+ */
+static gboolean
+icon_load_prepare (GSource *source,
+                   gint    *timeout)
+{
+  *timeout = -1;
+
+  return icon_loads_replied (((IconLoadSource *) source)->display);
+}
+
+static gboolean
+icon_load_check (GSource *source)
+{
+  return icon_loads_replied (((IconLoadSource *) source)->display);
+}
+
+static gboolean
+icon_load_dispatch (GSource     *source,
+                    GSourceFunc  callback,
+                    gpointer     user_data)
+{
+  MetaDisplay *display = ((IconLoadSource *) source)->display;
+  GSList *l, *next;
+
+  for (l = display->icon_loads; l != NULL; l = next)
+    {
+      MetaIconLoad *load = l->data;
+
+      next = l->next;
+
+      if (load->task != NULL && ag_task_have_reply (load->task))
+        icon_load_got_reply (load);
+    }
+
+  return TRUE;
+}
+
+static GSourceFuncs icon_load_funcs = {
+  icon_load_prepare,
+  icon_load_check,
+  icon_load_dispatch
+};
+
+static void
+start_icon_load (MetaDisplay   *display,
+                 Window         xwindow,
+                 MetaIconCache *icon_cache,
+                 int            ideal_width,
+                 int            ideal_height,
+                 int            ideal_mini_width,
+                 int            ideal_mini_height)
+{
+  MetaIconLoad *load;
+
+  if (icon_cache->net_wm_icon_load != NULL)
+    {
+      icon_cache->net_wm_icon_load->icon_cache = NULL;
+      icon_cache->net_wm_icon_load = NULL;
+    }
+
+  load = g_new0 (MetaIconLoad, 1);
+  load->display = display;
+  load->icon_cache = icon_cache;
+  load->xwindow = xwindow;
+  load->ideal_width = ideal_width;
+  load->ideal_height = ideal_height;
+  load->ideal_mini_width = ideal_mini_width;
+  load->ideal_mini_height = ideal_mini_height;
+
+  load->task = ag_task_create (display->xdisplay, xwindow,
+                               display->atom__NET_WM_ICON,
+                               0, G_MAXLONG, False, XA_CARDINAL);
+  if (load->task == NULL)
+    {
+      g_free (load);
+      return;
+    }
+
+  XFlush (display->xdisplay);
+
+  icon_cache->net_wm_icon_load = load;
+  display->icon_loads = g_slist_prepend (display->icon_loads, load);
+
+  if (display->icon_load_source == NULL)
+    {
+      display->icon_load_source = g_source_new (&icon_load_funcs,
+                                                sizeof (IconLoadSource));
+      ((IconLoadSource *) display->icon_load_source)->display = display;
+      g_source_attach (display->icon_load_source, NULL);
+    }
+}
+
+/* Waits for the reply to @load and decodes it on the spot, for when
+ * there is no icon to show in the meantime.
+ */
+static void
+finish_icon_load_now (MetaIconLoad *load)
+{
+  MetaDisplay *display = load->display;
+
+  if (load->task == NULL)
+    return;
+
+  load->synchronous = TRUE;
+
+  if (!ag_task_have_reply (load->task))
+    {
+      XSync (display->xdisplay, False);
+      meta_roundtrip_note (META_ROUNDTRIP_GET_PROPERTY);
+    }
+
+  icon_load_got_reply (load);
+}
+
+/**
+ * meta_icon_cache_free_shared: (skip)
+ * @display: the display being closed
+ *
+ * Reports how well icons were shared and forgets the shared icons
+ * that are still in use.
+ */
+LOCAL_SYMBOL void
+meta_icon_cache_free_shared (MetaDisplay *display)
+{
+  GHashTableIter iter;
+  SharedIcon *icon;
+
+  GSList *loads, *l;
+
+  meta_verbose ("Shared icons: %u hits, %u misses, %u unchanged\n",
+                display->shared_icon_hits,
+                display->shared_icon_misses,
+                display->shared_icon_unchanged);
+
+  if (display->icon_load_source != NULL)
+    {
+      g_source_destroy (display->icon_load_source);
+      g_source_unref (display->icon_load_source);
+      display->icon_load_source = NULL;
+    }
+
+  /* Collect the outstanding replies; loads being decoded clean up
+   * after themselves
+   */
+  if (display->icon_loads != NULL)
+    XSync (display->xdisplay, False);
+
+  loads = display->icon_loads;
+  display->icon_loads = NULL;
+
+  for (l = loads; l != NULL; l = l->next)
+    {
+      MetaIconLoad *load = l->data;
+
+      if (load->icon_cache != NULL)
+        load->icon_cache->net_wm_icon_load = NULL;
+      load->icon_cache = NULL;
+      load->display = NULL;
+
+      if (load->task != NULL)
+        icon_load_got_reply (load);
+    }
+  g_slist_free (loads);
+
+  if (display->shared_icons == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, display->shared_icons);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &icon, NULL))
+    {
+      g_object_weak_unref (G_OBJECT (icon->pixbuf),
+                           shared_icon_finalized, icon);
+      g_hash_table_iter_remove (&iter);
+      g_free (icon->argb);
+      g_free (icon);
+    }
+
+  g_hash_table_destroy (display->shared_icons);
+  display->shared_icons = NULL;
+}
+
 LOCAL_SYMBOL gboolean
 meta_read_icons (MetaScreen     *screen,
                  Window          xwindow,
@@ -717,10 +1255,6 @@ meta_read_icons (MetaScreen     *screen,
                  int             ideal_mini_width,
                  int             ideal_mini_height)
 {
-  guchar *pixdata;
-  int w, h;
-  guchar *mini_pixdata;
-  int mini_w, mini_h;
   Pixmap pixmap;
   Pixmap mask;
 
@@ -747,8 +1281,6 @@ meta_read_icons (MetaScreen     *screen,
   if (!meta_icon_cache_get_icon_invalidated (icon_cache))
     return FALSE; /* we have no new info to use */
 
-  pixdata = NULL;
-
   /* Our algorithm here assumes that we can't have for example origin
    * < USING_NET_WM_ICON and icon_cache->net_wm_icon_dirty == FALSE
    * unless we have tried to read NET_WM_ICON.
@@ -758,41 +1290,81 @@ meta_read_icons (MetaScreen     *screen,
    * we haven't done that since the last change.
    */
 
-  if (icon_cache->origin <= USING_NET_WM_ICON &&
+  if (!icon_cache->net_wm_icon_loaded &&
+      icon_cache->origin <= USING_NET_WM_ICON &&
       icon_cache->net_wm_icon_dirty)
-
     {
       icon_cache->net_wm_icon_dirty = FALSE;
 
-      if (read_rgb_icon (screen->display, xwindow,
-                         ideal_width, ideal_height,
-                         ideal_mini_width, ideal_mini_height,
-                         &w, &h, &pixdata,
-                         &mini_w, &mini_h, &mini_pixdata))
+      start_icon_load (screen->display, xwindow, icon_cache,
+                       ideal_width, ideal_height,
+                       ideal_mini_width, ideal_mini_height);
+
+      /* With no icon to keep showing, the first one is worth waiting
+       * for rather than flashing the fallback icon
+       */
+      if (icon_cache->origin == USING_NO_ICON &&
+          icon_cache->net_wm_icon_load != NULL)
+        finish_icon_load_now (icon_cache->net_wm_icon_load);
+    }
+
+  if (icon_cache->net_wm_icon_loaded)
+    {
+      icon_cache->net_wm_icon_loaded = FALSE;
+
+      *iconp = icon_cache->loaded_icon;
+      *mini_iconp = icon_cache->loaded_mini_icon;
+      icon_cache->loaded_icon = NULL;
+      icon_cache->loaded_mini_icon = NULL;
+
+      /* The property changed again while it was being read; what we
+       * got is still newer than what we have, but read it once more
+       */
+      if (icon_cache->origin <= USING_NET_WM_ICON &&
+          icon_cache->net_wm_icon_dirty)
         {
-          *iconp = scaled_from_pixdata (pixdata, w, h,
-                                        ideal_width, ideal_height);
+          icon_cache->net_wm_icon_dirty = FALSE;
 
-          *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
-                                             ideal_mini_width, ideal_mini_height);
+          start_icon_load (screen->display, xwindow, icon_cache,
+                           ideal_width, ideal_height,
+                           ideal_mini_width, ideal_mini_height);
+        }
 
-          if (*iconp && *mini_iconp)
-            {
-              replace_cache (icon_cache, USING_NET_WM_ICON,
-                             *iconp, *mini_iconp);
-              
-              return TRUE;
-            }
-          else
-            {
-              if (*iconp)
-                g_object_unref (G_OBJECT (*iconp));
-              if (*mini_iconp)
-                g_object_unref (G_OBJECT (*mini_iconp));
-            }
+      if (*iconp &&
+          icon_cache->origin == USING_NET_WM_ICON &&
+          *iconp == icon_cache->net_wm_icon &&
+          *mini_iconp == icon_cache->net_wm_mini_icon)
+        {
+          /* The property was rewritten with the same images */
+          screen->display->shared_icon_unchanged += 1;
+
+          g_object_unref (G_OBJECT (*iconp));
+          g_object_unref (G_OBJECT (*mini_iconp));
+          *iconp = NULL;
+          *mini_iconp = NULL;
+
+          return FALSE;
+        }
+
+      if (*iconp)
+        {
+          replace_cache (icon_cache, USING_NET_WM_ICON,
+                         *iconp, *mini_iconp);
+          icon_cache->net_wm_icon = *iconp;
+          icon_cache->net_wm_mini_icon = *mini_iconp;
+
+          return TRUE;
         }
     }
 
+  /* Keep what we have until the load is done; the other sources are
+   * read afterwards if it doesn't find anything, or meanwhile if
+   * there is no icon at all.
+   */
+  if (icon_cache->net_wm_icon_load != NULL &&
+      icon_cache->origin != USING_NO_ICON)
+    return FALSE;
+
   if (icon_cache->origin <= USING_WM_HINTS &&
       icon_cache->wm_hints_dirty)
     {
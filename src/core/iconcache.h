@@ -27,6 +27,7 @@
 #include "screen-private.h"
 
 typedef struct _MetaIconCache MetaIconCache;
+typedef struct _MetaIconLoad MetaIconLoad;
 
 typedef enum
 {
@@ -51,6 +52,18 @@ struct _MetaIconCache
   guint wm_hints_dirty : 1;
   guint kwm_win_icon_dirty : 1;
   guint net_wm_icon_dirty : 1;
+  /* The shared icons last handed out for _NET_WM_ICON; only compared,
+   * never dereferenced, as the window holds the references
+   */
+  gconstpointer net_wm_icon;
+  gconstpointer net_wm_mini_icon;
+  /* _NET_WM_ICON is read in the background; the images found end up
+   * here, and net_wm_icon_loaded is set, when it is done
+   */
+  MetaIconLoad *net_wm_icon_load;
+  GdkPixbuf *loaded_icon;
+  GdkPixbuf *loaded_mini_icon;
+  guint net_wm_icon_loaded : 1;
 };
 
 void           meta_icon_cache_init                 (MetaIconCache *icon_cache);
@@ -59,6 +72,7 @@ void           meta_icon_cache_property_changed     (MetaIconCache *icon_cache,
                                                      MetaDisplay   *display,
                                                      Atom           atom);
 gboolean       meta_icon_cache_get_icon_invalidated (MetaIconCache *icon_cache);
+void           meta_icon_cache_free_shared          (MetaDisplay   *display);
 
 gboolean meta_read_icons         (MetaScreen     *screen,
                                   Window          xwindow,
@@ -160,12 +160,23 @@ static gboolean process_keyboard_resize_grab (MetaDisplay *display,
                                               KeySym       keysym);
 
 static void regrab_key_bindings         (MetaDisplay *display);
+static void invalidate_wanted_key_grabs (MetaDisplay *display);
+static gboolean update_changed_bindings (MetaDisplay *display,
+                                         GHashTable  *changed);
 
 
 static GHashTable *key_handlers;
 
 #define HANDLER(name) g_hash_table_lookup (key_handlers, (name))
 
+/* Key events carry 8 bits of modifier state and an 8-bit keycode, so
+ * the pair packs losslessly into a hash key.
+ */
+#define BINDING_INDEX_KEY(keycode, mask) \
+  GUINT_TO_POINTER (((guint) (mask) << 8) | ((guint) (keycode) & 0xff))
+#define BINDING_INDEX_KEYCODE(key) (GPOINTER_TO_UINT (key) & 0xff)
+#define BINDING_INDEX_MASK(key)    (GPOINTER_TO_UINT (key) >> 8)
+
 static void
 key_handler_free (MetaKeyHandler *handler)
 {
@@ -330,6 +341,62 @@ reload_keycodes (MetaDisplay *display)
     }
 }
 
+/* Index the binding table by (keycode, mask), the pair every key event
+ * is matched against.  Must be redone whenever either of those changes
+ * for any binding, i.e. after reload_keycodes() and reload_modifiers().
+ */
+static void
+rebuild_binding_index (MetaDisplay *display)
+{
+  int i;
+
+  if (display->key_bindings_index == NULL)
+    display->key_bindings_index =
+      g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_slist_free);
+  else
+    g_hash_table_remove_all (display->key_bindings_index);
+
+  /* Walk backwards so that prepending leaves each chain in table order */
+  i = display->n_key_bindings - 1;
+  while (i >= 0)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+      gpointer key;
+      GSList *chain;
+
+      if (binding->keycode != 0)
+        {
+          key = BINDING_INDEX_KEY (binding->keycode, binding->mask);
+          chain = g_hash_table_lookup (display->key_bindings_index, key);
+
+          /* steal first, or the table would free the list we extend */
+          g_hash_table_steal (display->key_bindings_index, key);
+          g_hash_table_insert (display->key_bindings_index, key,
+                               g_slist_prepend (chain, binding));
+        }
+
+      --i;
+    }
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              " %u distinct keycode/mask pairs in binding index\n",
+              g_hash_table_size (display->key_bindings_index));
+
+  invalidate_wanted_key_grabs (display);
+}
+
+static GSList *
+display_get_keybindings_for_code (MetaDisplay  *display,
+                                  unsigned int  keycode,
+                                  unsigned long mask)
+{
+  if (display->key_bindings_index == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (display->key_bindings_index,
+                              BINDING_INDEX_KEY (keycode, mask));
+}
+
 static void
 reload_modifiers (MetaDisplay *display)
 {
@@ -356,6 +423,8 @@ reload_modifiers (MetaDisplay *display)
           ++i;
         }
     }
+
+  rebuild_binding_index (display);
 }
 
 
@@ -405,6 +474,13 @@ rebuild_binding_table (MetaDisplay     *display,
   int i;
   
   n_bindings = count_bindings (prefs);
+
+  /* The index points into the table we are about to free; it is
+   * refilled by reload_modifiers() once keycodes and masks are known.
+   */
+  if (display->key_bindings_index)
+    g_hash_table_remove_all (display->key_bindings_index);
+
   g_free (*bindings_p);
   *bindings_p = g_new0 (MetaKeyBinding, n_bindings);
 
@@ -482,11 +558,25 @@ rebuild_key_binding_table (MetaDisplay *display)
   g_list_free (prefs);
 }
 
+/* Bring the passive grabs on every screen and window in line with the
+ * current binding table.  The grab functions only send the difference
+ * between what a window holds and what it should hold, so this is cheap
+ * when a single binding changed.  Grabs made while a different set of
+ * modifiers was being ignored can't be diffed against, though, so in
+ * that case everything is dropped and grabbed again.
+ */
 static void
 regrab_key_bindings (MetaDisplay *display)
 {
   GSList *tmp;
   GSList *windows;
+  gboolean full;
+  guint n_grabs;
+  guint n_ungrabs;
+
+  full = display->key_grabs_ignored_mask != display->ignored_modifier_mask;
+  n_grabs = display->n_key_grab_requests;
+  n_ungrabs = display->n_key_ungrab_requests;
 
   meta_error_trap_push (display); /* for efficiency push outer trap */
   
@@ -495,7 +585,8 @@ regrab_key_bindings (MetaDisplay *display)
     {
       MetaScreen *screen = tmp->data;
 
-      meta_screen_ungrab_keys (screen);
+      if (full)
+        meta_screen_ungrab_keys (screen);
       meta_screen_grab_keys (screen);
 
       tmp = tmp->next;
@@ -507,7 +598,8 @@ regrab_key_bindings (MetaDisplay *display)
     {
       MetaWindow *w = tmp->data;
       
-      meta_window_ungrab_keys (w);
+      if (full)
+        meta_window_ungrab_keys (w);
       meta_window_grab_keys (w);
       
       tmp = tmp->next;
@@ -515,6 +607,17 @@ regrab_key_bindings (MetaDisplay *display)
   meta_error_trap_pop (display);
 
   g_slist_free (windows);
+
+  display->key_grabs_ignored_mask = display->ignored_modifier_mask;
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "%s regrab sent %u XGrabKey and %u XUngrabKey requests "
+              "(%u and %u since startup)\n",
+              full ? "Full" : "Incremental",
+              display->n_key_grab_requests - n_grabs,
+              display->n_key_ungrab_requests - n_ungrabs,
+              display->n_key_grab_requests,
+              display->n_key_ungrab_requests);
 }
 
 static MetaKeyBinding *
@@ -523,22 +626,23 @@ display_get_keybinding (MetaDisplay  *display,
                         unsigned int  keycode,
                         unsigned long mask)
 {
-  int i;
+  MetaKeyBinding *result;
+  GSList *tmp;
 
-  i = display->n_key_bindings - 1;
-  while (i >= 0)
+  /* Later entries in the table take precedence */
+  result = NULL;
+  tmp = display_get_keybindings_for_code (display, keycode, mask);
+  while (tmp != NULL)
     {
-      if (display->key_bindings[i].keysym == keysym &&
-          display->key_bindings[i].keycode == keycode &&
-          display->key_bindings[i].mask == mask)
-        {
-          return &display->key_bindings[i];
-        }
-      
-      --i;
+      MetaKeyBinding *binding = tmp->data;
+
+      if (binding->keysym == keysym)
+        result = binding;
+
+      tmp = tmp->next;
     }
 
-  return NULL;
+  return result;
 }
 
 static gboolean
@@ -854,6 +958,14 @@ bindings_changed_callback (MetaPreference pref,
   switch (pref)
     {
     case META_PREF_KEYBINDINGS:
+      /* Every binding changed during the last main loop iteration is
+       * delivered here at once, together with their names; only those
+       * bindings need resolving and regrabbing.
+       */
+      if (meta_prefs_get_changed_keys () &&
+          update_changed_bindings (display, meta_prefs_get_changed_keys ()))
+        break;
+
       rebuild_key_binding_table (display);
       reload_keycodes (display);
       reload_modifiers (display);
@@ -885,6 +997,13 @@ meta_display_shutdown_keys (MetaDisplay *display)
   
   if (display->modmap)
     XFreeModifiermap (display->modmap);
+
+  if (display->key_bindings_index)
+    g_hash_table_destroy (display->key_bindings_index);
+  display->key_bindings_index = NULL;
+
+  invalidate_wanted_key_grabs (display);
+
   g_free (display->key_bindings);
 }
 
@@ -900,6 +1019,29 @@ keysym_name (int keysym)
   return name;
 }
 
+typedef struct
+{
+  int keysym;
+  unsigned int mask;
+} KeyGrabTrap;
+
+static void
+key_grab_trapped (MetaDisplay *display,
+                  int          error_code,
+                  gpointer     user_data)
+{
+  KeyGrabTrap *trap = user_data;
+
+  if (error_code == BadAccess)
+    meta_warning (_("Some other program is already using the key %s with modifiers %x as a binding\n"), keysym_name (trap->keysym), trap->mask);
+  else if (error_code != Success)
+    meta_topic (META_DEBUG_KEYBINDINGS,
+                "Failed to grab key %s with modifiers %x\n",
+                keysym_name (trap->keysym), trap->mask);
+
+  g_slice_free (KeyGrabTrap, trap);
+}
+
 /* Grab/ungrab, ignoring all annoying modifiers like NumLock etc. */
 static void
 meta_change_keygrab (MetaDisplay *display,
@@ -937,34 +1079,33 @@ meta_change_keygrab (MetaDisplay *display,
           continue;
         }
 
-      if (meta_is_debugging ())
-        meta_error_trap_push_with_return (display);
+      if (grab && meta_is_debugging ())
+        meta_error_trap_push_async (display);
       if (grab)
-        XGrabKey (display->xdisplay, keycode,
-                  modmask | ignored_mask,
-                  xwindow,
-                  True,
-                  GrabModeAsync, GrabModeSync);
-      else
-        XUngrabKey (display->xdisplay, keycode,
+        {
+          XGrabKey (display->xdisplay, keycode,
                     modmask | ignored_mask,
-                    xwindow);
+                    xwindow,
+                    True,
+                    GrabModeAsync, GrabModeSync);
+          display->n_key_grab_requests += 1;
+        }
+      else
+        {
+          XUngrabKey (display->xdisplay, keycode,
+                      modmask | ignored_mask,
+                      xwindow);
+          display->n_key_ungrab_requests += 1;
+        }
 
-      if (meta_is_debugging ())
+      if (grab && meta_is_debugging ())
         {
-          int result;
-          
-          result = meta_error_trap_pop_with_return (display);
-          
-          if (grab && result != Success)
-            {      
-              if (result == BadAccess)
-                meta_warning (_("Some other program is already using the key %s with modifiers %x as a binding\n"), keysym_name (keysym), modmask | ignored_mask);
-              else
-                meta_topic (META_DEBUG_KEYBINDINGS,
-                            "Failed to grab key %s with modifiers %x\n",
-                            keysym_name (keysym), modmask | ignored_mask);
-            }
+          KeyGrabTrap *trap;
+
+          trap = g_slice_new (KeyGrabTrap);
+          trap->keysym = keysym;
+          trap->mask = modmask | ignored_mask;
+          meta_error_trap_pop_async (display, key_grab_trapped, trap);
         }
 
       ++ignored_mask;
@@ -973,72 +1114,352 @@ meta_change_keygrab (MetaDisplay *display,
   meta_error_trap_pop (display);
 }
 
+/* A key grab set maps BINDING_INDEX_KEY (keycode, mask) to the keysym
+ * for each passive grab wanted on, or held on, some X window.  Sets are
+ * never modified once built; the display owns the ones currently wanted
+ * and each screen or window keeps a reference to the one it was last
+ * grabbed with, so an unchanged window is recognised by pointer equality.
+ */
+static GHashTable *
+get_wanted_key_grabs (MetaDisplay *display,
+                      gboolean     binding_per_window)
+{
+  GHashTable **set_p;
+  int i;
+
+  if (binding_per_window)
+    set_p = &display->per_window_key_grabs;
+  else
+    set_p = &display->global_key_grabs;
+
+  if (*set_p != NULL)
+    return *set_p;
+
+  *set_p = g_hash_table_new (NULL, NULL);
+
+  i = 0;
+  while (i < display->n_key_bindings)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+
+      if (!!binding_per_window ==
+          !!(binding->handler->flags & META_KEY_BINDING_PER_WINDOW) &&
+          binding->keycode != 0)
+        g_hash_table_insert (*set_p,
+                             BINDING_INDEX_KEY (binding->keycode,
+                                                binding->mask),
+                             GUINT_TO_POINTER (binding->keysym));
+
+      ++i;
+    }
+
+  return *set_p;
+}
+
 static void
-meta_grab_key (MetaDisplay *display,
-               Window       xwindow,
-               int          keysym,
-               unsigned int keycode,
-               int          modmask)
+invalidate_wanted_key_grabs (MetaDisplay *display)
 {
-  meta_change_keygrab (display, xwindow, TRUE, keysym, keycode, modmask);
+  g_clear_pointer (&display->global_key_grabs, g_hash_table_unref);
+  g_clear_pointer (&display->per_window_key_grabs, g_hash_table_unref);
 }
 
+/* The requests that take a window from holding one key grab set to
+ * holding another; worked out once and applied to every window that
+ * holds @from.
+ */
+typedef struct
+{
+  GHashTable *from;
+  GHashTable *to;
+  GSList *removed; /* keys in @from only */
+  GSList *added;   /* keys in @to only */
+} KeyGrabDiff;
+
 static void
-grab_keys (MetaKeyBinding *bindings,
-           int             n_bindings,
-           MetaDisplay    *display,
-           Window          xwindow,
-           gboolean        binding_per_window)
+key_grab_diff_init (KeyGrabDiff *diff,
+                    GHashTable  *from,
+                    GHashTable  *to)
 {
-  int i;
+  GHashTableIter iter;
+  gpointer key;
 
-  g_assert (n_bindings == 0 || bindings != NULL);
+  diff->from = from;
+  diff->to = to;
+  diff->removed = NULL;
+  diff->added = NULL;
+
+  if (from != NULL)
+    {
+      g_hash_table_iter_init (&iter, from);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        if (!g_hash_table_contains (to, key))
+          diff->removed = g_slist_prepend (diff->removed, key);
+    }
+
+  g_hash_table_iter_init (&iter, to);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    if (from == NULL || !g_hash_table_contains (from, key))
+      diff->added = g_slist_prepend (diff->added, key);
+}
+
+static void
+key_grab_diff_clear (KeyGrabDiff *diff)
+{
+  g_slist_free (diff->removed);
+  g_slist_free (diff->added);
+}
+
+/* Sends @diff to @xwindow, which must hold @diff->from in *@held_p */
+static void
+apply_key_grab_diff (MetaDisplay  *display,
+                     Window        xwindow,
+                     GHashTable  **held_p,
+                     KeyGrabDiff  *diff)
+{
+  GSList *tmp;
 
   meta_error_trap_push (display);
-  
-  i = 0;
-  while (i < n_bindings)
+
+  for (tmp = diff->removed; tmp; tmp = tmp->next)
+    meta_change_keygrab (display, xwindow, FALSE,
+                         GPOINTER_TO_UINT (g_hash_table_lookup (diff->from,
+                                                                tmp->data)),
+                         BINDING_INDEX_KEYCODE (tmp->data),
+                         BINDING_INDEX_MASK (tmp->data));
+
+  for (tmp = diff->added; tmp; tmp = tmp->next)
+    meta_change_keygrab (display, xwindow, TRUE,
+                         GPOINTER_TO_UINT (g_hash_table_lookup (diff->to,
+                                                                tmp->data)),
+                         BINDING_INDEX_KEYCODE (tmp->data),
+                         BINDING_INDEX_MASK (tmp->data));
+
+  meta_error_trap_pop (display);
+
+  if (*held_p != NULL)
+    g_hash_table_unref (*held_p);
+  *held_p = g_hash_table_ref (diff->to);
+}
+
+/* Make @xwindow hold exactly the wanted grabs, sending only the
+ * requests needed to get there from *@held_p.
+ */
+static void
+grab_keys (MetaDisplay *display,
+           Window       xwindow,
+           GHashTable **held_p,
+           gboolean     binding_per_window)
+{
+  GHashTable *wanted;
+  KeyGrabDiff diff;
+
+  wanted = get_wanted_key_grabs (display, binding_per_window);
+  if (*held_p == wanted)
+    return;
+
+  key_grab_diff_init (&diff, *held_p, wanted);
+  apply_key_grab_diff (display, xwindow, held_p, &diff);
+  key_grab_diff_clear (&diff);
+}
+
+/* Resolve the keycode and mask of one binding, as reload_keycodes()
+ * and reload_modifiers() do for the whole table.
+ */
+static void
+resolve_binding (MetaDisplay    *display,
+                 MetaKeyBinding *binding)
+{
+  if (binding->keysym != 0)
+    binding->keycode = keysym_to_keycode (display, binding->keysym);
+
+  meta_display_devirtualize_modifiers (display,
+                                       binding->modifiers,
+                                       &binding->mask);
+}
+
+/* Rebuild the binding table after the bindings named in @changed were
+ * changed, added or removed, resolving only those, and send every
+ * screen and window the grabs for just the key combinations that
+ * appeared or went away.
+ *
+ * Returns FALSE, having done nothing, if the grabs can't be updated
+ * incrementally, in which case the caller does a full rebuild.
+ */
+static gboolean
+update_changed_bindings (MetaDisplay *display,
+                         GHashTable  *changed)
+{
+  MetaKeyBinding *old_bindings;
+  int n_old_bindings;
+  GHashTable *old_index;
+  GHashTable *old_grabs[2];
+  KeyGrabDiff diffs[2];
+  GList *prefs;
+  GSList *windows;
+  GSList *tmp;
+  guint n_grabs;
+  guint n_ungrabs;
+  int i, j;
+
+  /* Grabs held under another ignored mask can only be redone in full */
+  if (display->key_bindings == NULL ||
+      display->key_grabs_ignored_mask != display->ignored_modifier_mask)
+    return FALSE;
+
+  n_grabs = display->n_key_grab_requests;
+  n_ungrabs = display->n_key_ungrab_requests;
+
+  /* The sets the screens and windows were grabbed with */
+  old_grabs[0] = g_hash_table_ref (get_wanted_key_grabs (display, FALSE));
+  old_grabs[1] = g_hash_table_ref (get_wanted_key_grabs (display, TRUE));
+
+  old_bindings = display->key_bindings;
+  n_old_bindings = display->n_key_bindings;
+  display->key_bindings = NULL;
+
+  prefs = meta_prefs_get_keybindings ();
+  rebuild_binding_table (display,
+                         &display->key_bindings,
+                         &display->n_key_bindings,
+                         prefs);
+  g_list_free (prefs);
+
+  /* Bindings keep pointing at their preference's name, so the entries
+   * of an unchanged preference are found in the old table by pointer;
+   * names of removed preferences may be gone, so never look at them.
+   */
+  old_index = g_hash_table_new (NULL, NULL);
+  for (j = n_old_bindings - 1; j >= 0; j--)
+    g_hash_table_insert (old_index, (gpointer) old_bindings[j].name,
+                         GINT_TO_POINTER (j));
+
+  j = -1;
+  for (i = 0; i < display->n_key_bindings; i++)
     {
-      if (!!binding_per_window ==
-          !!(bindings[i].handler->flags & META_KEY_BINDING_PER_WINDOW) &&
-          bindings[i].keycode != 0)
+      MetaKeyBinding *binding = &display->key_bindings[i];
+      MetaKeyBinding *old = NULL;
+      gpointer value;
+
+      if (j >= 0 && binding->name == display->key_bindings[i - 1].name)
+        j = j + 1 < n_old_bindings ? j + 1 : -1;
+      else if (!g_hash_table_contains (changed, binding->name) &&
+               g_hash_table_lookup_extended (old_index, binding->name,
+                                             NULL, &value))
+        j = GPOINTER_TO_INT (value);
+      else
+        j = -1;
+
+      if (j >= 0)
+        old = &old_bindings[j];
+
+      if (old != NULL &&
+          old->name == binding->name &&
+          old->keysym == binding->keysym &&
+          old->modifiers == binding->modifiers &&
+          (binding->keysym != 0 || old->keycode == binding->keycode))
         {
-          meta_grab_key (display, xwindow,
-                         bindings[i].keysym,
-                         bindings[i].keycode,
-                         bindings[i].mask);
+          binding->keycode = old->keycode;
+          binding->mask = old->mask;
+        }
+      else
+        {
+          resolve_binding (display, binding);
+          meta_topic (META_DEBUG_KEYBINDINGS,
+                      " Resolved changed binding %s: keycode %u mask 0x%x\n",
+                      binding->name, binding->keycode, binding->mask);
         }
-      
-      ++i;
     }
 
+  g_hash_table_destroy (old_index);
+  g_free (old_bindings);
+
+  rebuild_binding_index (display);
+
+  key_grab_diff_init (&diffs[0], old_grabs[0],
+                      get_wanted_key_grabs (display, FALSE));
+  key_grab_diff_init (&diffs[1], old_grabs[1],
+                      get_wanted_key_grabs (display, TRUE));
+
+  meta_error_trap_push (display); /* for efficiency push outer trap */
+
+  for (tmp = display->screens; tmp; tmp = tmp->next)
+    {
+      MetaScreen *screen = tmp->data;
+
+      if (screen->all_keys_grabbed)
+        continue;
+
+      if (screen->keys_grabbed && screen->key_grabs == old_grabs[0])
+        apply_key_grab_diff (display, screen->xroot,
+                             &screen->key_grabs, &diffs[0]);
+      else
+        meta_screen_grab_keys (screen);
+    }
+
+  windows = meta_display_list_windows (display, META_LIST_DEFAULT);
+  for (tmp = windows; tmp; tmp = tmp->next)
+    {
+      MetaWindow *w = tmp->data;
+
+      if (w->all_keys_grabbed)
+        continue;
+
+      /* Grabbed with the old set on the window it should be on */
+      if (w->keys_grabbed &&
+          w->key_grabs == old_grabs[1] &&
+          w->grab_on_frame == (w->frame != NULL))
+        apply_key_grab_diff (display,
+                             w->frame ? w->frame->xwindow : w->xwindow,
+                             &w->key_grabs, &diffs[1]);
+      else
+        meta_window_grab_keys (w);
+    }
+  g_slist_free (windows);
+
   meta_error_trap_pop (display);
+
+  key_grab_diff_clear (&diffs[0]);
+  key_grab_diff_clear (&diffs[1]);
+  g_hash_table_unref (old_grabs[0]);
+  g_hash_table_unref (old_grabs[1]);
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "%u changed keybindings sent %u XGrabKey and %u XUngrabKey "
+              "requests\n",
+              g_hash_table_size (changed),
+              display->n_key_grab_requests - n_grabs,
+              display->n_key_ungrab_requests - n_ungrabs);
+
+  return TRUE;
+}
+
+static void
+ungrab_all_keys_trapped (MetaDisplay *display,
+                         int          error_code,
+                         gpointer     user_data)
+{
+  if (error_code != Success)
+    meta_topic (META_DEBUG_KEYBINDINGS,
+                "Ungrabbing all keys on 0x%lx failed\n",
+                (Window) GPOINTER_TO_UINT (user_data));
 }
 
 static void
 ungrab_all_keys (MetaDisplay *display,
-                 Window       xwindow)
+                 Window       xwindow,
+                 GHashTable **held_p)
 {
-  if (meta_is_debugging ())
-    meta_error_trap_push_with_return (display);
-  else
-    meta_error_trap_push (display);
+  g_clear_pointer (held_p, g_hash_table_unref);
+
+  meta_error_trap_push_async (display);
 
   XUngrabKey (display->xdisplay, AnyKey, AnyModifier,
               xwindow);
+  display->n_key_ungrab_requests += 1;
 
-  if (meta_is_debugging ())
-    {
-      int result;
-      
-      result = meta_error_trap_pop_with_return (display);
-      
-      if (result != Success)    
-        meta_topic (META_DEBUG_KEYBINDINGS,
-                    "Ungrabbing all keys on 0x%lx failed\n", xwindow);
-    }
-  else
-    meta_error_trap_pop (display);
+  meta_error_trap_pop_async (display,
+                             meta_is_debugging () ? ungrab_all_keys_trapped : NULL,
+                             GUINT_TO_POINTER (xwindow));
 }
 
 LOCAL_SYMBOL void
@@ -1047,13 +1468,8 @@ meta_screen_grab_keys (MetaScreen *screen)
   if (screen->all_keys_grabbed)
     return;
 
-  if (screen->keys_grabbed)
-    return;
-
-  grab_keys (screen->display->key_bindings,
-             screen->display->n_key_bindings,
-             screen->display, screen->xroot,
-             FALSE);
+  /* If keys are already grabbed, this only sends what changed */
+  grab_keys (screen->display, screen->xroot, &screen->key_grabs, FALSE);
 
   screen->keys_grabbed = TRUE;
 }
@@ -1063,7 +1479,7 @@ meta_screen_ungrab_keys (MetaScreen  *screen)
 {
   if (screen->keys_grabbed)
     {
-      ungrab_all_keys (screen->display, screen->xroot);
+      ungrab_all_keys (screen->display, screen->xroot, &screen->key_grabs);
       screen->keys_grabbed = FALSE;
     }
 }
@@ -1078,7 +1494,8 @@ meta_window_grab_keys (MetaWindow  *window)
       || window->override_redirect)
     {
       if (window->keys_grabbed)
-        ungrab_all_keys (window->display, window->xwindow);
+        ungrab_all_keys (window->display, window->xwindow,
+                         &window->key_grabs);
       window->keys_grabbed = FALSE;
       return;
     }
@@ -1086,18 +1503,20 @@ meta_window_grab_keys (MetaWindow  *window)
   if (window->keys_grabbed)
     {
       if (window->frame && !window->grab_on_frame)
-        ungrab_all_keys (window->display, window->xwindow);
+        ungrab_all_keys (window->display, window->xwindow,
+                         &window->key_grabs);
       else if (window->frame == NULL &&
                window->grab_on_frame)
-        ; /* continue to regrab on client window */
-      else
-        return; /* already all good */
+        {
+          /* grabs went away with the frame; regrab on client window */
+          g_clear_pointer (&window->key_grabs, g_hash_table_unref);
+        }
+      /* else already on the right window, only send what changed */
     }
   
-  grab_keys (window->display->key_bindings,
-             window->display->n_key_bindings,
-             window->display,
+  grab_keys (window->display,
              window->frame ? window->frame->xwindow : window->xwindow,
+             &window->key_grabs,
              TRUE);
 
   window->keys_grabbed = TRUE;
@@ -1112,10 +1531,14 @@ meta_window_ungrab_keys (MetaWindow  *window)
       if (window->grab_on_frame &&
           window->frame != NULL)
         ungrab_all_keys (window->display,
-                         window->frame->xwindow);
+                         window->frame->xwindow,
+                         &window->key_grabs);
       else if (!window->grab_on_frame)
         ungrab_all_keys (window->display,
-                         window->xwindow);
+                         window->xwindow,
+                         &window->key_grabs);
+      else
+        g_clear_pointer (&window->key_grabs, g_hash_table_unref);
 
       window->keys_grabbed = FALSE;
     }
@@ -1422,11 +1845,8 @@ is_modifier_only_kb (MetaDisplay *display, XEvent *event, KeySym keysym)
     return mask == 0 && modifier_only_keysym (keysym);
 }
 
-/* now called from only one place, may be worth merging */
 static gboolean
-process_event (MetaKeyBinding       *bindings,
-               int                   n_bindings,
-               MetaDisplay          *display,
+process_event (MetaDisplay          *display,
                MetaScreen           *screen,
                MetaWindow           *window,
                XEvent               *event,
@@ -1434,7 +1854,7 @@ process_event (MetaKeyBinding       *bindings,
                gboolean              on_window,
                gboolean              allow_release)
 {
-  int i;
+  GSList *tmp;
   unsigned long mask;
 
   /* we used to have release-based bindings but no longer. */
@@ -1448,23 +1868,22 @@ process_event (MetaKeyBinding       *bindings,
       strip_self_mod (keysym, &mask);
     }
 
-  /*
-   * TODO: This would be better done with a hash table;
-   * it doesn't suit to use O(n) for such a common operation.
-   */
-  for (i=0; i<n_bindings; i++)
+  if (event->type != KeyPress && !allow_release)
+    return FALSE;
+
+  for (tmp = display_get_keybindings_for_code (display,
+                                               event->xkey.keycode,
+                                               mask);
+       tmp != NULL;
+       tmp = tmp->next)
     {
-      MetaKeyHandler *handler = bindings[i].handler;
+      MetaKeyBinding *binding = tmp->data;
+      MetaKeyHandler *handler = binding->handler;
 
       /* Custom keybindings are from Cinnamon, and never need a window */
       if (!on_window && handler->flags & META_KEY_BINDING_PER_WINDOW && handler->action < META_KEYBINDING_ACTION_CUSTOM)
         continue;
 
-      if ((event->type != KeyPress && !allow_release) ||
-          bindings[i].keycode != event->xkey.keycode ||
-          mask != bindings[i].mask)
-        continue;
-
       /*
        * window must be non-NULL for on_window to be true,
        * and so also window must be non-NULL if we get here and
@@ -1473,15 +1892,15 @@ process_event (MetaKeyBinding       *bindings,
 
       meta_topic (META_DEBUG_KEYBINDINGS,
                   "Binding keycode 0x%x mask 0x%x matches event 0x%x state 0x%x\n",
-                  bindings[i].keycode, bindings[i].mask,
+                  binding->keycode, binding->mask,
                   event->xkey.keycode, event->xkey.state);
 
       if (handler == NULL)
-        meta_bug ("Binding %s has no handler\n", bindings[i].name);
+        meta_bug ("Binding %s has no handler\n", binding->name);
       else
         meta_topic (META_DEBUG_KEYBINDINGS,
                     "Running handler for %s\n",
-                    bindings[i].name);
+                    binding->name);
 
       /* Global keybindings count as a let-the-terminal-lose-focus
        * due to new window mapping until the user starts
@@ -1489,7 +1908,7 @@ process_event (MetaKeyBinding       *bindings,
        */
       display->allow_terminal_deactivation = TRUE;
 
-      invoke_handler (display, screen, handler, window, event, &bindings[i]);
+      invoke_handler (display, screen, handler, window, event, binding);
 
       return TRUE;
     }
@@ -1531,9 +1950,7 @@ process_modifier_key (MetaDisplay *display,
            */
           modifier_only_is_down = FALSE;
             /* Try our keybindings */
-          if (process_event (display->key_bindings,
-                             display->n_key_bindings,
-                             display, screen, window, event, keysym,
+          if (process_event (display, screen, window, event, keysym,
                              have_window, FALSE))
             {
               /* we had a binding, we're done */
@@ -1716,9 +2133,7 @@ meta_display_process_key_event (MetaDisplay *display,
     }
   
   /* Do the normal keybindings */
-  return process_event (display->key_bindings,
-                        display->n_key_bindings,
-                        display, screen, window, event, keysym,
+  return process_event (display, screen, window, event, keysym,
                         !all_keys_grabbed && window, allow_key_up);
 }
 
@@ -3530,6 +3945,11 @@ meta_display_init_keys (MetaDisplay *display)
   display->meta_mask = 0;
   display->key_bindings = NULL;
   display->n_key_bindings = 0;
+  display->key_bindings_index = NULL;
+  display->global_key_grabs = NULL;
+  display->per_window_key_grabs = NULL;
+  display->n_key_grab_requests = 0;
+  display->n_key_ungrab_requests = 0;
 
   XDisplayKeycodes (display->xdisplay,
                     &display->min_keycode,
@@ -3542,6 +3962,7 @@ meta_display_init_keys (MetaDisplay *display)
 
   reload_keymap (display);
   reload_modmap (display);
+  display->key_grabs_ignored_mask = display->ignored_modifier_mask;
 
   key_handlers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                                         (GDestroyNotify) key_handler_free);
@@ -54,6 +54,7 @@
 #include <meta/errors.h>
 #include "ui.h"
 #include "session.h"
+#include "roundtrips.h"
 #include <meta/prefs.h>
 #include <meta/compositor.h>
 
@@ -487,8 +488,10 @@ meta_run (void)
   guint i;
 
   /* Load prefs */
+  meta_startup_phase_begin ("prefs init");
   meta_prefs_init ();
   meta_prefs_add_listener (prefs_changed_callback, NULL);
+  meta_startup_phase_end ("prefs init");
 
   for (i=0; i<G_N_ELEMENTS(log_domains); i++)
     g_log_set_handler (log_domains[i],
@@ -498,6 +501,7 @@ meta_run (void)
   if (g_getenv ("MUFFIN_G_FATAL_WARNINGS") != NULL)
     g_log_set_always_fatal (G_LOG_LEVEL_MASK);
   
+  meta_startup_phase_begin ("theme load");
   meta_ui_set_current_theme (meta_prefs_get_theme (), FALSE);
 
   if (!meta_ui_have_a_theme ())
@@ -505,6 +509,7 @@ meta_run (void)
       meta_ui_set_current_theme ("Default", FALSE);
       meta_warning (_("Could not find theme %s. Falling back to default theme."), meta_prefs_get_theme ());
     }
+  meta_startup_phase_end ("theme load");
  
  
   /* Connect to SM as late as possible - but before managing display,
@@ -580,8 +585,12 @@ prefs_changed_callback (MetaPreference pref,
 {
   switch (pref)
     {
-    case META_PREF_THEME:
     case META_PREF_DRAGGABLE_BORDER_WIDTH:
+      /* A theme change in the same batch reloads everything anyway */
+      if (meta_prefs_changed_in_batch (META_PREF_THEME))
+        break;
+      /* fall through */
+    case META_PREF_THEME:
       meta_ui_set_current_theme (meta_prefs_get_theme (), FALSE);
       meta_display_retheme_all ();
       break;
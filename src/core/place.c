@@ -28,6 +28,7 @@
 
 #include "boxes-private.h"
 #include "place.h"
+#include "roundtrips.h"
 #include <meta/workspace.h>
 #include <meta/prefs.h>
 #include <gdk/gdk.h>
@@ -101,6 +102,7 @@ place_by_pointer(MetaWindow *window,
   int win_x_return, win_y_return;
   unsigned int mask_return;
 
+  meta_roundtrip_note (META_ROUNDTRIP_QUERY_POINTER);
   XQueryPointer (window->display->xdisplay,
                  window->screen->xroot,
                  &root_return,
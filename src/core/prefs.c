@@ -75,7 +75,14 @@
 
 #define SETTINGS(s) g_hash_table_lookup (settings_schemas, (s))
 
+/* Changes are delivered in batches, one per main loop iteration; these
+ * collect the next batch, and the current_ ones hold the batch being
+ * delivered to listeners.
+ */
 static GList *changes = NULL;
+static GHashTable *changed_keys = NULL;
+static GList *current_changes = NULL;
+static GHashTable *current_changed_keys = NULL;
 static guint changed_idle;
 static GList *listeners = NULL;
 static GHashTable *settings_schemas;
@@ -148,6 +155,8 @@ static void bindings_changed (GSettings      *settings,
                               gpointer        data);
 
 static void queue_changed (MetaPreference  pref);
+static void queue_changed_key (MetaPreference  pref,
+                               const char     *key);
 
 static void maybe_give_disable_workarounds_warning (void);
 
@@ -685,7 +694,7 @@ handle_preference_update_enum (GSettings *settings,
 
   /* Did it change?  If so, tell the listeners about it. */
   if (old_value != *((gint *)cursor->target))
-    queue_changed (cursor->base.pref);
+    queue_changed_key (cursor->base.pref, cursor->base.key);
 }
 
 static void
@@ -713,7 +722,7 @@ handle_preference_update_bool (GSettings *settings,
 
   /* Did it change?  If so, tell the listeners about it. */
   if (old_value != *((gboolean *)cursor->target))
-    queue_changed (cursor->base.pref);
+    queue_changed_key (cursor->base.pref, cursor->base.key);
 
   if (cursor->base.pref==META_PREF_DISABLE_WORKAROUNDS)
     maybe_give_disable_workarounds_warning ();
@@ -760,7 +769,7 @@ handle_preference_update_string (GSettings *settings,
     }
 
   if (inform_listeners)
-    queue_changed (cursor->base.pref);
+    queue_changed_key (cursor->base.pref, cursor->base.key);
 }
 
 static void
@@ -783,7 +792,7 @@ handle_preference_update_int (GSettings *settings,
   if (*cursor->target != new_value)
     {
       *cursor->target = new_value;
-      queue_changed (cursor->base.pref);
+      queue_changed_key (cursor->base.pref, cursor->base.key);
     }
 }
 
@@ -868,16 +877,29 @@ static gboolean
 changed_idle_handler (gpointer data)
 {
   GList *tmp;
-  GList *copy;
+  GList *saved_changes;
+  GHashTable *saved_keys;
 
   changed_idle = 0;
   
-  copy = g_list_copy (changes); /* reentrancy paranoia */
+  /* Listeners may queue further changes, which start a new batch;
+   * they may also nest through a main loop, hence the save/restore.
+   */
+  saved_changes = current_changes;
+  saved_keys = current_changed_keys;
 
-  g_list_free (changes);
+  current_changes = changes;
+  current_changed_keys = changed_keys;
   changes = NULL;
-  
-  tmp = copy;
+  changed_keys = NULL;
+
+  meta_topic (META_DEBUG_PREFS,
+              "Delivering batch of %u prefs from %u changed keys\n",
+              g_list_length (current_changes),
+              current_changed_keys ?
+                g_hash_table_size (current_changed_keys) : 0);
+
+  tmp = current_changes;
   while (tmp != NULL)
     {
       MetaPreference pref = GPOINTER_TO_INT (tmp->data);
@@ -887,11 +909,63 @@ changed_idle_handler (gpointer data)
       tmp = tmp->next;
     }
 
-  g_list_free (copy);
+  g_list_free (current_changes);
+  if (current_changed_keys)
+    g_hash_table_destroy (current_changed_keys);
+
+  current_changes = saved_changes;
+  current_changed_keys = saved_keys;
   
   return FALSE;
 }
 
+/**
+ * meta_prefs_changed_in_batch: (skip)
+ * @pref: a #MetaPreference
+ *
+ * Preference changes made during one main loop iteration are delivered
+ * to listeners together, each preference once.  From inside a listener,
+ * this tells whether @pref is part of the batch being delivered, so
+ * that work covered by several preferences can be done only once.
+ *
+ * Returns: %TRUE if @pref changed in the current batch
+ */
+gboolean
+meta_prefs_changed_in_batch (MetaPreference pref)
+{
+  return g_list_find (current_changes, GINT_TO_POINTER (pref)) != NULL;
+}
+
+/**
+ * meta_prefs_get_changed_keys: (skip)
+ *
+ * From inside a listener, returns the set of settings keys (for
+ * keybindings, the binding names) whose change is being delivered in
+ * the current batch.  Preferences parsed through a mapping handler,
+ * such as the theme or the titlebar font, are not listed by key.
+ *
+ * Returns: (transfer none): a set of key names, or %NULL if no key
+ *   was recorded for this batch
+ */
+GHashTable *
+meta_prefs_get_changed_keys (void)
+{
+  return current_changed_keys;
+}
+
+static void
+queue_changed_key (MetaPreference  pref,
+                   const char     *key)
+{
+  if (changed_keys == NULL)
+    changed_keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
+
+  g_hash_table_add (changed_keys, g_strdup (key));
+
+  queue_changed (pref);
+}
+
 static void
 queue_changed (MetaPreference pref)
 {
@@ -1138,14 +1212,14 @@ settings_changed (GSettings *settings,
   if (strcmp (key, KEY_WORKSPACE_NAMES) == 0)
     {
       if (update_workspace_names ())
-        queue_changed (META_PREF_WORKSPACE_NAMES);
+        queue_changed_key (META_PREF_WORKSPACE_NAMES, key);
       return;
     }
   
   if (strcmp (key, KEY_MIN_WINDOW_OPACITY) == 0)
     {
       update_min_win_opacity ();
-      queue_changed (META_PREF_MIN_WIN_OPACITY);
+      queue_changed_key (META_PREF_MIN_WIN_OPACITY, key);
       return;
     }
 
@@ -1197,7 +1271,7 @@ bindings_changed (GSettings *settings,
   strokes = g_settings_get_strv (settings, key);
 
   if (update_key_binding (key, strokes))
-    queue_changed (META_PREF_KEYBINDINGS);
+    queue_changed_key (META_PREF_KEYBINDINGS, key);
 
   g_strfreev (strokes);
 }
@@ -1712,7 +1786,7 @@ button_layout_handler (GVariant *value,
   if (!button_layout_equal (&button_layout, &new_layout))
     {
       button_layout = new_layout;
-      emit_changed (META_PREF_BUTTON_LAYOUT);
+      queue_changed (META_PREF_BUTTON_LAYOUT);
     }
 
   return TRUE;
@@ -2227,7 +2301,7 @@ meta_prefs_add_keybinding (const char           *name,
 
       g_object_set_data (G_OBJECT (settings), name, GUINT_TO_POINTER (id));
 
-      queue_changed (META_PREF_KEYBINDINGS);
+      queue_changed_key (META_PREF_KEYBINDINGS, name);
     }
 
   return TRUE;
@@ -2257,9 +2331,9 @@ meta_prefs_remove_keybinding (const char *name)
   id = GPOINTER_TO_UINT (g_object_steal_data (G_OBJECT (settings), name));
   g_signal_handler_disconnect (settings, id);
 
-  g_hash_table_remove (key_bindings, name);
+  queue_changed_key (META_PREF_KEYBINDINGS, name);
 
-  queue_changed (META_PREF_KEYBINDINGS);
+  g_hash_table_remove (key_bindings, name);
 
   return TRUE;
 }
@@ -2307,9 +2381,9 @@ meta_prefs_remove_custom_keybinding (const char *name)
       return FALSE;
     }
 
-  g_hash_table_remove (key_bindings, name);
+  queue_changed_key (META_PREF_KEYBINDINGS, name);
 
-  queue_changed (META_PREF_KEYBINDINGS);
+  g_hash_table_remove (key_bindings, name);
 
   return TRUE;
 }
@@ -0,0 +1,553 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin restart state handoff */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "restart-state.h"
+#include "screen-private.h"
+#include "window-private.h"
+#include "workspace-private.h"
+#include "stack.h"
+#include "xprops.h"
+#include <meta/errors.h>
+#include <X11/Xatom.h>
+#include <string.h>
+
+/* The property is a list of CARDINALs:
+ *
+ *   header:      MAGIC VERSION screen n_windows n_workspaces
+ *   per window:  RECORD_SIZE values, bottom of the stack first
+ *   per space:   n, then the n windows in MRU order
+ *
+ * Anything that doesn't add up is thrown away as a whole; the
+ * version must be bumped whenever the layout changes.
+ */
+#define RESTART_STATE_MAGIC   0x4d465253 /* "MFRS" */
+#define RESTART_STATE_VERSION 2
+#define HEADER_SIZE 5
+
+enum
+{
+  RECORD_XWINDOW,
+  RECORD_FLAGS,
+  RECORD_WORKSPACE,
+  RECORD_USER_TIME,
+  RECORD_WIDTH,
+  RECORD_HEIGHT,
+  RECORD_SAVED_X,
+  RECORD_SAVED_Y,
+  RECORD_SAVED_WIDTH,
+  RECORD_SAVED_HEIGHT,
+  RECORD_TILE_MODE,
+  RECORD_TILE_TYPE,
+  RECORD_TILE_MONITOR,
+  RECORD_TILE_X,
+  RECORD_TILE_Y,
+  RECORD_TILE_WIDTH,
+  RECORD_TILE_HEIGHT,
+
+  RECORD_SIZE
+};
+
+enum
+{
+  FLAG_TILED            = 1 << 0,
+  FLAG_CUSTOM_SNAP_SIZE = 1 << 1,
+  FLAG_NO_WORKSPACE     = 1 << 2
+};
+
+struct _MetaRestartState
+{
+  /* Window -> MetaRestartWindowInfo, only for validated windows */
+  GHashTable *windows;
+  /* Window -> MetaRestartWindowInfo, waiting for validation */
+  GHashTable *unvalidated;
+
+  /* One GArray of Window per workspace, most recently used first */
+  GPtrArray *mru_lists;
+};
+
+static void
+append_window (GArray     *data,
+               MetaWindow *window,
+               int         stack_position)
+{
+  gulong record[RECORD_SIZE];
+  MetaRectangle tile_rect;
+
+  memset (record, 0, sizeof (record));
+
+  record[RECORD_XWINDOW] = window->xwindow;
+
+  /* A window on no workspace yet gets one the usual way next time,
+   * rather than being put on all of them
+   */
+  if (window->on_all_workspaces_requested)
+    record[RECORD_WORKSPACE] = 0xFFFFFFFF;
+  else if (window->workspace == NULL)
+    record[RECORD_FLAGS] |= FLAG_NO_WORKSPACE;
+  else
+    record[RECORD_WORKSPACE] = meta_workspace_index (window->workspace);
+
+  record[RECORD_USER_TIME] = window->net_wm_user_time;
+  record[RECORD_WIDTH] = window->rect.width;
+  record[RECORD_HEIGHT] = window->rect.height;
+
+  /* Cast through guint32 so that negative coordinates survive the
+   * trip through a 32 bit property on 64 bit systems.
+   */
+  record[RECORD_SAVED_X] = (guint32) window->saved_rect.x;
+  record[RECORD_SAVED_Y] = (guint32) window->saved_rect.y;
+  record[RECORD_SAVED_WIDTH] = window->saved_rect.width;
+  record[RECORD_SAVED_HEIGHT] = window->saved_rect.height;
+
+  if (window->tile_type != META_WINDOW_TILE_TYPE_NONE)
+    {
+      record[RECORD_FLAGS] |= FLAG_TILED;
+      if (window->custom_snap_size)
+        record[RECORD_FLAGS] |= FLAG_CUSTOM_SNAP_SIZE;
+
+      meta_window_get_outer_rect (window, &tile_rect);
+      record[RECORD_TILE_MODE] = window->tile_mode;
+      record[RECORD_TILE_TYPE] = window->tile_type;
+      record[RECORD_TILE_MONITOR] = window->tile_monitor_number;
+      record[RECORD_TILE_X] = (guint32) tile_rect.x;
+      record[RECORD_TILE_Y] = (guint32) tile_rect.y;
+      record[RECORD_TILE_WIDTH] = tile_rect.width;
+      record[RECORD_TILE_HEIGHT] = tile_rect.height;
+    }
+
+  g_array_append_vals (data, record, RECORD_SIZE);
+
+  meta_topic (META_DEBUG_STARTUP,
+              "Saved restart state of %s at stack position %d\n",
+              window->desc, stack_position);
+}
+
+/**
+ * meta_restart_state_save: (skip)
+ * @screen: the screen being unmanaged
+ *
+ * Must be called before the windows are unmanaged.
+ */
+LOCAL_SYMBOL void
+meta_restart_state_save (MetaScreen *screen)
+{
+  MetaDisplay *display = screen->display;
+  GArray *data;
+  GList *stacked, *l;
+  gulong value;
+  long max_request;
+  int n_windows;
+
+  data = g_array_new (FALSE, FALSE, sizeof (gulong));
+
+  value = RESTART_STATE_MAGIC;
+  g_array_append_val (data, value);
+  value = RESTART_STATE_VERSION;
+  g_array_append_val (data, value);
+  value = screen->number;
+  g_array_append_val (data, value);
+  value = 0; /* number of windows, filled in below */
+  g_array_append_val (data, value);
+  value = g_list_length (screen->workspaces);
+  g_array_append_val (data, value);
+
+  n_windows = 0;
+  stacked = meta_stack_get_positions (screen->stack);
+  for (l = stacked; l != NULL; l = l->next)
+    {
+      MetaWindow *window = l->data;
+
+      if (window->unmanaging)
+        continue;
+
+      append_window (data, window, n_windows);
+      n_windows += 1;
+    }
+  g_list_free (stacked);
+
+  g_array_index (data, gulong, 3) = n_windows;
+
+  for (l = screen->workspaces; l != NULL; l = l->next)
+    {
+      MetaWorkspace *workspace = l->data;
+      GList *m;
+
+      value = g_list_length (workspace->mru_list);
+      g_array_append_val (data, value);
+
+      for (m = workspace->mru_list; m != NULL; m = m->next)
+        {
+          value = ((MetaWindow *) m->data)->xwindow;
+          g_array_append_val (data, value);
+        }
+    }
+
+  /* Leave a little room for the rest of the request */
+  max_request = XExtendedMaxRequestSize (display->xdisplay);
+  if (max_request == 0)
+    max_request = XMaxRequestSize (display->xdisplay);
+
+  if ((long) data->len > max_request - 16)
+    {
+      meta_verbose ("Restart state of %d windows is too large to save\n",
+                    n_windows);
+      g_array_free (data, TRUE);
+      return;
+    }
+
+  meta_error_trap_push (display);
+  XChangeProperty (display->xdisplay, screen->xroot,
+                   display->atom__MUFFIN_RESTART_STATE,
+                   XA_CARDINAL, 32, PropModeReplace,
+                   (guchar *) data->data, data->len);
+  meta_error_trap_pop (display);
+
+  meta_verbose ("Saved restart state of %d windows on screen %d\n",
+                n_windows, screen->number);
+
+  g_array_free (data, TRUE);
+}
+
+static void
+restart_state_free (MetaRestartState *state)
+{
+  g_hash_table_destroy (state->windows);
+  g_hash_table_destroy (state->unvalidated);
+  g_ptr_array_free (state->mru_lists, TRUE);
+  g_free (state);
+}
+
+static MetaRestartState *
+parse_state (MetaScreen   *screen,
+             const gulong *data,
+             int           n_items)
+{
+  MetaRestartState *state;
+  int n_windows, n_workspaces;
+  int i, pos;
+
+  if (n_items < HEADER_SIZE ||
+      data[0] != RESTART_STATE_MAGIC ||
+      data[1] != RESTART_STATE_VERSION ||
+      data[2] != (gulong) screen->number)
+    return NULL;
+
+  n_windows = data[3];
+  n_workspaces = data[4];
+
+  if (n_windows < 0 || n_workspaces < 0 ||
+      n_windows > (n_items - HEADER_SIZE) / RECORD_SIZE)
+    return NULL;
+
+  state = g_new0 (MetaRestartState, 1);
+  state->windows = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  state->unvalidated = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  state->mru_lists =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) g_array_unref);
+
+  pos = HEADER_SIZE;
+  for (i = 0; i < n_windows; i++, pos += RECORD_SIZE)
+    {
+      const gulong *record = data + pos;
+      MetaRestartWindowInfo *info;
+
+      info = g_new0 (MetaRestartWindowInfo, 1);
+      info->xwindow = record[RECORD_XWINDOW];
+      info->has_workspace =
+        (record[RECORD_FLAGS] & FLAG_NO_WORKSPACE) == 0;
+      info->workspace = (int) record[RECORD_WORKSPACE];
+      info->user_time = record[RECORD_USER_TIME];
+      info->width = record[RECORD_WIDTH];
+      info->height = record[RECORD_HEIGHT];
+      info->saved_rect.x = (gint32) record[RECORD_SAVED_X];
+      info->saved_rect.y = (gint32) record[RECORD_SAVED_Y];
+      info->saved_rect.width = record[RECORD_SAVED_WIDTH];
+      info->saved_rect.height = record[RECORD_SAVED_HEIGHT];
+      info->tiled = (record[RECORD_FLAGS] & FLAG_TILED) != 0;
+      info->custom_snap_size =
+        (record[RECORD_FLAGS] & FLAG_CUSTOM_SNAP_SIZE) != 0;
+      info->tile_mode = record[RECORD_TILE_MODE];
+      info->tile_type = record[RECORD_TILE_TYPE];
+      info->tile_monitor_number = record[RECORD_TILE_MONITOR];
+      info->tile_rect.x = (gint32) record[RECORD_TILE_X];
+      info->tile_rect.y = (gint32) record[RECORD_TILE_Y];
+      info->tile_rect.width = record[RECORD_TILE_WIDTH];
+      info->tile_rect.height = record[RECORD_TILE_HEIGHT];
+      info->stack_position = i;
+
+      g_hash_table_replace (state->unvalidated,
+                            GUINT_TO_POINTER (info->xwindow), info);
+    }
+
+  for (i = 0; i < n_workspaces; i++)
+    {
+      GArray *mru;
+      int n;
+
+      if (pos >= n_items)
+        goto bad;
+
+      n = data[pos++];
+      if (n < 0 || n > n_items - pos)
+        goto bad;
+
+      mru = g_array_sized_new (FALSE, FALSE, sizeof (Window), n);
+      for (; n > 0; n--)
+        {
+          Window xwindow = data[pos++];
+          g_array_append_val (mru, xwindow);
+        }
+      g_ptr_array_add (state->mru_lists, mru);
+    }
+
+  if (pos != n_items)
+    goto bad;
+
+  return state;
+
+ bad:
+  restart_state_free (state);
+  return NULL;
+}
+
+/**
+ * meta_restart_state_load: (skip)
+ * @screen: the screen about to be adopted
+ *
+ * Returns: (transfer full): the state, or %NULL
+ */
+LOCAL_SYMBOL MetaRestartState *
+meta_restart_state_load (MetaScreen *screen)
+{
+  MetaDisplay *display = screen->display;
+  MetaRestartState *state;
+  gulong *data;
+  int n_items;
+
+  if (!meta_prop_get_cardinal_list (display, screen->xroot,
+                                    display->atom__MUFFIN_RESTART_STATE,
+                                    &data, &n_items))
+    return NULL;
+
+  /* Whatever happens, nobody else gets to use it */
+  meta_error_trap_push (display);
+  XDeleteProperty (display->xdisplay, screen->xroot,
+                   display->atom__MUFFIN_RESTART_STATE);
+  meta_error_trap_pop (display);
+
+  state = parse_state (screen, data, n_items);
+  meta_XFree (data);
+
+  if (state == NULL)
+    meta_warning ("Ignoring malformed restart state on screen %d\n",
+                  screen->number);
+  else
+    meta_verbose ("Loaded restart state of %u windows on screen %d\n",
+                  g_hash_table_size (state->unvalidated), screen->number);
+
+  return state;
+}
+
+/**
+ * meta_restart_state_validate: (skip)
+ * @state: the loaded state, or %NULL
+ * @xwindow: a window about to be adopted
+ * @attrs: its attributes
+ *
+ * The property outlives the instance that wrote it, so something
+ * may have changed in between; a window whose size changed is
+ * treated as a stranger.
+ */
+LOCAL_SYMBOL void
+meta_restart_state_validate (MetaRestartState        *state,
+                             Window                   xwindow,
+                             const XWindowAttributes *attrs)
+{
+  MetaRestartWindowInfo *info;
+
+  if (state == NULL)
+    return;
+
+  info = g_hash_table_lookup (state->unvalidated, GUINT_TO_POINTER (xwindow));
+  if (info == NULL)
+    return;
+
+  g_hash_table_steal (state->unvalidated, GUINT_TO_POINTER (xwindow));
+
+  if (info->width != attrs->width || info->height != attrs->height)
+    {
+      meta_topic (META_DEBUG_STARTUP,
+                  "Restart state of 0x%lx is for a %dx%d window, not %dx%d\n",
+                  xwindow, info->width, info->height,
+                  attrs->width, attrs->height);
+      g_free (info);
+      return;
+    }
+
+  g_hash_table_replace (state->windows, GUINT_TO_POINTER (xwindow), info);
+}
+
+/**
+ * meta_restart_state_lookup: (skip)
+ * @screen: the screen the window is on
+ * @xwindow: the client window
+ *
+ * Returns: (transfer none): the saved state of @xwindow, or %NULL
+ */
+LOCAL_SYMBOL const MetaRestartWindowInfo *
+meta_restart_state_lookup (MetaScreen *screen,
+                           Window      xwindow)
+{
+  if (screen->restart_state == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (screen->restart_state->windows,
+                              GUINT_TO_POINTER (xwindow));
+}
+
+static gint
+compare_rank (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+  GHashTable *ranks = user_data;
+
+  return GPOINTER_TO_INT (g_hash_table_lookup (ranks, a)) -
+         GPOINTER_TO_INT (g_hash_table_lookup (ranks, b));
+}
+
+/* Sorts the windows that have a rank among themselves, leaving the
+ * others where they are. Ranks are stored plus one, so that a lookup
+ * returning NULL means "no rank".
+ */
+static void
+reorder_ranked_windows (GList      *windows,
+                        GHashTable *ranks)
+{
+  GList *ranked, *l, *r;
+
+  ranked = NULL;
+  for (l = windows; l != NULL; l = l->next)
+    if (g_hash_table_lookup (ranks, l->data))
+      ranked = g_list_prepend (ranked, l->data);
+
+  ranked = g_list_sort_with_data (ranked, compare_rank, ranks);
+
+  r = ranked;
+  for (l = windows; l != NULL; l = l->next)
+    if (g_hash_table_lookup (ranks, l->data))
+      {
+        l->data = r->data;
+        r = r->next;
+      }
+
+  g_list_free (ranked);
+}
+
+static void
+restore_stacking (MetaRestartState *state,
+                  MetaScreen       *screen)
+{
+  GHashTable *ranks;
+  GHashTableIter iter;
+  MetaRestartWindowInfo *info;
+  GList *stacked;
+
+  ranks = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&iter, state->windows);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info))
+    {
+      MetaWindow *window;
+
+      window = meta_display_lookup_x_window (screen->display, info->xwindow);
+      if (window != NULL && window->screen == screen)
+        g_hash_table_insert (ranks, window,
+                             GINT_TO_POINTER (info->stack_position + 1));
+    }
+
+  if (g_hash_table_size (ranks) > 0)
+    {
+      stacked = meta_stack_get_positions (screen->stack);
+      reorder_ranked_windows (stacked, ranks);
+      meta_stack_set_positions (screen->stack, stacked);
+      g_list_free (stacked);
+    }
+
+  g_hash_table_destroy (ranks);
+}
+
+static void
+restore_mru_lists (MetaRestartState *state,
+                   MetaScreen       *screen)
+{
+  GHashTable *ranks;
+  GList *l;
+  guint i, j;
+
+  ranks = g_hash_table_new (NULL, NULL);
+
+  for (l = screen->workspaces, i = 0;
+       l != NULL && i < state->mru_lists->len;
+       l = l->next, i++)
+    {
+      MetaWorkspace *workspace = l->data;
+      GArray *mru = g_ptr_array_index (state->mru_lists, i);
+
+      g_hash_table_remove_all (ranks);
+
+      for (j = 0; j < mru->len; j++)
+        {
+          Window xwindow = g_array_index (mru, Window, j);
+          MetaWindow *window;
+
+          if (!g_hash_table_lookup (state->windows, GUINT_TO_POINTER (xwindow)))
+            continue;
+
+          window = meta_display_lookup_x_window (screen->display, xwindow);
+          if (window != NULL)
+            g_hash_table_insert (ranks, window, GINT_TO_POINTER (j + 1));
+        }
+
+      reorder_ranked_windows (workspace->mru_list, ranks);
+    }
+
+  g_hash_table_destroy (ranks);
+}
+
+/**
+ * meta_restart_state_finish: (skip)
+ * @state: (transfer full): the loaded state
+ * @screen: the screen that was adopted
+ */
+LOCAL_SYMBOL void
+meta_restart_state_finish (MetaRestartState *state,
+                           MetaScreen       *screen)
+{
+  meta_verbose ("Restoring stacking and MRU order of %u windows\n",
+                g_hash_table_size (state->windows));
+
+  restore_stacking (state, screen);
+  restore_mru_lists (state, screen);
+
+  restart_state_free (state);
+}
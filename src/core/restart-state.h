@@ -0,0 +1,118 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/**
+ * \file restart-state.h  Window state handed from one muffin to the next
+ *
+ * When a screen is unmanaged (muffin exiting or being replaced), the
+ * state that the X server doesn't keep for us -- saved rectangles,
+ * tiling, stacking and MRU order, user times -- is written to the
+ * _MUFFIN_RESTART_STATE property on the root window. The next instance
+ * reads and deletes it before adopting the existing windows, and uses
+ * it instead of reconstructing that state from scratch.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_RESTART_STATE_H
+#define META_RESTART_STATE_H
+
+#include <X11/Xlib.h>
+#include <meta/types.h>
+#include <meta/boxes.h>
+
+typedef struct _MetaRestartState MetaRestartState;
+typedef struct _MetaRestartWindowInfo MetaRestartWindowInfo;
+
+struct _MetaRestartWindowInfo
+{
+  Window xwindow;
+
+  /* Index of the workspace, or 0xFFFFFFFF for all of them; only
+   * meaningful if has_workspace is set
+   */
+  guint has_workspace : 1;
+  int workspace;
+  guint32 user_time;
+
+  /* Size of the client window, to check it is still the same window */
+  int width;
+  int height;
+
+  MetaRectangle saved_rect;
+
+  /* Same meaning as _NET_WM_WINDOW_TILE_INFO */
+  guint tiled : 1;
+  guint custom_snap_size : 1;
+  guint tile_mode;
+  guint tile_type;
+  int tile_monitor_number;
+  MetaRectangle tile_rect;
+
+  /* Position in the old stack, bottom first */
+  int stack_position;
+};
+
+/**
+ * Writes the state of the windows on a screen to the root window, to
+ * be picked up by whoever manages the screen next.
+ *
+ * \param screen  The screen being unmanaged
+ */
+void meta_restart_state_save (MetaScreen *screen);
+
+/**
+ * Reads and deletes the state left by the previous window manager.
+ *
+ * \param screen  The screen about to be adopted
+ * \return  The state, or NULL if there is none or it is not usable
+ */
+MetaRestartState *meta_restart_state_load (MetaScreen *screen);
+
+/**
+ * Keeps the saved state of a window only if it still looks like the
+ * window that was saved. Windows that aren't validated are ignored.
+ *
+ * \param state    The loaded state, or NULL
+ * \param xwindow  A window about to be adopted
+ * \param attrs    Its attributes
+ */
+void meta_restart_state_validate (MetaRestartState        *state,
+                                  Window                   xwindow,
+                                  const XWindowAttributes *attrs);
+
+/**
+ * Finds the saved state of a window being adopted.
+ *
+ * \param screen   The screen the window is on
+ * \param xwindow  The client window
+ * \return  The saved state, or NULL
+ */
+const MetaRestartWindowInfo *meta_restart_state_lookup (MetaScreen *screen,
+                                                        Window      xwindow);
+
+/**
+ * Restores the stacking and MRU order once all windows have been
+ * adopted, and frees the state.
+ *
+ * \param state   The loaded state
+ * \param screen  The screen that was adopted
+ */
+void meta_restart_state_finish (MetaRestartState *state,
+                                MetaScreen       *screen);
+
+#endif
@@ -0,0 +1,385 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin round trip accounting */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "roundtrips.h"
+#include <meta/util.h>
+#include <string.h>
+
+/* Scopes nest, and a round trip counts against every operation that
+ * is open when it happens, so the figures for an operation include
+ * whatever it called; an operation that is open twice (recursion)
+ * only counts it once. Round trips made outside any operation are
+ * collected under a pseudo-operation so the total stays honest.
+ */
+
+#define NO_OPERATION "(no operation)"
+
+typedef struct
+{
+  const char *operation;
+  guint calls;
+  guint roundtrips[META_ROUNDTRIP_N_SOURCES];
+  gint64 total_time;
+  gint64 max_time;
+} OperationStats;
+
+typedef struct
+{
+  OperationStats *stats;
+  gint64 start_time;
+} OpenScope;
+
+static const char * const source_names[META_ROUNDTRIP_N_SOURCES] = {
+  "sync",
+  "property",
+  "attributes",
+  "geometry",
+  "pointer",
+  "timestamp",
+  "error-trap",
+  "other"
+};
+
+static int enabled = -1;
+static GHashTable *operations = NULL;
+static GArray *open_scopes = NULL;
+
+static gboolean
+roundtrips_enabled (void)
+{
+  if (G_LIKELY (enabled >= 0))
+    return enabled;
+
+  enabled = g_getenv ("MUFFIN_DEBUG_ROUNDTRIPS") != NULL;
+  if (enabled)
+    {
+      operations = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          NULL, g_free);
+      open_scopes = g_array_new (FALSE, FALSE, sizeof (OpenScope));
+    }
+
+  return enabled;
+}
+
+static OperationStats *
+get_stats (const char *operation)
+{
+  OperationStats *stats;
+
+  stats = g_hash_table_lookup (operations, operation);
+  if (stats == NULL)
+    {
+      stats = g_new0 (OperationStats, 1);
+      stats->operation = operation;
+      g_hash_table_insert (operations, (char *) operation, stats);
+    }
+
+  return stats;
+}
+
+/**
+ * meta_roundtrip_scope_begin: (skip)
+ * @operation: a static string naming the operation, usually %G_STRFUNC
+ *
+ * Starts attributing round trips to @operation.
+ */
+LOCAL_SYMBOL void
+meta_roundtrip_scope_begin (const char *operation)
+{
+  OpenScope scope;
+
+  if (!roundtrips_enabled ())
+    return;
+
+  scope.stats = get_stats (operation);
+  scope.stats->calls += 1;
+  scope.start_time = g_get_monotonic_time ();
+
+  g_array_append_val (open_scopes, scope);
+}
+
+/**
+ * meta_roundtrip_scope_end: (skip)
+ * @operation: the string passed to meta_roundtrip_scope_begin()
+ *
+ * Ends the innermost operation, which must be @operation.
+ */
+LOCAL_SYMBOL void
+meta_roundtrip_scope_end (const char *operation)
+{
+  OpenScope *scope;
+  gint64 elapsed;
+
+  if (!roundtrips_enabled ())
+    return;
+
+  g_return_if_fail (open_scopes->len > 0);
+
+  scope = &g_array_index (open_scopes, OpenScope, open_scopes->len - 1);
+  if (strcmp (scope->stats->operation, operation) != 0)
+    meta_bug ("Round trip scope %s ended while %s was open\n",
+              operation, scope->stats->operation);
+
+  elapsed = g_get_monotonic_time () - scope->start_time;
+  scope->stats->total_time += elapsed;
+  scope->stats->max_time = MAX (scope->stats->max_time, elapsed);
+
+  g_array_set_size (open_scopes, open_scopes->len - 1);
+}
+
+/**
+ * meta_roundtrip_note: (skip)
+ * @source: the kind of call that blocked on the server
+ *
+ * Records one round trip against every open operation.
+ */
+LOCAL_SYMBOL void
+meta_roundtrip_note (MetaRoundtripSource source)
+{
+  guint i, j;
+
+  if (!roundtrips_enabled ())
+    return;
+
+  if (open_scopes->len == 0)
+    {
+      get_stats (NO_OPERATION)->roundtrips[source] += 1;
+      return;
+    }
+
+  for (i = 0; i < open_scopes->len; i++)
+    {
+      OperationStats *stats;
+
+      stats = g_array_index (open_scopes, OpenScope, i).stats;
+
+      for (j = 0; j < i; j++)
+        if (g_array_index (open_scopes, OpenScope, j).stats == stats)
+          break;
+
+      if (j == i)
+        stats->roundtrips[source] += 1;
+    }
+}
+
+static guint
+total_roundtrips (const OperationStats *stats)
+{
+  guint total = 0;
+  int i;
+
+  for (i = 0; i < META_ROUNDTRIP_N_SOURCES; i++)
+    total += stats->roundtrips[i];
+
+  return total;
+}
+
+static gint
+compare_stats (gconstpointer a,
+               gconstpointer b)
+{
+  guint total_a = total_roundtrips (a);
+  guint total_b = total_roundtrips (b);
+
+  if (total_a != total_b)
+    return total_a > total_b ? -1 : 1;
+
+  return strcmp (((const OperationStats *) a)->operation,
+                 ((const OperationStats *) b)->operation);
+}
+
+/**
+ * meta_roundtrip_report: (skip)
+ *
+ * Logs, for each operation seen, how often it ran, how many round
+ * trips it made of each kind and how long it took, most expensive
+ * first. If MUFFIN_ROUNDTRIP_REPORT names a file, the same figures are
+ * also written there, one operation per line and tab separated, for
+ * run-roundtrips.sh in wm-tester to check.
+ */
+LOCAL_SYMBOL void
+meta_roundtrip_report (void)
+{
+  GList *all, *l;
+  const char *report_file;
+  GString *report;
+  GError *error = NULL;
+  int i;
+
+  if (!roundtrips_enabled ())
+    return;
+
+  all = g_list_sort (g_hash_table_get_values (operations), compare_stats);
+
+  report = g_string_new ("# operation\tcalls\troundtrips");
+  for (i = 0; i < META_ROUNDTRIP_N_SOURCES; i++)
+    g_string_append_printf (report, "\t%s", source_names[i]);
+  g_string_append (report, "\ttotal_ms\tmax_ms\n");
+
+  meta_topic (META_DEBUG_SYNC, "Round trips per operation:\n");
+
+  for (l = all; l; l = l->next)
+    {
+      OperationStats *stats = l->data;
+      GString *detail;
+      char total_ms[G_ASCII_DTOSTR_BUF_SIZE];
+      char max_ms[G_ASCII_DTOSTR_BUF_SIZE];
+
+      detail = g_string_new (NULL);
+      for (i = 0; i < META_ROUNDTRIP_N_SOURCES; i++)
+        if (stats->roundtrips[i] > 0)
+          g_string_append_printf (detail, " %s=%u",
+                                  source_names[i], stats->roundtrips[i]);
+
+      meta_topic (META_DEBUG_SYNC,
+                  "  %s: %u call(s), %u round trip(s)%s, "
+                  "%.3f ms total, %.3f ms max\n",
+                  stats->operation, stats->calls,
+                  total_roundtrips (stats), detail->str,
+                  stats->total_time / 1000.0, stats->max_time / 1000.0);
+
+      g_string_free (detail, TRUE);
+
+      g_string_append_printf (report, "%s\t%u\t%u", stats->operation,
+                              stats->calls, total_roundtrips (stats));
+      for (i = 0; i < META_ROUNDTRIP_N_SOURCES; i++)
+        g_string_append_printf (report, "\t%u", stats->roundtrips[i]);
+      g_string_append_printf (report, "\t%s\t%s\n",
+                              g_ascii_formatd (total_ms, sizeof (total_ms),
+                                               "%.3f",
+                                               stats->total_time / 1000.0),
+                              g_ascii_formatd (max_ms, sizeof (max_ms),
+                                               "%.3f",
+                                               stats->max_time / 1000.0));
+    }
+
+  g_list_free (all);
+
+  report_file = g_getenv ("MUFFIN_ROUNDTRIP_REPORT");
+  if (report_file &&
+      !g_file_set_contents (report_file, report->str, report->len, &error))
+    {
+      meta_warning ("Could not write the round trip report: %s\n",
+                    error->message);
+      g_error_free (error);
+    }
+
+  g_string_free (report, TRUE);
+}
+
+/* Startup phases. The report goes out when the first paint phase
+ * ends, which is the last thing that happens during startup.
+ */
+typedef struct
+{
+  const char *phase;
+  gint64 start_time;
+  gint64 end_time;
+} StartupPhase;
+
+static GArray *startup_phases = NULL;
+static gboolean startup_reported = FALSE;
+
+static void
+startup_report (void)
+{
+  StartupPhase *first;
+  guint i;
+
+  first = &g_array_index (startup_phases, StartupPhase, 0);
+
+  meta_topic (META_DEBUG_STARTUP, "Startup phases:\n");
+
+  for (i = 0; i < startup_phases->len; i++)
+    {
+      StartupPhase *p = &g_array_index (startup_phases, StartupPhase, i);
+
+      if (p->end_time == 0)
+        continue;
+
+      meta_topic (META_DEBUG_STARTUP,
+                  "  %-16s %8.1f ms (at %.1f ms)\n",
+                  p->phase,
+                  (p->end_time - p->start_time) / 1000.0,
+                  (p->start_time - first->start_time) / 1000.0);
+    }
+}
+
+/**
+ * meta_startup_phase_begin: (skip)
+ * @phase: a static string naming the phase
+ *
+ * Marks the start of a startup phase. Does nothing once startup is
+ * over.
+ */
+LOCAL_SYMBOL void
+meta_startup_phase_begin (const char *phase)
+{
+  StartupPhase p;
+
+  if (startup_reported)
+    return;
+
+  if (startup_phases == NULL)
+    startup_phases = g_array_new (FALSE, FALSE, sizeof (StartupPhase));
+
+  p.phase = phase;
+  p.start_time = g_get_monotonic_time ();
+  p.end_time = 0;
+
+  g_array_append_val (startup_phases, p);
+}
+
+/**
+ * meta_startup_phase_end: (skip)
+ * @phase: the string passed to meta_startup_phase_begin()
+ *
+ * Marks the end of a startup phase; ending
+ * %META_STARTUP_PHASE_FIRST_PAINT logs the report.
+ */
+LOCAL_SYMBOL void
+meta_startup_phase_end (const char *phase)
+{
+  guint i;
+
+  if (startup_reported || startup_phases == NULL)
+    return;
+
+  for (i = startup_phases->len; i > 0; i--)
+    {
+      StartupPhase *p = &g_array_index (startup_phases, StartupPhase, i - 1);
+
+      if (p->end_time == 0 && strcmp (p->phase, phase) == 0)
+        {
+          p->end_time = g_get_monotonic_time ();
+          break;
+        }
+    }
+
+  if (strcmp (phase, META_STARTUP_PHASE_FIRST_PAINT) == 0)
+    {
+      startup_report ();
+      startup_reported = TRUE;
+      g_array_free (startup_phases, TRUE);
+      startup_phases = NULL;
+    }
+}
@@ -0,0 +1,68 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/**
+ * \file roundtrips.h  Attribute blocking X calls to window manager operations
+ *
+ * Operations like managing a window or starting a grab are bracketed
+ * with meta_roundtrip_scope_begin() and meta_roundtrip_scope_end();
+ * every call that waits on the X server notes itself with
+ * meta_roundtrip_note(). Counts and wall time are kept per operation
+ * and logged by meta_roundtrip_report().
+ *
+ * Nothing is recorded unless MUFFIN_DEBUG_ROUNDTRIPS is set in the
+ * environment. MUFFIN_ROUNDTRIP_REPORT can name a file to write the
+ * report to as well; src/wm-tester/run-roundtrips.sh uses that to run
+ * muffin under Xvfb and check the figures.
+ *
+ * The startup phases (prefs, theme, key grabs, adopting windows, first
+ * paint) are always timed, and logged under the startup topic once
+ * the first frame has been painted.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_ROUNDTRIPS_H
+#define META_ROUNDTRIPS_H
+
+#include <glib.h>
+
+typedef enum
+{
+  META_ROUNDTRIP_SYNC,
+  META_ROUNDTRIP_GET_PROPERTY,
+  META_ROUNDTRIP_GET_ATTRIBUTES,
+  META_ROUNDTRIP_GET_GEOMETRY,
+  META_ROUNDTRIP_QUERY_POINTER,
+  META_ROUNDTRIP_TIMESTAMP,
+  META_ROUNDTRIP_ERROR_TRAP,
+  META_ROUNDTRIP_OTHER,
+
+  META_ROUNDTRIP_N_SOURCES
+} MetaRoundtripSource;
+
+void meta_roundtrip_scope_begin (const char          *operation);
+void meta_roundtrip_scope_end   (const char          *operation);
+void meta_roundtrip_note        (MetaRoundtripSource  source);
+void meta_roundtrip_report      (void);
+
+#define META_STARTUP_PHASE_FIRST_PAINT "first paint"
+
+void meta_startup_phase_begin   (const char          *phase);
+void meta_startup_phase_end     (const char          *phase);
+
+#endif
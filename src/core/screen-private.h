@@ -37,6 +37,7 @@
 #include <meta/screen.h>
 #include <X11/Xutil.h>
 #include "stack-tracker.h"
+#include "restart-state.h"
 #include "ui.h"
 
 typedef struct _MetaMonitorInfo MetaMonitorInfo;
@@ -128,6 +129,7 @@ struct _MetaScreen
   
   guint keys_grabbed : 1;
   guint all_keys_grabbed : 1;
+  GHashTable *key_grabs; /* passive grabs held on xroot */
   
   int closing;
 
@@ -138,6 +140,9 @@ struct _MetaScreen
    * and restack them below a guard window. When using a compositor
    * this allows us to provide live previews of unmapped windows */
   Window guard_window;
+
+  /* State left by the previous window manager, while adopting */
+  MetaRestartState *restart_state;
 };
 
 struct _MetaScreenClass
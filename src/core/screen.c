@@ -42,6 +42,8 @@
 #include "keybindings-private.h"
 #include "stack.h"
 #include "xprops.h"
+#include "window-props.h"
+#include "roundtrips.h"
 #include <meta/compositor.h>
 #include "muffin-enum-types.h"
 
@@ -861,6 +863,7 @@ meta_screen_new (MetaDisplay *display,
   /* We need to or with the existing event mask since
    * gtk+ may be interested in other events.
    */
+  meta_roundtrip_note (META_ROUNDTRIP_GET_ATTRIBUTES);
   XGetWindowAttributes (xdisplay, xroot, &attr);
   XSelectInput (xdisplay,
                 xroot,
@@ -963,7 +966,10 @@ meta_screen_new (MetaDisplay *display,
 
   screen->all_keys_grabbed = FALSE;
   screen->keys_grabbed = FALSE;
+  screen->key_grabs = NULL;
+  meta_startup_phase_begin ("key grabs");
   meta_screen_grab_keys (screen);
+  meta_startup_phase_end ("key grabs");
 
   screen->ui = meta_ui_new (screen->display->xdisplay,
                             screen->xscreen);
@@ -1021,8 +1027,12 @@ meta_screen_free (MetaScreen *screen,
   
   meta_display_grab (display);
 
+  /* Before unmanaging windows throws their state away */
+  meta_restart_state_save (screen);
+
   if (screen->display->compositor)
     {
+      meta_ui_set_frames_composited (screen->ui, FALSE);
       meta_compositor_unmanage_screen (screen->display->compositor,
 				       screen);
     }
@@ -1123,6 +1133,7 @@ list_windows (MetaScreen *screen)
 
       meta_error_trap_push_with_return (screen->display);
       
+      meta_roundtrip_note (META_ROUNDTRIP_GET_ATTRIBUTES);
       XGetWindowAttributes (screen->display->xdisplay,
                             children[i], &info->attrs);
 
@@ -1135,9 +1146,8 @@ list_windows (MetaScreen *screen)
       else
         {
 	  info->xwindow = children[i];
+          result = g_list_prepend (result, info);
 	}
-
-      result = g_list_prepend (result, info);
     }
 
   if (children)
@@ -1152,6 +1162,7 @@ meta_screen_manage_all_windows (MetaScreen *screen)
   GList *windows;
   GList *list;
 
+  meta_roundtrip_scope_begin (G_STRFUNC);
   meta_display_grab (screen->display);
 
   if (screen->guard_window == None)
@@ -1160,6 +1171,24 @@ meta_screen_manage_all_windows (MetaScreen *screen)
 
   windows = list_windows (screen);
 
+  screen->restart_state = meta_restart_state_load (screen);
+
+  /* Ask for the properties of every window before managing any of
+   * them, so that the first round trip brings in all the replies
+   * instead of each window paying for its own.
+   */
+  for (list = windows; list != NULL; list = list->next)
+    {
+      WindowInfo *info = list->data;
+
+      if (info->attrs.class != InputOnly)
+        meta_window_prefetch_properties (screen->display, info->xwindow,
+                                         info->attrs.override_redirect);
+
+      meta_restart_state_validate (screen->restart_state,
+                                   info->xwindow, &info->attrs);
+    }
+
   meta_stack_freeze (screen->stack);
   for (list = windows; list != NULL; list = list->next)
     {
@@ -1168,13 +1197,23 @@ meta_screen_manage_all_windows (MetaScreen *screen)
       meta_window_new_with_attrs (screen->display, info->xwindow, TRUE,
                                   META_COMP_EFFECT_NONE,
                                   &info->attrs);
+
+      /* Left over if the window wasn't managed */
+      meta_prop_prefetch_clear (screen->display, info->xwindow);
     }
   meta_stack_thaw (screen->stack);
 
+  if (screen->restart_state != NULL)
+    {
+      meta_restart_state_finish (screen->restart_state, screen);
+      screen->restart_state = NULL;
+    }
+
   g_list_foreach (windows, (GFunc)g_free, NULL);
   g_list_free (windows);
 
   meta_display_ungrab (screen->display);
+  meta_roundtrip_scope_end (G_STRFUNC);
 }
 
 LOCAL_SYMBOL void
@@ -1233,9 +1272,14 @@ prefs_changed_callback (MetaPreference pref,
 {
   MetaScreen *screen = data;
   
-  if ((pref == META_PREF_NUM_WORKSPACES ||
-       pref == META_PREF_DYNAMIC_WORKSPACES) &&
-      !meta_prefs_get_dynamic_workspaces ())
+  if (pref == META_PREF_DYNAMIC_WORKSPACES &&
+      meta_prefs_changed_in_batch (META_PREF_NUM_WORKSPACES))
+    {
+      /* handled once, when META_PREF_NUM_WORKSPACES is delivered */
+    }
+  else if ((pref == META_PREF_NUM_WORKSPACES ||
+            pref == META_PREF_DYNAMIC_WORKSPACES) &&
+           !meta_prefs_get_dynamic_workspaces ())
     {
       /* GSettings doesn't provide timestamps, but luckily update_num_workspaces
        * often doesn't need it...
@@ -2060,6 +2104,7 @@ meta_screen_get_mouse_window (MetaScreen  *screen,
                 "Focusing mouse window excluding %s\n", not_this_one->desc);
 
   meta_error_trap_push (screen->display);
+  meta_roundtrip_note (META_ROUNDTRIP_QUERY_POINTER);
   XQueryPointer (screen->display->xdisplay,
                  screen->xroot,
                  &root_return,
@@ -2303,6 +2348,7 @@ meta_screen_get_current_monitor (MetaScreen *screen)
       screen->display->monitor_cache_invalidated = FALSE;
       
       pointer_position.width = pointer_position.height = 1;
+      meta_roundtrip_note (META_ROUNDTRIP_QUERY_POINTER);
       XQueryPointer (screen->display->xdisplay,
                      screen->xroot,
                      &root_return,
@@ -0,0 +1,252 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Checks that asynchronous error traps see real X errors */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/* Needs an X server; run it under Xvfb for an unattended check:
+ *
+ *   xvfb-run ./testasyncerrors
+ *
+ * Each check forces an error (or none) inside an asynchronous trap
+ * and waits for the trap's callback, either by reading events the way
+ * the main loop does, which is how muffin resolves traps, or with a
+ * round trip.
+ */
+
+#include <config.h>
+#include "async-errors.h"
+
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NOT_CALLED -1
+
+static int n_failures = 0;
+static int n_handler_errors = 0;
+static int owner_tag;
+
+/* Stands in for GDK's handler: the hooks must not swallow anything */
+static int
+x_error_handler (Display     *xdisplay,
+                 XErrorEvent *error)
+{
+  n_handler_errors += 1;
+  return 0;
+}
+
+static void
+record_error (gpointer owner,
+              int      error_code,
+              gpointer user_data)
+{
+  int *result = user_data;
+
+  if (owner != &owner_tag)
+    {
+      fprintf (stderr, "Callback got the wrong owner\n");
+      n_failures += 1;
+    }
+
+  if (*result != NOT_CALLED)
+    {
+      fprintf (stderr, "Callback ran twice\n");
+      n_failures += 1;
+    }
+
+  *result = error_code;
+}
+
+static void
+check (const char *what,
+       int         result,
+       int         expected)
+{
+  if (result == expected)
+    {
+      printf ("ok: %s\n", what);
+    }
+  else
+    {
+      printf ("FAIL: %s: got %d, expected %d\n", what, result, expected);
+      n_failures += 1;
+    }
+}
+
+/* Resolves traps the way the event loop does, without a round trip */
+static void
+wait_without_sync (Display         *xdisplay,
+                   MetaAsyncErrors *errors)
+{
+  gint64 deadline;
+
+  XFlush (xdisplay);
+
+  deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+  while (meta_async_errors_pending (errors) &&
+         g_get_monotonic_time () < deadline)
+    {
+      XEvent xevent;
+
+      while (XPending (xdisplay) > 0)
+        XNextEvent (xdisplay, &xevent);
+
+      meta_async_errors_process (errors);
+      g_usleep (1000);
+    }
+}
+
+static void
+wait_with_sync (Display         *xdisplay,
+                MetaAsyncErrors *errors)
+{
+  XSync (xdisplay, False);
+  meta_async_errors_process (errors);
+}
+
+static Window
+make_dead_window (Display *xdisplay)
+{
+  Window window;
+
+  window = XCreateSimpleWindow (xdisplay, DefaultRootWindow (xdisplay),
+                                0, 0, 1, 1, 0, 0, 0);
+  XDestroyWindow (xdisplay, window);
+  XSync (xdisplay, False);
+
+  return window;
+}
+
+int
+main (int argc, char **argv)
+{
+  Display *xdisplay, *other;
+  MetaAsyncErrors *errors;
+  Window root, live, dead;
+  int min_keycode, max_keycode;
+  int result, inner, outer, cancelled;
+  int expected_handler_errors;
+  guint trap_id;
+
+  xdisplay = XOpenDisplay (NULL);
+  other = XOpenDisplay (NULL);
+  if (xdisplay == NULL || other == NULL)
+    {
+      fprintf (stderr, "Could not open display\n");
+      return 1;
+    }
+
+  XSetErrorHandler (x_error_handler);
+
+  root = DefaultRootWindow (xdisplay);
+  live = XCreateSimpleWindow (xdisplay, root, 0, 0, 1, 1, 0, 0, 0);
+  dead = make_dead_window (xdisplay);
+  expected_handler_errors = 0;
+
+  errors = meta_async_errors_new (xdisplay, &owner_tag);
+
+  /* BadWindow, picked up while reading events */
+  result = NOT_CALLED;
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, dead);
+  meta_async_errors_pop (errors, record_error, &result);
+  expected_handler_errors += 1;
+  check ("pending before the server answered",
+         meta_async_errors_pending (errors), TRUE);
+  wait_without_sync (xdisplay, errors);
+  check ("BadWindow without a round trip", result, BadWindow);
+
+  /* BadWindow, picked up by a round trip */
+  result = NOT_CALLED;
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, dead);
+  meta_async_errors_pop (errors, record_error, &result);
+  expected_handler_errors += 1;
+  wait_with_sync (xdisplay, errors);
+  check ("BadWindow with a round trip", result, BadWindow);
+
+  /* BadAccess, grabbing a key another client already grabbed */
+  XDisplayKeycodes (xdisplay, &min_keycode, &max_keycode);
+  XGrabKey (other, max_keycode, AnyModifier, DefaultRootWindow (other),
+            False, GrabModeAsync, GrabModeAsync);
+  XSync (other, False);
+
+  result = NOT_CALLED;
+  meta_async_errors_push (errors);
+  XGrabKey (xdisplay, max_keycode, AnyModifier, root,
+            False, GrabModeAsync, GrabModeAsync);
+  meta_async_errors_pop (errors, record_error, &result);
+  expected_handler_errors += 1;
+  wait_without_sync (xdisplay, errors);
+  check ("BadAccess from a key grab", result, BadAccess);
+
+  /* No error */
+  result = NOT_CALLED;
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, live);
+  XUnmapWindow (xdisplay, live);
+  meta_async_errors_pop (errors, record_error, &result);
+  wait_with_sync (xdisplay, errors);
+  check ("Success when nothing failed", result, Success);
+
+  /* An error before the trap doesn't leak into it */
+  result = NOT_CALLED;
+  XMapWindow (xdisplay, dead);
+  expected_handler_errors += 1;
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, live);
+  meta_async_errors_pop (errors, record_error, &result);
+  wait_with_sync (xdisplay, errors);
+  check ("Success after an untrapped error", result, Success);
+
+  /* Nested traps both see an error in the inner one */
+  inner = outer = NOT_CALLED;
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, live);
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, dead);
+  meta_async_errors_pop (errors, record_error, &inner);
+  XUnmapWindow (xdisplay, live);
+  meta_async_errors_pop (errors, record_error, &outer);
+  expected_handler_errors += 1;
+  wait_without_sync (xdisplay, errors);
+  check ("BadWindow in the inner trap", inner, BadWindow);
+  check ("BadWindow in the outer trap", outer, BadWindow);
+
+  /* A cancelled trap never calls back */
+  cancelled = NOT_CALLED;
+  meta_async_errors_push (errors);
+  XMapWindow (xdisplay, dead);
+  trap_id = meta_async_errors_pop (errors, record_error, &cancelled);
+  expected_handler_errors += 1;
+  meta_async_errors_cancel (errors, trap_id);
+  wait_with_sync (xdisplay, errors);
+  check ("no callback after cancelling", cancelled, NOT_CALLED);
+
+  check ("errors still reach the error handler",
+         n_handler_errors, expected_handler_errors);
+
+  meta_async_errors_free (errors);
+
+  XDestroyWindow (xdisplay, live);
+  XCloseDisplay (other);
+  XCloseDisplay (xdisplay);
+
+  return n_failures > 0 ? 1 : 0;
+}
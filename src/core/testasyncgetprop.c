@@ -27,6 +27,8 @@
 
 #include "async-getprop.h"
 
+#include <X11/Xatom.h>
+
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -237,8 +239,10 @@ try_get_reply (Display           *xdisplay,
   return False;
 }
 
-static void run_speed_comparison (Display *xdisplay,
-                                  Window   window);
+static void run_speed_comparison     (Display *xdisplay,
+                                      Window   window);
+static void run_throughput_benchmark (Display *xdisplay,
+                                      Window   window);
 
 int
 main (int argc, char **argv)
@@ -358,50 +362,19 @@ main (int argc, char **argv)
     }
 
   run_speed_comparison (xdisplay, window);
+  run_throughput_benchmark (xdisplay, window);
   
   return 0;
 }
 
-/* This function doesn't have all the printf's
- * and other noise, it just compares async to sync
- */
+/* Waits for n_tasks replies, throwing them away */
 static void
-run_speed_comparison (Display *xdisplay,
-                      Window   window)
+drain_completed_tasks (Display *xdisplay,
+                       int      n_tasks)
 {
-  int i;
-  int n_props;
-  struct timeval start, end;
   int n_left;
-  
-  /* We just use atom values (0 to n_props) % 200, many are probably
-   * BadAtom, that's fine, but the %200 keeps most of them valid. The
-   * async case is about twice as advantageous when using valid atoms
-   * (or the issue may be that it's more advantageous when the
-   * properties are present and data is transmitted).
-   */
-  n_props = 4000;
-  printf ("Timing with %d property requests\n", n_props);
-  
-  gettimeofday (&start, NULL);
-  
-  i = 0;
-  while (i < n_props)
-    {
-      if (ag_task_create (xdisplay,
-                          window, (Atom) i % 200,
-                          0, 0xffffffff,
-                          False,
-                          AnyPropertyType) == NULL)
-        {
-          fprintf (stderr, "Failed to send request\n");
-          exit (1);
-        }
-      
-      ++i;
-    }
 
-  n_left = n_props;
+  n_left = n_tasks;
   
   while (TRUE)
     {
@@ -449,6 +422,47 @@ run_speed_comparison (Display *xdisplay,
 
       select (connection + 1, &set, NULL, NULL, NULL);
     }
+}
+
+/* This function doesn't have all the printf's
+ * and other noise, it just compares async to sync
+ */
+static void
+run_speed_comparison (Display *xdisplay,
+                      Window   window)
+{
+  int i;
+  int n_props;
+  struct timeval start, end;
+  
+  /* We just use atom values (0 to n_props) % 200, many are probably
+   * BadAtom, that's fine, but the %200 keeps most of them valid. The
+   * async case is about twice as advantageous when using valid atoms
+   * (or the issue may be that it's more advantageous when the
+   * properties are present and data is transmitted).
+   */
+  n_props = 4000;
+  printf ("Timing with %d property requests\n", n_props);
+  
+  gettimeofday (&start, NULL);
+  
+  i = 0;
+  while (i < n_props)
+    {
+      if (ag_task_create (xdisplay,
+                          window, (Atom) i % 200,
+                          0, 0xffffffff,
+                          False,
+                          AnyPropertyType) == NULL)
+        {
+          fprintf (stderr, "Failed to send request\n");
+          exit (1);
+        }
+      
+      ++i;
+    }
+
+  drain_completed_tasks (xdisplay, n_props);
   
   gettimeofday (&end, NULL);
   
@@ -494,3 +508,60 @@ run_speed_comparison (Display *xdisplay,
   printf ("Sync time:  %gms\n",
           ELAPSED (start, end));
 }
+
+/* Measures how fast replies are matched to tasks when thousands of
+ * them are outstanding at once, as when properties are fetched for
+ * every window at startup. With "interleaved", every request is
+ * followed by one that fails, so the reply handler also sees an
+ * error it has to recognize as not being ours.
+ */
+static void
+run_throughput_benchmark (Display *xdisplay,
+                          Window   window)
+{
+  static const int n_outstanding[] = { 1000, 4000, 16000 };
+  const int n_runs = sizeof (n_outstanding) / sizeof (n_outstanding[0]);
+  int interleaved;
+  int n;
+
+  for (interleaved = FALSE; interleaved <= TRUE; interleaved++)
+    for (n = 0; n < n_runs; n++)
+      {
+        struct timeval start, end;
+        int n_props;
+        int i;
+
+        n_props = n_outstanding[n];
+
+        error_trap_push (xdisplay);
+
+        gettimeofday (&start, NULL);
+
+        for (i = 0; i < n_props; i++)
+          {
+            if (ag_task_create (xdisplay,
+                                window, (Atom) i % 200,
+                                0, 0xffffffff,
+                                False,
+                                AnyPropertyType) == NULL)
+              {
+                fprintf (stderr, "Failed to send request\n");
+                exit (1);
+              }
+
+            if (interleaved)
+              XDeleteProperty (xdisplay, None, XA_WM_NAME); /* BadWindow */
+          }
+
+        drain_completed_tasks (xdisplay, n_props);
+
+        gettimeofday (&end, NULL);
+
+        error_trap_pop (xdisplay);
+
+        printf ("%5d outstanding%s: %gms, %g replies/ms\n",
+                n_props, interleaved ? ", interleaved with errors" : "",
+                ELAPSED (start, end),
+                n_props / ELAPSED (start, end));
+      }
+}
@@ -337,11 +337,16 @@ struct _MetaWindow
   
   /* Are we in the various queues? (Bitfield: see META_WINDOW_IS_IN_QUEUE) */
   guint is_in_queues : NUMBER_OF_QUEUES;
+
+  /* Property changes waiting to be reloaded, see window-props.c */
+  guint property_reload_queued : 1;
+  GArray *prop_notify_states;
  
   /* Used by keybindings.c */
   guint keys_grabbed : 1;     /* normal keybindings grabbed */
   guint grab_on_frame : 1;    /* grabs are on the frame */
   guint all_keys_grabbed : 1; /* AnyKey grabbed */
+  GHashTable *key_grabs;      /* passive grabs held, see keybindings.c */
   
   /* Set if the reason for unmanaging the window is that
    * it was withdrawn
@@ -66,6 +66,11 @@ struct _MetaWindowPropHooks
   ReloadValueFunc reload_func;
   gboolean load_initially;
   gboolean include_override_redirect;
+  /* Notifications are folded into one reload per frame, at most one
+   * every min_interval milliseconds; see meta_window_queue_property_reload()
+   */
+  gboolean coalesce;
+  guint min_interval;
 };
 
 static void init_prop_value            (MetaWindow          *window,
@@ -195,6 +200,46 @@ meta_window_load_initial_properties (MetaWindow *window)
   g_free (values);
 }
 
+/* Besides the properties meta_window_load_initial_properties() reads,
+ * meta_window_new_with_attrs() reads a few on their own.
+ */
+LOCAL_SYMBOL void
+meta_window_prefetch_properties (MetaDisplay *display,
+                                 Window       xwindow,
+                                 gboolean     override_redirect)
+{
+  Atom *atoms;
+  int i, n_atoms;
+
+  atoms = g_new (Atom, display->n_prop_hooks + 5);
+  n_atoms = 0;
+
+  for (i = 0; i < display->n_prop_hooks; i++)
+    {
+      MetaWindowPropHooks *hooks = &display->prop_hooks_table[i];
+
+      if (hooks->load_initially &&
+          hooks->type != META_PROP_VALUE_INVALID &&
+          (!override_redirect || hooks->include_override_redirect))
+        atoms[n_atoms++] = hooks->property;
+    }
+
+  atoms[n_atoms++] = display->atom_WM_STATE;
+  atoms[n_atoms++] = display->atom__NET_WM_WINDOW_TYPE;
+
+  if (!override_redirect)
+    {
+      /* update_sm_hints() and meta_window_update_role() */
+      atoms[n_atoms++] = display->atom_WM_CLIENT_LEADER;
+      atoms[n_atoms++] = display->atom_SM_CLIENT_ID;
+      atoms[n_atoms++] = display->atom_WM_WINDOW_ROLE;
+    }
+
+  meta_prop_prefetch (display, xwindow, atoms, n_atoms);
+
+  g_free (atoms);
+}
+
 /* Fill in the MetaPropValue used to get the value of "property" */
 static void
 init_prop_value (MetaWindow          *window,
@@ -1783,6 +1828,26 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
     { 0 },
   };
 
+  /* Properties that clients are known to rewrite over and over (progress
+   * in titles, animated icons), whose latest value is all that matters.
+   * The names redraw the frame and the icons get decoded, so those are
+   * also rate limited.
+   */
+  struct {
+    Atom property;
+    guint min_interval;
+  } coalesced[] = {
+    { display->atom__NET_WM_NAME,      100 },
+    { XA_WM_NAME,                      100 },
+    { display->atom__NET_WM_ICON_NAME, 100 },
+    { XA_WM_ICON_NAME,                 100 },
+    { display->atom__NET_WM_ICON,      500 },
+    { display->atom__KWM_WIN_ICON,     500 },
+    { XA_WM_NORMAL_HINTS,              0 },
+    { display->atom__GTK_FRAME_EXTENTS, 0 },
+  };
+  int i;
+
   MetaWindowPropHooks *table = g_memdup (hooks, sizeof (hooks)),
     *cursor = table;
   
@@ -1806,6 +1871,13 @@ meta_display_init_window_prop_hooks (MetaDisplay *display)
       cursor++;
     }
   display->n_prop_hooks = cursor - table;
+
+  for (i = 0; i < (int) G_N_ELEMENTS (coalesced); i++)
+    {
+      cursor = find_hooks (display, coalesced[i].property);
+      cursor->coalesce = TRUE;
+      cursor->min_interval = coalesced[i].min_interval;
+    }
 }
 
 LOCAL_SYMBOL void
@@ -1825,3 +1897,455 @@ find_hooks (MetaDisplay *display,
   return g_hash_table_lookup (display->prop_hooks,
                               GINT_TO_POINTER (property));
 }
+
+/* Coalescing PropertyNotify.
+ *
+ * Each window keeps a PropNotifyState per atom it has been told about
+ * (only the coalesced ones, unless MUFFIN_DEBUG_PROPERTY_NOTIFY is
+ * set). A notification on a coalesced atom just marks it pending and
+ * puts the window on the display's list; the pending atoms of each
+ * window are reloaded together in the resize phase, after the events
+ * that are already queued have been handled, so a burst costs one
+ * fetch. Atoms reloaded less than min_interval ago stay pending until
+ * a timeout says they are due.
+ */
+
+typedef struct
+{
+  Atom property;
+  gint64 last_reload;  /* monotonic, in microseconds */
+  guint notifies;
+  guint reloads;
+  guint pending : 1;
+} PropNotifyState;
+
+/* What was seen on a window that has gone away, for the report */
+typedef struct
+{
+  char *desc;
+  Atom property;
+  guint notifies;
+  guint reloads;
+} PropNotifyRecord;
+
+static int prop_notify_debug = -1;
+
+static gboolean
+prop_notify_debugging (void)
+{
+  if (G_UNLIKELY (prop_notify_debug < 0))
+    prop_notify_debug = g_getenv ("MUFFIN_DEBUG_PROPERTY_NOTIFY") != NULL;
+
+  return prop_notify_debug;
+}
+
+static PropNotifyState *
+get_prop_notify_state (MetaWindow *window,
+                       Atom        property)
+{
+  PropNotifyState state = { 0, };
+  guint i;
+
+  if (window->prop_notify_states == NULL)
+    window->prop_notify_states = g_array_new (FALSE, FALSE,
+                                              sizeof (PropNotifyState));
+
+  /* Only a handful of atoms per window ever get here */
+  for (i = 0; i < window->prop_notify_states->len; i++)
+    {
+      PropNotifyState *s = &g_array_index (window->prop_notify_states,
+                                           PropNotifyState, i);
+      if (s->property == property)
+        return s;
+    }
+
+  state.property = property;
+  g_array_append_val (window->prop_notify_states, state);
+
+  return &g_array_index (window->prop_notify_states, PropNotifyState,
+                         window->prop_notify_states->len - 1);
+}
+
+static gboolean run_property_reloads (gpointer data);
+
+static void
+queue_property_reloads (MetaDisplay *display)
+{
+  if (display->property_reload_later == 0)
+    display->property_reload_later = meta_later_add (META_LATER_RESIZE,
+                                                     run_property_reloads,
+                                                     display, NULL);
+}
+
+static gboolean
+property_reloads_due (gpointer data)
+{
+  MetaDisplay *display = data;
+
+  display->property_reload_timeout = 0;
+  queue_property_reloads (display);
+
+  return FALSE;
+}
+
+/* Reloads the pending atoms of @window that are due, in one batch.
+ * Returns the time the first of the others is due, or 0.
+ */
+static gint64
+reload_pending_properties (MetaWindow *window,
+                           gboolean    force)
+{
+  GArray *atoms;
+  gint64 now, next_due;
+  guint i;
+
+  if (window->prop_notify_states == NULL)
+    return 0;
+
+  atoms = g_array_new (FALSE, FALSE, sizeof (Atom));
+  now = g_get_monotonic_time ();
+  next_due = 0;
+
+  for (i = 0; i < window->prop_notify_states->len; i++)
+    {
+      PropNotifyState *s = &g_array_index (window->prop_notify_states,
+                                           PropNotifyState, i);
+      MetaWindowPropHooks *hooks;
+      gint64 due;
+
+      if (!s->pending)
+        continue;
+
+      hooks = find_hooks (window->display, s->property);
+      due = s->last_reload + (gint64) hooks->min_interval * 1000;
+
+      if (!force && s->last_reload != 0 && due > now)
+        {
+          if (next_due == 0 || due < next_due)
+            next_due = due;
+          continue;
+        }
+
+      s->pending = FALSE;
+      s->last_reload = now;
+      s->reloads += 1;
+      g_array_append_val (atoms, s->property);
+    }
+
+  if (atoms->len > 0)
+    meta_window_reload_properties (window, (Atom *) atoms->data, atoms->len,
+                                   FALSE);
+
+  g_array_free (atoms, TRUE);
+
+  return next_due;
+}
+
+/* Takes @window off both the list of windows to reload and the list
+ * of windows run_property_reloads() has already seen this time round.
+ */
+static void
+unqueue_property_reloads (MetaWindow *window)
+{
+  MetaDisplay *display = window->display;
+
+  window->property_reload_queued = FALSE;
+  display->property_reload_windows =
+    g_slist_remove (display->property_reload_windows, window);
+  display->property_reload_waiting =
+    g_slist_remove (display->property_reload_waiting, window);
+}
+
+static gboolean
+run_property_reloads (gpointer data)
+{
+  MetaDisplay *display = data;
+  gint64 next_due = 0;
+
+  display->property_reload_later = 0;
+
+  /* Reloading can unmanage and free any window, including the one being
+   * reloaded; meta_window_forget_property_reloads() takes windows off
+   * both lists, so only the window in hand needs a reference.
+   */
+  while (display->property_reload_windows != NULL)
+    {
+      MetaWindow *window = display->property_reload_windows->data;
+      gint64 due;
+
+      display->property_reload_windows =
+        g_slist_delete_link (display->property_reload_windows,
+                             display->property_reload_windows);
+
+      g_object_ref (window);
+      due = reload_pending_properties (window, FALSE);
+
+      /* Unmanaged or flushed while reloading; nothing left to wait for */
+      if (!window->unmanaging && window->property_reload_queued)
+        {
+          if (due != 0)
+            {
+              display->property_reload_waiting =
+                g_slist_prepend (display->property_reload_waiting, window);
+              if (next_due == 0 || due < next_due)
+                next_due = due;
+            }
+          else
+            window->property_reload_queued = FALSE;
+        }
+
+      g_object_unref (window);
+    }
+
+  display->property_reload_windows = display->property_reload_waiting;
+  display->property_reload_waiting = NULL;
+
+  if (next_due != 0 && display->property_reload_timeout == 0)
+    {
+      gint64 delay = next_due - g_get_monotonic_time ();
+
+      display->property_reload_timeout =
+        g_timeout_add (MAX (delay / 1000, 0) + 1,
+                       property_reloads_due, display);
+    }
+
+  return FALSE;
+}
+
+/**
+ * meta_window_queue_property_reload: (skip)
+ * @window: a #MetaWindow
+ * @xwindow: the window the property is on, usually @window's client window
+ * @property: the property that changed
+ *
+ * Deals with a PropertyNotify: the property is either reloaded right
+ * away or, if it is one that clients change in bursts, together with
+ * the other changes to @window before the next frame.
+ */
+LOCAL_SYMBOL void
+meta_window_queue_property_reload (MetaWindow *window,
+                                   Window      xwindow,
+                                   Atom        property)
+{
+  MetaWindowPropHooks *hooks;
+  PropNotifyState *state;
+
+  hooks = find_hooks (window->display, property);
+
+  if (hooks == NULL || !hooks->coalesce || xwindow != window->xwindow)
+    {
+      if (prop_notify_debugging ())
+        {
+          state = get_prop_notify_state (window, property);
+          state->notifies += 1;
+          state->reloads += 1;
+        }
+
+      meta_window_reload_property_from_xwindow (window, xwindow, property,
+                                                FALSE);
+      return;
+    }
+
+  state = get_prop_notify_state (window, property);
+  state->notifies += 1;
+  state->pending = TRUE;
+
+  if (!window->property_reload_queued)
+    {
+      window->property_reload_queued = TRUE;
+      window->display->property_reload_windows =
+        g_slist_prepend (window->display->property_reload_windows, window);
+    }
+
+  queue_property_reloads (window->display);
+}
+
+/**
+ * meta_window_flush_property_reloads: (skip)
+ * @window: a #MetaWindow
+ *
+ * Reloads whatever is pending for @window now, for when the current
+ * values matter, like before acting on a ConfigureRequest.
+ */
+LOCAL_SYMBOL void
+meta_window_flush_property_reloads (MetaWindow *window)
+{
+  if (!window->property_reload_queued)
+    return;
+
+  unqueue_property_reloads (window);
+  reload_pending_properties (window, TRUE);
+}
+
+/**
+ * meta_window_forget_property_reloads: (skip)
+ * @window: a #MetaWindow being unmanaged
+ *
+ * Drops any pending reloads for @window, keeping its counts for
+ * meta_display_report_property_notifies().
+ */
+LOCAL_SYMBOL void
+meta_window_forget_property_reloads (MetaWindow *window)
+{
+  MetaDisplay *display = window->display;
+  guint i;
+
+  if (window->property_reload_queued)
+    unqueue_property_reloads (window);
+
+  if (window->prop_notify_states == NULL)
+    return;
+
+  if (prop_notify_debugging ())
+    {
+      if (display->property_notify_history == NULL)
+        display->property_notify_history =
+          g_array_new (FALSE, FALSE, sizeof (PropNotifyRecord));
+
+      for (i = 0; i < window->prop_notify_states->len; i++)
+        {
+          PropNotifyState *s = &g_array_index (window->prop_notify_states,
+                                               PropNotifyState, i);
+          PropNotifyRecord record;
+
+          record.desc = g_strdup (window->desc);
+          record.property = s->property;
+          record.notifies = s->notifies;
+          record.reloads = s->reloads;
+          g_array_append_val (display->property_notify_history, record);
+        }
+    }
+
+  g_array_free (window->prop_notify_states, TRUE);
+  window->prop_notify_states = NULL;
+}
+
+static gint
+compare_records (gconstpointer a,
+                 gconstpointer b)
+{
+  const PropNotifyRecord *ra = a;
+  const PropNotifyRecord *rb = b;
+
+  if (ra->notifies != rb->notifies)
+    return ra->notifies > rb->notifies ? -1 : 1;
+
+  return 0;
+}
+
+/**
+ * meta_display_free_property_reloads: (skip)
+ * @display: a #MetaDisplay
+ *
+ * Cancels the pending run of coalesced property reloads and drops the
+ * windows still waiting for one. Called when the display is closed.
+ */
+LOCAL_SYMBOL void
+meta_display_free_property_reloads (MetaDisplay *display)
+{
+  if (display->property_reload_later != 0)
+    {
+      meta_later_remove (display->property_reload_later);
+      display->property_reload_later = 0;
+    }
+  if (display->property_reload_timeout != 0)
+    {
+      g_source_remove (display->property_reload_timeout);
+      display->property_reload_timeout = 0;
+    }
+
+  g_slist_free (display->property_reload_windows);
+  display->property_reload_windows = NULL;
+  g_slist_free (display->property_reload_waiting);
+  display->property_reload_waiting = NULL;
+}
+
+#define N_REPORTED 20
+
+/**
+ * meta_display_report_property_notifies: (skip)
+ * @display: a #MetaDisplay
+ *
+ * If MUFFIN_DEBUG_PROPERTY_NOTIFY is set, logs the windows and atoms
+ * that got the most PropertyNotify events, and how many reloads they
+ * came down to. Called when the display is closed, after all windows
+ * have been unmanaged.
+ */
+LOCAL_SYMBOL void
+meta_display_report_property_notifies (MetaDisplay *display)
+{
+  GArray *records;
+  GHashTable *per_window;
+  GList *descs, *d;
+  guint i;
+
+  if (!prop_notify_debugging ())
+    return;
+
+  records = display->property_notify_history;
+  display->property_notify_history = NULL;
+  if (records == NULL)
+    return;
+
+  g_array_sort (records, compare_records);
+
+  meta_topic (META_DEBUG_EVENTS, "Noisiest properties:\n");
+
+  for (i = 0; i < records->len && i < N_REPORTED; i++)
+    {
+      PropNotifyRecord *record = &g_array_index (records, PropNotifyRecord, i);
+      char *name;
+
+      meta_error_trap_push (display);
+      name = XGetAtomName (display->xdisplay, record->property);
+      meta_error_trap_pop (display);
+
+      meta_topic (META_DEBUG_EVENTS,
+                  "  %s on %s: %u notifies, %u reloads\n",
+                  name ? name : "(unknown atom)", record->desc,
+                  record->notifies, record->reloads);
+
+      if (name)
+        XFree (name);
+    }
+
+  /* Totals per window; windows are told apart by their description,
+   * which includes the XID
+   */
+  per_window = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < records->len; i++)
+    {
+      PropNotifyRecord *record = &g_array_index (records, PropNotifyRecord, i);
+      guint total;
+
+      total = GPOINTER_TO_UINT (g_hash_table_lookup (per_window, record->desc));
+      g_hash_table_insert (per_window, record->desc,
+                           GUINT_TO_POINTER (total + record->notifies));
+    }
+
+  meta_topic (META_DEBUG_EVENTS, "Noisiest windows:\n");
+
+  descs = g_hash_table_get_keys (per_window);
+  for (i = 0; i < N_REPORTED && descs != NULL; i++)
+    {
+      GList *noisiest = descs;
+
+      for (d = descs->next; d != NULL; d = d->next)
+        if (GPOINTER_TO_UINT (g_hash_table_lookup (per_window, d->data)) >
+            GPOINTER_TO_UINT (g_hash_table_lookup (per_window, noisiest->data)))
+          noisiest = d;
+
+      meta_topic (META_DEBUG_EVENTS, "  %s: %u notifies\n",
+                  (char *) noisiest->data,
+                  GPOINTER_TO_UINT (g_hash_table_lookup (per_window,
+                                                         noisiest->data)));
+
+      descs = g_list_delete_link (descs, noisiest);
+    }
+  g_list_free (descs);
+  g_hash_table_destroy (per_window);
+
+  for (i = 0; i < records->len; i++)
+    g_free (g_array_index (records, PropNotifyRecord, i).desc);
+  g_array_free (records, TRUE);
+}
@@ -104,6 +104,63 @@ void meta_window_reload_properties_from_xwindow
  */
 void meta_window_load_initial_properties (MetaWindow *window);
 
+/**
+ * Sends the requests for the properties that managing a window reads,
+ * so that the replies arrive together; see meta_prop_prefetch().
+ *
+ * \param display            The display.
+ * \param xwindow            The window about to be managed.
+ * \param override_redirect  Whether the window is override redirect.
+ */
+void meta_window_prefetch_properties (MetaDisplay *display,
+                                      Window       xwindow,
+                                      gboolean     override_redirect);
+
+/**
+ * Deals with a change to a property of a window. Properties that
+ * clients change in bursts are reloaded together before the next
+ * frame, and no more often than their hooks allow; others are
+ * reloaded right away.
+ *
+ * \param window    The window.
+ * \param xwindow   The X window the property changed on; only changes
+ *                  on the client window itself are coalesced.
+ * \param property  The property that changed.
+ */
+void meta_window_queue_property_reload (MetaWindow *window,
+                                        Window      xwindow,
+                                        Atom        property);
+
+/**
+ * Reloads the properties of a window that are waiting to be coalesced,
+ * for when their current values matter.
+ *
+ * \param window  The window.
+ */
+void meta_window_flush_property_reloads (MetaWindow *window);
+
+/**
+ * Drops the reloads waiting for a window that is being unmanaged.
+ *
+ * \param window  The window.
+ */
+void meta_window_forget_property_reloads (MetaWindow *window);
+
+/**
+ * Cancels pending coalesced property reloads.
+ *
+ * \param display  The display being closed.
+ */
+void meta_display_free_property_reloads (MetaDisplay *display);
+
+/**
+ * Logs the windows and atoms that got the most PropertyNotify events,
+ * if MUFFIN_DEBUG_PROPERTY_NOTIFY is set.
+ *
+ * \param display  The display being closed.
+ */
+void meta_display_report_property_notifies (MetaDisplay *display);
+
 /**
  * Initialises the hooks used for the reload_propert* functions
  * on a particular display, and stores a pointer to them in the
@@ -47,6 +47,7 @@
 #include <meta/group.h>
 #include "window-props.h"
 #include "constraints.h"
+#include "roundtrips.h"
 #include "muffin-enum-types.h"
 #include <clutter/clutter.h>
 
@@ -692,6 +693,7 @@ meta_window_new (MetaDisplay *display,
 
   meta_error_trap_push_with_return (display);
 
+  meta_roundtrip_note (META_ROUNDTRIP_GET_ATTRIBUTES);
   if (XGetWindowAttributes (display->xdisplay,xwindow, &attrs))
    {
       if(meta_error_trap_pop_with_return (display) != Success)
@@ -760,6 +762,7 @@ maybe_filter_window (MetaDisplay       *display,
   filtered = TRUE;
 
   meta_error_trap_push (display);
+  meta_roundtrip_note (META_ROUNDTRIP_GET_PROPERTY);
   success = XGetClassHint (display->xdisplay, xwindow, &class_hint);
 
   if (success)
@@ -833,12 +836,12 @@ meta_window_should_attach_to_parent (MetaWindow *window)
     }
 }
 
-LOCAL_SYMBOL LOCAL_SYMBOL MetaWindow*
-meta_window_new_with_attrs (MetaDisplay       *display,
-                            Window             xwindow,
-                            gboolean           must_be_viewable,
-                            MetaCompEffect     effect,
-                            XWindowAttributes *attrs)
+static MetaWindow*
+meta_window_new_with_attrs_internal (MetaDisplay       *display,
+                                     Window             xwindow,
+                                     gboolean           must_be_viewable,
+                                     MetaCompEffect     effect,
+                                     XWindowAttributes *attrs)
 {
   MetaWindow *window;
   GSList *tmp;
@@ -848,6 +851,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   MetaMoveResizeFlags flags;
   gboolean has_shape;
   MetaScreen *screen;
+  const MetaRestartWindowInfo *restart_info;
 
   g_assert (attrs != NULL);
 
@@ -907,6 +911,13 @@ meta_window_new_with_attrs (MetaDisplay       *display,
                                    * creation, to reduce XSync() calls
                                    */
 
+  /* Ask for everything we are going to read up front; whichever round
+   * trip comes first below brings all the replies in. The server grab
+   * keeps the values from changing before we select PropertyChangeMask.
+   */
+  meta_window_prefetch_properties (display, xwindow,
+                                   attrs->override_redirect);
+
   meta_verbose ("must_be_viewable = %d attrs->map_state = %d (%s)\n",
                 must_be_viewable,
                 attrs->map_state,
@@ -932,6 +943,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
             (state == IconicState || state == NormalState)))
         {
           meta_verbose ("Deciding not to manage unmapped or unviewable window 0x%lx\n", xwindow);
+          meta_prop_prefetch_clear (display, xwindow);
           meta_error_trap_pop (display);
           meta_display_ungrab (display);
           return NULL;
@@ -942,19 +954,22 @@ meta_window_new_with_attrs (MetaDisplay       *display,
                     wm_state_to_string (existing_wm_state));
     }
 
-  meta_error_trap_push_with_return (display);
-
   /*
    * XAddToSaveSet can only be called on windows created by a different client.
    * with Muffin we want to be able to create manageable windows from within
    * the process (such as a dummy desktop window), so we do not want this
    * call failing to prevent the window from being managed -- wrap it in its
-   * own error trap (we use the _with_return() version here to ensure that
-   * XSync() is done on the pop, otherwise the error will not get caught).
+   * own error trap, outside the one below, and ignore the result.
    */
-  meta_error_trap_push_with_return (display);
+  meta_error_trap_push (display);
   XAddToSaveSet (display->xdisplay, xwindow);
-  meta_error_trap_pop_with_return (display);
+  meta_error_trap_pop (display);
+
+  /* The attributes we were handed may be stale: the window can be gone
+   * even though we hold a server grab now, and then it must not be
+   * managed, so this trap has to stay synchronous.
+   */
+  meta_error_trap_push_with_return (display);
 
   event_mask =
     PropertyChangeMask | EnterWindowMask | LeaveWindowMask |
@@ -1014,6 +1029,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
     {
       meta_verbose ("Window 0x%lx disappeared just as we tried to manage it\n",
                     xwindow);
+      meta_prop_prefetch_clear (display, xwindow);
       meta_error_trap_pop (display);
       meta_display_ungrab (display);
       return NULL;
@@ -1137,7 +1153,10 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->denied_focus_and_not_transient = FALSE;
   window->unmanaging = FALSE;
   window->is_in_queues = 0;
+  window->property_reload_queued = FALSE;
+  window->prop_notify_states = NULL;
   window->keys_grabbed = FALSE;
+  window->key_grabs = NULL;
   window->grab_on_frame = FALSE;
   window->all_keys_grabbed = FALSE;
   window->withdrawn = FALSE;
@@ -1259,6 +1278,9 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   if (!window->override_redirect)
     meta_window_update_icon_now (window);
 
+  /* From here on we may have changed properties ourselves */
+  meta_prop_prefetch_clear (display, xwindow);
+
   if (window->initially_iconic)
     {
       /* WM_HINTS said minimized */
@@ -1284,6 +1306,9 @@ meta_window_new_with_attrs (MetaDisplay       *display,
    */
   meta_screen_apply_startup_properties (window->screen, window);
 
+  /* State handed over by the window manager we replaced, if any */
+  restart_info = meta_restart_state_lookup (window->screen, window->xwindow);
+
   /* Try to get a "launch timestamp" for the window.  If the window is
    * a transient, we'd like to be able to get a last-usage timestamp
    * from the parent window.  If the window has no parent, there isn't
@@ -1306,6 +1331,11 @@ meta_window_new_with_attrs (MetaDisplay       *display,
       window->net_wm_user_time = window->initial_timestamp;
     else if (parent != NULL)
       meta_window_set_user_time(window, parent->net_wm_user_time);
+    else if (restart_info != NULL)
+      /* NOTE: Do NOT toggle net_wm_user_time_set to true; this is just
+       * the fallback the previous window manager had recorded
+       */
+      window->net_wm_user_time = restart_info->user_time;
     else
       /* NOTE: Do NOT toggle net_wm_user_time_set to true; this is just
        * being recorded as a fallback for potential transients
@@ -1341,6 +1371,12 @@ meta_window_new_with_attrs (MetaDisplay       *display,
 
   window->on_all_workspaces = should_be_on_all_workspaces (window);
 
+  if (restart_info != NULL && restart_info->has_workspace)
+    {
+      window->initial_workspace_set = TRUE;
+      window->initial_workspace = restart_info->workspace;
+    }
+
   /* For the workspace, first honor hints,
    * if that fails put transients with parents,
    * otherwise put window on active space
@@ -1471,6 +1507,12 @@ meta_window_new_with_attrs (MetaDisplay       *display,
       }
   }
 
+  /* Placement has just made up a saved_rect for initially maximized
+   * windows; the one the previous window manager had is better.
+   */
+  if (restart_info != NULL)
+    window->saved_rect = restart_info->saved_rect;
+
   if (!window->override_redirect)
     {
       /* FIXME we have a tendency to set this then immediately
@@ -1534,6 +1576,24 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   return window;
 }
 
+LOCAL_SYMBOL MetaWindow*
+meta_window_new_with_attrs (MetaDisplay       *display,
+                            Window             xwindow,
+                            gboolean           must_be_viewable,
+                            MetaCompEffect     effect,
+                            XWindowAttributes *attrs)
+{
+  MetaWindow *window;
+
+  meta_roundtrip_scope_begin (G_STRFUNC);
+  window = meta_window_new_with_attrs_internal (display, xwindow,
+                                                must_be_viewable,
+                                                effect, attrs);
+  meta_roundtrip_scope_end (G_STRFUNC);
+
+  return window;
+}
+
 /* This function should only be called from the end of meta_window_new_with_attrs () */
 static void
 meta_window_apply_session_info (MetaWindow *window,
@@ -1826,6 +1886,7 @@ meta_window_unmanage (MetaWindow  *window,
   meta_window_unqueue (window, META_QUEUE_CALC_SHOWING |
                                META_QUEUE_MOVE_RESIZE |
                                META_QUEUE_UPDATE_ICON);
+  meta_window_forget_property_reloads (window);
   meta_window_free_delete_dialog (window);
 
   if (window->workspace)
@@ -5882,9 +5943,9 @@ get_modal_transient (MetaWindow *window)
 }
 
 /* XXX META_EFFECT_FOCUS */
-LOCAL_SYMBOL void
-meta_window_focus (MetaWindow  *window,
-                   guint32      timestamp)
+static void
+meta_window_focus_internal (MetaWindow  *window,
+                            guint32      timestamp)
 {
   MetaWindow *modal_transient;
 
@@ -5978,6 +6039,15 @@ meta_window_focus (MetaWindow  *window,
 /*  meta_effect_run_focus(window, NULL, NULL); */
 }
 
+LOCAL_SYMBOL void
+meta_window_focus (MetaWindow  *window,
+                   guint32      timestamp)
+{
+  meta_roundtrip_scope_begin (G_STRFUNC);
+  meta_window_focus_internal (window, timestamp);
+  meta_roundtrip_scope_end (G_STRFUNC);
+}
+
 static void
 meta_window_change_workspace_without_transients (MetaWindow    *window,
                                                  MetaWorkspace *workspace)
@@ -6488,6 +6558,10 @@ meta_window_configure_request (MetaWindow *window,
    * and give windows a border of 0. But we save the
    * requested border here.
    */
+
+  /* The request may rely on hints set just before it */
+  meta_window_flush_property_reloads (window);
+
   if (event->xconfigurerequest.value_mask & CWBorderWidth)
     window->border_width = event->xconfigurerequest.border_width;
 
@@ -6995,6 +7069,7 @@ meta_window_client_message (MetaWindow *window,
                */
               mask = 0;
               meta_error_trap_push (window->display);
+              meta_roundtrip_note (META_ROUNDTRIP_QUERY_POINTER);
               XQueryPointer (window->display->xdisplay,
                              window->xwindow,
                              &root, &child,
@@ -7411,7 +7486,7 @@ process_property_notify (MetaWindow     *window,
         xid = window->user_time_window;
     }
 
-  meta_window_reload_property_from_xwindow (window, xid, event->atom, FALSE);
+  meta_window_queue_property_reload (window, xid, event->atom);
 
   return TRUE;
 }
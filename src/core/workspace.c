@@ -39,6 +39,7 @@
 #include <meta/workspace.h>
 #include "workspace-private.h"
 #include "boxes-private.h"
+#include "roundtrips.h"
 #include <meta/errors.h>
 #include <meta/prefs.h>
 
@@ -517,29 +518,10 @@ workspace_switch_sound(MetaWorkspace *from,
 #endif /* HAVE_LIBCANBERRA */
 }
 
-/**
- * meta_workspace_activate_with_focus:
- * @workspace: a #MetaWorkspace
- * @focus_this: the #MetaWindow to be focused, or %NULL
- * @timestamp: timestamp for @focus_this
- *
- * Switches to @workspace and possibly activates the window @focus_this.
- *
- * The window @focus_this is activated by calling meta_window_activate()
- * which will unminimize it and transient parents, raise it and give it
- * the focus.
- *
- * If a window is currently being moved by the user, it will be
- * moved to @workspace.
- *
- * The advantage of calling this function instead of meta_workspace_activate()
- * followed by meta_window_activate() is that it happens as a unit, so
- * no other window gets focused first before @focus_this.
- */
-void
-meta_workspace_activate_with_focus (MetaWorkspace *workspace,
-                                    MetaWindow    *focus_this,
-                                    guint32        timestamp)
+static void
+meta_workspace_activate_with_focus_internal (MetaWorkspace *workspace,
+                                             MetaWindow    *focus_this,
+                                             guint32        timestamp)
 {
   MetaWorkspace  *old;
   MetaWindow     *move_window;
@@ -692,6 +674,35 @@ meta_workspace_activate_with_focus (MetaWorkspace *workspace,
    meta_screen_workspace_switched (screen, current_space, new_space, direction);
 }
 
+/**
+ * meta_workspace_activate_with_focus:
+ * @workspace: a #MetaWorkspace
+ * @focus_this: the #MetaWindow to be focused, or %NULL
+ * @timestamp: timestamp for @focus_this
+ *
+ * Switches to @workspace and possibly activates the window @focus_this.
+ *
+ * The window @focus_this is activated by calling meta_window_activate()
+ * which will unminimize it and transient parents, raise it and give it
+ * the focus.
+ *
+ * If a window is currently being moved by the user, it will be
+ * moved to @workspace.
+ *
+ * The advantage of calling this function instead of meta_workspace_activate()
+ * followed by meta_window_activate() is that it happens as a unit, so
+ * no other window gets focused first before @focus_this.
+ */
+void
+meta_workspace_activate_with_focus (MetaWorkspace *workspace,
+                                    MetaWindow    *focus_this,
+                                    guint32        timestamp)
+{
+  meta_roundtrip_scope_begin (G_STRFUNC);
+  meta_workspace_activate_with_focus_internal (workspace, focus_this, timestamp);
+  meta_roundtrip_scope_end (G_STRFUNC);
+}
+
 void
 meta_workspace_activate (MetaWorkspace *workspace,
                          guint32        timestamp)
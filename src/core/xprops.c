@@ -90,6 +90,7 @@ from The Open Group.
 #include <X11/Xatom.h>
 #include <string.h>
 #include "window-private.h"
+#include "roundtrips.h"
 
 typedef struct
 {
@@ -177,6 +178,274 @@ validate_or_free_results (GetPropertyResults *results,
   return FALSE;
 }
 
+/* Property prefetching.
+ *
+ * While a window is being managed we know most of the properties we
+ * are about to read, one request at a time. meta_prop_prefetch() asks
+ * for all of them at once, with AnyPropertyType, and the getters take
+ * the prefetched reply instead of making a request of their own, so
+ * the first round trip brings in every reply. Several windows can be
+ * prefetched at once, e.g. all existing windows at startup.
+ */
+
+static AgGetPropertyTask*
+get_task (MetaDisplay        *display,
+          Window              xwindow,
+          Atom                xatom,
+          Atom                req_type)
+{
+  return ag_task_create (display->xdisplay,
+                         xwindow,
+                         xatom, 0, G_MAXLONG,
+                         False, req_type);
+}
+
+static AgGetPropertyTask*
+take_prefetched_task (MetaDisplay *display,
+                      Window       xwindow,
+                      Atom         xatom)
+{
+  GHashTable *window_props;
+  AgGetPropertyTask *task;
+
+  if (display->prefetched_props == NULL)
+    return NULL;
+
+  window_props = g_hash_table_lookup (display->prefetched_props,
+                                      GUINT_TO_POINTER (xwindow));
+  if (window_props == NULL)
+    return NULL;
+
+  task = g_hash_table_lookup (window_props, GUINT_TO_POINTER (xatom));
+  if (task != NULL)
+    g_hash_table_remove (window_props, GUINT_TO_POINTER (xatom));
+
+  return task;
+}
+
+/* A prefetch asks for any type; make the results look like what the
+ * server sends back when the property doesn't have the type asked for.
+ */
+static void
+filter_results_type (GetPropertyResults *results,
+                     Atom                req_type)
+{
+  if (req_type == AnyPropertyType ||
+      results->type == req_type ||
+      results->type == None)
+    return;
+
+  if (results->prop)
+    {
+      XFree (results->prop);
+      results->prop = NULL;
+    }
+  results->n_items = 0;
+}
+
+static void
+discard_task (AgGetPropertyTask *task)
+{
+  Atom type;
+  int format;
+  unsigned long n_items, bytes_after;
+  unsigned char *prop;
+
+  ag_task_get_reply_and_free (task, &type, &format,
+                              &n_items, &bytes_after, &prop);
+  if (prop)
+    XFree (prop);
+}
+
+/* Tasks can't be dropped before their reply arrives, or the async
+ * handler won't recognise it; park them until then.
+ */
+static void
+reap_orphaned_prefetches (MetaDisplay *display)
+{
+  GSList *l, *next;
+
+  for (l = display->orphaned_prefetches; l; l = next)
+    {
+      AgGetPropertyTask *task = l->data;
+
+      next = l->next;
+
+      if (ag_task_have_reply (task))
+        {
+          discard_task (task);
+          display->orphaned_prefetches =
+            g_slist_delete_link (display->orphaned_prefetches, l);
+        }
+    }
+}
+
+/**
+ * meta_prop_prefetch: (skip)
+ * @display: a #MetaDisplay
+ * @xwindow: the window whose properties to fetch
+ * @atoms: (array length=n_atoms): the properties; %None entries and
+ *   duplicates are skipped
+ * @n_atoms: length of @atoms
+ *
+ * Sends requests for all of @atoms on @xwindow without waiting for the
+ * replies; atoms already prefetched for @xwindow are not asked for
+ * again. Until meta_prop_prefetch_clear(), reading one of them with
+ * the meta_prop_get_*() functions uses the prefetched reply.
+ *
+ * The properties may have changed by the time they are read unless the
+ * caller holds a server grab or has selected PropertyChangeMask first.
+ */
+LOCAL_SYMBOL void
+meta_prop_prefetch (MetaDisplay *display,
+                    Window       xwindow,
+                    const Atom  *atoms,
+                    int          n_atoms)
+{
+  GHashTable *window_props;
+  int i, n_requested;
+
+  if (display->prefetched_props == NULL)
+    display->prefetched_props =
+      g_hash_table_new_full (NULL, NULL,
+                             NULL, (GDestroyNotify) g_hash_table_destroy);
+
+  window_props = g_hash_table_lookup (display->prefetched_props,
+                                      GUINT_TO_POINTER (xwindow));
+  if (window_props == NULL)
+    {
+      window_props = g_hash_table_new (NULL, NULL);
+      g_hash_table_insert (display->prefetched_props,
+                           GUINT_TO_POINTER (xwindow), window_props);
+    }
+
+  n_requested = 0;
+  for (i = 0; i < n_atoms; i++)
+    {
+      AgGetPropertyTask *task;
+
+      if (atoms[i] == None ||
+          g_hash_table_lookup (window_props, GUINT_TO_POINTER (atoms[i])))
+        continue;
+
+      task = get_task (display, xwindow, atoms[i], AnyPropertyType);
+      if (task != NULL)
+        {
+          g_hash_table_insert (window_props,
+                               GUINT_TO_POINTER (atoms[i]), task);
+          ++n_requested;
+        }
+    }
+
+  if (n_requested > 0)
+    meta_verbose ("Prefetching %d properties of 0x%lx\n",
+                  n_requested, xwindow);
+}
+
+static void
+orphan_prefetches (MetaDisplay *display,
+                   GHashTable  *window_props)
+{
+  GHashTableIter iter;
+  gpointer task;
+
+  g_hash_table_iter_init (&iter, window_props);
+  while (g_hash_table_iter_next (&iter, NULL, &task))
+    display->orphaned_prefetches =
+      g_slist_prepend (display->orphaned_prefetches, task);
+}
+
+/**
+ * meta_prop_prefetch_clear: (skip)
+ * @display: a #MetaDisplay
+ * @xwindow: a window passed to meta_prop_prefetch()
+ *
+ * Forgets the properties of @xwindow prefetched with
+ * meta_prop_prefetch() that nobody read.
+ */
+LOCAL_SYMBOL void
+meta_prop_prefetch_clear (MetaDisplay *display,
+                          Window       xwindow)
+{
+  GHashTable *window_props;
+
+  if (display->prefetched_props == NULL)
+    return;
+
+  window_props = g_hash_table_lookup (display->prefetched_props,
+                                      GUINT_TO_POINTER (xwindow));
+  if (window_props != NULL)
+    {
+      orphan_prefetches (display, window_props);
+      g_hash_table_remove (display->prefetched_props,
+                           GUINT_TO_POINTER (xwindow));
+    }
+
+  reap_orphaned_prefetches (display);
+}
+
+/**
+ * meta_prop_prefetch_free: (skip)
+ * @display: a #MetaDisplay
+ *
+ * Forgets all prefetched properties and waits for the replies of
+ * unread ones so nothing is left behind; used when closing the
+ * display.
+ */
+LOCAL_SYMBOL void
+meta_prop_prefetch_free (MetaDisplay *display)
+{
+  if (display->prefetched_props != NULL)
+    {
+      GHashTableIter iter;
+      gpointer window_props;
+
+      g_hash_table_iter_init (&iter, display->prefetched_props);
+      while (g_hash_table_iter_next (&iter, NULL, &window_props))
+        orphan_prefetches (display, window_props);
+
+      g_clear_pointer (&display->prefetched_props, g_hash_table_destroy);
+    }
+
+  if (display->orphaned_prefetches != NULL)
+    {
+      XSync (display->xdisplay, False);
+      reap_orphaned_prefetches (display);
+    }
+}
+
+static gboolean
+get_prefetched_property (AgGetPropertyTask  *task,
+                         Atom                req_type,
+                         GetPropertyResults *results)
+{
+  if (!ag_task_have_reply (task))
+    {
+      meta_topic (META_DEBUG_SYNC, "Syncing to get prefetched property\n");
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
+      XSync (results->display->xdisplay, False);
+    }
+
+  if (ag_task_get_reply_and_free (task,
+                                  &results->type, &results->format,
+                                  &results->n_items,
+                                  &results->bytes_after,
+                                  &results->prop) != Success ||
+      results->type == None)
+    {
+      if (results->prop)
+        {
+          XFree (results->prop);
+          results->prop = NULL;
+        }
+      return FALSE;
+    }
+
+  filter_results_type (results, req_type);
+
+  return TRUE;
+}
+
 static gboolean
 get_property (MetaDisplay        *display,
               Window              xwindow,
@@ -184,6 +453,8 @@ get_property (MetaDisplay        *display,
               Atom                req_type,
               GetPropertyResults *results)
 {
+  AgGetPropertyTask *task;
+
   results->display = display;
   results->xwindow = xwindow;
   results->xatom = xatom;
@@ -192,8 +463,13 @@ get_property (MetaDisplay        *display,
   results->type = None;
   results->bytes_after = 0;
   results->format = 0;
+
+  task = take_prefetched_task (display, xwindow, xatom);
+  if (task != NULL)
+    return get_prefetched_property (task, req_type, results);
   
   meta_error_trap_push_with_return (display);
+  meta_roundtrip_note (META_ROUNDTRIP_GET_PROPERTY);
   if (XGetWindowProperty (display->xdisplay, xwindow, xatom,
                           0, G_MAXLONG,
                           False, req_type, &results->type, &results->format,
@@ -917,18 +1193,6 @@ meta_prop_get_size_hints (MetaDisplay   *display,
   return size_hints_from_results (&results, hints_p, flags_p);
 }
 
-static AgGetPropertyTask*
-get_task (MetaDisplay        *display,
-          Window              xwindow,
-          Atom                xatom,
-          Atom                req_type)
-{
-  return ag_task_create (display->xdisplay,
-                         xwindow,
-                         xatom, 0, G_MAXLONG,
-                         False, req_type);
-}
-
 static char*
 latin1_to_utf8 (const char *text)
 {
@@ -947,22 +1211,44 @@ latin1_to_utf8 (const char *text)
   return g_string_free (str, FALSE);
 }
 
-LOCAL_SYMBOL void
-meta_prop_get_values (MetaDisplay   *display,
-                      Window         xwindow,
-                      MetaPropValue *values,
-                      int            n_values)
+typedef struct
 {
-  int i;
+  MetaDisplay *display;
+  Window xwindow;
+  MetaPropValue *values;
+  int n_values;
   AgGetPropertyTask **tasks;
+} MetaPropRequest;
+
+/* First half of meta_prop_get_values(): sends the requests for all of
+ * the values, or picks up prefetched ones, without waiting for any
+ * reply.
+ */
+static MetaPropRequest *
+request_values (MetaDisplay   *display,
+                Window         xwindow,
+                MetaPropValue *values,
+                int            n_values)
+{
+  MetaPropRequest *request;
+  AgGetPropertyTask **tasks;
+  int i;
 
   meta_verbose ("Requesting %d properties of 0x%lx at once\n",
                 n_values, xwindow);
-  
+
+  request = g_slice_new (MetaPropRequest);
+  request->display = display;
+  request->xwindow = xwindow;
+  request->values = values;
+  request->n_values = n_values;
+  request->tasks = NULL;
+
   if (n_values == 0)
-    return;
+    return request;
   
   tasks = g_new0 (AgGetPropertyTask*, n_values);
+  request->tasks = tasks;
 
   /* Start up tasks. The "values" array can have values
    * with atom == None, which means to ignore that element.
@@ -1021,18 +1307,59 @@ meta_prop_get_values (MetaDisplay   *display,
         }
 
       if (values[i].atom != None)
-        tasks[i] = get_task (display, xwindow,
-                             values[i].atom, values[i].required_type);
+        {
+          tasks[i] = take_prefetched_task (display, xwindow, values[i].atom);
+          if (tasks[i] == NULL)
+            tasks[i] = get_task (display, xwindow,
+                                 values[i].atom, values[i].required_type);
+        }
       
       ++i;
     }  
+
+  return request;
+}
+
+/* Second half of meta_prop_get_values(): waits for whatever replies
+ * are still outstanding, with a single sync, and fills in the values.
+ * Frees @request.
+ */
+static void
+finish_request (MetaPropRequest *request)
+{
+  MetaDisplay *display = request->display;
+  Window xwindow = request->xwindow;
+  MetaPropValue *values = request->values;
+  int n_values = request->n_values;
+  AgGetPropertyTask **tasks = request->tasks;
+  gboolean need_sync;
+  int i;
+
+  g_slice_free (MetaPropRequest, request);
+
+  if (n_values == 0)
+    return;
+
+  need_sync = FALSE;
+  for (i = 0; i < n_values; i++)
+    if (tasks[i] != NULL && !ag_task_have_reply (tasks[i]))
+      need_sync = TRUE;
+
+  /* Get replies for all our tasks, unless something since the
+   * request already waited for them
+   */
+  if (need_sync)
+    {
+      meta_topic (META_DEBUG_SYNC,
+                  "Syncing to get %d GetProperty replies in %s\n",
+                  n_values, G_STRFUNC);
+      meta_roundtrip_note (META_ROUNDTRIP_SYNC);
+      XSync (display->xdisplay, False);
+    }
   
-  /* Get replies for all our tasks */
-  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
-              n_values, G_STRFUNC);
-  XSync (display->xdisplay, False);
-  
-  /* Collect results, should arrive in order requested */
+  /* Collect results. Take them task by task rather than in completion
+   * order, since other requests may be outstanding at the same time.
+   */
   i = 0;
   while (i < n_values)
     {
@@ -1048,8 +1375,7 @@ meta_prop_get_values (MetaDisplay   *display,
           goto next;
         }
       
-      task = ag_get_next_completed_task (display->xdisplay);
-      g_assert (task != NULL);
+      task = tasks[i];
       g_assert (ag_task_have_reply (task));
 
       results.display = display;
@@ -1077,6 +1403,8 @@ meta_prop_get_values (MetaDisplay   *display,
           goto next;
         }
 
+      filter_results_type (&results, values[i].required_type);
+
       switch (values[i].type)
         {
         case META_PROP_VALUE_INVALID:
@@ -1188,6 +1516,15 @@ meta_prop_get_values (MetaDisplay   *display,
   g_free (tasks);
 }
 
+LOCAL_SYMBOL void
+meta_prop_get_values (MetaDisplay   *display,
+                      Window         xwindow,
+                      MetaPropValue *values,
+                      int            n_values)
+{
+  finish_request (request_values (display, xwindow, values, n_values));
+}
+
 static void
 free_value (MetaPropValue *value)
 {
@@ -220,6 +220,14 @@ void meta_prop_get_values (MetaDisplay   *display,
 void meta_prop_free_values (MetaPropValue *values,
                             int            n_values);
 
+void meta_prop_prefetch       (MetaDisplay *display,
+                               Window       xwindow,
+                               const Atom  *atoms,
+                               int          n_atoms);
+void meta_prop_prefetch_clear (MetaDisplay *display,
+                               Window       xwindow);
+void meta_prop_prefetch_free  (MetaDisplay *display);
+
 #endif
 
 
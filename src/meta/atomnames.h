@@ -71,6 +71,7 @@ item(_GNOME_PANEL_ACTION)
 item(_GNOME_PANEL_ACTION_RUN_DIALOG)
 item(_MUFFIN_SENTINEL)
 item(_MUFFIN_VERSION)
+item(_MUFFIN_RESTART_STATE)
 item(WM_CLIENT_MACHINE)
 item(MANAGER)
 item(TARGETS)
@@ -90,6 +90,9 @@ void meta_prefs_add_listener    (MetaPrefsChangedFunc func,
 void meta_prefs_remove_listener (MetaPrefsChangedFunc func,
                                  gpointer             data);
 
+gboolean    meta_prefs_changed_in_batch (MetaPreference pref);
+GHashTable *meta_prefs_get_changed_keys (void);
+
 void meta_prefs_init (void);
 
 void meta_prefs_override_preference_schema (const char *key,
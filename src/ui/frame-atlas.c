@@ -0,0 +1,575 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin frame piece atlases */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "frame-atlas.h"
+
+/* A new atlas is the smallest power of two at least this long and
+ * deep that holds its first piece: 512x32 for a titlebar up to 512
+ * pixels wide, 64 KiB. It doubles, deeper first, up to 4096x256, 4 MiB.
+ */
+#define FRAME_ATLAS_MIN_LENGTH 512
+#define FRAME_ATLAS_MIN_DEPTH  32
+#define FRAME_ATLAS_MAX_LENGTH 4096
+#define FRAME_ATLAS_MAX_DEPTH  256
+
+/* Server pixmaps are 32 bits per pixel at depth 24 as well as 32 */
+#define SURFACE_BYTES(width, height) ((gsize) (width) * (height) * 4)
+
+typedef struct
+{
+  cairo_surface_t *surface;
+  GdkVisual *visual;
+  /* Whether shelves are columns, for the sides */
+  gboolean vertical;
+  /* Along and across the shelves */
+  int length;
+  int depth;
+  /* FrameAtlasShelf, in the order they were made */
+  GList *shelves;
+  int n_pieces;
+} FrameAtlas;
+
+typedef struct
+{
+  /* Where the shelf starts across the atlas, and how deep it is */
+  int start;
+  int depth;
+  /* The MetaFramePieces on the shelf, in order along it */
+  GList *pieces;
+} FrameAtlasShelf;
+
+struct _MetaFrameAtlases
+{
+  gsize budget;
+  gsize bytes;
+  gsize used_bytes;
+
+  GList *atlases;
+  guint n_own_surfaces;
+  guint n_grows;
+  guint n_evictions;
+};
+
+/* How far @piece goes along a shelf, and how deep it is, in a wide
+ * atlas or, if @vertical, a tall one.
+ */
+#define PIECE_LENGTH(piece, vertical) \
+  ((vertical) ? (piece)->rect.height : (piece)->rect.width)
+#define PIECE_DEPTH(piece, vertical) \
+  ((vertical) ? (piece)->rect.width : (piece)->rect.height)
+#define PIECE_OFFSET(piece, vertical) \
+  ((vertical) ? (piece)->y : (piece)->x)
+
+/**
+ * meta_frame_atlases_new: (skip)
+ * @budget: most server memory to use, in bytes
+ *
+ * Returns: a new, empty #MetaFrameAtlases
+ */
+MetaFrameAtlases*
+meta_frame_atlases_new (gsize budget)
+{
+  MetaFrameAtlases *atlases;
+
+  atlases = g_new0 (MetaFrameAtlases, 1);
+  atlases->budget = budget;
+
+  return atlases;
+}
+
+static void
+atlas_free (FrameAtlas *atlas)
+{
+  g_list_free_full (atlas->shelves, g_free);
+  cairo_surface_destroy (atlas->surface);
+  g_free (atlas);
+}
+
+/**
+ * meta_frame_atlases_free: (skip)
+ * @atlases: a #MetaFrameAtlases
+ *
+ * Frees @atlases. Every piece given space must have been released.
+ */
+void
+meta_frame_atlases_free (MetaFrameAtlases *atlases)
+{
+  g_warn_if_fail (atlases->atlases == NULL && atlases->n_own_surfaces == 0);
+
+  g_list_free_full (atlases->atlases, (GDestroyNotify) atlas_free);
+  g_free (atlases);
+}
+
+/**
+ * meta_frame_atlases_release: (skip)
+ * @atlases: a #MetaFrameAtlases
+ * @piece: a piece given space by meta_frame_atlases_allocate()
+ *
+ * Gives back the space of @piece, if it has any. An atlas is freed
+ * with the last piece in it.
+ */
+void
+meta_frame_atlases_release (MetaFrameAtlases *atlases,
+                            MetaFramePiece   *piece)
+{
+  FrameAtlas *atlas = piece->atlas;
+  FrameAtlasShelf *piece_shelf = piece->shelf;
+
+  if (piece->pixmap == NULL)
+    return;
+
+  atlases->used_bytes -= SURFACE_BYTES (piece->rect.width,
+                                        piece->rect.height);
+
+  if (atlas == NULL)
+    {
+      atlases->bytes -= SURFACE_BYTES (piece->rect.width,
+                                       piece->rect.height);
+      atlases->n_own_surfaces -= 1;
+      cairo_surface_destroy (piece->pixmap);
+    }
+  else
+    {
+      piece_shelf->pieces = g_list_remove (piece_shelf->pieces, piece);
+      atlas->n_pieces -= 1;
+
+      /* Empty shelves at the end go, so the space can be shelved
+       * again at another depth.
+       */
+      while (atlas->shelves)
+        {
+          GList *last = g_list_last (atlas->shelves);
+          FrameAtlasShelf *shelf = last->data;
+
+          if (shelf->pieces)
+            break;
+
+          atlas->shelves = g_list_delete_link (atlas->shelves, last);
+          g_free (shelf);
+        }
+
+      if (atlas->n_pieces == 0)
+        {
+          atlases->atlases = g_list_remove (atlases->atlases, atlas);
+          atlases->bytes -= SURFACE_BYTES (atlas->length, atlas->depth);
+          atlas_free (atlas);
+        }
+    }
+
+  piece->pixmap = NULL;
+  piece->atlas = NULL;
+  piece->shelf = NULL;
+}
+
+/* Finds room for @length pixels on @shelf, in the first gap long
+ * enough; @next is set to the piece the new one goes before.
+ */
+static gboolean
+shelf_find_space (FrameAtlas      *atlas,
+                  FrameAtlasShelf *shelf,
+                  int              length,
+                  int             *offset,
+                  GList          **next)
+{
+  GList *l;
+  int gap = 0;
+
+  for (l = shelf->pieces; l; l = l->next)
+    {
+      MetaFramePiece *piece = l->data;
+
+      if (PIECE_OFFSET (piece, atlas->vertical) - gap >= length)
+        break;
+
+      gap = PIECE_OFFSET (piece, atlas->vertical) +
+            PIECE_LENGTH (piece, atlas->vertical);
+    }
+
+  if (l == NULL && atlas->length - gap < length)
+    return FALSE;
+
+  *offset = gap;
+  *next = l;
+  return TRUE;
+}
+
+static gboolean
+atlas_add_piece (MetaFrameAtlases *atlases,
+                 FrameAtlas       *atlas,
+                 MetaFramePiece   *piece)
+{
+  FrameAtlasShelf *shelf = NULL;
+  GList *l, *next = NULL;
+  int length = PIECE_LENGTH (piece, atlas->vertical);
+  int depth = PIECE_DEPTH (piece, atlas->vertical);
+  int offset = 0;
+
+  for (l = atlas->shelves; l; l = l->next)
+    {
+      FrameAtlasShelf *candidate = l->data;
+
+      /* Don't waste more than a third of a shelf on a shallow piece,
+       * unless the shelf is empty anyway
+       */
+      if (depth > candidate->depth ||
+          (candidate->pieces && depth * 3 < candidate->depth * 2))
+        continue;
+
+      if (shelf_find_space (atlas, candidate, length, &offset, &next))
+        {
+          shelf = candidate;
+          break;
+        }
+    }
+
+  if (shelf == NULL)
+    {
+      int start = 0;
+
+      if (atlas->shelves)
+        {
+          FrameAtlasShelf *last = g_list_last (atlas->shelves)->data;
+
+          start = last->start + last->depth;
+        }
+
+      if (start + depth > atlas->depth || length > atlas->length)
+        return FALSE;
+
+      shelf = g_new0 (FrameAtlasShelf, 1);
+      shelf->start = start;
+      shelf->depth = depth;
+      atlas->shelves = g_list_append (atlas->shelves, shelf);
+
+      offset = 0;
+      next = NULL;
+    }
+
+  shelf->pieces = g_list_insert_before (shelf->pieces, next, piece);
+  atlas->n_pieces += 1;
+  atlases->used_bytes += SURFACE_BYTES (piece->rect.width,
+                                        piece->rect.height);
+
+  piece->pixmap = atlas->surface;
+  piece->atlas = atlas;
+  piece->shelf = shelf;
+  if (atlas->vertical)
+    {
+      piece->x = shelf->start;
+      piece->y = offset;
+    }
+  else
+    {
+      piece->x = offset;
+      piece->y = shelf->start;
+    }
+
+  return TRUE;
+}
+
+static cairo_surface_t *
+create_atlas_surface (GdkWindow *window,
+                      gboolean   vertical,
+                      int        length,
+                      int        depth)
+{
+  return gdk_window_create_similar_surface (window,
+                                            CAIRO_CONTENT_COLOR,
+                                            vertical ? depth : length,
+                                            vertical ? length : depth);
+}
+
+/* The smallest power of two times @min that @size fits in */
+static int
+atlas_size_for (int size,
+                int min)
+{
+  int result = min;
+
+  while (result < size)
+    result *= 2;
+
+  return result;
+}
+
+/* The next size up that might make room in @atlas for @piece: long
+ * enough for it first, then deeper for more shelves, then longer for
+ * more on each shelf. Returns FALSE if @atlas can't grow any more.
+ */
+static gboolean
+atlas_next_size (FrameAtlas     *atlas,
+                 MetaFramePiece *piece,
+                 int            *length,
+                 int            *depth)
+{
+  *length = atlas->length;
+  *depth = atlas->depth;
+
+  if (PIECE_LENGTH (piece, atlas->vertical) > atlas->length)
+    *length = atlas_size_for (PIECE_LENGTH (piece, atlas->vertical),
+                              atlas->length);
+  else if (atlas->depth < FRAME_ATLAS_MAX_DEPTH)
+    *depth = atlas->depth * 2;
+  else if (atlas->length < FRAME_ATLAS_MAX_LENGTH)
+    *length = atlas->length * 2;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Moves @atlas to a bigger surface. Pieces keep their place, so what
+ * was drawn is copied over rather than drawn again.
+ */
+static void
+atlas_resize (FrameAtlas *atlas,
+              GdkWindow  *window,
+              int         length,
+              int         depth)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  GList *s, *p;
+
+  surface = create_atlas_surface (window, atlas->vertical, length, depth);
+
+  cr = cairo_create (surface);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface (cr, atlas->surface, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  cairo_surface_destroy (atlas->surface);
+  atlas->surface = surface;
+  atlas->length = length;
+  atlas->depth = depth;
+
+  for (s = atlas->shelves; s; s = s->next)
+    {
+      FrameAtlasShelf *shelf = s->data;
+
+      for (p = shelf->pieces; p; p = p->next)
+        ((MetaFramePiece *) p->data)->pixmap = surface;
+    }
+}
+
+/**
+ * meta_frame_atlases_allocate: (skip)
+ * @atlases: a #MetaFrameAtlases
+ * @window: the window the piece will be drawn for
+ * @piece: a piece with its rect set and no space yet
+ * @evict: (allow-none): called to free some space when there is not
+ *   enough left in the budget
+ * @user_data: data for @evict
+ *
+ * Gives @piece space to be drawn in, in an atlas of the same visual as
+ * @window. Pieces already in the atlases may be moved to a new surface
+ * when one grows, but never to another place on it.
+ *
+ * Returns: %FALSE if @piece doesn't fit in the budget even after
+ *   @evict gave up
+ */
+gboolean
+meta_frame_atlases_allocate (MetaFrameAtlases        *atlases,
+                             GdkWindow               *window,
+                             MetaFramePiece          *piece,
+                             MetaFrameAtlasEvictFunc  evict,
+                             gpointer                 user_data)
+{
+  GdkVisual *visual;
+  FrameAtlas *atlas, *grow;
+  gboolean vertical;
+  gboolean own_surface;
+  int length = 0, depth = 0;
+  gsize needed;
+  GList *l;
+
+  g_return_val_if_fail (piece->pixmap == NULL, TRUE);
+
+  visual = gdk_window_get_visual (window);
+  vertical = piece->rect.height > piece->rect.width;
+  own_surface = PIECE_LENGTH (piece, vertical) > FRAME_ATLAS_MAX_LENGTH ||
+                PIECE_DEPTH (piece, vertical) > FRAME_ATLAS_MAX_DEPTH;
+
+  while (TRUE)
+    {
+      grow = NULL;
+
+      if (own_surface)
+        {
+          needed = SURFACE_BYTES (piece->rect.width, piece->rect.height);
+        }
+      else
+        {
+          for (l = atlases->atlases; l; l = l->next)
+            {
+              atlas = l->data;
+
+              if (atlas->visual != visual || atlas->vertical != vertical)
+                continue;
+
+              if (atlas_add_piece (atlases, atlas, piece))
+                return TRUE;
+
+              if (grow == NULL &&
+                  atlas_next_size (atlas, piece, &length, &depth))
+                grow = atlas;
+            }
+
+          if (grow)
+            {
+              needed = SURFACE_BYTES (length, depth) -
+                       SURFACE_BYTES (grow->length, grow->depth);
+            }
+          else
+            {
+              length = atlas_size_for (PIECE_LENGTH (piece, vertical),
+                                       FRAME_ATLAS_MIN_LENGTH);
+              depth = atlas_size_for (PIECE_DEPTH (piece, vertical),
+                                      FRAME_ATLAS_MIN_DEPTH);
+              needed = SURFACE_BYTES (length, depth);
+            }
+        }
+
+      if (atlases->bytes + needed <= atlases->budget)
+        {
+          if (grow == NULL)
+            break;
+
+          /* and try again with the room that made */
+          atlases->bytes += needed;
+          atlases->n_grows += 1;
+          atlas_resize (grow, window, length, depth);
+          continue;
+        }
+
+      if (evict == NULL || !(* evict) (user_data))
+        return FALSE;
+
+      atlases->n_evictions += 1;
+    }
+
+  atlases->bytes += needed;
+
+  if (own_surface)
+    {
+      piece->pixmap = gdk_window_create_similar_surface (window,
+                                                         CAIRO_CONTENT_COLOR,
+                                                         piece->rect.width,
+                                                         piece->rect.height);
+      piece->x = 0;
+      piece->y = 0;
+      atlases->n_own_surfaces += 1;
+      atlases->used_bytes += needed;
+      return TRUE;
+    }
+
+  atlas = g_new0 (FrameAtlas, 1);
+  atlas->visual = visual;
+  atlas->vertical = vertical;
+  atlas->length = length;
+  atlas->depth = depth;
+  atlas->surface = create_atlas_surface (window, vertical, length, depth);
+  atlases->atlases = g_list_prepend (atlases->atlases, atlas);
+
+  return atlas_add_piece (atlases, atlas, piece);
+}
+
+/**
+ * meta_frame_atlases_get_stats: (skip)
+ * @atlases: a #MetaFrameAtlases
+ * @stats: (out): where to put the figures
+ *
+ * Reports how much memory the atlases hold and how well it is used.
+ */
+void
+meta_frame_atlases_get_stats (MetaFrameAtlases    *atlases,
+                              MetaFrameAtlasStats *stats)
+{
+  GList *l;
+
+  stats->bytes = atlases->bytes;
+  stats->used_bytes = atlases->used_bytes;
+  stats->n_wide_atlases = 0;
+  stats->n_tall_atlases = 0;
+  stats->n_own_surfaces = atlases->n_own_surfaces;
+  stats->n_grows = atlases->n_grows;
+  stats->n_evictions = atlases->n_evictions;
+
+  for (l = atlases->atlases; l; l = l->next)
+    {
+      FrameAtlas *atlas = l->data;
+
+      if (atlas->vertical)
+        stats->n_tall_atlases += 1;
+      else
+        stats->n_wide_atlases += 1;
+    }
+}
+
+/**
+ * meta_frame_get_piece_rects: (skip)
+ * @borders: the borders of the frame
+ * @client_width: width of the client window
+ * @client_height: height of the client window
+ * @rects: (out): the pieces, in frame coordinates
+ *
+ * Splits the visible part of a frame into the four pieces that get
+ * cached: first top, then left, right and bottom. Top and bottom
+ * extend to the invisible borders while left and right snugly fit in
+ * between:
+ *   -----
+ *   |   |
+ *   -----
+ */
+void
+meta_frame_get_piece_rects (const MetaFrameBorders *borders,
+                            int                     client_width,
+                            int                     client_height,
+                            cairo_rectangle_int_t   rects[4])
+{
+  /* top */
+  rects[0].x = borders->invisible.left;
+  rects[0].y = borders->invisible.top;
+  rects[0].width = client_width + borders->visible.left +
+                   borders->visible.right;
+  rects[0].height = borders->visible.top;
+
+  /* left */
+  rects[1].x = borders->invisible.left;
+  rects[1].y = borders->total.top;
+  rects[1].height = client_height;
+  rects[1].width = borders->visible.left;
+
+  /* right */
+  rects[2].x = borders->total.left + client_width;
+  rects[2].y = borders->total.top;
+  rects[2].width = borders->visible.right;
+  rects[2].height = client_height;
+
+  /* bottom */
+  rects[3].x = borders->invisible.left;
+  rects[3].y = borders->total.top + client_height;
+  rects[3].width = client_width + borders->visible.left +
+                   borders->visible.right;
+  rects[3].height = borders->visible.bottom;
+}
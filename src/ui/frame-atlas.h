@@ -0,0 +1,100 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin frame piece atlases */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_FRAME_ATLAS_H
+#define META_FRAME_ATLAS_H
+
+#include <gtk/gtk.h>
+#include <meta/common.h>
+
+/* Rendered frame pieces are packed into a few shared server-side
+ * surfaces (atlases) instead of one surface each, in shelves of
+ * similar depth. Wide pieces, the titlebar and the bottom, go in wide
+ * atlases with shelves stacked top to bottom; tall pieces, the sides,
+ * go in tall atlases with shelves side by side.
+ *
+ * Atlases start out just big enough for their first piece and double
+ * in size when they fill up, up to a limit. A piece too big for the
+ * largest atlas gets a surface of its own. All of it counts against
+ * the budget the atlases were made with; what to drop to stay under
+ * it is left to the caller.
+ */
+
+/* What the frames widget keeps its cached pieces under; the pieces of
+ * the frames drawn least recently are dropped to stay under it.
+ */
+#define META_FRAME_CACHE_BUDGET (16 * 1024 * 1024)
+
+typedef struct _MetaFrameAtlases MetaFrameAtlases;
+
+typedef struct
+{
+  /* Where the piece goes in the frame */
+  cairo_rectangle_int_t rect;
+
+  /* The surface it is drawn in and where, or %NULL if it has no space */
+  cairo_surface_t *pixmap;
+  int x;
+  int y;
+
+  /*< private >*/
+  gpointer atlas;
+  gpointer shelf;
+} MetaFramePiece;
+
+typedef struct
+{
+  /* Server memory held, and how much of it pieces are drawn in */
+  gsize bytes;
+  gsize used_bytes;
+
+  guint n_wide_atlases;
+  guint n_tall_atlases;
+  guint n_own_surfaces;
+
+  /* Times an atlas was made bigger, and room was made by the caller */
+  guint n_grows;
+  guint n_evictions;
+} MetaFrameAtlasStats;
+
+/* Called to free some space; returns FALSE if nothing more can go */
+typedef gboolean (* MetaFrameAtlasEvictFunc) (gpointer user_data);
+
+MetaFrameAtlases *meta_frame_atlases_new       (gsize                    budget);
+void              meta_frame_atlases_free      (MetaFrameAtlases        *atlases);
+
+gboolean          meta_frame_atlases_allocate  (MetaFrameAtlases        *atlases,
+                                                GdkWindow               *window,
+                                                MetaFramePiece          *piece,
+                                                MetaFrameAtlasEvictFunc  evict,
+                                                gpointer                 user_data);
+void              meta_frame_atlases_release   (MetaFrameAtlases        *atlases,
+                                                MetaFramePiece          *piece);
+
+void              meta_frame_atlases_get_stats (MetaFrameAtlases        *atlases,
+                                                MetaFrameAtlasStats     *stats);
+
+void              meta_frame_get_piece_rects   (const MetaFrameBorders  *borders,
+                                                int                      client_width,
+                                                int                      client_height,
+                                                cairo_rectangle_int_t    rects[4]);
+
+#endif
@@ -44,6 +44,9 @@
 
 #define DEFAULT_INNER_BUTTON_BORDER 3
 
+/* Width steps, in pixels, at which frames stop sharing title layouts */
+#define TITLE_WIDTH_BUCKET 64
+
 static void meta_frames_destroy       (GtkWidget       *object);
 static void meta_frames_finalize      (GObject         *object);
 static void meta_frames_style_updated (GtkWidget       *widget);
@@ -84,6 +87,8 @@ static void meta_frames_calc_geometry (MetaFrames        *frames,
 
 static void meta_frames_ensure_layout (MetaFrames      *frames,
                                        MetaUIFrame     *frame);
+static void meta_frames_release_layout (MetaFrames     *frames,
+                                        MetaUIFrame    *frame);
 
 static MetaUIFrame* meta_frames_lookup_window (MetaFrames *frames,
                                                Window      xwindow);
@@ -180,7 +185,9 @@ prefs_changed_callback (MetaPreference pref,
       meta_frames_font_changed (META_FRAMES (data));
       break;
     case META_PREF_BUTTON_LAYOUT:
-      meta_frames_button_layout_changed (META_FRAMES (data));
+      /* a font change already redraws every frame */
+      if (!meta_prefs_changed_in_batch (META_PREF_TITLEBAR_FONT))
+        meta_frames_button_layout_changed (META_FRAMES (data));
       break;
     default:
       break;
@@ -259,6 +266,7 @@ static void
 meta_frames_init (MetaFrames *frames)
 {
   frames->text_heights = g_hash_table_new (NULL, NULL);
+  frames->title_layouts = g_hash_table_new (g_str_hash, g_str_equal);
   
   frames->frames = g_hash_table_new (unsigned_long_hash, unsigned_long_equal);
 
@@ -269,6 +277,8 @@ meta_frames_init (MetaFrames *frames)
   frames->invalidate_cache_timeout_id = 0;
   frames->invalidate_frames = NULL;
   frames->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_queue_init (&frames->cache_lru);
+  frames->atlases = meta_frame_atlases_new (META_FRAME_CACHE_BUDGET);
 
   frames->style_variants = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                   g_free, g_object_unref);
@@ -277,6 +287,11 @@ meta_frames_init (MetaFrames *frames)
 
   gtk_widget_set_double_buffered (GTK_WIDGET (frames), FALSE);
 
+  /* Until a compositor is there to paint them, see
+   * meta_frames_set_composited()
+   */
+  frames->composited = FALSE;
+
   meta_prefs_add_listener (prefs_changed_callback, frames);
 }
 
@@ -337,6 +352,7 @@ meta_frames_finalize (GObject *object)
   meta_prefs_remove_listener (prefs_changed_callback, frames);
   
   g_hash_table_destroy (frames->text_heights);
+  g_hash_table_destroy (frames->title_layouts);
 
   invalidate_all_caches (frames);
   if (frames->invalidate_cache_timeout_id) {
@@ -347,22 +363,20 @@ meta_frames_finalize (GObject *object)
   g_assert (g_hash_table_size (frames->frames) == 0);
   g_hash_table_destroy (frames->frames);
   g_hash_table_destroy (frames->cache);
+  meta_frame_atlases_free (frames->atlases);
 
   G_OBJECT_CLASS (meta_frames_parent_class)->finalize (object);
 }
 
 typedef struct
 {
-  cairo_rectangle_int_t rect;
-  cairo_surface_t *pixmap;
-} CachedFramePiece;
+  MetaUIFrame *frame;
+  GList *link; /* in frames->cache_lru */
 
-typedef struct
-{
   /* Caches of the four rendered sides in a MetaFrame.
    * Order: top (titlebar), left, right, bottom.
    */
-  CachedFramePiece piece[4];
+  MetaFramePiece piece[4];
 } CachedPixels;
 
 static CachedPixels *
@@ -376,6 +390,9 @@ get_cache (MetaFrames *frames,
   if (!pixels)
     {
       pixels = g_new0 (CachedPixels, 1);
+      pixels->frame = frame;
+      g_queue_push_head (&frames->cache_lru, pixels);
+      pixels->link = frames->cache_lru.head;
       g_hash_table_insert (frames->cache, frame, pixels);
     }
 
@@ -386,17 +403,84 @@ static void
 invalidate_cache (MetaFrames *frames,
                   MetaUIFrame *frame)
 {
-  CachedPixels *pixels = get_cache (frames, frame);
+  CachedPixels *pixels;
   int i;
+
+  pixels = g_hash_table_lookup (frames->cache, frame);
+  if (pixels == NULL)
+    return;
   
   for (i = 0; i < 4; i++)
-    if (pixels->piece[i].pixmap)
-      cairo_surface_destroy (pixels->piece[i].pixmap);
-  
+    meta_frame_atlases_release (frames->atlases, &pixels->piece[i]);
+
+  g_queue_delete_link (&frames->cache_lru, pixels->link);
   g_free (pixels);
   g_hash_table_remove (frames->cache, frame);
 }
 
+typedef struct
+{
+  MetaFrames *frames;
+  CachedPixels *drawing;
+} EvictData;
+
+/* Drops the pieces of the frame drawn least recently, but never those
+ * of the frame being drawn
+ */
+static gboolean
+evict_least_recent (gpointer user_data)
+{
+  EvictData *data = user_data;
+  CachedPixels *victim;
+
+  victim = g_queue_peek_tail (&data->frames->cache_lru);
+  if (victim == data->drawing)
+    victim = victim->link->prev ? victim->link->prev->data : NULL;
+  if (victim == NULL)
+    return FALSE;
+
+  invalidate_cache (data->frames, victim->frame);
+  return TRUE;
+}
+
+/* Gives @piece somewhere to be drawn, evicting other frames' pieces
+ * to stay in budget. Returns FALSE if it can't be cached at all.
+ */
+static gboolean
+allocate_piece (MetaFrames     *frames,
+                MetaUIFrame    *frame,
+                CachedPixels   *pixels,
+                MetaFramePiece *piece)
+{
+  EvictData data;
+
+  data.frames = frames;
+  data.drawing = pixels;
+
+  return meta_frame_atlases_allocate (frames->atlases, frame->window, piece,
+                                      evict_least_recent, &data);
+}
+
+/**
+ * meta_frames_get_cache_stats: (skip)
+ * @frames: the frames widget
+ * @hits: (out): frame pieces drawn from the cache
+ * @misses: (out): frame pieces that had to be rendered
+ * @atlas_stats: (out): how the memory the cache holds is used
+ *
+ * Reports how well the frame piece cache is doing.
+ */
+LOCAL_SYMBOL void
+meta_frames_get_cache_stats (MetaFrames          *frames,
+                             guint               *hits,
+                             guint               *misses,
+                             MetaFrameAtlasStats *atlas_stats)
+{
+  *hits = frames->cache_hits;
+  *misses = frames->cache_misses;
+  meta_frame_atlases_get_stats (frames->atlases, atlas_stats);
+}
+
 static void
 invalidate_all_caches (MetaFrames *frames)
 {
@@ -417,9 +501,20 @@ static gboolean
 invalidate_cache_timeout (gpointer data)
 {
   MetaFrames *frames = data;
-  
+  MetaFrameAtlasStats stats;
+  guint hits, misses;
+
+  meta_frames_get_cache_stats (frames, &hits, &misses, &stats);
+  meta_verbose ("Frame cache: %" G_GSIZE_FORMAT " bytes (%" G_GSIZE_FORMAT
+                " drawn on) in %u wide and %u tall atlases and %u other "
+                "surfaces; %u hits, %u misses, %u evictions\n",
+                stats.bytes, stats.used_bytes, stats.n_wide_atlases,
+                stats.n_tall_atlases, stats.n_own_surfaces,
+                hits, misses, stats.n_evictions);
+
   invalidate_all_caches (frames);
   frames->invalidate_cache_timeout_id = 0;
+
   return FALSE;
 }
 
@@ -441,16 +536,7 @@ queue_recalc_func (gpointer key, gpointer value, gpointer data)
   invalidate_whole_window (frames, frame);
   meta_core_queue_frame_resize (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
                                 frame->xwindow);
-  if (frame->layout)
-    {
-      /* save title to recreate layout */
-      g_free (frame->title);
-      
-      frame->title = g_strdup (pango_layout_get_text (frame->layout));
-
-      g_object_unref (G_OBJECT (frame->layout));
-      frame->layout = NULL;
-    }
+  meta_frames_release_layout (frames, frame);
 }
 
 static void
@@ -514,6 +600,9 @@ meta_frames_style_updated  (GtkWidget *widget)
 
   meta_frames_font_changed (frames);
 
+  /* Rendered pieces may use colors from the old style */
+  meta_theme_flush_piece_cache ();
+
   update_style_contexts (frames);
 
   g_hash_table_foreach (frames->frames,
@@ -522,6 +611,63 @@ meta_frames_style_updated  (GtkWidget *widget)
   GTK_WIDGET_CLASS (meta_frames_parent_class)->style_updated (widget);
 }
 
+static int
+get_text_height (MetaFrames           *frames,
+                 PangoFontDescription *font_desc)
+{
+  gpointer key, value;
+  int size;
+  int text_height;
+
+  size = pango_font_description_get_size (font_desc);
+
+  if (g_hash_table_lookup_extended (frames->text_heights,
+                                    GINT_TO_POINTER (size),
+                                    &key, &value))
+    return GPOINTER_TO_INT (value);
+
+  text_height =
+    meta_pango_font_desc_get_text_height (font_desc,
+                                          gtk_widget_get_pango_context (GTK_WIDGET (frames)));
+
+  g_hash_table_replace (frames->text_heights,
+                        GINT_TO_POINTER (size),
+                        GINT_TO_POINTER (text_height));
+
+  return text_height;
+}
+
+/* Drops the frame's title layout, keeping the title to make a new one */
+static void
+meta_frames_release_layout (MetaFrames  *frames,
+                            MetaUIFrame *frame)
+{
+  MetaTitleLayout *title_layout = frame->title_layout;
+
+  if (title_layout == NULL)
+    return;
+
+  g_free (frame->title);
+  frame->title = g_strdup (pango_layout_get_text (title_layout->layout));
+
+  frame->title_layout = NULL;
+  frame->layout = NULL;
+
+  title_layout->ref_count -= 1;
+  if (title_layout->ref_count == 0)
+    {
+      g_hash_table_remove (frames->title_layouts, title_layout->key);
+      g_object_unref (G_OBJECT (title_layout->layout));
+      g_free (title_layout->key);
+      g_free (title_layout);
+    }
+}
+
+/* Frames showing the same title in the same font share a layout, so
+ * it is only shaped once; they are told apart by width, in steps of
+ * TITLE_WIDTH_BUCKET pixels, so that frames of very different widths
+ * don't keep re-ellipsizing each other's layout.
+ */
 static void
 meta_frames_ensure_layout (MetaFrames  *frames,
                            MetaUIFrame *frame)
@@ -530,6 +676,8 @@ meta_frames_ensure_layout (MetaFrames  *frames,
   MetaFrameFlags flags;
   MetaFrameType type;
   MetaFrameStyle *style;
+  int client_width;
+  int width_bucket;
 
   widget = GTK_WIDGET (frames);
 
@@ -538,70 +686,76 @@ meta_frames_ensure_layout (MetaFrames  *frames,
   meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
                  META_CORE_GET_FRAME_FLAGS, &flags,
                  META_CORE_GET_FRAME_TYPE, &type,
+                 META_CORE_GET_CLIENT_WIDTH, &client_width,
                  META_CORE_GET_END);
 
   style = meta_theme_get_frame_style (meta_theme_get_current (),
                                       type, flags);
 
-  if (style != frame->cache_style)
-    {
-      if (frame->layout)
-        {
-          /* save title to recreate layout */
-          g_free (frame->title);
-          
-          frame->title = g_strdup (pango_layout_get_text (frame->layout));
+  width_bucket = client_width / TITLE_WIDTH_BUCKET;
 
-          g_object_unref (G_OBJECT (frame->layout));
-          frame->layout = NULL;
-        }
-    }
+  if (style != frame->cache_style ||
+      (frame->title_layout != NULL &&
+       frame->title_layout->width_bucket != width_bucket))
+    meta_frames_release_layout (frames, frame);
 
   frame->cache_style = style;
   
   if (frame->layout == NULL)
     {
-      gpointer key, value;
+      MetaTitleLayout *title_layout;
       PangoFontDescription *font_desc;
+      char *font_name;
+      char *key;
       double scale;
-      int size;
       
       scale = meta_theme_get_title_scale (meta_theme_get_current (),
                                           type,
                                           flags);
       
-      frame->layout = gtk_widget_create_pango_layout (widget, frame->title);
-
-      pango_layout_set_ellipsize (frame->layout, PANGO_ELLIPSIZE_END);
-      pango_layout_set_auto_dir (frame->layout, FALSE);
-      
       font_desc = meta_gtk_widget_get_font_desc (widget, scale,
                                                  meta_prefs_get_titlebar_font ());
 
-      size = pango_font_description_get_size (font_desc);
+      /* The font description includes the size, hence the scale */
+      font_name = pango_font_description_to_string (font_desc);
+      key = g_strdup_printf ("%d|%s|%s", width_bucket, font_name,
+                             frame->title ? frame->title : "");
+      g_free (font_name);
 
-      if (g_hash_table_lookup_extended (frames->text_heights,
-                                        GINT_TO_POINTER (size),
-                                        &key, &value))
+      title_layout = g_hash_table_lookup (frames->title_layouts, key);
+      if (title_layout != NULL)
         {
-          frame->text_height = GPOINTER_TO_INT (value);
+          title_layout->ref_count += 1;
+          g_free (key);
         }
       else
         {
-          frame->text_height =
-            meta_pango_font_desc_get_text_height (font_desc,
-                                                  gtk_widget_get_pango_context (widget));
-
-          g_hash_table_replace (frames->text_heights,
-                                GINT_TO_POINTER (size),
-                                GINT_TO_POINTER (frame->text_height));
+          title_layout = g_new0 (MetaTitleLayout, 1);
+          title_layout->key = key;
+          title_layout->width_bucket = width_bucket;
+          title_layout->ref_count = 1;
+          title_layout->layout = gtk_widget_create_pango_layout (widget,
+                                                                 frame->title);
+
+          pango_layout_set_ellipsize (title_layout->layout,
+                                      PANGO_ELLIPSIZE_END);
+          pango_layout_set_auto_dir (title_layout->layout, FALSE);
+          pango_layout_set_font_description (title_layout->layout,
+                                             font_desc);
+
+          title_layout->text_height =
+            get_text_height (frames, font_desc);
+
+          g_hash_table_insert (frames->title_layouts,
+                               title_layout->key, title_layout);
         }
-      
-      pango_layout_set_font_description (frame->layout, 
-                                         font_desc);
-      
+
       pango_font_description_free (font_desc);
 
+      frame->title_layout = title_layout;
+      frame->layout = title_layout->layout;
+      frame->text_height = title_layout->text_height;
+
       /* Save some RAM */
       g_free (frame->title);
       frame->title = NULL;
@@ -701,6 +855,7 @@ meta_frames_manage_window (MetaFrames *frames,
   
   frame->xwindow = xwindow;
   frame->cache_style = NULL;
+  frame->title_layout = NULL;
   frame->layout = NULL;
   frame->text_height = -1;
   frame->title = NULL;
@@ -732,6 +887,7 @@ meta_frames_unmanage_window (MetaFrames *frames,
        * is not actually referenced anymore
        */
       invalidate_all_caches (frames);
+      invalidate_cache (frames, frame);
       
       /* restore the cursor */
       meta_core_set_screen_cursor (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
@@ -749,8 +905,7 @@ meta_frames_unmanage_window (MetaFrames *frames,
 
       gdk_window_destroy (frame->window);
 
-      if (frame->layout)
-        g_object_unref (G_OBJECT (frame->layout));
+      meta_frames_release_layout (frames, frame);
 
       if (frame->title)
         g_free (frame->title);
@@ -1068,6 +1223,38 @@ meta_frames_queue_draw (MetaFrames *frames,
   invalidate_whole_window (frames, frame);
 }
 
+/**
+ * meta_frames_set_composited: (skip)
+ * @frames: a #MetaFrames
+ * @composited: whether a compositor manages the screen
+ *
+ * With MUFFIN_COMPOSITED_FRAMES set, the contents of frames are painted
+ * by the compositor instead of into the frame windows. That only works
+ * while there is a compositor, so this is switched on when it manages
+ * the screen and off again before it goes away; existing frames are
+ * repainted the new way.
+ */
+LOCAL_SYMBOL void
+meta_frames_set_composited (MetaFrames *frames,
+                            gboolean    composited)
+{
+  GHashTableIter iter;
+  MetaUIFrame *frame;
+
+  composited = composited && g_getenv ("MUFFIN_COMPOSITED_FRAMES") != NULL;
+  if (composited == frames->composited)
+    return;
+
+  frames->composited = composited;
+
+  g_hash_table_iter_init (&iter, frames->frames);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &frame))
+    {
+      meta_frames_set_window_background (frames, frame);
+      invalidate_whole_window (frames, frame);
+    }
+}
+
 LOCAL_SYMBOL void
 meta_frames_set_title (MetaFrames *frames,
                        Window      xwindow,
@@ -1079,14 +1266,10 @@ meta_frames_set_title (MetaFrames *frames,
 
   g_assert (frame);
   
+  meta_frames_release_layout (frames, frame);
+
   g_free (frame->title);
   frame->title = g_strdup (title);
-  
-  if (frame->layout)
-    {
-      g_object_unref (frame->layout);
-      frame->layout = NULL;
-    }
 
   invalidate_whole_window (frames, frame);
 }
@@ -1115,6 +1298,10 @@ meta_frames_repaint_frame (MetaFrames *frames,
 
   g_assert (frame);
 
+  /* The compositor picks the frame up when it next paints */
+  if (frames->composited)
+    return;
+
   /* repaint everything, so the other frame don't
    * lag behind if they are exposed
    */
@@ -1128,6 +1315,12 @@ redraw_control (MetaFrames *frames,
 {
   MetaFrameGeometry fgeom;
   GdkRectangle *rect;
+
+  if (frames->composited)
+    {
+      invalidate_whole_window (frames, frame);
+      return;
+    }
   
   meta_frames_calc_geometry (frames, frame, &fgeom);
 
@@ -2034,27 +2227,21 @@ setup_bg_cr (cairo_t *cr, GdkWindow *window, int x_offset, int y_offset)
     }
 }
 
-/* Returns a pixmap with a piece of the windows frame painted on it.
+/* Paints a piece of the windows frame into the space allocated for it.
 */
 
-static cairo_surface_t *
-generate_pixmap (MetaFrames            *frames,
-                 MetaUIFrame           *frame,
-                 cairo_rectangle_int_t *rect)
+static void
+generate_pixmap (MetaFrames       *frames,
+                 MetaUIFrame      *frame,
+                 MetaFramePiece   *piece)
 {
-  cairo_surface_t *result;
   cairo_t *cr;
 
-  /* do not create a pixmap for nonexisting areas */
-  if (rect->width <= 0 || rect->height <= 0)
-    return NULL;
-
-  result = gdk_window_create_similar_surface (frame->window,
-                                              CAIRO_CONTENT_COLOR,
-                                              rect->width, rect->height);
-  
-  cr = cairo_create (result);
-  cairo_translate (cr, -rect->x, -rect->y);
+  cr = cairo_create (piece->pixmap);
+  cairo_rectangle (cr, piece->x, piece->y,
+                   piece->rect.width, piece->rect.height);
+  cairo_clip (cr);
+  cairo_translate (cr, piece->x - piece->rect.x, piece->y - piece->rect.y);
 
   setup_bg_cr (cr, frame->window, 0, 0);
   cairo_paint (cr);
@@ -2062,8 +2249,6 @@ generate_pixmap (MetaFrames            *frames,
   meta_frames_paint (frames, frame, cr);
 
   cairo_destroy (cr);
-
-  return result;
 }
 
 
@@ -2075,6 +2260,7 @@ populate_cache (MetaFrames *frames,
   int width, height;
   int frame_width, frame_height, screen_width, screen_height;
   CachedPixels *pixels;
+  cairo_rectangle_int_t rects[4];
   MetaFrameType frame_type;
   MetaFrameFlags frame_flags;
   int i;
@@ -2106,48 +2292,39 @@ populate_cache (MetaFrames *frames,
 
   pixels = get_cache (frames, frame);
 
-  /* Setup the rectangles for the four visible frame borders. First top, then
-   * left, right and bottom. Top and bottom extend to the invisible borders
-   * while left and right snugly fit in between:
-   *   -----
-   *   |   |
-   *   -----
-   */
+  g_queue_unlink (&frames->cache_lru, pixels->link);
+  g_queue_push_head_link (&frames->cache_lru, pixels->link);
 
   /* width and height refer to the client window's
    * size without any border added. */
-
-  /* top */
-  pixels->piece[0].rect.x = borders.invisible.left;
-  pixels->piece[0].rect.y = borders.invisible.top;
-  pixels->piece[0].rect.width = width + borders.visible.left + borders.visible.right;
-  pixels->piece[0].rect.height = borders.visible.top;
-
-  /* left */
-  pixels->piece[1].rect.x = borders.invisible.left;
-  pixels->piece[1].rect.y = borders.total.top;
-  pixels->piece[1].rect.height = height;
-  pixels->piece[1].rect.width = borders.visible.left;
-
-  /* right */
-  pixels->piece[2].rect.x = borders.total.left + width;
-  pixels->piece[2].rect.y = borders.total.top;
-  pixels->piece[2].rect.width = borders.visible.right;
-  pixels->piece[2].rect.height = height;
-
-  /* bottom */
-  pixels->piece[3].rect.x = borders.invisible.left;
-  pixels->piece[3].rect.y = borders.total.top + height;
-  pixels->piece[3].rect.width = width + borders.visible.left + borders.visible.right;
-  pixels->piece[3].rect.height = borders.visible.bottom;
+  meta_frame_get_piece_rects (&borders, width, height, rects);
 
   for (i = 0; i < 4; i++)
     {
-      CachedFramePiece *piece = &pixels->piece[i];
-      /* generate_pixmap() returns NULL for 0 width/height pieces, but
-       * does so cheaply so we don't need to cache the NULL return */
-      if (!piece->pixmap)
-        piece->pixmap = generate_pixmap (frames, frame, &piece->rect);
+      MetaFramePiece *piece = &pixels->piece[i];
+
+      /* The space allocated for a piece is only good for its size */
+      if (piece->pixmap &&
+          (piece->rect.width != rects[i].width ||
+           piece->rect.height != rects[i].height))
+        meta_frame_atlases_release (frames->atlases, piece);
+
+      piece->rect = rects[i];
+
+      /* do not create a pixmap for nonexisting areas */
+      if (piece->rect.width <= 0 || piece->rect.height <= 0)
+        continue;
+
+      if (piece->pixmap)
+        {
+          frames->cache_hits += 1;
+          continue;
+        }
+
+      frames->cache_misses += 1;
+
+      if (allocate_piece (frames, frame, pixels, piece))
+        generate_pixmap (frames, frame, piece);
     }
   
   if (frames->invalidate_cache_timeout_id) {
@@ -2238,14 +2415,17 @@ cached_pixels_draw (CachedPixels   *pixels,
 
   for (i = 0; i < 4; i++)
     {
-      CachedFramePiece *piece;
+      MetaFramePiece *piece;
       piece = &pixels->piece[i];
       
       if (piece->pixmap)
         {
           cairo_set_source_surface (cr, piece->pixmap,
-                                    piece->rect.x, piece->rect.y);
-          cairo_paint (cr);
+                                    piece->rect.x - piece->x,
+                                    piece->rect.y - piece->y);
+          cairo_rectangle (cr, piece->rect.x, piece->rect.y,
+                           piece->rect.width, piece->rect.height);
+          cairo_fill (cr);
           
           region_piece = cairo_region_create_rectangle (&piece->rect);
           cairo_region_subtract (region, region_piece);
@@ -2275,6 +2455,10 @@ meta_frames_draw (GtkWidget *widget,
   if (frame == NULL)
     return FALSE;
 
+  /* Nothing is drawn into the X window of a composited frame */
+  if (frames->composited)
+    return TRUE;
+
   if (frames->expose_delay_count > 0)
     {
       /* Redraw this entire frame later */
@@ -2286,9 +2470,10 @@ meta_frames_draw (GtkWidget *widget,
 
   region = cairo_region_create_rectangle (&clip);
   
-  pixels = get_cache (frames, frame);
-
-  cached_pixels_draw (pixels, cr, region);
+  /* Frames too large to cache have no pieces */
+  pixels = g_hash_table_lookup (frames->cache, frame);
+  if (pixels)
+    cached_pixels_draw (pixels, cr, region);
   
   clip_to_screen (region, frame);
   subtract_client_area (region, frame);
@@ -2459,6 +2644,14 @@ meta_frames_set_window_background (MetaFrames   *frames,
   MetaFrameStyle *style = NULL;
   gboolean frame_exists;
 
+  /* Keep the X server from painting a window nobody looks at */
+  if (frames->composited)
+    {
+      set_background_none (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                           frame->xwindow);
+      return;
+    }
+
   meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
                  META_CORE_WINDOW_HAS_FRAME, &frame_exists,
                  META_CORE_GET_FRAME_FLAGS, &flags,
@@ -2496,6 +2689,141 @@ meta_frames_set_window_background (MetaFrames   *frames,
     }
  }
 
+/* Paints what the X server would have filled the frame window with;
+ * see meta_frames_set_window_background()
+ */
+static void
+paint_frame_background (MetaFrames  *frames,
+                        MetaUIFrame *frame,
+                        cairo_t     *cr,
+                        int          width,
+                        int          height)
+{
+  MetaFrameFlags flags;
+  MetaFrameType type;
+  MetaFrameStyle *style;
+
+  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
+                 META_CORE_GET_FRAME_FLAGS, &flags,
+                 META_CORE_GET_FRAME_TYPE, &type,
+                 META_CORE_GET_END);
+
+  style = meta_theme_get_frame_style (meta_theme_get_current (), type, flags);
+
+  if (style && style->window_background_color != NULL)
+    {
+      GdkRGBA color;
+      GdkVisual *visual;
+
+      meta_color_spec_render (style->window_background_color,
+                              frame->style,
+                              &color);
+
+      visual = gtk_widget_get_visual (GTK_WIDGET (frames));
+      if (gdk_visual_get_depth (visual) == 32) /* we have ARGB */
+        color.alpha = style->window_background_alpha / 255.0;
+
+      gdk_cairo_set_source_rgba (cr, &color);
+      cairo_paint (cr);
+    }
+  else
+    {
+      gtk_render_background (frame->style, cr, 0, 0, width, height);
+    }
+}
+
+/* Clips to the visible part of the frame, outside the client, with
+ * the same rounded corners the compositor gives X frames.
+ */
+static void
+clip_to_frame_shape (cairo_t           *cr,
+                     MetaFrameGeometry *fgeom,
+                     int                width,
+                     int                height)
+{
+  cairo_rectangle_int_t visible, client;
+  double top_left, top_right, bottom_left, bottom_right;
+  double x0, y0, x1, y1;
+
+#define CORNER_RADIUS(r) ((r) ? (r) + sqrt (r) : 0.0)
+  top_left = CORNER_RADIUS (fgeom->top_left_corner_rounded_radius);
+  top_right = CORNER_RADIUS (fgeom->top_right_corner_rounded_radius);
+  bottom_left = CORNER_RADIUS (fgeom->bottom_left_corner_rounded_radius);
+  bottom_right = CORNER_RADIUS (fgeom->bottom_right_corner_rounded_radius);
+#undef CORNER_RADIUS
+
+  get_visible_frame_rect (fgeom, width, height, &visible);
+  get_client_rect (fgeom, width, height, &client);
+
+  x0 = visible.x;
+  y0 = visible.y;
+  x1 = visible.x + visible.width;
+  y1 = visible.y + visible.height;
+
+  cairo_new_path (cr);
+  cairo_move_to (cr, x0 + top_left, y0);
+  cairo_arc (cr, x1 - top_right, y0 + top_right, top_right, -M_PI / 2, 0);
+  cairo_arc (cr, x1 - bottom_right, y1 - bottom_right, bottom_right, 0, M_PI / 2);
+  cairo_arc (cr, x0 + bottom_left, y1 - bottom_left, bottom_left, M_PI / 2, M_PI);
+  cairo_arc (cr, x0 + top_left, y0 + top_left, top_left, M_PI, 3 * M_PI / 2);
+  cairo_close_path (cr);
+
+  if (client.width > 0 && client.height > 0)
+    cairo_rectangle (cr, client.x, client.y, client.width, client.height);
+
+  cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
+  cairo_clip (cr);
+  cairo_set_fill_rule (cr, CAIRO_FILL_RULE_WINDING);
+}
+
+/**
+ * meta_frames_render_frame: (skip)
+ * @frames: the frames widget
+ * @xwindow: the frame window
+ *
+ * Draws a composited frame at its current size, for the compositor to
+ * upload as a texture. The client area and anything outside the
+ * visible frame are left transparent.
+ *
+ * Returns: (transfer full): an ARGB32 image surface, or %NULL
+ */
+LOCAL_SYMBOL cairo_surface_t *
+meta_frames_render_frame (MetaFrames *frames,
+                          Window      xwindow)
+{
+  MetaUIFrame *frame;
+  MetaFrameGeometry fgeom;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  int width, height;
+
+  frame = meta_frames_lookup_window (frames, xwindow);
+  g_return_val_if_fail (frame != NULL, NULL);
+
+  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()), frame->xwindow,
+                 META_CORE_GET_FRAME_WIDTH, &width,
+                 META_CORE_GET_FRAME_HEIGHT, &height,
+                 META_CORE_GET_END);
+
+  if (width <= 0 || height <= 0)
+    return NULL;
+
+  meta_frames_calc_geometry (frames, frame, &fgeom);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cr = cairo_create (surface);
+
+  clip_to_frame_shape (cr, &fgeom, width, height);
+
+  paint_frame_background (frames, frame, cr, width, height);
+  meta_frames_paint (frames, frame, cr);
+
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+
+  return surface;
+}
+
 static gboolean
 meta_frames_enter_notify_event      (GtkWidget           *widget,
                                      GdkEventCrossing    *event)
@@ -2820,6 +3148,13 @@ static void
 invalidate_whole_window (MetaFrames *frames,
                          MetaUIFrame *frame)
 {
+  if (frames->composited)
+    {
+      meta_core_queue_frame_redraw (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                                    frame->xwindow);
+      return;
+    }
+
   gdk_window_invalidate_rect (frame->window, NULL, FALSE);
   invalidate_cache (frames, frame);
 }
@@ -28,6 +28,7 @@
 #include <gdk/gdkx.h>
 #include <meta/common.h>
 #include "theme-private.h"
+#include "frame-atlas.h"
 
 typedef enum
 {
@@ -70,6 +71,19 @@ typedef struct _MetaFrames        MetaFrames;
 typedef struct _MetaFramesClass   MetaFramesClass;
 
 typedef struct _MetaUIFrame         MetaUIFrame;
+typedef struct _MetaTitleLayout     MetaTitleLayout;
+
+/* A title layout shared by all frames showing the same text in the
+ * same font at about the same width; see meta_frames_ensure_layout()
+ */
+struct _MetaTitleLayout
+{
+  char *key;
+  PangoLayout *layout;
+  int text_height;
+  int width_bucket;
+  int ref_count;
+};
 
 struct _MetaUIFrame
 {
@@ -77,7 +91,8 @@ struct _MetaUIFrame
   GdkWindow *window;
   GtkStyleContext *style;
   MetaFrameStyle *cache_style;
-  PangoLayout *layout;
+  MetaTitleLayout *title_layout;
+  PangoLayout *layout; /* title_layout->layout */
   int text_height;
   char *title; /* NULL once we have a layout */
   guint expose_delayed : 1;
@@ -92,6 +107,7 @@ struct _MetaFrames
   GtkWindow parent_instance;
   
   GHashTable *text_heights;
+  GHashTable *title_layouts;
 
   GHashTable *frames;
 
@@ -106,6 +122,20 @@ struct _MetaFrames
   int invalidate_cache_timeout_id;
   GList *invalidate_frames;
   GHashTable *cache;
+
+  /* Shared surfaces the cached frame pieces are drawn in, the cached
+   * frames most recently drawn first, and how the cache is doing
+   */
+  MetaFrameAtlases *atlases;
+  GQueue cache_lru;
+  guint cache_hits;
+  guint cache_misses;
+
+  /* The contents of frames are painted by the compositor, not into
+   * their X windows; see meta_frames_set_composited() and
+   * meta_frames_render_frame()
+   */
+  gboolean composited;
 };
 
 struct _MetaFramesClass
@@ -165,10 +195,21 @@ void meta_frames_move_resize_frame (MetaFrames *frames,
 void meta_frames_queue_draw (MetaFrames *frames,
                              Window      xwindow);
 
+void meta_frames_set_composited (MetaFrames *frames,
+                                 gboolean    composited);
+
+cairo_surface_t *meta_frames_render_frame (MetaFrames *frames,
+                                           Window      xwindow);
+
 void meta_frames_notify_menu_hide (MetaFrames *frames);
 
 Window meta_frames_get_moving_frame (MetaFrames *frames);
 
+void meta_frames_get_cache_stats (MetaFrames          *frames,
+                                  guint               *hits,
+                                  guint               *misses,
+                                  MetaFrameAtlasStats *atlas_stats);
+
 void meta_frames_push_delay_exposes (MetaFrames *frames);
 void meta_frames_pop_delay_exposes  (MetaFrames *frames);
 
@@ -0,0 +1,33 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin pixel loops shared by gradients and themes */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_GRADIENT_PRIVATE_H
+#define META_GRADIENT_PRIVATE_H
+
+#include <gtk/gtk.h>
+
+gboolean   meta_gradient_use_sse2        (void);
+void       meta_gradient_set_use_sse2    (gboolean       enabled);
+
+GdkPixbuf* meta_gradient_colorize_pixbuf (GdkPixbuf     *orig,
+                                          const GdkRGBA *new_color);
+
+#endif /* META_GRADIENT_PRIVATE_H */
@@ -22,10 +22,26 @@
  * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
  * 02110-1335, USA.  */
 
+#include <config.h>
 #include <meta/gradient.h>
 #include <meta/util.h>
+#include "gradient-private.h"
 #include <string.h>
 
+/* SSE2 versions of the per-pixel loops. They are built with a target
+ * attribute rather than depending on the compiler flags, and chosen
+ * at runtime, so builds for CPUs without SSE2 still use them where
+ * they can.
+ */
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+#define HAVE_SSE2_KERNELS 1
+#define SSE2_KERNEL __attribute__ ((target ("sse2")))
+#include <emmintrin.h>
+#endif
+
+#define CLAMP_UCHAR(v) ((guchar) (CLAMP (((int)v), (int)0, (int)255)))
+#define INTENSITY(r, g, b) ((r) * 0.30 + (g) * 0.59 + (b) * 0.11)
+
 /* This is all Alfredo's and Dan's usual very nice WindowMaker code,
  * slightly GTK-ized
  */
@@ -690,15 +706,157 @@ meta_gradient_create_multi_diagonal (int width, int height,
   return pixbuf;
 }
 
+#ifdef HAVE_SSE2_KERNELS
+/* -1 until the CPU and environment have been looked at */
+static int use_sse2 = -1;
+
+static gboolean
+cpu_has_sse2 (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("sse2") != 0;
+}
+#endif
+
+/**
+ * meta_gradient_use_sse2: (skip)
+ *
+ * Whether the SSE2 pixel loops can be used. Setting MUFFIN_DISABLE_SIMD
+ * in the environment turns them off; it is read once, on the first call.
+ *
+ * Return value: %TRUE if this CPU has SSE2 and it isn't disabled
+ */
+LOCAL_SYMBOL gboolean
+meta_gradient_use_sse2 (void)
+{
+#ifdef HAVE_SSE2_KERNELS
+  if (use_sse2 < 0)
+    use_sse2 = cpu_has_sse2 () && g_getenv ("MUFFIN_DISABLE_SIMD") == NULL;
+
+  return use_sse2;
+#else
+  return FALSE;
+#endif
+}
+
+/**
+ * meta_gradient_set_use_sse2: (skip)
+ * @enabled: whether to use the SSE2 pixel loops where the CPU has SSE2
+ *
+ * Overrides MUFFIN_DISABLE_SIMD, so that testgradient can compare the
+ * SSE2 loops with the plain C ones in one run.
+ */
+void
+meta_gradient_set_use_sse2 (gboolean enabled)
+{
+#ifdef HAVE_SSE2_KERNELS
+  use_sse2 = enabled && cpu_has_sse2 ();
+#endif
+}
+
+/* Multiplies the alpha of RGBA pixels with either one alpha for all of
+ * them, or one each from @alphas.
+ */
 static void
-simple_multiply_alpha (GdkPixbuf *pixbuf,
-                       guchar     alpha)
+multiply_alpha_row (guchar       *p,
+                    int           n_pixels,
+                    const guchar *alphas,
+                    guchar        alpha)
+{
+  int i;
+
+  for (i = 0; i < n_pixels; i++)
+    {
+      int a = alphas ? alphas[i] : alpha;
+
+      /* multiply the two alpha channels. not sure this is right.
+       * but some end cases are that if the pixbuf contains 255,
+       * then it should be modified to contain "alpha"; if the
+       * pixbuf contains 0, it should remain 0.
+       */
+      /* ((*p / 255.0) * (alpha / 255.0)) * 255; */
+      p[4 * i + 3] = (guchar) (((int) p[4 * i + 3] * a) / (int) 255);
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+static SSE2_KERNEL void
+multiply_alpha_row_sse2 (guchar       *p,
+                         int           n_pixels,
+                         const guchar *alphas,
+                         guchar        alpha)
+{
+  const __m128i rgb_mask = _mm_set1_epi32 (0x00ffffff);
+  const __m128i one = _mm_set1_epi32 (1);
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i a;
+  int i;
+
+  a = _mm_set1_epi32 (alpha);
+
+  /* Four pixels at a time; alpha is the top byte of each */
+  for (i = 0; i + 4 <= n_pixels; i += 4)
+    {
+      __m128i v, x;
+
+      v = _mm_loadu_si128 ((const __m128i *) (p + 4 * i));
+
+      if (alphas)
+        {
+          guint32 four;
+
+          memcpy (&four, alphas + i, sizeof (four));
+          a = _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((int) four),
+                                                     zero),
+                                  zero);
+        }
+
+      x = _mm_mullo_epi16 (_mm_srli_epi32 (v, 24), a);
+
+      /* x / 255, which is exact this way for x up to 255 * 255 */
+      x = _mm_srli_epi32 (_mm_add_epi32 (_mm_add_epi32 (x, one),
+                                         _mm_srli_epi32 (x, 8)),
+                          8);
+
+      v = _mm_or_si128 (_mm_and_si128 (v, rgb_mask), _mm_slli_epi32 (x, 24));
+      _mm_storeu_si128 ((__m128i *) (p + 4 * i), v);
+    }
+
+  multiply_alpha_row (p + 4 * i, n_pixels - i,
+                      alphas ? alphas + i : NULL, alpha);
+}
+#endif
+
+static void
+multiply_alpha (GdkPixbuf    *pixbuf,
+                const guchar *alphas,
+                guchar        alpha)
 {
   guchar *pixels;
   int rowstride;
-  int height;
+  int width, height;
   int row;
+  void (* multiply_row) (guchar *, int, const guchar *, guchar);
+
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
 
+  multiply_row = multiply_alpha_row;
+#ifdef HAVE_SSE2_KERNELS
+  if (meta_gradient_use_sse2 ())
+    multiply_row = multiply_alpha_row_sse2;
+#endif
+
+  for (row = 0; row < height; row++)
+    multiply_row (pixels + row * rowstride, width, alphas, alpha);
+}
+
+static void
+simple_multiply_alpha (GdkPixbuf *pixbuf,
+                       guchar     alpha)
+{
   g_return_if_fail (GDK_IS_PIXBUF (pixbuf));
   
   if (alpha == 255)
@@ -706,36 +864,7 @@ simple_multiply_alpha (GdkPixbuf *pixbuf,
   
   g_assert (gdk_pixbuf_get_has_alpha (pixbuf));
   
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
-
-  row = 0;
-  while (row < height)
-    {
-      guchar *p;
-      guchar *end;
-
-      p = pixels + row * rowstride;
-      end = p + rowstride;
-
-      while (p != end)
-        {
-          p += 3; /* skip RGB */
-
-          /* multiply the two alpha channels. not sure this is right.
-           * but some end cases are that if the pixbuf contains 255,
-           * then it should be modified to contain "alpha"; if the
-           * pixbuf contains 0, it should remain 0.
-           */
-          /* ((*p / 255.0) * (alpha / 255.0)) * 255; */
-          *p = (guchar) (((int) *p * (int) alpha) / (int) 255);
-          
-          ++p; /* skip A */
-        }
-
-      ++row;
-    }
+  multiply_alpha (pixbuf, NULL, alpha);
 }
 
 static void
@@ -745,11 +874,8 @@ meta_gradient_add_alpha_horizontal (GdkPixbuf           *pixbuf,
 {
   int i, j;
   long a, da;
-  unsigned char *p;
-  unsigned char *pixels;
   int width2;  
-  int rowstride;
-  int width, height;
+  int width;
   unsigned char *gradient;
   unsigned char *gradient_p;
   unsigned char *gradient_end;
@@ -764,7 +890,6 @@ meta_gradient_add_alpha_horizontal (GdkPixbuf           *pixbuf,
     }
   
   width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
 
   gradient = g_new (unsigned char, width);
   gradient_end = gradient + width;
@@ -802,34 +927,7 @@ meta_gradient_add_alpha_horizontal (GdkPixbuf           *pixbuf,
     }
     
   /* Now for each line of the pixbuf, fill in with the gradient */
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  
-  p = pixels;
-  i = 0;
-  while (i < height)
-    {
-      unsigned char *row_end = p + rowstride;
-      gradient_p = gradient;
-
-      p += 3;
-      while (gradient_p != gradient_end)
-        {
-          /* multiply the two alpha channels. not sure this is right.
-           * but some end cases are that if the pixbuf contains 255,
-           * then it should be modified to contain "alpha"; if the
-           * pixbuf contains 0, it should remain 0.
-           */
-          /* ((*p / 255.0) * (alpha / 255.0)) * 255; */
-          *p = (guchar) (((int) *p * (int) *gradient_p) / (int) 255);
-
-          p += 4;
-          ++gradient_p;
-        }
-
-      p = row_end;
-      ++i;
-    }
+  multiply_alpha (pixbuf, gradient, 0);
   
   g_free (gradient);
 }
@@ -863,3 +961,175 @@ meta_gradient_add_alpha (GdkPixbuf       *pixbuf,
       break;
     }
 }
+
+/* Colorizing goes from black through the color to white, by the
+ * intensity of each pixel.
+ */
+static void
+colorize_row (const guchar  *src,
+              guchar        *dest,
+              int            width,
+              int            n_channels,
+              const GdkRGBA *new_color)
+{
+  double intensity;
+  int x;
+
+  for (x = 0; x < width; x++)
+    {
+      double dr, dg, db;
+      
+      intensity = INTENSITY (src[0], src[1], src[2]) / 255.0;
+
+      if (intensity <= 0.5)
+        {
+          /* Go from black at intensity = 0.0 to new_color at intensity = 0.5 */
+          dr = new_color->red * intensity * 2.0;
+          dg = new_color->green * intensity * 2.0;
+          db = new_color->blue * intensity * 2.0;
+        }
+      else
+        {
+          /* Go from new_color at intensity = 0.5 to white at intensity = 1.0 */
+          dr = new_color->red + (1.0 - new_color->red) * (intensity - 0.5) * 2.0;
+          dg = new_color->green + (1.0 - new_color->green) * (intensity - 0.5) * 2.0;
+          db = new_color->blue + (1.0 - new_color->blue) * (intensity - 0.5) * 2.0;
+        }
+      
+      dest[0] = CLAMP_UCHAR (255 * dr);
+      dest[1] = CLAMP_UCHAR (255 * dg);
+      dest[2] = CLAMP_UCHAR (255 * db);
+      
+      if (n_channels == 4)
+        dest[3] = src[3];
+
+      src += n_channels;
+      dest += n_channels;
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+static SSE2_KERNEL __m128d
+colorize_channel_sse2 (double  component,
+                       __m128d intensity,
+                       __m128d dark)
+{
+  const __m128d half = _mm_set1_pd (0.5);
+  const __m128d two = _mm_set1_pd (2.0);
+  __m128d c, low, high;
+
+  /* The same operations, in the same order, as colorize_row() */
+  c = _mm_set1_pd (component);
+  low = _mm_mul_pd (_mm_mul_pd (c, intensity), two);
+  high = _mm_add_pd (c, _mm_mul_pd (_mm_mul_pd (_mm_sub_pd (_mm_set1_pd (1.0), c),
+                                                _mm_sub_pd (intensity, half)),
+                                    two));
+  c = _mm_or_pd (_mm_and_pd (dark, low), _mm_andnot_pd (dark, high));
+
+  return _mm_min_pd (_mm_max_pd (_mm_mul_pd (_mm_set1_pd (255.0), c),
+                                 _mm_setzero_pd ()),
+                     _mm_set1_pd (255.0));
+}
+
+static SSE2_KERNEL void
+colorize_row_sse2 (const guchar  *src,
+                   guchar        *dest,
+                   int            width,
+                   int            n_channels,
+                   const GdkRGBA *new_color)
+{
+  int x;
+
+  /* Two pixels at a time, in double precision so the results match */
+  for (x = 0; x + 2 <= width; x += 2)
+    {
+      const guchar *s0 = src + x * n_channels;
+      const guchar *s1 = s0 + n_channels;
+      guchar *d0 = dest + x * n_channels;
+      guchar *d1 = d0 + n_channels;
+      __m128d intensity, dark;
+      __m128i r, g, b;
+
+      intensity = _mm_add_pd (_mm_add_pd (_mm_mul_pd (_mm_set_pd (s1[0], s0[0]),
+                                                      _mm_set1_pd (0.30)),
+                                          _mm_mul_pd (_mm_set_pd (s1[1], s0[1]),
+                                                      _mm_set1_pd (0.59))),
+                              _mm_mul_pd (_mm_set_pd (s1[2], s0[2]),
+                                          _mm_set1_pd (0.11)));
+      intensity = _mm_div_pd (intensity, _mm_set1_pd (255.0));
+      dark = _mm_cmple_pd (intensity, _mm_set1_pd (0.5));
+
+      r = _mm_cvttpd_epi32 (colorize_channel_sse2 (new_color->red, intensity, dark));
+      g = _mm_cvttpd_epi32 (colorize_channel_sse2 (new_color->green, intensity, dark));
+      b = _mm_cvttpd_epi32 (colorize_channel_sse2 (new_color->blue, intensity, dark));
+
+      d0[0] = _mm_cvtsi128_si32 (r);
+      d0[1] = _mm_cvtsi128_si32 (g);
+      d0[2] = _mm_cvtsi128_si32 (b);
+      d1[0] = _mm_cvtsi128_si32 (_mm_srli_si128 (r, 4));
+      d1[1] = _mm_cvtsi128_si32 (_mm_srli_si128 (g, 4));
+      d1[2] = _mm_cvtsi128_si32 (_mm_srli_si128 (b, 4));
+
+      if (n_channels == 4)
+        {
+          d0[3] = s0[3];
+          d1[3] = s1[3];
+        }
+    }
+
+  colorize_row (src + x * n_channels, dest + x * n_channels,
+                width - x, n_channels, new_color);
+}
+#endif
+
+/**
+ * meta_gradient_colorize_pixbuf: (skip)
+ * @orig: the pixbuf to colorize
+ * @new_color: the color mid-intensity pixels get
+ *
+ * Used for the colorize attribute of theme images.
+ *
+ * Return value: (transfer full): a colorized copy of @orig, or %NULL
+ */
+GdkPixbuf *
+meta_gradient_colorize_pixbuf (GdkPixbuf     *orig,
+                               const GdkRGBA *new_color)
+{
+  GdkPixbuf *pixbuf;
+  int y;
+  int orig_rowstride;
+  int dest_rowstride;
+  int width, height;
+  int n_channels;
+  const guchar *src_pixels;
+  guchar *dest_pixels;
+  void (* colorize) (const guchar *, guchar *, int, int, const GdkRGBA *);
+  
+  pixbuf = gdk_pixbuf_new (gdk_pixbuf_get_colorspace (orig), gdk_pixbuf_get_has_alpha (orig),
+			   gdk_pixbuf_get_bits_per_sample (orig),
+			   gdk_pixbuf_get_width (orig), gdk_pixbuf_get_height (orig));
+
+  if (pixbuf == NULL)
+    return NULL;
+  
+  orig_rowstride = gdk_pixbuf_get_rowstride (orig);
+  dest_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  n_channels = gdk_pixbuf_get_has_alpha (orig) ? 4 : 3;
+  src_pixels = gdk_pixbuf_get_pixels (orig);
+  dest_pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+  colorize = colorize_row;
+#ifdef HAVE_SSE2_KERNELS
+  if (meta_gradient_use_sse2 ())
+    colorize = colorize_row_sse2;
+#endif
+  
+  for (y = 0; y < height; y++)
+    colorize (src_pixels + y * orig_rowstride,
+              dest_pixels + y * dest_rowstride,
+              width, n_channels, new_color);
+
+  return pixbuf;
+}
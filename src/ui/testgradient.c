@@ -21,7 +21,9 @@
  * 02110-1335, USA.  */
 
 #include <meta/gradient.h>
+#include "gradient-private.h"
 #include <gtk/gtk.h>
+#include <string.h>
 
 typedef void (* RenderGradientFunc) (cairo_t     *cr,
                                      int          width,
@@ -303,9 +305,312 @@ meta_gradient_test (void)
 
 }
 
+/* --benchmark: check that the SSE2 pixel loops give the same bytes as
+ * the plain C ones, then time both.
+ */
+
+static void
+set_simd (gboolean enabled)
+{
+  meta_gradient_set_use_sse2 (enabled);
+}
+
+static GdkPixbuf *
+random_pixbuf (GRand *rand,
+               int    width,
+               int    height)
+{
+  GdkPixbuf *pixbuf;
+  guchar *pixels;
+  int rowstride;
+  int x, y;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width * 4; x++)
+      pixels[y * rowstride + x] = g_rand_int_range (rand, 0, 256);
+
+  return pixbuf;
+}
+
+static gboolean
+pixbufs_equal (GdkPixbuf *a,
+               GdkPixbuf *b)
+{
+  int width, height, y;
+
+  width = gdk_pixbuf_get_width (a);
+  height = gdk_pixbuf_get_height (a);
+
+  if (width != gdk_pixbuf_get_width (b) ||
+      height != gdk_pixbuf_get_height (b) ||
+      gdk_pixbuf_get_n_channels (a) != gdk_pixbuf_get_n_channels (b))
+    return FALSE;
+
+  for (y = 0; y < height; y++)
+    if (memcmp (gdk_pixbuf_get_pixels (a) + y * gdk_pixbuf_get_rowstride (a),
+                gdk_pixbuf_get_pixels (b) + y * gdk_pixbuf_get_rowstride (b),
+                width * gdk_pixbuf_get_n_channels (a)) != 0)
+      return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+check_add_alpha (GRand *rand,
+                 int    width,
+                 int    n_alphas)
+{
+  GdkPixbuf *source, *simd, *plain;
+  guchar alphas[8];
+  gboolean ok;
+  int i;
+
+  for (i = 0; i < n_alphas; i++)
+    alphas[i] = g_rand_int_range (rand, 0, 256);
+
+  source = random_pixbuf (rand, width, 3);
+  simd = gdk_pixbuf_copy (source);
+  plain = gdk_pixbuf_copy (source);
+
+  set_simd (TRUE);
+  meta_gradient_add_alpha (simd, alphas, n_alphas, META_GRADIENT_HORIZONTAL);
+  set_simd (FALSE);
+  meta_gradient_add_alpha (plain, alphas, n_alphas, META_GRADIENT_HORIZONTAL);
+
+  ok = pixbufs_equal (simd, plain);
+
+  /* With one alpha, also check against the formula itself */
+  if (ok && n_alphas == 1)
+    {
+      guchar *s = gdk_pixbuf_get_pixels (source);
+      guchar *p = gdk_pixbuf_get_pixels (plain);
+      int rowstride = gdk_pixbuf_get_rowstride (source);
+      int x, y;
+
+      for (y = 0; y < 3 && ok; y++)
+        for (x = 0; x < width && ok; x++)
+          ok = p[y * rowstride + x * 4 + 3] ==
+               s[y * rowstride + x * 4 + 3] * alphas[0] / 255;
+    }
+
+  if (!ok)
+    g_printerr ("add_alpha differs: width %d, %d alpha(s)\n",
+                width, n_alphas);
+
+  g_object_unref (source);
+  g_object_unref (simd);
+  g_object_unref (plain);
+
+  return ok;
+}
+
+static gboolean
+check_colorize (GRand    *rand,
+                int       width,
+                gboolean  has_alpha)
+{
+  GdkPixbuf *source, *simd, *plain;
+  GdkRGBA color;
+  gboolean ok;
+
+  color.red = g_rand_double (rand);
+  color.green = g_rand_double (rand);
+  color.blue = g_rand_double (rand);
+  color.alpha = 1.0;
+
+  if (has_alpha)
+    {
+      source = random_pixbuf (rand, width, 3);
+    }
+  else
+    {
+      guchar *pixels;
+      int rowstride;
+      int x, y;
+
+      source = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, 3);
+      pixels = gdk_pixbuf_get_pixels (source);
+      rowstride = gdk_pixbuf_get_rowstride (source);
+
+      for (y = 0; y < 3; y++)
+        for (x = 0; x < width * 3; x++)
+          pixels[y * rowstride + x] = g_rand_int_range (rand, 0, 256);
+    }
+
+  set_simd (TRUE);
+  simd = meta_gradient_colorize_pixbuf (source, &color);
+  set_simd (FALSE);
+  plain = meta_gradient_colorize_pixbuf (source, &color);
+
+  ok = pixbufs_equal (simd, plain);
+
+  if (!ok)
+    g_printerr ("colorize differs: width %d, %s\n",
+                width, has_alpha ? "RGBA" : "RGB");
+
+  g_object_unref (source);
+  g_object_unref (simd);
+  g_object_unref (plain);
+
+  return ok;
+}
+
+static gboolean
+run_checks (void)
+{
+  GRand *rand;
+  gboolean ok = TRUE;
+  int width;
+
+  rand = g_rand_new_with_seed (0x6d756666);
+
+  /* Odd widths exercise the leftover pixels after the vector loop */
+  for (width = 1; width <= 67; width++)
+    {
+      ok &= check_add_alpha (rand, width, 1);
+      ok &= check_add_alpha (rand, width, 2);
+      ok &= check_add_alpha (rand, width, 5);
+      ok &= check_colorize (rand, width, TRUE);
+      ok &= check_colorize (rand, width, FALSE);
+    }
+
+  g_rand_free (rand);
+
+  return ok;
+}
+
+static void
+time_gradients (void)
+{
+  static const char * const type_names[] = {
+    "horizontal", "vertical", "diagonal"
+  };
+  GdkRGBA colors[3];
+  GdkPixbuf *pixbuf;
+  GTimer *timer;
+  int type, i;
+
+  gdk_rgba_parse (&colors[0], "#3465a4");
+  gdk_rgba_parse (&colors[1], "#eeeeec");
+  gdk_rgba_parse (&colors[2], "#2e3436");
+
+  timer = g_timer_new ();
+
+  for (type = 0; type < META_GRADIENT_LAST; type++)
+    {
+      g_timer_start (timer);
+      for (i = 0; i < 200; i++)
+        {
+          pixbuf = meta_gradient_create_multi (640, 32, colors, 3, type);
+          g_object_unref (pixbuf);
+        }
+      g_timer_stop (timer);
+
+      g_print ("  %-10s         %8.3f ms per 640x32\n", type_names[type],
+               g_timer_elapsed (timer, NULL) * 1000.0 / 200);
+    }
+
+  g_timer_destroy (timer);
+}
+
+static void
+time_add_alpha (gboolean simd)
+{
+  GRand *rand;
+  GdkPixbuf *pixbuf;
+  GTimer *timer;
+  guchar alphas[] = { 0xff, 0x40, 0xc0 };
+  int i;
+
+  rand = g_rand_new_with_seed (0x6d756666);
+  pixbuf = random_pixbuf (rand, 640, 32);
+  g_rand_free (rand);
+
+  set_simd (simd);
+  timer = g_timer_new ();
+
+  g_timer_start (timer);
+  for (i = 0; i < 200; i++)
+    {
+      meta_gradient_add_alpha (pixbuf, &alphas[1], 1, META_GRADIENT_HORIZONTAL);
+      meta_gradient_add_alpha (pixbuf, alphas, 3, META_GRADIENT_HORIZONTAL);
+    }
+  g_timer_stop (timer);
+
+  g_print ("  %-10s  %s  %8.3f ms per 640x32\n",
+           "add_alpha", simd ? "sse2 " : "plain",
+           g_timer_elapsed (timer, NULL) * 1000.0 / 400);
+
+  set_simd (TRUE);
+  g_object_unref (pixbuf);
+  g_timer_destroy (timer);
+}
+
+static void
+time_colorize (gboolean simd)
+{
+  GRand *rand;
+  GdkPixbuf *source, *pixbuf;
+  GdkRGBA color;
+  GTimer *timer;
+  int i;
+
+  rand = g_rand_new_with_seed (0x6d756666);
+  source = random_pixbuf (rand, 640, 32);
+  g_rand_free (rand);
+
+  gdk_rgba_parse (&color, "#3465a4");
+
+  set_simd (simd);
+  timer = g_timer_new ();
+
+  g_timer_start (timer);
+  for (i = 0; i < 200; i++)
+    {
+      pixbuf = meta_gradient_colorize_pixbuf (source, &color);
+      g_object_unref (pixbuf);
+    }
+  g_timer_stop (timer);
+
+  g_print ("  %-10s  %s  %8.3f ms per 640x32\n",
+           "colorize", simd ? "sse2 " : "plain",
+           g_timer_elapsed (timer, NULL) * 1000.0 / 200);
+
+  set_simd (TRUE);
+  g_object_unref (source);
+  g_timer_destroy (timer);
+}
+
+static int
+run_benchmark (void)
+{
+  if (!run_checks ())
+    {
+      g_printerr ("SIMD and plain pixel loops disagree\n");
+      return 1;
+    }
+
+  g_print ("SIMD and plain pixel loops agree\n");
+
+  time_gradients ();
+  time_add_alpha (FALSE);
+  time_add_alpha (TRUE);
+  time_colorize (FALSE);
+  time_colorize (TRUE);
+
+  return 0;
+}
+
 int
 main (int argc, char **argv)
 {
+  if (argc > 1 && strcmp (argv[1], "--benchmark") == 0)
+    return run_benchmark ();
+
   gtk_init (&argc, &argv);
 
   meta_gradient_test ();
@@ -0,0 +1,794 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin theme benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+/* Loads each theme and draws every frame type, frame state and button
+ * state at a few sizes into image surfaces, so it needs no window; GTK
+ * still wants a display for its style contexts, which Xvfb can give.
+ *
+ * Themes are named as for muffin, or given as a directory with a theme
+ * file in it. By default the theme in the source tree's data/theme is
+ * used, the one installed as Default, so the benchmark can run before
+ * muffin is installed.
+ *
+ * Results are written one operation per line, tab separated, in the
+ * order given by the header line. Lines starting with '#' are
+ * comments; they also say how many of each theme's images got loaded,
+ * how much memory parsing took and how much the cached frame pieces
+ * take. The same file can be passed back with --baseline, and the run
+ * fails if any operation got slower than its baseline by more than
+ * --threshold percent. Operations are compared by their fastest run,
+ * which is the least noisy figure.
+ *
+ * Exits 0 if there was no regression, 1 if there was one, and 2 if
+ * the benchmark could not run.
+ */
+
+#include <config.h>
+#include <meta/util.h>
+#include <meta/theme.h>
+#include "theme-private.h"
+#include "frame-atlas.h"
+#include <meta/preview-widget.h>
+#include <gtk/gtk.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEADER "# operation\ttheme\ttype\tstate\tbuttons\twidth\theight\t" \
+               "iterations\tmean_us\tmin_us\n"
+
+/* The fields that say what was measured, as opposed to how long it took */
+#define N_KEY_FIELDS 7
+#define N_FIELDS 10
+
+typedef struct
+{
+  const char *name;
+  MetaFrameFlags flags;
+} FrameState;
+
+static const FrameState frame_states[] = {
+  { "normal", 0 },
+  { "maximized", META_FRAME_MAXIMIZED },
+  { "shaded", META_FRAME_SHADED },
+  { "tiled-left", META_FRAME_TILED_LEFT },
+  { "tiled-right", META_FRAME_TILED_RIGHT },
+  { "maximized-shaded", META_FRAME_MAXIMIZED | META_FRAME_SHADED }
+};
+
+static const char * const button_state_names[META_BUTTON_STATE_LAST] = {
+  "normal",
+  "pressed",
+  "prelight"
+};
+
+static char **theme_names = NULL;
+static char **size_specs = NULL;
+static int iterations = 20;
+static char *output_file = NULL;
+static char *baseline_file = NULL;
+static double threshold = 10.0;
+
+static GOptionEntry options[] = {
+  { "theme", 't', 0, G_OPTION_ARG_STRING_ARRAY, &theme_names,
+    "Theme to benchmark, by name or directory; may be repeated "
+    "(default: " SOURCE_THEME_DIR ")", "THEME" },
+  { "size", 's', 0, G_OPTION_ARG_STRING_ARRAY, &size_specs,
+    "Client size to draw frames around; may be repeated", "WIDTHxHEIGHT" },
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+    "Times to repeat each operation (default: 20)", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_file,
+    "Write the results to FILE instead of standard output", "FILE" },
+  { "baseline", 'b', 0, G_OPTION_ARG_FILENAME, &baseline_file,
+    "Compare with results written by an earlier run", "FILE" },
+  { "threshold", 0, 0, G_OPTION_ARG_DOUBLE, &threshold,
+    "Slowdown, in percent, that counts as a regression (default: 10)",
+    "PERCENT" },
+  { NULL }
+};
+
+typedef struct
+{
+  int width;
+  int height;
+} Size;
+
+typedef struct
+{
+  FILE *out;
+  GHashTable *baseline;
+  int n_regressions;
+} Run;
+
+/* A theme given by a path is loaded from that directory, any other one
+ * by name from wherever muffin looks for themes
+ */
+static MetaTheme *
+load_theme (const char  *theme,
+            GError     **error)
+{
+  if (strchr (theme, G_DIR_SEPARATOR) != NULL)
+    return meta_theme_load_dir (theme, error);
+
+  return meta_theme_load (theme, error);
+}
+
+/* What a theme is called in the results: a directory by its last
+ * component, so that results can be compared between checkouts
+ */
+static const char *
+theme_label (const char *theme)
+{
+  const char *slash = strrchr (theme, G_DIR_SEPARATOR);
+
+  return slash && slash[1] ? slash + 1 : theme;
+}
+
+static char *
+format_us (double us)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  return g_strdup (g_ascii_formatd (buf, sizeof (buf), "%.1f", us));
+}
+
+static void
+report (Run        *run,
+        const char *operation,
+        const char *theme,
+        const char *type,
+        const char *state,
+        const char *buttons,
+        int         width,
+        int         height,
+        double      total_us,
+        double      min_us)
+{
+  char *key;
+  char *mean_str, *min_str;
+  const double *baseline_us;
+
+  key = g_strdup_printf ("%s\t%s\t%s\t%s\t%s\t%d\t%d",
+                         operation, theme_label (theme), type, state, buttons,
+                         width, height);
+  mean_str = format_us (total_us / iterations);
+  min_str = format_us (min_us);
+
+  fprintf (run->out, "%s\t%d\t%s\t%s\n", key, iterations, mean_str, min_str);
+
+  baseline_us = run->baseline ? g_hash_table_lookup (run->baseline, key) : NULL;
+  if (baseline_us && *baseline_us > 0 &&
+      min_us > *baseline_us * (1.0 + threshold / 100.0))
+    {
+      char *was_str = format_us (*baseline_us);
+
+      g_printerr ("Regression: %s %s %s %s %s %dx%d took %s us, was %s us (+%.0f%%)\n",
+                  operation, theme_label (theme), type, state, buttons,
+                  width, height,
+                  min_str, was_str, (min_us / *baseline_us - 1.0) * 100.0);
+      run->n_regressions++;
+
+      g_free (was_str);
+    }
+
+  g_free (key);
+  g_free (mean_str);
+  g_free (min_str);
+}
+
+/* Reads the fastest times from an earlier run, keyed on what was
+ * measured.
+ */
+static GHashTable *
+load_baseline (const char *filename,
+               GError    **error)
+{
+  GHashTable *baseline;
+  char *contents;
+  char **lines;
+  int i;
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return NULL;
+
+  baseline = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++)
+    {
+      char **fields;
+      double *min_us;
+
+      if (lines[i][0] == '#' || lines[i][0] == '\0')
+        continue;
+
+      fields = g_strsplit (lines[i], "\t", -1);
+      if (g_strv_length (fields) == N_FIELDS)
+        {
+          char *last_key_field = fields[N_KEY_FIELDS];
+
+          min_us = g_new (double, 1);
+          *min_us = g_ascii_strtod (fields[N_FIELDS - 1], NULL);
+
+          fields[N_KEY_FIELDS] = NULL;
+          g_hash_table_replace (baseline, g_strjoinv ("\t", fields), min_us);
+          fields[N_KEY_FIELDS] = last_key_field;
+        }
+
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return baseline;
+}
+
+static gboolean
+parse_sizes (GArray  *sizes,
+             GError **error)
+{
+  static const Size default_sizes[] = {
+    { 200, 150 }, { 500, 350 }, { 1000, 700 }
+  };
+  int i;
+
+  if (size_specs == NULL)
+    {
+      g_array_append_vals (sizes, default_sizes, G_N_ELEMENTS (default_sizes));
+      return TRUE;
+    }
+
+  for (i = 0; size_specs[i]; i++)
+    {
+      Size size;
+
+      if (sscanf (size_specs[i], "%dx%d", &size.width, &size.height) != 2 ||
+          size.width <= 0 || size.height <= 0)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Bad size \"%s\", expected WIDTHxHEIGHT",
+                       size_specs[i]);
+          return FALSE;
+        }
+
+      g_array_append_val (sizes, size);
+    }
+
+  return TRUE;
+}
+
+/* Times loading a theme from its XML or from the cache. With
+ * @lazy_images unset every image is loaded while parsing, as it used
+ * to be, to show what loading them only once a style needs them saves.
+ */
+static void
+time_theme_loads (Run        *run,
+                  const char *theme_name,
+                  gboolean    use_cache,
+                  gboolean    lazy_images)
+{
+  MetaTheme *theme;
+  GTimer *timer;
+  double total_us, min_us;
+  char *operation;
+  int i;
+
+  meta_theme_set_lazy_images (lazy_images);
+
+  if (use_cache)
+    g_unsetenv ("MUFFIN_DISABLE_THEME_CACHE");
+  else
+    g_setenv ("MUFFIN_DISABLE_THEME_CACHE", "1", TRUE);
+
+  /* So that the cache has been written before it is timed */
+  theme = load_theme (theme_name, NULL);
+  if (theme)
+    meta_theme_free (theme);
+
+  timer = g_timer_new ();
+  total_us = 0;
+  min_us = G_MAXDOUBLE;
+
+  for (i = 0; i < iterations; i++)
+    {
+      double us;
+
+      g_timer_start (timer);
+      theme = load_theme (theme_name, NULL);
+      us = g_timer_elapsed (timer, NULL) * 1000000.0;
+
+      if (theme)
+        meta_theme_free (theme);
+
+      total_us += us;
+      min_us = MIN (min_us, us);
+    }
+
+  g_timer_destroy (timer);
+  meta_theme_set_lazy_images (TRUE);
+
+  operation = g_strconcat (use_cache ? "load-cache" : "load-xml",
+                           lazy_images ? "" : "-eager-images", NULL);
+  report (run, operation, theme_name, "-", "-", "-", 0, 0, total_us, min_us);
+  g_free (operation);
+}
+
+static void
+report_images (Run        *run,
+               MetaTheme  *theme,
+               const char *theme_name,
+               const char *when)
+{
+  guint n_images;
+  gsize bytes;
+
+  meta_theme_get_image_stats (theme, &n_images, &bytes);
+
+  fprintf (run->out, "# %s: %u images (%lu KiB) loaded %s\n",
+           theme_label (theme_name), n_images, (gulong) (bytes / 1024),
+           when);
+}
+
+/* The resident set size, from /proc; 0 where that isn't there */
+static gsize
+get_resident_bytes (void)
+{
+  char *contents;
+  gulong size, resident;
+  gsize bytes = 0;
+
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    {
+      if (sscanf (contents, "%lu %lu", &size, &resident) == 2)
+        bytes = (gsize) resident * sysconf (_SC_PAGESIZE);
+
+      g_free (contents);
+    }
+
+  return bytes;
+}
+
+/* Says how much the resident memory grows by when a theme is parsed
+ * with its images loaded lazily, and then when another copy is parsed
+ * with all of them loaded. Both copies are kept until the end, so the
+ * second can't reuse what the first freed. Parsing is from the XML,
+ * since the cache maps its images instead of decoding them.
+ */
+static void
+report_resident_memory (Run        *run,
+                        const char *theme_name)
+{
+  MetaTheme *lazy_theme, *eager_theme;
+  gsize before, after_lazy, after_eager;
+
+  g_setenv ("MUFFIN_DISABLE_THEME_CACHE", "1", TRUE);
+
+  before = get_resident_bytes ();
+  lazy_theme = load_theme (theme_name, NULL);
+  after_lazy = get_resident_bytes ();
+
+  meta_theme_set_lazy_images (FALSE);
+  eager_theme = load_theme (theme_name, NULL);
+  after_eager = get_resident_bytes ();
+  meta_theme_set_lazy_images (TRUE);
+
+  if (before > 0)
+    fprintf (run->out,
+             "# %s: parsing took %ld KiB of resident memory with images "
+             "loaded lazily, %ld KiB with all of them loaded\n",
+             theme_label (theme_name),
+             ((long) after_lazy - (long) before) / 1024,
+             ((long) after_eager - (long) after_lazy) / 1024);
+
+  if (lazy_theme)
+    meta_theme_free (lazy_theme);
+  if (eager_theme)
+    meta_theme_free (eager_theme);
+
+  g_unsetenv ("MUFFIN_DISABLE_THEME_CACHE");
+}
+
+static void
+draw_frame (MetaTheme              *theme,
+            GtkWidget              *widget,
+            MetaFrameType           type,
+            MetaFrameFlags          flags,
+            const Size             *size,
+            PangoLayout            *title_layout,
+            int                     text_height,
+            const MetaButtonLayout *button_layout,
+            MetaButtonState        *button_states)
+{
+  MetaFrameBorders borders;
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  meta_theme_get_frame_borders (theme, type, text_height, flags, &borders);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                        size->width + borders.total.left +
+                                        borders.total.right,
+                                        size->height + borders.total.top +
+                                        borders.total.bottom);
+  cr = cairo_create (surface);
+
+  meta_theme_draw_frame (theme, widget, cr, type, flags,
+                         size->width, size->height,
+                         title_layout, text_height,
+                         button_layout, button_states,
+                         meta_preview_get_mini_icon (),
+                         meta_preview_get_icon ());
+
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+}
+
+/* Packs the pieces the frames widget caches for @n_windows normal
+ * frames of each size into atlases, the way it does, and says how much
+ * server memory that takes.
+ */
+static void
+report_frame_atlases (Run            *run,
+                      MetaTheme      *theme,
+                      const char     *theme_name,
+                      GtkWidget      *widget,
+                      int             text_height,
+                      MetaFrameFlags  flags,
+                      GArray         *sizes)
+{
+  static const int window_counts[] = { 1, 20 };
+  MetaFrameBorders borders;
+  GdkWindow *window;
+  guint z, c;
+
+  gtk_widget_realize (widget);
+  window = gtk_widget_get_window (widget);
+
+  meta_theme_get_frame_borders (theme, META_FRAME_TYPE_NORMAL, text_height,
+                                flags, &borders);
+
+  for (z = 0; z < sizes->len; z++)
+    for (c = 0; c < G_N_ELEMENTS (window_counts); c++)
+      {
+        const Size *size = &g_array_index (sizes, Size, z);
+        int n_pieces = window_counts[c] * 4;
+        MetaFrameAtlases *atlases;
+        MetaFrameAtlasStats stats;
+        MetaFramePiece *pieces;
+        cairo_rectangle_int_t rects[4];
+        int i, n_uncached = 0;
+
+        meta_frame_get_piece_rects (&borders, size->width, size->height,
+                                    rects);
+
+        atlases = meta_frame_atlases_new (META_FRAME_CACHE_BUDGET);
+        pieces = g_new0 (MetaFramePiece, n_pieces);
+
+        for (i = 0; i < n_pieces; i++)
+          {
+            pieces[i].rect = rects[i % 4];
+            if (pieces[i].rect.width <= 0 || pieces[i].rect.height <= 0)
+              continue;
+
+            if (!meta_frame_atlases_allocate (atlases, window, &pieces[i],
+                                              NULL, NULL))
+              n_uncached++;
+          }
+
+        meta_frame_atlases_get_stats (atlases, &stats);
+
+        fprintf (run->out,
+                 "# %s: the frame pieces of %d %dx%d windows take %lu KiB "
+                 "(%lu KiB drawn on) in %u wide and %u tall atlases and "
+                 "%u other surfaces, after %u grows; %d did not fit\n",
+                 theme_label (theme_name), window_counts[c],
+                 size->width, size->height,
+                 (gulong) (stats.bytes / 1024),
+                 (gulong) (stats.used_bytes / 1024),
+                 stats.n_wide_atlases, stats.n_tall_atlases,
+                 stats.n_own_surfaces, stats.n_grows, n_uncached);
+
+        for (i = 0; i < n_pieces; i++)
+          meta_frame_atlases_release (atlases, &pieces[i]);
+
+        meta_frame_atlases_free (atlases);
+        g_free (pieces);
+      }
+}
+
+static void
+time_frame_draws (Run        *run,
+                  MetaTheme  *theme,
+                  const char *theme_name,
+                  GArray     *sizes)
+{
+  GtkWidget *widget;
+  PangoLayout *title_layout;
+  PangoFontDescription *font_desc;
+  MetaButtonLayout button_layout;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+  MetaFrameFlags base_flags;
+  GTimer *timer;
+  int text_height;
+  int type, s, focus, b, i, j;
+  guint z;
+
+  widget = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  title_layout = gtk_widget_create_pango_layout (widget,
+                                                 "Window Title Goes Here");
+
+  gtk_style_context_get (gtk_widget_get_style_context (widget),
+                         GTK_STATE_FLAG_NORMAL,
+                         GTK_STYLE_PROPERTY_FONT, &font_desc,
+                         NULL);
+  text_height = meta_pango_font_desc_get_text_height (font_desc,
+                                                      gtk_widget_get_pango_context (widget));
+  pango_font_description_free (font_desc);
+
+  for (i = 0; i < MAX_BUTTONS_PER_CORNER; i++)
+    {
+      button_layout.left_buttons[i] = META_BUTTON_FUNCTION_LAST;
+      button_layout.right_buttons[i] = META_BUTTON_FUNCTION_LAST;
+    }
+
+  button_layout.left_buttons[0] = META_BUTTON_FUNCTION_MENU;
+  button_layout.right_buttons[0] = META_BUTTON_FUNCTION_MINIMIZE;
+  button_layout.right_buttons[1] = META_BUTTON_FUNCTION_MAXIMIZE;
+  button_layout.right_buttons[2] = META_BUTTON_FUNCTION_CLOSE;
+
+  base_flags = META_FRAME_ALLOWS_DELETE | META_FRAME_ALLOWS_MENU |
+               META_FRAME_ALLOWS_MINIMIZE | META_FRAME_ALLOWS_MAXIMIZE |
+               META_FRAME_ALLOWS_VERTICAL_RESIZE |
+               META_FRAME_ALLOWS_HORIZONTAL_RESIZE |
+               META_FRAME_ALLOWS_SHADE | META_FRAME_ALLOWS_MOVE;
+
+  timer = g_timer_new ();
+
+  for (type = 0; type < META_FRAME_TYPE_LAST; type++)
+    for (s = 0; s < (int) G_N_ELEMENTS (frame_states); s++)
+      for (focus = 0; focus < 2; focus++)
+        for (b = 0; b < META_BUTTON_STATE_LAST; b++)
+          for (z = 0; z < sizes->len; z++)
+            {
+              const Size *size = &g_array_index (sizes, Size, z);
+              MetaFrameFlags flags;
+              double total_us, min_us;
+              char *state;
+
+              flags = base_flags | frame_states[s].flags;
+              if (focus)
+                flags |= META_FRAME_HAS_FOCUS;
+
+              for (j = 0; j < META_BUTTON_TYPE_LAST; j++)
+                button_states[j] = b;
+
+              /* Untimed, so that loading the style's images and filling
+               * the caches doesn't count; it is the steady state that
+               * windows see. The draw-cold operations below time the
+               * first draw.
+               */
+              draw_frame (theme, widget, type, flags, size, title_layout,
+                          text_height, &button_layout, button_states);
+
+              total_us = 0;
+              min_us = G_MAXDOUBLE;
+
+              for (i = 0; i < iterations; i++)
+                {
+                  double us;
+
+                  g_timer_start (timer);
+                  draw_frame (theme, widget, type, flags, size, title_layout,
+                              text_height, &button_layout, button_states);
+                  us = g_timer_elapsed (timer, NULL) * 1000000.0;
+
+                  total_us += us;
+                  min_us = MIN (min_us, us);
+                }
+
+              state = g_strconcat (frame_states[s].name,
+                                   focus ? "-focused" : "-unfocused",
+                                   NULL);
+
+              report (run, "draw", theme_name,
+                      meta_frame_type_to_string (type), state,
+                      button_state_names[b], size->width, size->height,
+                      total_us, min_us);
+
+              g_free (state);
+            }
+
+  /* What a window sees the first time its frame is drawn: every run
+   * gets a theme of its own, so no images have been loaded, nothing
+   * has been laid out and no pieces have been rendered yet. Loading
+   * the theme isn't timed. Only normal states are drawn, since the
+   * loads make this slow.
+   */
+  for (type = 0; type < META_FRAME_TYPE_LAST; type++)
+    for (focus = 0; focus < 2; focus++)
+      for (z = 0; z < sizes->len; z++)
+        {
+          const Size *size = &g_array_index (sizes, Size, z);
+          MetaFrameFlags flags;
+          double total_us, min_us;
+
+          flags = base_flags;
+          if (focus)
+            flags |= META_FRAME_HAS_FOCUS;
+
+          for (j = 0; j < META_BUTTON_TYPE_LAST; j++)
+            button_states[j] = META_BUTTON_STATE_NORMAL;
+
+          total_us = 0;
+          min_us = G_MAXDOUBLE;
+
+          for (i = 0; i < iterations; i++)
+            {
+              MetaTheme *cold_theme;
+              double us;
+
+              cold_theme = load_theme (theme_name, NULL);
+              if (cold_theme == NULL)
+                break;
+
+              g_timer_start (timer);
+              draw_frame (cold_theme, widget, type, flags, size, title_layout,
+                          text_height, &button_layout, button_states);
+              us = g_timer_elapsed (timer, NULL) * 1000000.0;
+
+              meta_theme_free (cold_theme);
+
+              total_us += us;
+              min_us = MIN (min_us, us);
+            }
+
+          if (i < iterations)
+            continue;
+
+          report (run, "draw-cold", theme_name,
+                  meta_frame_type_to_string (type),
+                  focus ? "normal-focused" : "normal-unfocused",
+                  button_state_names[META_BUTTON_STATE_NORMAL],
+                  size->width, size->height, total_us, min_us);
+        }
+
+  g_timer_destroy (timer);
+
+  report_frame_atlases (run, theme, theme_name, widget, text_height,
+                        base_flags, sizes);
+
+  g_object_unref (title_layout);
+  gtk_widget_destroy (widget);
+}
+
+int
+main (int argc, char **argv)
+{
+  static char *default_themes[] = { (char *) SOURCE_THEME_DIR, NULL };
+  GOptionContext *context;
+  GError *error = NULL;
+  GArray *sizes;
+  Run run;
+  int i;
+
+  context = g_option_context_new ("- benchmark theme loading and frame drawing");
+  g_option_context_add_main_entries (context, options, NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 2;
+    }
+
+  g_option_context_free (context);
+
+  if (iterations <= 0)
+    {
+      g_printerr ("--iterations must be at least 1\n");
+      return 2;
+    }
+
+  sizes = g_array_new (FALSE, FALSE, sizeof (Size));
+  if (!parse_sizes (sizes, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 2;
+    }
+
+  run.out = stdout;
+  run.baseline = NULL;
+  run.n_regressions = 0;
+
+  if (baseline_file)
+    {
+      run.baseline = load_baseline (baseline_file, &error);
+      if (run.baseline == NULL)
+        {
+          g_printerr ("Could not read baseline: %s\n", error->message);
+          return 2;
+        }
+    }
+
+  if (output_file)
+    {
+      run.out = fopen (output_file, "w");
+      if (run.out == NULL)
+        {
+          g_printerr ("Could not write %s: %s\n",
+                      output_file, g_strerror (errno));
+          return 2;
+        }
+    }
+
+  if (theme_names == NULL)
+    theme_names = default_themes;
+
+  fputs (HEADER, run.out);
+
+  for (i = 0; theme_names[i]; i++)
+    {
+      MetaTheme *theme;
+
+      theme = load_theme (theme_names[i], &error);
+      if (theme == NULL)
+        {
+          g_printerr ("Could not load theme %s: %s\n", theme_names[i],
+                      error ? error->message : "not found");
+          return 2;
+        }
+
+      report_resident_memory (&run, theme_names[i]);
+
+      time_theme_loads (&run, theme_names[i], FALSE, TRUE);
+      time_theme_loads (&run, theme_names[i], FALSE, FALSE);
+      time_theme_loads (&run, theme_names[i], TRUE, TRUE);
+      time_theme_loads (&run, theme_names[i], TRUE, FALSE);
+
+      report_images (&run, theme, theme_names[i], "after parsing");
+      time_frame_draws (&run, theme, theme_names[i], sizes);
+      report_images (&run, theme, theme_names[i],
+                     "after drawing every kind of frame");
+      meta_theme_load_all_images (theme);
+      report_images (&run, theme, theme_names[i], "in all");
+
+      meta_theme_free (theme);
+    }
+
+  if (run.out != stdout)
+    fclose (run.out);
+
+  g_array_free (sizes, TRUE);
+  if (run.baseline)
+    g_hash_table_destroy (run.baseline);
+
+  if (run.n_regressions > 0)
+    {
+      g_printerr ("%d operation(s) slower than the baseline by more than %g%%\n",
+                  run.n_regressions, threshold);
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,2147 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin binary theme cache */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#include <config.h>
+#include "theme-cache.h"
+#include <meta/util.h>
+#include <meta/prefs.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+
+/* A cache file is a header, which says what the cache was made from,
+ * followed by the theme. Numbers are in host byte order, strings are
+ * a length (0 for NULL) and the bytes including the nul.
+ *
+ * Objects that can be shared (images, layouts, draw op lists, styles
+ * and style sets) are written once each, in tables, and referred to
+ * by their index in the table. Styles and style sets come after their
+ * parents. Everything else is written where it is used.
+ *
+ * Image pixels are stored aligned to 16 bytes, and the pixbufs point
+ * into the mapped file instead of copying them. The file is mapped
+ * privately and writable, so even a stray write to one of those
+ * pixbufs would not reach the file. Cache files are only ever replaced
+ * whole, with g_file_set_contents(), so one that is mapped never
+ * changes under us.
+ *
+ * Images that no style had needed yet when the cache was written are
+ * only named, and are loaded the same way as after a parse: when a
+ * style that draws them is first looked up.
+ */
+
+#define CACHE_MAGIC "MUFFTHEM"
+#define CACHE_FORMAT_VERSION 3
+#define CACHE_BYTE_ORDER 0x01020304
+
+#define NO_INDEX ((guint32) -1)
+
+/* Deepest nesting of color specs we accept when reading */
+#define MAX_COLOR_SPEC_DEPTH 32
+
+enum
+{
+  IMAGE_EMBEDDED,
+  IMAGE_FROM_ICON_THEME
+};
+
+static gboolean
+cache_disabled (void)
+{
+  return g_getenv ("MUFFIN_DISABLE_THEME_CACHE") != NULL;
+}
+
+static char *
+cache_filename (const char *theme_file,
+                guint       scale)
+{
+  char *checksum;
+  char *basename;
+  char *filename;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, theme_file, -1);
+  basename = g_strdup_printf ("%s-%u.cache", checksum, scale);
+  filename = g_build_filename (g_get_user_cache_dir (),
+                               "muffin", "themes", basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+
+  return filename;
+}
+
+#define N_STYLE_SET_SLOTS 44
+
+/* All the style pointers in a style set, in a fixed order */
+static void
+style_set_get_slots (MetaFrameStyleSet *style_set,
+                     MetaFrameStyle   **slots[N_STYLE_SET_SLOTS])
+{
+  MetaFrameStyle **focus_styles[] = {
+    style_set->maximized_styles,
+    style_set->tiled_left_styles,
+    style_set->tiled_right_styles,
+    style_set->tiled_ulc_styles,
+    style_set->tiled_llc_styles,
+    style_set->tiled_urc_styles,
+    style_set->tiled_lrc_styles,
+    style_set->maximized_and_shaded_styles,
+    style_set->tiled_left_and_shaded_styles,
+    style_set->tiled_right_and_shaded_styles,
+    style_set->tiled_ulc_and_shaded_styles,
+    style_set->tiled_llc_and_shaded_styles,
+    style_set->tiled_urc_and_shaded_styles,
+    style_set->tiled_lrc_and_shaded_styles
+  };
+  int n, i, j;
+
+  n = 0;
+
+  for (i = 0; i < META_FRAME_RESIZE_LAST; i++)
+    for (j = 0; j < META_FRAME_FOCUS_LAST; j++)
+      {
+        slots[n++] = &style_set->normal_styles[i][j];
+        slots[n++] = &style_set->shaded_styles[i][j];
+      }
+
+  for (i = 0; i < (int) G_N_ELEMENTS (focus_styles); i++)
+    for (j = 0; j < META_FRAME_FOCUS_LAST; j++)
+      slots[n++] = &focus_styles[i][j];
+
+  g_assert (n == N_STYLE_SET_SLOTS);
+}
+
+/*
+ * Writing
+ */
+
+typedef struct
+{
+  GHashTable *indices;
+  GPtrArray *objects;
+} ObjectTable;
+
+typedef struct
+{
+  MetaTheme *theme;
+  GByteArray *data;
+
+  /* Pixbuf -> the name it was loaded under */
+  GHashTable *image_names;
+  /* Names of the images that are not loaded yet */
+  GHashTable *lazy_images;
+
+  ObjectTable images;
+  ObjectTable layouts;
+  ObjectTable op_lists;
+  ObjectTable styles;
+  ObjectTable style_sets;
+} CacheWriter;
+
+static void
+object_table_init (ObjectTable *table)
+{
+  table->indices = g_hash_table_new (NULL, NULL);
+  table->objects = g_ptr_array_new ();
+}
+
+static void
+object_table_destroy (ObjectTable *table)
+{
+  g_hash_table_destroy (table->indices);
+  g_ptr_array_free (table->objects, TRUE);
+}
+
+static gboolean
+object_table_contains (ObjectTable *table,
+                       gpointer     object)
+{
+  return g_hash_table_lookup (table->indices, object) != NULL;
+}
+
+static void
+object_table_add (ObjectTable *table,
+                  gpointer     object)
+{
+  g_ptr_array_add (table->objects, object);
+  g_hash_table_insert (table->indices, object,
+                       GUINT_TO_POINTER (table->objects->len));
+}
+
+static guint32
+object_table_index (ObjectTable *table,
+                    gpointer     object)
+{
+  if (object == NULL)
+    return NO_INDEX;
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (table->indices, object)) - 1;
+}
+
+static void
+put_data (CacheWriter  *w,
+          gconstpointer data,
+          gsize         length)
+{
+  g_byte_array_append (w->data, data, length);
+}
+
+static void
+put_uint (CacheWriter *w,
+          guint32      value)
+{
+  put_data (w, &value, sizeof (value));
+}
+
+static void
+put_int (CacheWriter *w,
+         gint32       value)
+{
+  put_data (w, &value, sizeof (value));
+}
+
+static void
+put_int64 (CacheWriter *w,
+           gint64       value)
+{
+  put_data (w, &value, sizeof (value));
+}
+
+static void
+put_double (CacheWriter *w,
+            double       value)
+{
+  put_data (w, &value, sizeof (value));
+}
+
+static void
+put_string (CacheWriter *w,
+            const char  *str)
+{
+  if (str == NULL)
+    {
+      put_uint (w, 0);
+      return;
+    }
+
+  put_uint (w, strlen (str) + 1);
+  put_data (w, str, strlen (str) + 1);
+}
+
+static void
+put_rgba (CacheWriter   *w,
+          const GdkRGBA *color)
+{
+  put_double (w, color->red);
+  put_double (w, color->green);
+  put_double (w, color->blue);
+  put_double (w, color->alpha);
+}
+
+static void
+put_border (CacheWriter     *w,
+            const GtkBorder *border)
+{
+  put_int (w, border->left);
+  put_int (w, border->right);
+  put_int (w, border->top);
+  put_int (w, border->bottom);
+}
+
+static void
+put_padding (CacheWriter *w,
+             guint        alignment)
+{
+  static const guint8 zeros[16] = { 0 };
+
+  if (w->data->len % alignment != 0)
+    put_data (w, zeros, alignment - w->data->len % alignment);
+}
+
+static void
+collect_op_list (CacheWriter    *w,
+                 MetaDrawOpList *op_list)
+{
+  int i;
+
+  if (op_list == NULL || object_table_contains (&w->op_lists, op_list))
+    return;
+
+  object_table_add (&w->op_lists, op_list);
+
+  for (i = 0; i < op_list->n_ops; i++)
+    {
+      MetaDrawOp *op = op_list->ops[i];
+
+      switch (op->type)
+        {
+        case META_DRAW_IMAGE:
+          if (op->data.image.pixbuf == NULL)
+            g_hash_table_add (w->lazy_images, op->data.image.filename);
+          else if (!object_table_contains (&w->images, op->data.image.pixbuf))
+            object_table_add (&w->images, op->data.image.pixbuf);
+          break;
+
+        case META_DRAW_OP_LIST:
+          collect_op_list (w, op->data.op_list.op_list);
+          break;
+
+        case META_DRAW_TILE:
+          collect_op_list (w, op->data.tile.op_list);
+          break;
+
+        default:
+          break;
+        }
+    }
+}
+
+static void
+collect_style (CacheWriter    *w,
+               MetaFrameStyle *style)
+{
+  int i, j;
+
+  if (style == NULL || object_table_contains (&w->styles, style))
+    return;
+
+  collect_style (w, style->parent);
+
+  if (style->layout && !object_table_contains (&w->layouts, style->layout))
+    object_table_add (&w->layouts, style->layout);
+
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+      collect_op_list (w, style->buttons[i][j]);
+
+  for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+    collect_op_list (w, style->pieces[i]);
+
+  object_table_add (&w->styles, style);
+}
+
+static void
+collect_style_set (CacheWriter       *w,
+                   MetaFrameStyleSet *style_set)
+{
+  MetaFrameStyle **slots[N_STYLE_SET_SLOTS];
+  int i;
+
+  if (style_set == NULL || object_table_contains (&w->style_sets, style_set))
+    return;
+
+  collect_style_set (w, style_set->parent);
+
+  style_set_get_slots (style_set, slots);
+  for (i = 0; i < N_STYLE_SET_SLOTS; i++)
+    collect_style (w, *slots[i]);
+
+  object_table_add (&w->style_sets, style_set);
+}
+
+static void
+collect_objects (CacheWriter *w)
+{
+  MetaTheme *theme = w->theme;
+  GHashTableIter iter;
+  gpointer key, value;
+  int i;
+
+  g_hash_table_iter_init (&iter, theme->images_by_filename);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (!object_table_contains (&w->images, value))
+        object_table_add (&w->images, value);
+      g_hash_table_insert (w->image_names, value, key);
+    }
+
+  g_hash_table_iter_init (&iter, theme->layouts_by_name);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    if (!object_table_contains (&w->layouts, value))
+      object_table_add (&w->layouts, value);
+
+  g_hash_table_iter_init (&iter, theme->draw_op_lists_by_name);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    collect_op_list (w, value);
+
+  g_hash_table_iter_init (&iter, theme->styles_by_name);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    collect_style (w, value);
+
+  g_hash_table_iter_init (&iter, theme->style_sets_by_name);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    collect_style_set (w, value);
+
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    collect_style_set (w, theme->style_sets_by_type[i]);
+}
+
+static gboolean
+image_from_icon_theme (CacheWriter *w,
+                       const char  *name)
+{
+  return name != NULL &&
+         g_str_has_prefix (name, "theme:") &&
+         META_THEME_ALLOWS (w->theme, META_THEME_IMAGES_FROM_ICON_THEMES);
+}
+
+/* The files the images come from, embedded or not; the cache is
+ * stale if any of them changes.
+ */
+static void
+write_dependencies (CacheWriter *w)
+{
+  GPtrArray *paths;
+  GHashTable *names;
+  GHashTableIter iter;
+  gpointer name;
+  guint i;
+
+  paths = g_ptr_array_new_with_free_func (g_free);
+  names = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < w->images.objects->len; i++)
+    {
+      name = g_hash_table_lookup (w->image_names,
+                                  g_ptr_array_index (w->images.objects, i));
+      if (name)
+        g_hash_table_add (names, name);
+    }
+
+  g_hash_table_iter_init (&iter, w->lazy_images);
+  while (g_hash_table_iter_next (&iter, &name, NULL))
+    g_hash_table_add (names, name);
+
+  g_hash_table_iter_init (&iter, names);
+  while (g_hash_table_iter_next (&iter, &name, NULL))
+    if (!image_from_icon_theme (w, name))
+      g_ptr_array_add (paths,
+                       g_build_filename (w->theme->dirname, name, NULL));
+
+  g_hash_table_destroy (names);
+
+  put_uint (w, paths->len);
+
+  for (i = 0; i < paths->len; i++)
+    {
+      const char *path = g_ptr_array_index (paths, i);
+      GStatBuf st;
+
+      if (g_stat (path, &st) != 0)
+        memset (&st, 0, sizeof (st));
+
+      put_string (w, path);
+      put_int64 (w, st.st_mtime);
+      put_int64 (w, st.st_size);
+    }
+
+  g_ptr_array_free (paths, TRUE);
+}
+
+static void
+write_header (CacheWriter *w,
+              const char  *text,
+              gsize        length)
+{
+  char *checksum;
+  GStatBuf st;
+
+  if (g_stat (w->theme->filename, &st) != 0)
+    memset (&st, 0, sizeof (st));
+
+  checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+                                          (const guchar *) text, length);
+
+  put_data (w, CACHE_MAGIC, strlen (CACHE_MAGIC));
+  put_uint (w, CACHE_FORMAT_VERSION);
+  put_uint (w, CACHE_BYTE_ORDER);
+  put_string (w, VERSION);
+
+  put_string (w, w->theme->filename);
+  put_int64 (w, st.st_mtime);
+  put_int64 (w, length);
+  put_string (w, checksum);
+
+  put_string (w, w->theme->name);
+  put_string (w, w->theme->dirname);
+  put_uint (w, w->theme->scale);
+
+  write_dependencies (w);
+
+  g_free (checksum);
+}
+
+static void
+write_images (CacheWriter *w)
+{
+  guint i;
+
+  put_uint (w, w->images.objects->len);
+
+  for (i = 0; i < w->images.objects->len; i++)
+    {
+      GdkPixbuf *pixbuf = g_ptr_array_index (w->images.objects, i);
+      const char *name;
+      int width, height, rowstride, n_channels;
+      const guchar *pixels;
+      int y;
+
+      name = g_hash_table_lookup (w->image_names, pixbuf);
+
+      if (image_from_icon_theme (w, name))
+        {
+          put_uint (w, IMAGE_FROM_ICON_THEME);
+          put_string (w, name);
+          continue;
+        }
+
+      width = gdk_pixbuf_get_width (pixbuf);
+      height = gdk_pixbuf_get_height (pixbuf);
+      rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+      n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+      pixels = gdk_pixbuf_get_pixels (pixbuf);
+
+      put_uint (w, IMAGE_EMBEDDED);
+      put_string (w, name);
+      put_int (w, width);
+      put_int (w, height);
+      put_int (w, rowstride);
+      put_uint (w, gdk_pixbuf_get_has_alpha (pixbuf));
+
+      /* The last row may be short in memory, so it is padded here */
+      put_padding (w, 16);
+      for (y = 0; y < height; y++)
+        {
+          put_data (w, pixels + y * rowstride, width * n_channels);
+          if (rowstride > width * n_channels)
+            {
+              gsize len = w->data->len;
+
+              g_byte_array_set_size (w->data,
+                                     len + rowstride - width * n_channels);
+              memset (w->data->data + len, 0,
+                      rowstride - width * n_channels);
+            }
+        }
+    }
+}
+
+static void
+write_constants (CacheWriter *w)
+{
+  MetaTheme *theme = w->theme;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  put_uint (w, theme->integer_constants ?
+            g_hash_table_size (theme->integer_constants) : 0);
+  if (theme->integer_constants)
+    {
+      g_hash_table_iter_init (&iter, theme->integer_constants);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          put_string (w, key);
+          put_int (w, GPOINTER_TO_INT (value));
+        }
+    }
+
+  put_uint (w, theme->float_constants ?
+            g_hash_table_size (theme->float_constants) : 0);
+  if (theme->float_constants)
+    {
+      g_hash_table_iter_init (&iter, theme->float_constants);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          put_string (w, key);
+          put_double (w, *(double *) value);
+        }
+    }
+
+  put_uint (w, theme->color_constants ?
+            g_hash_table_size (theme->color_constants) : 0);
+  if (theme->color_constants)
+    {
+      g_hash_table_iter_init (&iter, theme->color_constants);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          put_string (w, key);
+          put_string (w, value);
+        }
+    }
+}
+
+static void
+write_layouts (CacheWriter *w)
+{
+  guint i;
+
+  put_uint (w, w->layouts.objects->len);
+
+  for (i = 0; i < w->layouts.objects->len; i++)
+    {
+      MetaFrameLayout *layout = g_ptr_array_index (w->layouts.objects, i);
+
+      put_int (w, layout->left_width);
+      put_int (w, layout->right_width);
+      put_int (w, layout->bottom_height);
+      put_border (w, &layout->title_border);
+      put_int (w, layout->title_vertical_pad);
+      put_int (w, layout->right_titlebar_edge);
+      put_int (w, layout->left_titlebar_edge);
+      put_int (w, layout->button_sizing);
+      put_double (w, layout->button_aspect);
+      put_int (w, layout->button_width);
+      put_int (w, layout->button_height);
+      put_border (w, &layout->button_border);
+      put_double (w, layout->title_scale);
+      put_uint (w, layout->has_title);
+      put_uint (w, layout->hide_buttons);
+      put_uint (w, layout->top_left_corner_rounded_radius);
+      put_uint (w, layout->top_right_corner_rounded_radius);
+      put_uint (w, layout->bottom_left_corner_rounded_radius);
+      put_uint (w, layout->bottom_right_corner_rounded_radius);
+    }
+}
+
+static void
+write_color_spec (CacheWriter         *w,
+                  const MetaColorSpec *spec)
+{
+  if (spec == NULL)
+    {
+      put_int (w, -1);
+      return;
+    }
+
+  put_int (w, spec->type);
+
+  switch (spec->type)
+    {
+    case META_COLOR_SPEC_BASIC:
+      put_rgba (w, &spec->data.basic.color);
+      break;
+
+    case META_COLOR_SPEC_GTK:
+      put_int (w, spec->data.gtk.component);
+      put_uint (w, spec->data.gtk.state);
+      break;
+
+    case META_COLOR_SPEC_GTK_CUSTOM:
+      put_string (w, spec->data.gtkcustom.color_name);
+      write_color_spec (w, spec->data.gtkcustom.fallback);
+      break;
+
+    case META_COLOR_SPEC_BLEND:
+      write_color_spec (w, spec->data.blend.foreground);
+      write_color_spec (w, spec->data.blend.background);
+      put_double (w, spec->data.blend.alpha);
+      break;
+
+    case META_COLOR_SPEC_SHADE:
+      write_color_spec (w, spec->data.shade.base);
+      put_double (w, spec->data.shade.factor);
+      break;
+    }
+}
+
+static void
+write_alpha_spec (CacheWriter                 *w,
+                  const MetaAlphaGradientSpec *spec)
+{
+  if (spec == NULL)
+    {
+      put_int (w, -1);
+      return;
+    }
+
+  put_int (w, spec->type);
+  put_uint (w, spec->n_alphas);
+  put_data (w, spec->alphas, spec->n_alphas);
+}
+
+static void
+write_gradient_spec (CacheWriter            *w,
+                     const MetaGradientSpec *spec)
+{
+  GSList *tmp;
+
+  if (spec == NULL)
+    {
+      put_int (w, -1);
+      return;
+    }
+
+  put_int (w, spec->type);
+  put_uint (w, g_slist_length (spec->color_specs));
+
+  for (tmp = spec->color_specs; tmp; tmp = tmp->next)
+    write_color_spec (w, tmp->data);
+}
+
+static void
+write_draw_spec (CacheWriter        *w,
+                 const MetaDrawSpec *spec)
+{
+  int i;
+
+  if (spec == NULL)
+    {
+      put_int (w, -1);
+      return;
+    }
+
+  put_int (w, spec->n_tokens);
+  put_int (w, spec->value);
+  put_uint (w, spec->constant);
+
+  for (i = 0; i < spec->n_tokens; i++)
+    {
+      const PosToken *t = &spec->tokens[i];
+
+      put_int (w, t->type);
+
+      switch (t->type)
+        {
+        case POS_TOKEN_INT:
+          put_int (w, t->d.i.val);
+          break;
+
+        case POS_TOKEN_DOUBLE:
+          put_double (w, t->d.d.val);
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          put_int (w, t->d.o.op);
+          break;
+
+        case POS_TOKEN_VARIABLE:
+          put_string (w, t->d.v.name);
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+        case POS_TOKEN_CLOSE_PAREN:
+          break;
+        }
+    }
+}
+
+static void
+write_draw_op (CacheWriter      *w,
+               const MetaDrawOp *op)
+{
+  put_int (w, op->type);
+
+  switch (op->type)
+    {
+    case META_DRAW_LINE:
+      write_color_spec (w, op->data.line.color_spec);
+      put_int (w, op->data.line.dash_on_length);
+      put_int (w, op->data.line.dash_off_length);
+      put_int (w, op->data.line.width);
+      write_draw_spec (w, op->data.line.x1);
+      write_draw_spec (w, op->data.line.y1);
+      write_draw_spec (w, op->data.line.x2);
+      write_draw_spec (w, op->data.line.y2);
+      break;
+
+    case META_DRAW_RECTANGLE:
+      write_color_spec (w, op->data.rectangle.color_spec);
+      put_uint (w, op->data.rectangle.filled);
+      write_draw_spec (w, op->data.rectangle.x);
+      write_draw_spec (w, op->data.rectangle.y);
+      write_draw_spec (w, op->data.rectangle.width);
+      write_draw_spec (w, op->data.rectangle.height);
+      break;
+
+    case META_DRAW_ARC:
+      write_color_spec (w, op->data.arc.color_spec);
+      put_uint (w, op->data.arc.filled);
+      write_draw_spec (w, op->data.arc.x);
+      write_draw_spec (w, op->data.arc.y);
+      write_draw_spec (w, op->data.arc.width);
+      write_draw_spec (w, op->data.arc.height);
+      put_double (w, op->data.arc.start_angle);
+      put_double (w, op->data.arc.extent_angle);
+      break;
+
+    case META_DRAW_CLIP:
+      write_draw_spec (w, op->data.clip.x);
+      write_draw_spec (w, op->data.clip.y);
+      write_draw_spec (w, op->data.clip.width);
+      write_draw_spec (w, op->data.clip.height);
+      break;
+
+    case META_DRAW_TINT:
+      write_color_spec (w, op->data.tint.color_spec);
+      write_alpha_spec (w, op->data.tint.alpha_spec);
+      write_draw_spec (w, op->data.tint.x);
+      write_draw_spec (w, op->data.tint.y);
+      write_draw_spec (w, op->data.tint.width);
+      write_draw_spec (w, op->data.tint.height);
+      break;
+
+    case META_DRAW_GRADIENT:
+      write_gradient_spec (w, op->data.gradient.gradient_spec);
+      write_alpha_spec (w, op->data.gradient.alpha_spec);
+      write_draw_spec (w, op->data.gradient.x);
+      write_draw_spec (w, op->data.gradient.y);
+      write_draw_spec (w, op->data.gradient.width);
+      write_draw_spec (w, op->data.gradient.height);
+      break;
+
+    case META_DRAW_IMAGE:
+      put_uint (w, object_table_index (&w->images, op->data.image.pixbuf));
+      put_string (w, op->data.image.filename);
+      write_color_spec (w, op->data.image.colorize_spec);
+      write_alpha_spec (w, op->data.image.alpha_spec);
+      write_draw_spec (w, op->data.image.x);
+      write_draw_spec (w, op->data.image.y);
+      write_draw_spec (w, op->data.image.width);
+      write_draw_spec (w, op->data.image.height);
+      put_int (w, op->data.image.fill_type);
+      put_uint (w, op->data.image.vertical_stripes);
+      put_uint (w, op->data.image.horizontal_stripes);
+      break;
+
+    case META_DRAW_GTK_ARROW:
+      put_uint (w, op->data.gtk_arrow.state);
+      put_int (w, op->data.gtk_arrow.shadow);
+      put_int (w, op->data.gtk_arrow.arrow);
+      put_uint (w, op->data.gtk_arrow.filled);
+      write_draw_spec (w, op->data.gtk_arrow.x);
+      write_draw_spec (w, op->data.gtk_arrow.y);
+      write_draw_spec (w, op->data.gtk_arrow.width);
+      write_draw_spec (w, op->data.gtk_arrow.height);
+      break;
+
+    case META_DRAW_GTK_BOX:
+      put_uint (w, op->data.gtk_box.state);
+      put_int (w, op->data.gtk_box.shadow);
+      write_draw_spec (w, op->data.gtk_box.x);
+      write_draw_spec (w, op->data.gtk_box.y);
+      write_draw_spec (w, op->data.gtk_box.width);
+      write_draw_spec (w, op->data.gtk_box.height);
+      break;
+
+    case META_DRAW_GTK_VLINE:
+      put_uint (w, op->data.gtk_vline.state);
+      write_draw_spec (w, op->data.gtk_vline.x);
+      write_draw_spec (w, op->data.gtk_vline.y1);
+      write_draw_spec (w, op->data.gtk_vline.y2);
+      break;
+
+    case META_DRAW_ICON:
+      write_alpha_spec (w, op->data.icon.alpha_spec);
+      write_draw_spec (w, op->data.icon.x);
+      write_draw_spec (w, op->data.icon.y);
+      write_draw_spec (w, op->data.icon.width);
+      write_draw_spec (w, op->data.icon.height);
+      put_int (w, op->data.icon.fill_type);
+      break;
+
+    case META_DRAW_TITLE:
+      write_color_spec (w, op->data.title.color_spec);
+      write_draw_spec (w, op->data.title.x);
+      write_draw_spec (w, op->data.title.y);
+      write_draw_spec (w, op->data.title.ellipsize_width);
+      break;
+
+    case META_DRAW_OP_LIST:
+      put_uint (w, object_table_index (&w->op_lists, op->data.op_list.op_list));
+      write_draw_spec (w, op->data.op_list.x);
+      write_draw_spec (w, op->data.op_list.y);
+      write_draw_spec (w, op->data.op_list.width);
+      write_draw_spec (w, op->data.op_list.height);
+      break;
+
+    case META_DRAW_TILE:
+      put_uint (w, object_table_index (&w->op_lists, op->data.tile.op_list));
+      write_draw_spec (w, op->data.tile.x);
+      write_draw_spec (w, op->data.tile.y);
+      write_draw_spec (w, op->data.tile.width);
+      write_draw_spec (w, op->data.tile.height);
+      write_draw_spec (w, op->data.tile.tile_xoffset);
+      write_draw_spec (w, op->data.tile.tile_yoffset);
+      write_draw_spec (w, op->data.tile.tile_width);
+      write_draw_spec (w, op->data.tile.tile_height);
+      break;
+    }
+}
+
+static void
+write_op_lists (CacheWriter *w)
+{
+  guint i;
+  int j;
+
+  put_uint (w, w->op_lists.objects->len);
+
+  for (i = 0; i < w->op_lists.objects->len; i++)
+    {
+      MetaDrawOpList *op_list = g_ptr_array_index (w->op_lists.objects, i);
+
+      put_uint (w, op_list->n_ops);
+      for (j = 0; j < op_list->n_ops; j++)
+        write_draw_op (w, op_list->ops[j]);
+    }
+}
+
+static void
+write_styles (CacheWriter *w)
+{
+  guint i;
+  int j, k;
+
+  put_uint (w, w->styles.objects->len);
+
+  for (i = 0; i < w->styles.objects->len; i++)
+    {
+      MetaFrameStyle *style = g_ptr_array_index (w->styles.objects, i);
+
+      put_uint (w, object_table_index (&w->styles, style->parent));
+      put_uint (w, object_table_index (&w->layouts, style->layout));
+
+      for (j = 0; j < META_BUTTON_TYPE_LAST; j++)
+        for (k = 0; k < META_BUTTON_STATE_LAST; k++)
+          put_uint (w, object_table_index (&w->op_lists,
+                                           style->buttons[j][k]));
+
+      for (j = 0; j < META_FRAME_PIECE_LAST; j++)
+        put_uint (w, object_table_index (&w->op_lists, style->pieces[j]));
+
+      write_color_spec (w, style->window_background_color);
+      put_uint (w, style->window_background_alpha);
+    }
+}
+
+static void
+write_style_sets (CacheWriter *w)
+{
+  guint i;
+  int j;
+
+  put_uint (w, w->style_sets.objects->len);
+
+  for (i = 0; i < w->style_sets.objects->len; i++)
+    {
+      MetaFrameStyleSet *style_set;
+      MetaFrameStyle **slots[N_STYLE_SET_SLOTS];
+
+      style_set = g_ptr_array_index (w->style_sets.objects, i);
+      style_set_get_slots (style_set, slots);
+
+      put_uint (w, object_table_index (&w->style_sets, style_set->parent));
+      for (j = 0; j < N_STYLE_SET_SLOTS; j++)
+        put_uint (w, object_table_index (&w->styles, *slots[j]));
+    }
+}
+
+static void
+write_names (CacheWriter *w,
+             GHashTable  *by_name,
+             ObjectTable *table)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  put_uint (w, g_hash_table_size (by_name));
+
+  g_hash_table_iter_init (&iter, by_name);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      put_string (w, key);
+      put_uint (w, object_table_index (table, value));
+    }
+}
+
+static void
+write_theme (CacheWriter *w)
+{
+  MetaTheme *theme = w->theme;
+  int i;
+
+  put_string (w, theme->readable_name);
+  put_string (w, theme->author);
+  put_string (w, theme->copyright);
+  put_string (w, theme->date);
+  put_string (w, theme->description);
+  put_uint (w, theme->format_version);
+
+  write_images (w);
+  write_constants (w);
+  write_layouts (w);
+  write_op_lists (w);
+  write_styles (w);
+  write_style_sets (w);
+
+  write_names (w, theme->layouts_by_name, &w->layouts);
+  write_names (w, theme->draw_op_lists_by_name, &w->op_lists);
+  write_names (w, theme->styles_by_name, &w->styles);
+  write_names (w, theme->style_sets_by_name, &w->style_sets);
+
+  for (i = 0; i < META_FRAME_TYPE_LAST; i++)
+    put_uint (w, object_table_index (&w->style_sets,
+                                     theme->style_sets_by_type[i]));
+}
+
+/**
+ * meta_theme_cache_save: (skip)
+ * @theme: a theme that was just parsed from its file
+ * @text: the contents of the theme file
+ * @length: the length of @text
+ *
+ * Writes @theme to the cache, for meta_theme_cache_load() to find the
+ * next time the same file is loaded. Failing to write it is not an
+ * error, as the theme can always be parsed again.
+ */
+LOCAL_SYMBOL void
+meta_theme_cache_save (MetaTheme  *theme,
+                       const char *text,
+                       gsize       length)
+{
+  CacheWriter w;
+  char *filename;
+  char *dirname;
+  GError *error = NULL;
+
+  if (cache_disabled ())
+    return;
+
+  w.theme = theme;
+  w.data = g_byte_array_new ();
+  w.image_names = g_hash_table_new (NULL, NULL);
+  w.lazy_images = g_hash_table_new (g_str_hash, g_str_equal);
+  object_table_init (&w.images);
+  object_table_init (&w.layouts);
+  object_table_init (&w.op_lists);
+  object_table_init (&w.styles);
+  object_table_init (&w.style_sets);
+
+  collect_objects (&w);
+  write_header (&w, text, length);
+  write_theme (&w);
+
+  filename = cache_filename (theme->filename, theme->scale);
+  dirname = g_path_get_dirname (filename);
+
+  if (g_mkdir_with_parents (dirname, 0700) != 0 ||
+      !g_file_set_contents (filename, (const char *) w.data->data,
+                            w.data->len, &error))
+    {
+      meta_topic (META_DEBUG_THEMES, "Could not write theme cache %s: %s\n",
+                  filename, error ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+  else
+    meta_topic (META_DEBUG_THEMES, "Wrote %u bytes of theme cache to %s\n",
+                w.data->len, filename);
+
+  g_free (dirname);
+  g_free (filename);
+
+  object_table_destroy (&w.images);
+  object_table_destroy (&w.layouts);
+  object_table_destroy (&w.op_lists);
+  object_table_destroy (&w.styles);
+  object_table_destroy (&w.style_sets);
+  g_hash_table_destroy (w.image_names);
+  g_hash_table_destroy (w.lazy_images);
+  g_byte_array_free (w.data, TRUE);
+}
+
+/*
+ * Reading
+ *
+ * Every read is checked against the end of the file, and every index
+ * and enum against its range; once anything is out of place the
+ * reader is marked as failed, later reads return zeros, and the whole
+ * cache is thrown away.
+ */
+
+typedef struct
+{
+  GMappedFile *file;
+  const guchar *p;
+  const guchar *end;
+  gboolean failed;
+  int depth;
+
+  MetaTheme *theme;
+
+  GdkPixbuf **images;
+  guint n_images;
+  MetaFrameLayout **layouts;
+  guint n_layouts;
+  MetaDrawOpList **op_lists;
+  guint n_op_lists;
+  MetaFrameStyle **styles;
+  guint n_styles;
+  MetaFrameStyleSet **style_sets;
+  guint n_style_sets;
+} CacheReader;
+
+static gboolean
+get_data (CacheReader *r,
+          gpointer     data,
+          gsize        length)
+{
+  if (r->failed || (gsize) (r->end - r->p) < length)
+    {
+      r->failed = TRUE;
+      memset (data, 0, length);
+      return FALSE;
+    }
+
+  memcpy (data, r->p, length);
+  r->p += length;
+
+  return TRUE;
+}
+
+static guint32
+get_uint (CacheReader *r)
+{
+  guint32 value;
+
+  get_data (r, &value, sizeof (value));
+
+  return value;
+}
+
+static gint32
+get_int (CacheReader *r)
+{
+  gint32 value;
+
+  get_data (r, &value, sizeof (value));
+
+  return value;
+}
+
+static gint64
+get_int64 (CacheReader *r)
+{
+  gint64 value;
+
+  get_data (r, &value, sizeof (value));
+
+  return value;
+}
+
+static double
+get_double (CacheReader *r)
+{
+  double value;
+
+  get_data (r, &value, sizeof (value));
+
+  return value;
+}
+
+static gboolean
+get_boolean (CacheReader *r)
+{
+  return get_uint (r) != 0;
+}
+
+/* Returns a pointer into the file, or NULL */
+static const char *
+peek_string (CacheReader *r)
+{
+  const char *str;
+  guint32 length;
+
+  length = get_uint (r);
+  if (length == 0 || r->failed)
+    return NULL;
+
+  if ((gsize) (r->end - r->p) < length || r->p[length - 1] != '\0')
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  str = (const char *) r->p;
+  r->p += length;
+
+  return str;
+}
+
+static char *
+get_string (CacheReader *r)
+{
+  return g_strdup (peek_string (r));
+}
+
+/* A string that must be there and be equal to @expected */
+static gboolean
+check_string (CacheReader *r,
+              const char  *expected)
+{
+  const char *str = peek_string (r);
+
+  if (str == NULL || expected == NULL || strcmp (str, expected) != 0)
+    r->failed = TRUE;
+
+  return !r->failed;
+}
+
+/* An enum value from 0 to @last - 1, or -1 if @allow_none */
+static int
+get_enum (CacheReader *r,
+          int          last,
+          gboolean     allow_none)
+{
+  gint32 value = get_int (r);
+
+  if (value >= last || value < (allow_none ? -1 : 0))
+    {
+      r->failed = TRUE;
+      return allow_none ? -1 : 0;
+    }
+
+  return value;
+}
+
+/* A count of items each taking at least @item_size bytes */
+static guint
+get_count (CacheReader *r,
+           gsize        item_size)
+{
+  guint32 count = get_uint (r);
+
+  if ((gsize) (r->end - r->p) / item_size < count)
+    {
+      r->failed = TRUE;
+      return 0;
+    }
+
+  return count;
+}
+
+/* An index into a table of @n objects, or -1 for none */
+static int
+get_index (CacheReader *r,
+           guint        n)
+{
+  guint32 index = get_uint (r);
+
+  if (index == NO_INDEX)
+    return -1;
+
+  if (index >= n)
+    {
+      r->failed = TRUE;
+      return -1;
+    }
+
+  return index;
+}
+
+static void
+get_rgba (CacheReader *r,
+          GdkRGBA     *color)
+{
+  color->red = get_double (r);
+  color->green = get_double (r);
+  color->blue = get_double (r);
+  color->alpha = get_double (r);
+}
+
+static void
+get_border (CacheReader *r,
+            GtkBorder   *border)
+{
+  border->left = get_int (r);
+  border->right = get_int (r);
+  border->top = get_int (r);
+  border->bottom = get_int (r);
+}
+
+static void
+skip_padding (CacheReader *r,
+              guint        alignment)
+{
+  gsize offset = r->p - (const guchar *) g_mapped_file_get_contents (r->file);
+
+  if (offset % alignment != 0)
+    {
+      guint8 padding[16];
+
+      get_data (r, padding, alignment - offset % alignment);
+    }
+}
+
+static gboolean
+check_dependencies (CacheReader *r)
+{
+  guint n, i;
+
+  n = get_count (r, 20);
+
+  for (i = 0; i < n && !r->failed; i++)
+    {
+      const char *path;
+      gint64 mtime, size;
+      GStatBuf st;
+
+      path = peek_string (r);
+      mtime = get_int64 (r);
+      size = get_int64 (r);
+
+      if (path == NULL || g_stat (path, &st) != 0 ||
+          st.st_mtime != mtime || st.st_size != size)
+        {
+          meta_topic (META_DEBUG_THEMES, "Theme cache is stale: %s changed\n",
+                      path ? path : "(null)");
+          r->failed = TRUE;
+        }
+    }
+
+  return !r->failed;
+}
+
+static gboolean
+check_header (CacheReader *r,
+              const char  *theme_file,
+              const char  *theme_name,
+              const char  *theme_dir,
+              const char  *text,
+              gsize        length)
+{
+  char magic[sizeof (CACHE_MAGIC) - 1];
+  char *checksum;
+  GStatBuf st;
+
+  get_data (r, magic, sizeof (magic));
+  if (r->failed || memcmp (magic, CACHE_MAGIC, sizeof (magic)) != 0 ||
+      get_uint (r) != CACHE_FORMAT_VERSION ||
+      get_uint (r) != CACHE_BYTE_ORDER ||
+      !check_string (r, VERSION))
+    {
+      meta_topic (META_DEBUG_THEMES,
+                  "Theme cache was written by another version\n");
+      r->failed = TRUE;
+      return FALSE;
+    }
+
+  if (g_stat (theme_file, &st) != 0)
+    {
+      r->failed = TRUE;
+      return FALSE;
+    }
+
+  checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+                                          (const guchar *) text, length);
+
+  if (!check_string (r, theme_file) ||
+      get_int64 (r) != st.st_mtime ||
+      get_int64 (r) != (gint64) length ||
+      !check_string (r, checksum) ||
+      !check_string (r, theme_name) ||
+      !check_string (r, theme_dir) ||
+      get_uint (r) != meta_prefs_get_ui_scale ())
+    {
+      meta_topic (META_DEBUG_THEMES, "Theme cache is stale: %s changed\n",
+                  theme_file);
+      r->failed = TRUE;
+    }
+
+  g_free (checksum);
+
+  return !r->failed && check_dependencies (r);
+}
+
+static void
+release_mapped_file (guchar  *pixels,
+                     gpointer data)
+{
+  g_mapped_file_unref (data);
+}
+
+static void
+read_images (CacheReader *r)
+{
+  guint i;
+
+  r->n_images = get_count (r, 8);
+  r->images = g_new0 (GdkPixbuf *, r->n_images);
+
+  for (i = 0; i < r->n_images && !r->failed; i++)
+    {
+      GdkPixbuf *pixbuf;
+      guint32 kind;
+      const char *name;
+
+      kind = get_uint (r);
+      name = peek_string (r);
+
+      if (r->failed)
+        break;
+
+      if (kind == IMAGE_FROM_ICON_THEME && name != NULL)
+        {
+          /* The icon theme may have changed, so look it up again */
+          pixbuf = meta_theme_load_image (r->theme, name, r->theme->scale,
+                                          NULL);
+          if (pixbuf == NULL)
+            r->failed = TRUE;
+        }
+      else if (kind == IMAGE_EMBEDDED)
+        {
+          int width, height, rowstride, n_channels;
+          gboolean has_alpha;
+
+          width = get_int (r);
+          height = get_int (r);
+          rowstride = get_int (r);
+          has_alpha = get_boolean (r);
+          skip_padding (r, 16);
+
+          n_channels = has_alpha ? 4 : 3;
+
+          if (r->failed || width <= 0 || height <= 0 ||
+              rowstride < (gint64) width * n_channels ||
+              (guint64) rowstride * height > (guint64) (r->end - r->p))
+            {
+              r->failed = TRUE;
+              break;
+            }
+
+          pixbuf = gdk_pixbuf_new_from_data (r->p, GDK_COLORSPACE_RGB,
+                                             has_alpha, 8,
+                                             width, height, rowstride,
+                                             release_mapped_file,
+                                             g_mapped_file_ref (r->file));
+          r->p += (gsize) rowstride * height;
+
+          if (name)
+            g_hash_table_replace (r->theme->images_by_filename,
+                                  g_strdup (name),
+                                  g_object_ref (pixbuf));
+        }
+      else
+        {
+          r->failed = TRUE;
+          break;
+        }
+
+      r->images[i] = pixbuf;
+    }
+}
+
+static void
+read_constants (CacheReader *r)
+{
+  guint n, i;
+
+  n = get_count (r, 8);
+  for (i = 0; i < n && !r->failed; i++)
+    {
+      const char *name = peek_string (r);
+      int value = get_int (r);
+
+      if (r->failed ||
+          !meta_theme_define_int_constant (r->theme, name, value, NULL))
+        r->failed = TRUE;
+    }
+
+  n = get_count (r, 12);
+  for (i = 0; i < n && !r->failed; i++)
+    {
+      const char *name = peek_string (r);
+      double value = get_double (r);
+
+      if (r->failed ||
+          !meta_theme_define_float_constant (r->theme, name, value, NULL))
+        r->failed = TRUE;
+    }
+
+  n = get_count (r, 8);
+  for (i = 0; i < n && !r->failed; i++)
+    {
+      const char *name = peek_string (r);
+      const char *value = peek_string (r);
+
+      if (r->failed || value == NULL ||
+          !meta_theme_define_color_constant (r->theme, name, value, NULL))
+        r->failed = TRUE;
+    }
+}
+
+static void
+read_layouts (CacheReader *r)
+{
+  guint i;
+
+  r->n_layouts = get_count (r, 100);
+  r->layouts = g_new0 (MetaFrameLayout *, r->n_layouts);
+
+  for (i = 0; i < r->n_layouts && !r->failed; i++)
+    {
+      MetaFrameLayout *layout;
+
+      layout = meta_frame_layout_new ();
+      r->layouts[i] = layout;
+
+      layout->left_width = get_int (r);
+      layout->right_width = get_int (r);
+      layout->bottom_height = get_int (r);
+      get_border (r, &layout->title_border);
+      layout->title_vertical_pad = get_int (r);
+      layout->right_titlebar_edge = get_int (r);
+      layout->left_titlebar_edge = get_int (r);
+      layout->button_sizing = get_enum (r, META_BUTTON_SIZING_LAST + 1, FALSE);
+      layout->button_aspect = get_double (r);
+      layout->button_width = get_int (r);
+      layout->button_height = get_int (r);
+      get_border (r, &layout->button_border);
+      layout->title_scale = get_double (r);
+      layout->has_title = get_boolean (r);
+      layout->hide_buttons = get_boolean (r);
+      layout->top_left_corner_rounded_radius = get_uint (r);
+      layout->top_right_corner_rounded_radius = get_uint (r);
+      layout->bottom_left_corner_rounded_radius = get_uint (r);
+      layout->bottom_right_corner_rounded_radius = get_uint (r);
+    }
+}
+
+static MetaColorSpec *
+read_color_spec (CacheReader *r)
+{
+  MetaColorSpec *spec;
+  int type;
+
+  type = get_enum (r, META_COLOR_SPEC_SHADE + 1, TRUE);
+  if (type < 0 || r->failed)
+    return NULL;
+
+  if (r->depth >= MAX_COLOR_SPEC_DEPTH)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  r->depth += 1;
+
+  spec = meta_color_spec_new (type);
+
+  switch (spec->type)
+    {
+    case META_COLOR_SPEC_BASIC:
+      get_rgba (r, &spec->data.basic.color);
+      break;
+
+    case META_COLOR_SPEC_GTK:
+      spec->data.gtk.component = get_enum (r, META_GTK_COLOR_LAST, FALSE);
+      spec->data.gtk.state = get_uint (r);
+      break;
+
+    case META_COLOR_SPEC_GTK_CUSTOM:
+      spec->data.gtkcustom.color_name = get_string (r);
+      spec->data.gtkcustom.fallback = read_color_spec (r);
+      break;
+
+    case META_COLOR_SPEC_BLEND:
+      spec->data.blend.foreground = read_color_spec (r);
+      spec->data.blend.background = read_color_spec (r);
+      spec->data.blend.alpha = get_double (r);
+      break;
+
+    case META_COLOR_SPEC_SHADE:
+      spec->data.shade.base = read_color_spec (r);
+      spec->data.shade.factor = get_double (r);
+      break;
+    }
+
+  r->depth -= 1;
+
+  return spec;
+}
+
+static MetaAlphaGradientSpec *
+read_alpha_spec (CacheReader *r)
+{
+  MetaAlphaGradientSpec *spec;
+  int type;
+  guint n_alphas;
+
+  type = get_enum (r, META_GRADIENT_LAST, TRUE);
+  if (type < 0 || r->failed)
+    return NULL;
+
+  n_alphas = get_count (r, 1);
+  if (n_alphas == 0)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  spec = meta_alpha_gradient_spec_new (type, n_alphas);
+  get_data (r, spec->alphas, n_alphas);
+
+  return spec;
+}
+
+static MetaGradientSpec *
+read_gradient_spec (CacheReader *r)
+{
+  MetaGradientSpec *spec;
+  int type;
+  guint n_colors, i;
+
+  type = get_enum (r, META_GRADIENT_LAST, TRUE);
+  if (type < 0 || r->failed)
+    return NULL;
+
+  spec = meta_gradient_spec_new (type);
+
+  n_colors = get_count (r, 4);
+  for (i = 0; i < n_colors && !r->failed; i++)
+    {
+      MetaColorSpec *color_spec = read_color_spec (r);
+
+      if (color_spec == NULL)
+        r->failed = TRUE;
+      else
+        spec->color_specs = g_slist_prepend (spec->color_specs, color_spec);
+    }
+
+  spec->color_specs = g_slist_reverse (spec->color_specs);
+
+  return spec;
+}
+
+static MetaDrawSpec *
+read_draw_spec (CacheReader *r)
+{
+  MetaDrawSpec *spec;
+  gint32 n_tokens;
+  int i;
+
+  n_tokens = get_int (r);
+  if (n_tokens < 0 || r->failed)
+    {
+      if (n_tokens != -1)
+        r->failed = TRUE;
+      return NULL;
+    }
+
+  if ((gsize) (r->end - r->p) / 4 < (gsize) n_tokens)
+    {
+      r->failed = TRUE;
+      return NULL;
+    }
+
+  spec = g_slice_new0 (MetaDrawSpec);
+  spec->value = get_int (r);
+  spec->constant = get_boolean (r);
+
+  /* Zeroed, so freeing a half-read spec is safe */
+  spec->tokens = g_new0 (PosToken, n_tokens);
+  spec->n_tokens = n_tokens;
+
+  for (i = 0; i < n_tokens && !r->failed; i++)
+    {
+      PosToken *t = &spec->tokens[i];
+      PosTokenType type;
+
+      type = get_enum (r, POS_TOKEN_CLOSE_PAREN + 1, FALSE);
+
+      switch (type)
+        {
+        case POS_TOKEN_INT:
+          t->d.i.val = get_int (r);
+          break;
+
+        case POS_TOKEN_DOUBLE:
+          t->d.d.val = get_double (r);
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          t->d.o.op = get_enum (r, POS_OP_MIN + 1, FALSE);
+          break;
+
+        case POS_TOKEN_VARIABLE:
+          t->d.v.name = get_string (r);
+          if (t->d.v.name == NULL)
+            r->failed = TRUE;
+          else
+            t->d.v.name_quark = g_quark_from_string (t->d.v.name);
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+        case POS_TOKEN_CLOSE_PAREN:
+          break;
+        }
+
+      t->type = type;
+    }
+
+  /* The compiled code isn't stored, as evaluating it trusts it to be
+   * well formed; compiling the tokens again is cheap.
+   */
+  if (!r->failed)
+    meta_draw_spec_compile (spec);
+
+  return spec;
+}
+
+static MetaDrawOpList *
+get_op_list (CacheReader *r)
+{
+  int index = get_index (r, r->n_op_lists);
+
+  if (index < 0)
+    return NULL;
+
+  meta_draw_op_list_ref (r->op_lists[index]);
+
+  return r->op_lists[index];
+}
+
+static MetaDrawOp *
+read_draw_op (CacheReader *r)
+{
+  MetaDrawOp *op;
+  int index;
+
+  op = meta_draw_op_new (get_enum (r, META_DRAW_TILE + 1, FALSE));
+
+  switch (op->type)
+    {
+    case META_DRAW_LINE:
+      op->data.line.color_spec = read_color_spec (r);
+      op->data.line.dash_on_length = get_int (r);
+      op->data.line.dash_off_length = get_int (r);
+      op->data.line.width = get_int (r);
+      op->data.line.x1 = read_draw_spec (r);
+      op->data.line.y1 = read_draw_spec (r);
+      op->data.line.x2 = read_draw_spec (r);
+      op->data.line.y2 = read_draw_spec (r);
+      break;
+
+    case META_DRAW_RECTANGLE:
+      op->data.rectangle.color_spec = read_color_spec (r);
+      op->data.rectangle.filled = get_boolean (r);
+      op->data.rectangle.x = read_draw_spec (r);
+      op->data.rectangle.y = read_draw_spec (r);
+      op->data.rectangle.width = read_draw_spec (r);
+      op->data.rectangle.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_ARC:
+      op->data.arc.color_spec = read_color_spec (r);
+      op->data.arc.filled = get_boolean (r);
+      op->data.arc.x = read_draw_spec (r);
+      op->data.arc.y = read_draw_spec (r);
+      op->data.arc.width = read_draw_spec (r);
+      op->data.arc.height = read_draw_spec (r);
+      op->data.arc.start_angle = get_double (r);
+      op->data.arc.extent_angle = get_double (r);
+      break;
+
+    case META_DRAW_CLIP:
+      op->data.clip.x = read_draw_spec (r);
+      op->data.clip.y = read_draw_spec (r);
+      op->data.clip.width = read_draw_spec (r);
+      op->data.clip.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_TINT:
+      op->data.tint.color_spec = read_color_spec (r);
+      op->data.tint.alpha_spec = read_alpha_spec (r);
+      op->data.tint.x = read_draw_spec (r);
+      op->data.tint.y = read_draw_spec (r);
+      op->data.tint.width = read_draw_spec (r);
+      op->data.tint.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_GRADIENT:
+      op->data.gradient.gradient_spec = read_gradient_spec (r);
+      op->data.gradient.alpha_spec = read_alpha_spec (r);
+      op->data.gradient.x = read_draw_spec (r);
+      op->data.gradient.y = read_draw_spec (r);
+      op->data.gradient.width = read_draw_spec (r);
+      op->data.gradient.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_IMAGE:
+      index = get_index (r, r->n_images);
+      op->data.image.filename = get_string (r);
+      if (index >= 0 && r->images[index] != NULL)
+        op->data.image.pixbuf = g_object_ref (r->images[index]);
+      else if (index >= 0 || op->data.image.filename == NULL)
+        r->failed = TRUE;
+      op->data.image.colorize_spec = read_color_spec (r);
+      op->data.image.alpha_spec = read_alpha_spec (r);
+      op->data.image.x = read_draw_spec (r);
+      op->data.image.y = read_draw_spec (r);
+      op->data.image.width = read_draw_spec (r);
+      op->data.image.height = read_draw_spec (r);
+      op->data.image.fill_type = get_enum (r, META_IMAGE_FILL_TILE + 1, FALSE);
+      op->data.image.vertical_stripes = get_boolean (r);
+      op->data.image.horizontal_stripes = get_boolean (r);
+      break;
+
+    case META_DRAW_GTK_ARROW:
+      op->data.gtk_arrow.state = get_uint (r);
+      op->data.gtk_arrow.shadow = get_int (r);
+      op->data.gtk_arrow.arrow = get_int (r);
+      op->data.gtk_arrow.filled = get_boolean (r);
+      op->data.gtk_arrow.x = read_draw_spec (r);
+      op->data.gtk_arrow.y = read_draw_spec (r);
+      op->data.gtk_arrow.width = read_draw_spec (r);
+      op->data.gtk_arrow.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_GTK_BOX:
+      op->data.gtk_box.state = get_uint (r);
+      op->data.gtk_box.shadow = get_int (r);
+      op->data.gtk_box.x = read_draw_spec (r);
+      op->data.gtk_box.y = read_draw_spec (r);
+      op->data.gtk_box.width = read_draw_spec (r);
+      op->data.gtk_box.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_GTK_VLINE:
+      op->data.gtk_vline.state = get_uint (r);
+      op->data.gtk_vline.x = read_draw_spec (r);
+      op->data.gtk_vline.y1 = read_draw_spec (r);
+      op->data.gtk_vline.y2 = read_draw_spec (r);
+      break;
+
+    case META_DRAW_ICON:
+      op->data.icon.alpha_spec = read_alpha_spec (r);
+      op->data.icon.x = read_draw_spec (r);
+      op->data.icon.y = read_draw_spec (r);
+      op->data.icon.width = read_draw_spec (r);
+      op->data.icon.height = read_draw_spec (r);
+      op->data.icon.fill_type = get_enum (r, META_IMAGE_FILL_TILE + 1, FALSE);
+      break;
+
+    case META_DRAW_TITLE:
+      op->data.title.color_spec = read_color_spec (r);
+      op->data.title.x = read_draw_spec (r);
+      op->data.title.y = read_draw_spec (r);
+      op->data.title.ellipsize_width = read_draw_spec (r);
+      break;
+
+    case META_DRAW_OP_LIST:
+      op->data.op_list.op_list = get_op_list (r);
+      if (op->data.op_list.op_list == NULL)
+        r->failed = TRUE;
+      op->data.op_list.x = read_draw_spec (r);
+      op->data.op_list.y = read_draw_spec (r);
+      op->data.op_list.width = read_draw_spec (r);
+      op->data.op_list.height = read_draw_spec (r);
+      break;
+
+    case META_DRAW_TILE:
+      op->data.tile.op_list = get_op_list (r);
+      if (op->data.tile.op_list == NULL)
+        r->failed = TRUE;
+      op->data.tile.x = read_draw_spec (r);
+      op->data.tile.y = read_draw_spec (r);
+      op->data.tile.width = read_draw_spec (r);
+      op->data.tile.height = read_draw_spec (r);
+      op->data.tile.tile_xoffset = read_draw_spec (r);
+      op->data.tile.tile_yoffset = read_draw_spec (r);
+      op->data.tile.tile_width = read_draw_spec (r);
+      op->data.tile.tile_height = read_draw_spec (r);
+      break;
+    }
+
+  return op;
+}
+
+static void
+read_op_lists (CacheReader *r)
+{
+  guint i, j, n_ops;
+
+  /* Lists can include lists further on, so make them all first */
+  r->n_op_lists = get_count (r, 4);
+  r->op_lists = g_new0 (MetaDrawOpList *, r->n_op_lists);
+
+  for (i = 0; i < r->n_op_lists; i++)
+    r->op_lists[i] = meta_draw_op_list_new (1);
+
+  for (i = 0; i < r->n_op_lists && !r->failed; i++)
+    {
+      n_ops = get_count (r, 4);
+      for (j = 0; j < n_ops && !r->failed; j++)
+        meta_draw_op_list_append (r->op_lists[i], read_draw_op (r));
+    }
+}
+
+static void
+read_styles (CacheReader *r)
+{
+  guint i;
+  int j, k, index;
+
+  r->n_styles = get_count (r, 4 * (2 + META_BUTTON_TYPE_LAST *
+                                   META_BUTTON_STATE_LAST +
+                                   META_FRAME_PIECE_LAST + 2));
+  r->styles = g_new0 (MetaFrameStyle *, r->n_styles);
+
+  for (i = 0; i < r->n_styles && !r->failed; i++)
+    {
+      MetaFrameStyle *style;
+
+      /* Parents come first */
+      index = get_index (r, i);
+      style = meta_frame_style_new (index >= 0 ? r->styles[index] : NULL);
+      r->styles[i] = style;
+
+      index = get_index (r, r->n_layouts);
+      if (index >= 0)
+        {
+          style->layout = r->layouts[index];
+          meta_frame_layout_ref (style->layout);
+        }
+
+      for (j = 0; j < META_BUTTON_TYPE_LAST; j++)
+        for (k = 0; k < META_BUTTON_STATE_LAST; k++)
+          style->buttons[j][k] = get_op_list (r);
+
+      for (j = 0; j < META_FRAME_PIECE_LAST; j++)
+        style->pieces[j] = get_op_list (r);
+
+      style->window_background_color = read_color_spec (r);
+      style->window_background_alpha = get_uint (r);
+    }
+}
+
+static void
+read_style_sets (CacheReader *r)
+{
+  guint i;
+  int j, index;
+
+  r->n_style_sets = get_count (r, 4 * (1 + N_STYLE_SET_SLOTS));
+  r->style_sets = g_new0 (MetaFrameStyleSet *, r->n_style_sets);
+
+  for (i = 0; i < r->n_style_sets && !r->failed; i++)
+    {
+      MetaFrameStyleSet *style_set;
+      MetaFrameStyle **slots[N_STYLE_SET_SLOTS];
+
+      index = get_index (r, i);
+      style_set = meta_frame_style_set_new (index >= 0 ?
+                                            r->style_sets[index] : NULL);
+      r->style_sets[i] = style_set;
+
+      style_set_get_slots (style_set, slots);
+      for (j = 0; j < N_STYLE_SET_SLOTS; j++)
+        {
+          index = get_index (r, r->n_styles);
+          if (index >= 0)
+            {
+              *slots[j] = r->styles[index];
+              meta_frame_style_ref (*slots[j]);
+            }
+        }
+    }
+}
+
+static void
+read_names (CacheReader *r,
+            GHashTable  *by_name,
+            gpointer    *objects,
+            guint        n_objects,
+            void       (*ref) (gpointer object))
+{
+  guint n, i;
+
+  n = get_count (r, 8);
+  for (i = 0; i < n && !r->failed; i++)
+    {
+      const char *name;
+      int index;
+
+      name = peek_string (r);
+      index = get_index (r, n_objects);
+
+      if (name == NULL || index < 0)
+        {
+          r->failed = TRUE;
+          break;
+        }
+
+      ref (objects[index]);
+      g_hash_table_replace (by_name, g_strdup (name), objects[index]);
+    }
+}
+
+static void
+read_theme (CacheReader *r)
+{
+  MetaTheme *theme = r->theme;
+  int i, index;
+
+  theme->readable_name = get_string (r);
+  theme->author = get_string (r);
+  theme->copyright = get_string (r);
+  theme->date = get_string (r);
+  theme->description = get_string (r);
+  theme->format_version = get_uint (r);
+
+  read_images (r);
+  read_constants (r);
+  read_layouts (r);
+  read_op_lists (r);
+  read_styles (r);
+  read_style_sets (r);
+
+  read_names (r, theme->layouts_by_name,
+              (gpointer *) r->layouts, r->n_layouts,
+              (void (*) (gpointer)) meta_frame_layout_ref);
+  read_names (r, theme->draw_op_lists_by_name,
+              (gpointer *) r->op_lists, r->n_op_lists,
+              (void (*) (gpointer)) meta_draw_op_list_ref);
+  read_names (r, theme->styles_by_name,
+              (gpointer *) r->styles, r->n_styles,
+              (void (*) (gpointer)) meta_frame_style_ref);
+  read_names (r, theme->style_sets_by_name,
+              (gpointer *) r->style_sets, r->n_style_sets,
+              (void (*) (gpointer)) meta_frame_style_set_ref);
+
+  for (i = 0; i < META_FRAME_TYPE_LAST && !r->failed; i++)
+    {
+      index = get_index (r, r->n_style_sets);
+      if (index >= 0)
+        {
+          theme->style_sets_by_type[i] = r->style_sets[index];
+          meta_frame_style_set_ref (theme->style_sets_by_type[i]);
+        }
+    }
+
+  if (r->p != r->end)
+    r->failed = TRUE;
+}
+
+/* Drops the references the reader's tables hold; whatever the theme
+ * uses stays alive through its own references.
+ */
+static void
+reader_free_tables (CacheReader *r)
+{
+  guint i;
+
+  for (i = 0; i < r->n_images; i++)
+    if (r->images[i])
+      g_object_unref (r->images[i]);
+
+  for (i = 0; i < r->n_layouts; i++)
+    if (r->layouts[i])
+      meta_frame_layout_unref (r->layouts[i]);
+
+  for (i = 0; i < r->n_op_lists; i++)
+    if (r->op_lists[i])
+      meta_draw_op_list_unref (r->op_lists[i]);
+
+  for (i = 0; i < r->n_styles; i++)
+    if (r->styles[i])
+      meta_frame_style_unref (r->styles[i]);
+
+  for (i = 0; i < r->n_style_sets; i++)
+    if (r->style_sets[i])
+      meta_frame_style_set_unref (r->style_sets[i]);
+
+  g_free (r->images);
+  g_free (r->layouts);
+  g_free (r->op_lists);
+  g_free (r->styles);
+  g_free (r->style_sets);
+}
+
+/**
+ * meta_theme_cache_load: (skip)
+ * @theme_file: the theme file about to be parsed
+ * @theme_name: the name the theme is being loaded under
+ * @theme_dir: the directory of @theme_file
+ * @text: the contents of @theme_file
+ * @length: the length of @text
+ *
+ * Looks for a cache of @theme_file written by meta_theme_cache_save().
+ *
+ * Return value: the theme, or %NULL if there is no usable cache and
+ *   the file has to be parsed
+ */
+LOCAL_SYMBOL MetaTheme *
+meta_theme_cache_load (const char *theme_file,
+                       const char *theme_name,
+                       const char *theme_dir,
+                       const char *text,
+                       gsize       length)
+{
+  CacheReader r;
+  char *filename;
+  MetaTheme *theme;
+
+  if (cache_disabled ())
+    return NULL;
+
+  filename = cache_filename (theme_file, meta_prefs_get_ui_scale ());
+
+  /* Writable so that the mapping is copy-on-write, see the top */
+  memset (&r, 0, sizeof (r));
+  r.file = g_mapped_file_new (filename, TRUE, NULL);
+  if (r.file == NULL)
+    {
+      meta_topic (META_DEBUG_THEMES, "No theme cache at %s\n", filename);
+      g_free (filename);
+      return NULL;
+    }
+
+  r.p = (const guchar *) g_mapped_file_get_contents (r.file);
+  r.end = r.p + g_mapped_file_get_length (r.file);
+
+  theme = NULL;
+
+  if (check_header (&r, theme_file, theme_name, theme_dir, text, length))
+    {
+      theme = meta_theme_new ();
+      theme->name = g_strdup (theme_name);
+      theme->filename = g_strdup (theme_file);
+      theme->dirname = g_strdup (theme_dir);
+      theme->scale = meta_prefs_get_ui_scale ();
+
+      r.theme = theme;
+      read_theme (&r);
+
+      if (r.failed)
+        {
+          meta_topic (META_DEBUG_THEMES,
+                      "Theme cache %s is damaged, ignoring it\n", filename);
+          meta_theme_free (theme);
+          theme = NULL;
+        }
+    }
+
+  reader_free_tables (&r);
+  g_mapped_file_unref (r.file);
+  g_free (filename);
+
+  return theme;
+}
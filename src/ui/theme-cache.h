@@ -0,0 +1,46 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Muffin binary theme cache */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street - Suite 500, Boston, MA
+ * 02110-1335, USA.
+ */
+
+#ifndef META_THEME_CACHE_H
+#define META_THEME_CACHE_H
+
+#include "theme-private.h"
+
+/* A parsed theme file is written to the user cache directory, so the
+ * next load can map it instead of going through the XML parser. The
+ * cache is only used if the theme file (path, mtime, size and
+ * checksum), the images it loaded, the UI scale and the muffin version
+ * are all the same as when it was written.
+ *
+ * Setting MUFFIN_DISABLE_THEME_CACHE in the environment turns it off.
+ */
+
+MetaTheme *meta_theme_cache_load (const char *theme_file,
+                                  const char *theme_name,
+                                  const char *theme_dir,
+                                  const char *text,
+                                  gsize       length);
+
+void       meta_theme_cache_save (MetaTheme  *theme,
+                                  const char *text,
+                                  gsize       length);
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <config.h>
 #include "theme-private.h"
+#include "theme-cache.h"
 #include <meta/util.h>
 #include <meta/prefs.h>
 #include <string.h>
@@ -2167,12 +2168,8 @@ parse_draw_op_element (GMarkupParseContext  *context,
       const char *colorize;
       const char *fill_type;
       MetaAlphaGradientSpec *alpha_spec;
-      GdkPixbuf *pixbuf;
       MetaColorSpec *colorize_spec = NULL;
       MetaImageFillType fill_type_val;
-      int h, w, c;
-      int pixbuf_width, pixbuf_height, pixbuf_n_channels, pixbuf_rowstride;
-      guchar *pixbuf_pixels;
       
       if (!locate_attributes (context, element_name, attribute_names, attribute_values,
                               error,
@@ -2211,13 +2208,11 @@ parse_draw_op_element (GMarkupParseContext  *context,
             }
         }
       
-      /* Check last so we don't have to free it when other
-       * stuff fails.
-       *
+      /* The image itself is only loaded when a style that draws it is
+       * first looked up, but a file that is missing or isn't an image
+       * is still an error here.
        */
-      pixbuf = meta_theme_load_image (info->theme, filename, info->theme->scale, error);
-
-      if (pixbuf == NULL)
+      if (!meta_theme_check_image (info->theme, filename, error))
         {
           add_context_to_error (error, context);
           return;
@@ -2230,21 +2225,17 @@ parse_draw_op_element (GMarkupParseContext  *context,
           if (colorize_spec == NULL)
             {
               add_context_to_error (error, context);
-              g_object_unref (G_OBJECT (pixbuf));
               return;
             }
         }
 
       alpha_spec = NULL;
       if (alpha && !parse_alpha (alpha, &alpha_spec, context, error))
-        {
-          g_object_unref (G_OBJECT (pixbuf));
-          return;
-        }
+        return;
       
       op = meta_draw_op_new (META_DRAW_IMAGE);
 
-      op->data.image.pixbuf = pixbuf;
+      op->data.image.filename = g_strdup (filename);
       op->data.image.colorize_spec = colorize_spec;
 
       op->data.image.x = meta_draw_spec_new (info->theme, x, NULL);
@@ -2255,67 +2246,6 @@ parse_draw_op_element (GMarkupParseContext  *context,
       op->data.image.alpha_spec = alpha_spec;
       op->data.image.fill_type = fill_type_val;
       
-      /* Check for vertical & horizontal stripes */
-      pixbuf_n_channels = gdk_pixbuf_get_n_channels(pixbuf);
-      pixbuf_width = gdk_pixbuf_get_width(pixbuf);
-      pixbuf_height = gdk_pixbuf_get_height(pixbuf);
-      pixbuf_rowstride = gdk_pixbuf_get_rowstride(pixbuf);
-      pixbuf_pixels = gdk_pixbuf_get_pixels(pixbuf);
-
-      /* Check for horizontal stripes */
-      for (h = 0; h < pixbuf_height; h++)
-        {
-          for (w = 1; w < pixbuf_width; w++)
-            {
-              for (c = 0; c < pixbuf_n_channels; c++)
-                {
-                  if (pixbuf_pixels[(h * pixbuf_rowstride) + c] !=
-                      pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
-                    break;
-                }
-              if (c < pixbuf_n_channels)
-                break;
-            }
-          if (w < pixbuf_width)
-            break;
-        }
-
-      if (h >= pixbuf_height)
-        {
-          op->data.image.horizontal_stripes = TRUE; 
-        }
-      else
-        {
-          op->data.image.horizontal_stripes = FALSE; 
-        }
-
-      /* Check for vertical stripes */
-      for (w = 0; w < pixbuf_width; w++)
-        {
-          for (h = 1; h < pixbuf_height; h++)
-            {
-              for (c = 0; c < pixbuf_n_channels; c++)
-                {
-                  if (pixbuf_pixels[w + c] !=
-                      pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
-                    break;
-                }
-              if (c < pixbuf_n_channels)
-                break;
-            }
-          if (h < pixbuf_height)
-            break;
-        }
-
-      if (w >= pixbuf_width)
-        {
-          op->data.image.vertical_stripes = TRUE; 
-        }
-      else
-        {
-          op->data.image.vertical_stripes = FALSE; 
-        }
-      
       g_assert (info->op_list);
       
       meta_draw_op_list_append (info->op_list, op);
@@ -4227,6 +4157,7 @@ load_theme (const char *theme_dir,
   char *theme_filename;
   char *theme_file;
   MetaTheme *retval;
+  gint64 start_time;
 
   g_return_val_if_fail (error && *error == NULL, NULL);
 
@@ -4243,6 +4174,17 @@ load_theme (const char *theme_dir,
                             error))
     goto out;
 
+  start_time = g_get_monotonic_time ();
+
+  retval = meta_theme_cache_load (theme_file, theme_name, theme_dir,
+                                  text, length);
+  if (retval)
+    {
+      meta_topic (META_DEBUG_THEMES, "Loaded theme file %s from cache in %.2f ms\n",
+                  theme_file, (g_get_monotonic_time () - start_time) / 1000.0);
+      goto out;
+    }
+
   meta_topic (META_DEBUG_THEMES, "Parsing theme file %s\n", theme_file);
 
   parse_info_init (&info);
@@ -4268,6 +4210,15 @@ load_theme (const char *theme_dir,
   retval = info.theme;
   info.theme = NULL;
 
+  if (retval && !meta_theme_get_lazy_images ())
+    meta_theme_load_all_images (retval);
+
+  meta_topic (META_DEBUG_THEMES, "Parsed theme file %s in %.2f ms\n",
+              theme_file, (g_get_monotonic_time () - start_time) / 1000.0);
+
+  if (retval)
+    meta_theme_cache_save (retval, text, length);
+
  out:
   if (*error && !theme_error_is_fatal (*error))
     {
@@ -4403,3 +4354,44 @@ meta_theme_load (const char *theme_name,
 
   return retval;
 }
+
+/**
+ * meta_theme_load_dir: (skip)
+ * @theme_dir: a directory with a theme file in it
+ * @err: return location for an error
+ *
+ * Loads the theme in @theme_dir, trying the file of each supported
+ * major version from the newest, the way meta_theme_load() does in
+ * each place it looks. The theme is named after the directory. Used
+ * to benchmark themes that aren't installed.
+ */
+MetaTheme*
+meta_theme_load_dir (const char *theme_dir,
+                     GError    **err)
+{
+  GError *error = NULL;
+  MetaTheme *retval = NULL;
+  char *theme_name;
+  int major_version;
+
+  theme_name = g_path_get_basename (theme_dir);
+
+  for (major_version = THEME_MAJOR_VERSION; (major_version > 0); major_version--)
+    {
+      retval = load_theme (theme_dir, theme_name, major_version, &error);
+      if (!keep_trying (&error))
+        break;
+    }
+
+  if (!error && !retval)
+    g_set_error (&error, META_THEME_ERROR, META_THEME_ERROR_FAILED,
+                 _("Failed to find a valid file for theme %s\n"),
+                 theme_dir);
+
+  if (error)
+    g_propagate_error (err, error);
+
+  g_free (theme_name);
+
+  return retval;
+}
@@ -441,16 +441,70 @@ typedef struct
   } d;
 } PosToken;
 
+/**
+ * The variables an expression can refer to, in the order of
+ * pos_variable_names in theme.c.
+ */
+typedef enum
+{
+  POS_VAR_WIDTH,
+  POS_VAR_HEIGHT,
+  POS_VAR_OBJECT_WIDTH,
+  POS_VAR_OBJECT_HEIGHT,
+  POS_VAR_LEFT_WIDTH,
+  POS_VAR_RIGHT_WIDTH,
+  POS_VAR_TOP_HEIGHT,
+  POS_VAR_BOTTOM_HEIGHT,
+  POS_VAR_MINI_ICON_WIDTH,
+  POS_VAR_MINI_ICON_HEIGHT,
+  POS_VAR_ICON_WIDTH,
+  POS_VAR_ICON_HEIGHT,
+  POS_VAR_TITLE_WIDTH,
+  POS_VAR_TITLE_HEIGHT,
+  POS_VAR_FRAME_X_CENTER,
+  POS_VAR_FRAME_Y_CENTER,
+  POS_VAR_LAST
+} PosVariable;
+
+typedef enum
+{
+  POS_INSTR_INT,
+  POS_INSTR_DOUBLE,
+  POS_INSTR_VARIABLE,
+  POS_INSTR_OPERATOR
+} PosInstrType;
+
+/**
+ * One step of a compiled expression, which is in postfix order:
+ * operands are pushed on a stack, and operators replace the top two
+ * entries with their result.
+ *
+ * \ingroup parser
+ */
+typedef struct
+{
+  PosInstrType type;
+
+  union
+  {
+    int int_val;
+    double double_val;
+    PosVariable var;
+    PosOperatorType op;
+  } d;
+} PosInstr;
+
 /**
  * MetaDrawSpec: (skip)
  *
  * A computed expression in our simple vector drawing language.
- * While it appears to take the form of a tree, this is actually
- * merely a list; concerns such as precedence of operators are
- * currently recomputed on every recalculation.
+ *
+ * The tokens are compiled when the spec is created, folding whatever
+ * doesn't depend on variables; if the expression can't be compiled
+ * (it would give an error), evaluating it walks the tokens instead,
+ * which reports the error.
  *
  * Created by meta_draw_spec_new(), destroyed by meta_draw_spec_free().
- * pos_eval() fills this with ...FIXME. Are tokens a tree or a list?
  * \ingroup parser
  */
 typedef struct _MetaDrawSpec MetaDrawSpec;
@@ -468,6 +522,12 @@ struct _MetaDrawSpec
   /** How many tokens are in the tokens list. */
   int n_tokens;
 
+  /** The compiled expression, or NULL */
+  PosInstr *code;
+
+  /** How many instructions are in the code. */
+  int n_code;
+
   /** Does the expression contain any variables? */
   gboolean constant : 1;
 };
@@ -541,7 +601,9 @@ struct _MetaDrawOp
     struct {
       MetaColorSpec *colorize_spec;
       MetaAlphaGradientSpec *alpha_spec;
+      /* Loaded from @filename when a style using it is first looked up */
       GdkPixbuf *pixbuf;
+      char *filename;
       MetaDrawSpec *x;
       MetaDrawSpec *y;
       MetaDrawSpec *width;
@@ -635,6 +697,10 @@ struct _MetaDrawOpList
   MetaDrawOp **ops;
   int n_ops;
   int n_allocated;
+  /** Cached renderings of the list as a frame piece, most recent first */
+  GList *renders;
+  /** Whether the images in the list (and the lists it uses) are loaded */
+  gboolean materialized;
 };
 
 typedef enum
@@ -755,6 +821,11 @@ struct _MetaFrameStyle
    * Transparency of the window background. 0=transparent; 255=opaque.
    */
   guint8 window_background_alpha;
+  /**
+   * Whether the images used by this style and its parents are loaded.
+   * That happens the first time the style is looked up.
+   */
+  gboolean materialized;
 };
 
 /* Kinds of frame...
@@ -962,6 +1033,32 @@ MetaDrawSpec* meta_draw_spec_new (MetaTheme  *theme,
                                   const char *expr,
                                   GError    **error);
 void          meta_draw_spec_free (MetaDrawSpec *spec);
+void          meta_draw_spec_compile (MetaDrawSpec *spec);
+
+/* For benchmarking the expression compiler; on by default */
+void          meta_theme_set_compile_expressions (gboolean compile);
+
+/* Scaled image cache use, for the theme benchmark */
+void          meta_theme_get_image_cache_stats (guint *hits,
+                                                guint *misses);
+
+/* Frame geometry cache, for checking and benchmarking; on by default */
+void          meta_theme_set_geometry_cache (gboolean enabled);
+void          meta_theme_get_geometry_cache_stats (guint *hits,
+                                                   guint *misses);
+
+/* Loading images only when a style using them is looked up; on by
+ * default. The stats count the images a theme has loaded so far.
+ */
+void          meta_theme_set_lazy_images (gboolean lazy);
+gboolean      meta_theme_get_lazy_images (void);
+void          meta_theme_get_image_stats (MetaTheme *theme,
+                                          guint     *n_images,
+                                          gsize     *bytes);
+void          meta_theme_load_all_images (MetaTheme *theme);
+
+MetaTheme*    meta_theme_load_dir (const char  *theme_dir,
+                                   GError     **err);
 
 MetaColorSpec* meta_color_spec_new             (MetaColorSpecType  type);
 MetaColorSpec* meta_color_spec_new_from_string (const char        *str,
@@ -1043,6 +1140,8 @@ void meta_frame_style_draw (MetaFrameStyle          *style,
                             GdkPixbuf               *icon);
 
 
+void meta_theme_flush_piece_cache (void);
+
 void meta_frame_style_draw_with_style (MetaFrameStyle          *style,
                                        GtkStyleContext         *style_gtk,
                                        GtkWidget               *widget,
@@ -1072,6 +1171,9 @@ GdkPixbuf* meta_theme_load_image (MetaTheme  *theme,
                                   const char *filename,
                                   guint       size_of_theme_icons,
                                   GError    **error);
+gboolean   meta_theme_check_image (MetaTheme  *theme,
+                                   const char *filename,
+                                   GError    **error);
 
 MetaFrameStyle* meta_theme_get_frame_style (MetaTheme     *theme,
                                             MetaFrameType  type,
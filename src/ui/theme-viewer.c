@@ -64,9 +64,9 @@ static GtkWidget *previews[META_FRAME_TYPE_LAST*FONT_SIZE_LAST + BUTTON_LAYOUT_C
 static double milliseconds_to_draw_frame = 0.0;
 
 static void run_position_expression_tests (void);
-#if 0
 static void run_position_expression_timings (void);
-#endif
+static void run_theme_load_timings (const char *theme_name);
+static void run_geometry_cache_tests (void);
 static void run_theme_benchmark (void);
 
 
@@ -788,9 +788,6 @@ main (int argc, char **argv)
   bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
 
   run_position_expression_tests ();
-#if 0
-  run_position_expression_timings ();
-#endif
 
   gtk_init (&argc, &argv);
 
@@ -825,7 +822,11 @@ main (int argc, char **argv)
            global_theme->name,
            (end - start) / (double) CLOCKS_PER_SEC);
 
-  run_theme_benchmark ();
+  run_theme_load_timings (global_theme->name);
+
+  run_geometry_cache_tests ();
+
+  run_position_expression_timings ();
   
   window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_window_set_default_size (GTK_WINDOW (window), 350, 350);
@@ -978,6 +979,7 @@ run_theme_benchmark (void)
   int client_height;
   cairo_t *cr;
   int inc;
+  guint hits, misses, start_hits, start_misses;
   
   widget = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_widget_realize (widget);
@@ -1004,6 +1006,8 @@ run_theme_benchmark (void)
   button_layout.right_buttons[1] = META_BUTTON_FUNCTION_MAXIMIZE;
   button_layout.right_buttons[2] = META_BUTTON_FUNCTION_CLOSE;
 
+  meta_theme_get_image_cache_stats (&start_hits, &start_misses);
+
   timer = g_timer_new ();
   start = clock ();
 
@@ -1059,6 +1063,71 @@ run_theme_benchmark (void)
            g_timer_elapsed (timer, NULL),
            milliseconds_to_draw_frame);
 
+  meta_theme_get_image_cache_stats (&hits, &misses);
+  g_print (_("Scaled images: %u cache hits, %u misses\n"),
+           hits - start_hits, misses - start_misses);
+
+  /* Windows come in a few sizes and flip between focused and not, so
+   * draw every frame type at a handful of sizes; for themes made of
+   * images this is mostly scaling them.
+   */
+  start_hits = hits;
+  start_misses = misses;
+  g_timer_start (timer);
+
+  i = 0;
+  while (i < ITERATIONS)
+    {
+      MetaFrameType type;
+      MetaFrameFlags flags;
+
+      type = i % META_FRAME_TYPE_LAST;
+      flags = get_flags (widget);
+      if ((i / META_FRAME_TYPE_LAST) % 2)
+        flags &= ~META_FRAME_HAS_FOCUS;
+
+      client_width = 200 + 150 * ((i / (2 * META_FRAME_TYPE_LAST)) % 3);
+      client_height = 150 + 100 * ((i / (2 * META_FRAME_TYPE_LAST)) % 3);
+
+      meta_theme_get_frame_borders (global_theme, type,
+                                    get_text_height (widget),
+                                    flags, &borders);
+
+      pixmap = gdk_window_create_similar_surface (gtk_widget_get_window (widget),
+                                                  CAIRO_CONTENT_COLOR,
+                                                  client_width + borders.total.left + borders.total.right,
+                                                  client_height + borders.total.top + borders.total.bottom);
+
+      cr = cairo_create (pixmap);
+
+      meta_theme_draw_frame (global_theme,
+                             widget,
+                             cr,
+                             type,
+                             flags,
+                             client_width, client_height,
+                             layout,
+                             get_text_height (widget),
+                             &button_layout,
+                             button_states,
+                             meta_preview_get_mini_icon (),
+                             meta_preview_get_icon ());
+
+      cairo_destroy (cr);
+      cairo_surface_destroy (pixmap);
+
+      ++i;
+    }
+
+  g_timer_stop (timer);
+
+  meta_theme_get_image_cache_stats (&hits, &misses);
+  g_print (_("Drew %d frames of every type in %g seconds (%g milliseconds per frame); scaled images: %u cache hits, %u misses\n"),
+           ITERATIONS,
+           g_timer_elapsed (timer, NULL),
+           g_timer_elapsed (timer, NULL) / (double) ITERATIONS * 1000,
+           hits - start_hits, misses - start_misses);
+
   g_timer_destroy (timer);
   g_object_unref (G_OBJECT (layout));
   gtk_widget_destroy (widget);
@@ -1221,10 +1290,32 @@ static const PositionExpressionTest position_expression_tests[] = {
     "+ 2 * 5", 0, 0, META_THEME_ERROR_FAILED }
 };
 
+static void
+init_position_expression_env (MetaPositionExprEnv          *env,
+                              const PositionExpressionTest *test)
+{
+  env->rect = meta_rect (test->rect.x, test->rect.y,
+                         test->rect.width, test->rect.height);
+  env->object_width = -1;
+  env->object_height = -1;
+  env->left_width = 0;
+  env->right_width = 0;
+  env->top_height = 0;
+  env->bottom_height = 0;
+  env->title_width = 5;
+  env->title_height = 5;
+  env->frame_x_center = test->rect.width / 2;
+  env->frame_y_center = test->rect.height / 2;
+  env->icon_width = 32;
+  env->icon_height = 32;
+  env->mini_icon_width = 16;
+  env->mini_icon_height = 16;
+  env->theme = NULL;
+}
+
 static void
 run_position_expression_tests (void)
 {
-#if 0
   int i;
   MetaPositionExprEnv env;
 
@@ -1234,37 +1325,25 @@ run_position_expression_tests (void)
       GError *err;
       gboolean retval;
       const PositionExpressionTest *test;
-      PosToken *tokens;
-      int n_tokens;
+      MetaDrawSpec *spec;
       int x, y;
 
       test = &position_expression_tests[i];
 
       if (g_getenv ("META_PRINT_TESTS") != NULL)
-        g_print ("Test expression: \"%s\" expecting x = %d y = %d",
+        g_print ("Test expression: \"%s\" expecting x = %d y = %d\n",
                  test->expr, test->expected_x, test->expected_y);
 
       err = NULL;
+      retval = FALSE;
       
-      env.rect = meta_rect (test->rect.x, test->rect.y,
-                            test->rect.width, test->rect.height);
-      env.object_width = -1;
-      env.object_height = -1;
-      env.left_width = 0;
-      env.right_width = 0;
-      env.top_height = 0;
-      env.bottom_height = 0;
-      env.title_width = 5;
-      env.title_height = 5;
-      env.icon_width = 32;
-      env.icon_height = 32;
-      env.mini_icon_width = 16;
-      env.mini_icon_height = 16;
-      env.theme = NULL;
+      init_position_expression_env (&env, test);
+
+      spec = meta_draw_spec_new (NULL, test->expr, &err);
 
       if (err == NULL)
         {
-          retval = meta_parse_position_expression (tokens, n_tokens,
+          retval = meta_parse_position_expression (spec,
                                                    &env,
                                                    &x, &y,
                                                    &err);
@@ -1298,56 +1377,35 @@ run_position_expression_tests (void)
       if (err)
         g_error_free (err);
 
-      meta_pos_tokens_free (tokens, n_tokens);
+      meta_draw_spec_free (spec);
       ++i;
     }
-#endif
 }
 
-#if 0
-static void
-run_position_expression_timings (void)
+static double
+time_position_expressions (MetaDrawSpec **specs)
 {
   int i;
   int iters;
-  clock_t start;
-  clock_t end;
+  GTimer *timer;
   MetaPositionExprEnv env;
+  double elapsed;
 
 #define ITERATIONS 100000
 
-  start = clock ();
+  timer = g_timer_new ();
 
   iters = 0;
   i = 0;
   while (iters < ITERATIONS)
     {
-      const PositionExpressionTest *test;
       int x, y;
 
-      test = &position_expression_tests[i];
-
-      env.x = test->rect.x;
-      env.y = test->rect.y;
-      env.width = test->rect.width;
-      env.height = test->rect.height;
-      env.object_width = -1;
-      env.object_height = -1;
-      env.left_width = 0;
-      env.right_width = 0;
-      env.top_height = 0;
-      env.bottom_height = 0;
-      env.title_width = 5;
-      env.title_height = 5;
-      env.icon_width = 32;
-      env.icon_height = 32;
-      env.mini_icon_width = 16;
-      env.mini_icon_height = 16;
-      env.theme = NULL;
-
-      meta_parse_position_expression (test->expr,
-                                      &env,
-                                      &x, &y, NULL);
+      if (specs[i] != NULL)
+        {
+          init_position_expression_env (&env, &position_expression_tests[i]);
+          meta_parse_position_expression (specs[i], &env, &x, &y, NULL);
+        }
 
       ++iters;
       ++i;
@@ -1355,12 +1413,203 @@ run_position_expression_timings (void)
         i = 0;
     }
 
-  end = clock ();
+  g_timer_stop (timer);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
 
-  g_print (_("%d coordinate expressions parsed in %g seconds (%g seconds average)\n"),
-           ITERATIONS,
-           ((double)end - (double)start) / CLOCKS_PER_SEC,
-           ((double)end - (double)start) / CLOCKS_PER_SEC / (double) ITERATIONS);
+  g_print (_("%d coordinate expressions evaluated in %g seconds (%g seconds average)\n"),
+           ITERATIONS, elapsed, elapsed / (double) ITERATIONS);
+
+  return elapsed;
 
+#undef ITERATIONS
+}
+
+static double
+time_theme_loads (const char *theme_name,
+                  gboolean    use_cache)
+{
+  int i;
+  GTimer *timer;
+  double elapsed;
+
+#define ITERATIONS 20
+
+  if (use_cache)
+    g_unsetenv ("MUFFIN_DISABLE_THEME_CACHE");
+  else
+    g_setenv ("MUFFIN_DISABLE_THEME_CACHE", "1", TRUE);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      MetaTheme *theme;
+
+      theme = meta_theme_load (theme_name, NULL);
+      if (theme)
+        meta_theme_free (theme);
+    }
+
+  g_timer_stop (timer);
+  elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  g_print (_("Loaded the theme %d times %s in %g seconds (%g milliseconds average)\n"),
+           ITERATIONS, use_cache ? _("from the cache") : _("from XML"),
+           elapsed, elapsed / ITERATIONS * 1000);
+
+  return elapsed;
+
+#undef ITERATIONS
+}
+
+/* Compares parsing the theme with loading the cache that the first
+ * load wrote.
+ */
+static void
+run_theme_load_timings (const char *theme_name)
+{
+  double parsed, cached;
+
+  if (g_getenv ("MUFFIN_DISABLE_THEME_CACHE") != NULL)
+    return;
+
+  parsed = time_theme_loads (theme_name, FALSE);
+  cached = time_theme_loads (theme_name, TRUE);
+
+  g_print (_("Loading from the theme cache was %g times as fast\n"),
+           cached > 0 ? parsed / cached : 0.0);
+}
+
+/* Checks that frame geometry from the cache is the same as laying the
+ * frame out every time, for every frame type and button layout, while
+ * the width grows one pixel at a time and then shrinks again.
+ */
+static void
+run_geometry_cache_tests (void)
+{
+  static const MetaFrameFlags extra_flags[] = {
+    0,
+    META_FRAME_MAXIMIZED,
+    META_FRAME_SHADED,
+    META_FRAME_TILED_LEFT,
+    META_FRAME_TILED_RIGHT
+  };
+  static const int text_heights[] = { 0, 12, 24 };
+  MetaFrameGeometry *expected;
+  MetaFrameGeometry fgeom;
+  MetaFrameFlags flags;
+  GTimer *timer;
+  guint hits, misses, start_hits, start_misses;
+  int type, f, t, b, i;
+  int checked;
+
+#define MAX_CLIENT_WIDTH 600
+
+  init_layouts ();
+
+  expected = g_new (MetaFrameGeometry, MAX_CLIENT_WIDTH + 1);
+  meta_theme_get_geometry_cache_stats (&start_hits, &start_misses);
+  timer = g_timer_new ();
+  checked = 0;
+
+  for (type = 0; type < META_FRAME_TYPE_LAST; type++)
+    for (f = 0; f < (int) (G_N_ELEMENTS (extra_flags) * 2); f++)
+      for (t = 0; t < (int) G_N_ELEMENTS (text_heights); t++)
+        for (b = 0; b < BUTTON_LAYOUT_COMBINATIONS; b++)
+          {
+            flags = get_flags (NULL) | extra_flags[f / 2];
+            if (f % 2)
+              flags &= ~META_FRAME_HAS_FOCUS;
+
+            meta_theme_set_geometry_cache (FALSE);
+
+            for (i = 1; i <= MAX_CLIENT_WIDTH; i++)
+              {
+                memset (&expected[i], 0, sizeof (expected[i]));
+                meta_theme_calc_geometry (global_theme, type,
+                                          text_heights[t], flags,
+                                          i, i / 2,
+                                          &different_layouts[b],
+                                          &expected[i]);
+              }
+
+            meta_theme_set_geometry_cache (TRUE);
+
+            for (i = 1; i <= 2 * MAX_CLIENT_WIDTH; i++)
+              {
+                int width;
+
+                width = i <= MAX_CLIENT_WIDTH ? i : 2 * MAX_CLIENT_WIDTH + 1 - i;
+
+                memset (&fgeom, 0, sizeof (fgeom));
+                meta_theme_calc_geometry (global_theme, type,
+                                          text_heights[t], flags,
+                                          width, width / 2,
+                                          &different_layouts[b],
+                                          &fgeom);
+
+                if (memcmp (&fgeom, &expected[width], sizeof (fgeom)) != 0)
+                  g_error (_("Cached geometry for frame type %d, flags 0x%x, "
+                             "text height %d, button layout %d and client "
+                             "width %d differs from the uncached geometry"),
+                           type, flags, text_heights[t], b, width);
+
+                ++checked;
+              }
+          }
+
+  g_timer_stop (timer);
+  meta_theme_get_geometry_cache_stats (&hits, &misses);
+
+  g_print (_("Checked %d cached frame geometries in %g seconds; %u cache hits, %u misses\n"),
+           checked, g_timer_elapsed (timer, NULL),
+           hits - start_hits, misses - start_misses);
+
+  g_timer_destroy (timer);
+  g_free (expected);
+
+#undef MAX_CLIENT_WIDTH
+}
+
+/* Compares evaluating the test expressions and drawing the theme with
+ * and without compiling position expressions.
+ */
+static void
+run_position_expression_timings (void)
+{
+  MetaDrawSpec *specs[G_N_ELEMENTS (position_expression_tests)];
+  double interpreted, compiled;
+  double frame_interpreted;
+  int i;
+
+  /* Expressions that fail to parse are skipped */
+  for (i = 0; i < (int) G_N_ELEMENTS (position_expression_tests); i++)
+    {
+      if (((int) position_expression_tests[i].expected_error) != NO_ERROR)
+        specs[i] = NULL;
+      else
+        specs[i] = meta_draw_spec_new (NULL, position_expression_tests[i].expr,
+                                       NULL);
+    }
+
+  g_print (_("Interpreted position expressions:\n"));
+  meta_theme_set_compile_expressions (FALSE);
+  interpreted = time_position_expressions (specs);
+  run_theme_benchmark ();
+  frame_interpreted = milliseconds_to_draw_frame;
+
+  g_print (_("Compiled position expressions:\n"));
+  meta_theme_set_compile_expressions (TRUE);
+  compiled = time_position_expressions (specs);
+  run_theme_benchmark ();
+
+  g_print (_("Compiling made expressions %g times as fast, and frames %g times as fast\n"),
+           compiled > 0 ? interpreted / compiled : 0.0,
+           milliseconds_to_draw_frame > 0 ?
+           frame_interpreted / milliseconds_to_draw_frame : 0.0);
+
+  for (i = 0; i < (int) G_N_ELEMENTS (position_expression_tests); i++)
+    meta_draw_spec_free (specs[i]);
 }
-#endif
@@ -55,6 +55,7 @@
 
 #include <config.h>
 #include "theme-private.h"
+#include "gradient-private.h"
 #include <meta/util.h>
 #include <meta/gradient.h>
 #include <meta/prefs.h>
@@ -77,8 +78,6 @@
 #define ALPHA_TO_UCHAR(d) ((unsigned char) ((d) * 255))
 
 #define DEBUG_FILL_STRUCT(s) memset ((s), 0xef, sizeof (*(s)))
-#define CLAMP_UCHAR(v) ((guchar) (CLAMP (((int)v), (int)0, (int)255)))
-#define INTENSITY(r, g, b) ((r) * 0.30 + (g) * 0.59 + (b) * 0.11)
 
 static void gtk_style_shade		(GdkRGBA	 *a,
 					 GdkRGBA	 *b,
@@ -90,89 +89,13 @@ static void hls_to_rgb			(gdouble	 *h,
 					 gdouble	 *l,
 					 gdouble	 *s);
 
+static void geometry_cache_flush (void);
+
 /*
  * The current theme. (Themes are singleton.)
  */
 static MetaTheme *meta_current_theme = NULL;
 
-static GdkPixbuf *
-colorize_pixbuf (GdkPixbuf *orig,
-                 GdkRGBA   *new_color)
-{
-  GdkPixbuf *pixbuf;
-  double intensity;
-  int x, y;
-  const guchar *src;
-  guchar *dest;
-  int orig_rowstride;
-  int dest_rowstride;
-  int width, height;
-  gboolean has_alpha;
-  const guchar *src_pixels;
-  guchar *dest_pixels;
-  
-  pixbuf = gdk_pixbuf_new (gdk_pixbuf_get_colorspace (orig), gdk_pixbuf_get_has_alpha (orig),
-			   gdk_pixbuf_get_bits_per_sample (orig),
-			   gdk_pixbuf_get_width (orig), gdk_pixbuf_get_height (orig));
-
-  if (pixbuf == NULL)
-    return NULL;
-  
-  orig_rowstride = gdk_pixbuf_get_rowstride (orig);
-  dest_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  width = gdk_pixbuf_get_width (pixbuf);
-  height = gdk_pixbuf_get_height (pixbuf);
-  has_alpha = gdk_pixbuf_get_has_alpha (orig);
-  src_pixels = gdk_pixbuf_get_pixels (orig);
-  dest_pixels = gdk_pixbuf_get_pixels (pixbuf);
-  
-  for (y = 0; y < height; y++)
-    {
-      src = src_pixels + y * orig_rowstride;
-      dest = dest_pixels + y * dest_rowstride;
-
-      for (x = 0; x < width; x++)
-        {
-          double dr, dg, db;
-          
-          intensity = INTENSITY (src[0], src[1], src[2]) / 255.0;
-
-          if (intensity <= 0.5)
-            {
-              /* Go from black at intensity = 0.0 to new_color at intensity = 0.5 */
-              dr = new_color->red * intensity * 2.0;
-              dg = new_color->green * intensity * 2.0;
-              db = new_color->blue * intensity * 2.0;
-            }
-          else
-            {
-              /* Go from new_color at intensity = 0.5 to white at intensity = 1.0 */
-              dr = new_color->red + (1.0 - new_color->red) * (intensity - 0.5) * 2.0;
-              dg = new_color->green + (1.0 - new_color->green) * (intensity - 0.5) * 2.0;
-              db = new_color->blue + (1.0 - new_color->blue) * (intensity - 0.5) * 2.0;
-            }
-          
-          dest[0] = CLAMP_UCHAR (255 * dr);
-          dest[1] = CLAMP_UCHAR (255 * dg);
-          dest[2] = CLAMP_UCHAR (255 * db);
-          
-          if (has_alpha)
-            {
-              dest[3] = src[3];
-              src += 4;
-              dest += 4;
-            }
-          else
-            {
-              src += 3;
-              dest += 3;
-            }
-        }
-    }
-
-  return pixbuf;
-}
-
 static void
 color_composite (const GdkRGBA *bg,
                  const GdkRGBA *fg,
@@ -393,6 +316,9 @@ meta_frame_layout_unref (MetaFrameLayout *layout)
 
   if (layout->refcount == 0)
     {
+      /* Cached geometry is keyed on the layout's address */
+      geometry_cache_flush ();
+
       DEBUG_FILL_STRUCT (layout);
       g_free (layout);
     }
@@ -616,18 +542,46 @@ strip_button (MetaButtonSpace *func_rects[MAX_BUTTONS_PER_CORNER],
   return FALSE; /* did not strip anything */
 }
 
-LOCAL_SYMBOL void
-meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
-                                 int                     text_height,
-                                 MetaFrameFlags          flags,
-                                 int                     client_width,
-                                 int                     client_height,
-                                 const MetaButtonLayout *button_layout,
-                                 MetaFrameType           type,
-                                 MetaFrameGeometry      *fgeom,
-                                 MetaTheme              *theme)
+/* What calc_geometry() needs to know to move a geometry to another
+ * width without doing the layout again.
+ */
+typedef struct
+{
+  /* Every button was placed, none stripped */
+  gboolean fits;
+  /* The narrowest frame the buttons fit in */
+  int min_width;
+  /* The leftmost point the right-hand buttons were placed from */
+  int min_right_x;
+
+  /* Offsets in MetaFrameGeometry of the right-hand buttons and their
+   * backgrounds, which move with the right edge.
+   */
+  int n_right;
+  gsize right_rects[MAX_BUTTONS_PER_CORNER];
+  gsize right_bg_rects[MAX_BUTTONS_PER_CORNER];
+
+  /* The title rectangle before it is dropped for not fitting */
+  int title_width;
+  int title_height;
+} GeometryTemplate;
+
+static void
+calc_geometry_uncached (const MetaFrameLayout  *layout,
+                        int                     text_height,
+                        MetaFrameFlags          flags,
+                        int                     client_width,
+                        int                     client_height,
+                        const MetaButtonLayout *button_layout,
+                        MetaFrameType           type,
+                        MetaFrameGeometry      *fgeom,
+                        MetaTheme              *theme,
+                        GeometryTemplate       *tmpl)
 {
   int i, n_left, n_right, n_left_spacers, n_right_spacers;
+  int n_right_placed, min_right_x;
+  gboolean stripped;
+  int space_needed;
   int x;
   int button_y;
   int title_right_edge;
@@ -765,6 +719,8 @@ meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
     }
   
   /* Be sure buttons fit */
+  stripped = FALSE;
+  space_needed = G_MININT;
   while (n_left > 0 || n_right > 0)
     {
       int space_used_by_buttons;
@@ -784,8 +740,13 @@ meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
       space_used_by_buttons += layout->button_border.left * n_right;
       space_used_by_buttons += layout->button_border.right * n_right;
 
+      if (!stripped)
+        space_needed = space_used_by_buttons;
+
       if (space_used_by_buttons <= space_available)
         break; /* Everything fits, bail out */
+
+      stripped = TRUE;
       
       /* First try to remove separators */
       if (n_left_spacers > 0)
@@ -864,6 +825,8 @@ meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
   /* right edge of farthest-right button */
   x = width - layout->right_titlebar_edge - borders.invisible.right;
   
+  n_right_placed = 0;
+  min_right_x = G_MAXINT;
   i = n_right - 1;
   while (i >= 0)
     {
@@ -871,6 +834,9 @@ meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
 
       if (x < 0) /* if we go negative, leave the buttons we don't get to as 0-width */
         break;
+
+      ++n_right_placed;
+      min_right_x = MIN (min_right_x, x);
       
       rect = right_func_rects[i];
       rect->visible.x = x - layout->button_border.right - button_width;
@@ -957,6 +923,22 @@ meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
   fgeom->title_rect.width = title_right_edge - fgeom->title_rect.x;
   fgeom->title_rect.height = borders.visible.top - layout->title_border.top - layout->title_border.bottom;
 
+  if (tmpl)
+    {
+      tmpl->fits = !stripped && n_right_placed == n_right;
+      tmpl->min_width = space_needed == G_MININT ? G_MININT :
+        space_needed + layout->left_titlebar_edge + layout->right_titlebar_edge;
+      tmpl->min_right_x = min_right_x;
+      tmpl->n_right = n_right;
+      for (i = 0; i < n_right; i++)
+        {
+          tmpl->right_rects[i] = (char *) right_func_rects[i] - (char *) fgeom;
+          tmpl->right_bg_rects[i] = (char *) right_bg_rects[i] - (char *) fgeom;
+        }
+      tmpl->title_width = fgeom->title_rect.width;
+      tmpl->title_height = fgeom->title_rect.height;
+    }
+
   /* Nuke title if it won't fit */
   if (fgeom->title_rect.width < 0 ||
       fgeom->title_rect.height < 0)
@@ -986,6 +968,283 @@ meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
     fgeom->bottom_right_corner_rounded_radius = layout->bottom_right_corner_rounded_radius;
 }
 
+/* Frame geometry depends on the client width only through where the
+ * right-hand buttons and the end of the title go, as long as all the
+ * buttons fit. So geometry is cached without the client size, as a
+ * template computed at some width where everything fits, and moved to
+ * the width asked for; an interactive resize then doesn't lay out the
+ * frame again at every step. Frames too narrow for their buttons are
+ * computed every time.
+ *
+ * The text height, button layout and draggable border width are part
+ * of the key, so font and preference changes need no flushing; the
+ * cache is flushed when a layout is freed, which is when the theme
+ * changes.
+ */
+
+#define GEOMETRY_CACHE_MAX_ENTRIES 64
+
+typedef struct
+{
+  const MetaFrameLayout *layout;
+  MetaTheme *theme;
+  int text_height;
+  MetaFrameFlags flags;
+  MetaFrameType type;
+  int draggable_border_width;
+  MetaButtonLayout button_layout;
+} GeometryKey;
+
+typedef struct
+{
+  GeometryKey key;
+  MetaFrameGeometry fgeom;
+  GeometryTemplate tmpl;
+  GList *link;
+} CachedGeometry;
+
+static GHashTable *geometry_cache = NULL;
+static GQueue geometry_cache_lru = G_QUEUE_INIT;
+static gboolean cache_geometry = TRUE;
+static guint geometry_cache_hits = 0;
+static guint geometry_cache_misses = 0;
+
+static guint
+geometry_key_hash (gconstpointer data)
+{
+  const GeometryKey *key = data;
+  const guchar *p;
+  guint hash;
+  gsize i;
+
+  hash = GPOINTER_TO_UINT (key->layout);
+  hash = hash * 31 + key->text_height;
+  hash = hash * 31 + key->flags;
+  hash = hash * 31 + key->type;
+  hash = hash * 31 + key->draggable_border_width;
+
+  p = (const guchar *) &key->button_layout;
+  for (i = 0; i < sizeof (key->button_layout); i++)
+    hash = hash * 31 + p[i];
+
+  return hash;
+}
+
+static gboolean
+geometry_key_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const GeometryKey *ka = a;
+  const GeometryKey *kb = b;
+
+  return ka->layout == kb->layout &&
+         ka->theme == kb->theme &&
+         ka->text_height == kb->text_height &&
+         ka->flags == kb->flags &&
+         ka->type == kb->type &&
+         ka->draggable_border_width == kb->draggable_border_width &&
+         memcmp (&ka->button_layout, &kb->button_layout,
+                 sizeof (ka->button_layout)) == 0;
+}
+
+static void
+cached_geometry_free (gpointer data)
+{
+  CachedGeometry *cached = data;
+
+  g_queue_delete_link (&geometry_cache_lru, cached->link);
+  g_slice_free (CachedGeometry, cached);
+}
+
+static void
+geometry_cache_flush (void)
+{
+  if (geometry_cache)
+    g_hash_table_remove_all (geometry_cache);
+}
+
+static void
+geometry_cache_insert (const GeometryKey       *key,
+                       const MetaFrameGeometry *fgeom,
+                       const GeometryTemplate  *tmpl)
+{
+  CachedGeometry *cached;
+
+  if (geometry_cache == NULL)
+    geometry_cache = g_hash_table_new_full (geometry_key_hash,
+                                            geometry_key_equal,
+                                            NULL, cached_geometry_free);
+
+  g_hash_table_remove (geometry_cache, key);
+
+  while (g_queue_get_length (&geometry_cache_lru) >= GEOMETRY_CACHE_MAX_ENTRIES)
+    {
+      CachedGeometry *oldest = geometry_cache_lru.tail->data;
+
+      g_hash_table_remove (geometry_cache, &oldest->key);
+    }
+
+  cached = g_slice_new (CachedGeometry);
+  cached->key = *key;
+  cached->fgeom = *fgeom;
+  cached->tmpl = *tmpl;
+
+  g_queue_push_head (&geometry_cache_lru, cached);
+  cached->link = geometry_cache_lru.head;
+
+  g_hash_table_insert (geometry_cache, &cached->key, cached);
+}
+
+#define GEOMETRY_MEMBER(fgeom, offset, type) \
+  ((type *) ((char *) (fgeom) + (offset)))
+
+/* Moves cached geometry to a frame @width wide, if the layout there
+ * is the same apart from the right edge.
+ */
+static gboolean
+translate_geometry (const CachedGeometry *cached,
+                    int                   width,
+                    MetaFrameGeometry    *fgeom)
+{
+  const GeometryTemplate *tmpl = &cached->tmpl;
+  int delta;
+  int i;
+
+  if (width < tmpl->min_width)
+    return FALSE;
+
+  delta = width - cached->fgeom.width;
+
+  /* Buttons that would start off the left edge are dropped */
+  if (tmpl->n_right > 0 && tmpl->min_right_x + delta < 0)
+    return FALSE;
+
+  /* Spacers are placed by truncating, which only moves with the edge
+   * while positions stay positive.
+   */
+  for (i = 0; i < tmpl->n_right; i++)
+    {
+      const MetaButtonSpace *rect;
+
+      rect = GEOMETRY_MEMBER (&cached->fgeom, tmpl->right_rects[i],
+                              const MetaButtonSpace);
+      if (rect->visible.x < 1 || rect->visible.x + delta < 1)
+        return FALSE;
+    }
+
+  *fgeom = cached->fgeom;
+  fgeom->width = width;
+
+  for (i = 0; i < tmpl->n_right; i++)
+    {
+      GEOMETRY_MEMBER (fgeom, tmpl->right_rects[i], MetaButtonSpace)->visible.x += delta;
+      GEOMETRY_MEMBER (fgeom, tmpl->right_rects[i], MetaButtonSpace)->clickable.x += delta;
+      GEOMETRY_MEMBER (fgeom, tmpl->right_bg_rects[i], GdkRectangle)->x += delta;
+    }
+
+  fgeom->title_rect.width = tmpl->title_width + delta;
+  fgeom->title_rect.height = tmpl->title_height;
+
+  if (fgeom->title_rect.width < 0 ||
+      fgeom->title_rect.height < 0)
+    {
+      fgeom->title_rect.width = 0;
+      fgeom->title_rect.height = 0;
+    }
+
+  return TRUE;
+}
+
+LOCAL_SYMBOL void
+meta_frame_layout_calc_geometry (const MetaFrameLayout  *layout,
+                                 int                     text_height,
+                                 MetaFrameFlags          flags,
+                                 int                     client_width,
+                                 int                     client_height,
+                                 const MetaButtonLayout *button_layout,
+                                 MetaFrameType           type,
+                                 MetaFrameGeometry      *fgeom,
+                                 MetaTheme              *theme)
+{
+  GeometryKey key;
+  CachedGeometry *cached;
+  GeometryTemplate tmpl;
+
+  if (!cache_geometry)
+    {
+      calc_geometry_uncached (layout, text_height, flags,
+                              client_width, client_height,
+                              button_layout, type, fgeom, theme, NULL);
+      return;
+    }
+
+  memset (&key, 0, sizeof (key));
+  key.layout = layout;
+  key.theme = theme;
+  key.text_height = text_height;
+  key.flags = flags;
+  key.type = type;
+  key.draggable_border_width = meta_prefs_get_draggable_border_width ();
+  key.button_layout = *button_layout;
+
+  cached = geometry_cache ? g_hash_table_lookup (geometry_cache, &key) : NULL;
+
+  if (cached &&
+      translate_geometry (cached,
+                          client_width +
+                          cached->fgeom.borders.total.left +
+                          cached->fgeom.borders.total.right,
+                          fgeom))
+    {
+      geometry_cache_hits++;
+
+      g_queue_unlink (&geometry_cache_lru, cached->link);
+      g_queue_push_head_link (&geometry_cache_lru, cached->link);
+
+      fgeom->height = ((flags & META_FRAME_SHADED) ? 0 : client_height) +
+        fgeom->borders.total.top + fgeom->borders.total.bottom;
+      return;
+    }
+
+  geometry_cache_misses++;
+
+  calc_geometry_uncached (layout, text_height, flags,
+                          client_width, client_height,
+                          button_layout, type, fgeom, theme, &tmpl);
+
+  if (tmpl.fits)
+    geometry_cache_insert (&key, fgeom, &tmpl);
+}
+
+/**
+ * meta_theme_set_geometry_cache:
+ * @enabled: whether to cache frame geometry
+ *
+ * Turns the frame geometry cache on or off, so that
+ * muffin-theme-viewer can check it gives the same results.
+ */
+void
+meta_theme_set_geometry_cache (gboolean enabled)
+{
+  cache_geometry = enabled;
+  geometry_cache_flush ();
+}
+
+/**
+ * meta_theme_get_geometry_cache_stats:
+ * @hits: (out): how many geometries came from the cache
+ * @misses: (out): how many had to be laid out
+ *
+ * Counts of frame geometry cache use since startup.
+ */
+void
+meta_theme_get_geometry_cache_stats (guint *hits,
+                                     guint *misses)
+{
+  *hits = geometry_cache_hits;
+  *misses = geometry_cache_misses;
+}
+
 /**
  * meta_gradient_spec_new: (skip)
  *
@@ -1021,6 +1280,142 @@ meta_gradient_spec_free (MetaGradientSpec *spec)
   g_free (spec);
 }
 
+/* Rendered gradients, keyed by what goes into them: the type, the
+ * colors the spec resolves to with the current style, and the size.
+ * The pixbufs are shared, so whoever gets one must not change it.
+ */
+
+#define GRADIENT_CACHE_MAX_SIZE (4 * 1024 * 1024)
+
+typedef struct
+{
+  MetaGradientType type;
+  int n_colors;
+  GdkRGBA *colors;
+  int width;
+  int height;
+} GradientKey;
+
+typedef struct
+{
+  GradientKey key;
+  GdkPixbuf *pixbuf;
+  gsize size;
+  GList *link;
+} CachedGradient;
+
+static GHashTable *gradient_cache = NULL;
+static GQueue gradient_cache_lru = G_QUEUE_INIT;
+static gsize gradient_cache_size = 0;
+
+static guint
+gradient_key_hash (gconstpointer data)
+{
+  const GradientKey *key = data;
+  guint hash;
+  int i;
+
+  hash = key->type;
+  hash = hash * 31 + key->width;
+  hash = hash * 31 + key->height;
+
+  for (i = 0; i < key->n_colors; i++)
+    hash = hash * 31 + GDK_COLOR_RGBA (key->colors[i]);
+
+  return hash;
+}
+
+static gboolean
+gradient_key_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const GradientKey *ka = a;
+  const GradientKey *kb = b;
+  int i;
+
+  if (ka->type != kb->type ||
+      ka->width != kb->width ||
+      ka->height != kb->height ||
+      ka->n_colors != kb->n_colors)
+    return FALSE;
+
+  for (i = 0; i < ka->n_colors; i++)
+    if (!gdk_rgba_equal (&ka->colors[i], &kb->colors[i]))
+      return FALSE;
+
+  return TRUE;
+}
+
+static void
+cached_gradient_free (gpointer data)
+{
+  CachedGradient *gradient = data;
+
+  g_queue_delete_link (&gradient_cache_lru, gradient->link);
+  gradient_cache_size -= gradient->size;
+
+  g_free (gradient->key.colors);
+  g_object_unref (gradient->pixbuf);
+  g_slice_free (CachedGradient, gradient);
+}
+
+static GdkPixbuf *
+gradient_cache_lookup (const GradientKey *key)
+{
+  CachedGradient *gradient;
+
+  if (gradient_cache == NULL)
+    return NULL;
+
+  gradient = g_hash_table_lookup (gradient_cache, key);
+  if (gradient == NULL)
+    return NULL;
+
+  g_queue_unlink (&gradient_cache_lru, gradient->link);
+  g_queue_push_head_link (&gradient_cache_lru, gradient->link);
+
+  return g_object_ref (gradient->pixbuf);
+}
+
+static void
+gradient_cache_insert (const GradientKey *key,
+                       GdkPixbuf         *pixbuf)
+{
+  CachedGradient *gradient;
+  gsize size;
+
+  size = (gsize) gdk_pixbuf_get_rowstride (pixbuf) *
+         gdk_pixbuf_get_height (pixbuf);
+  if (size > GRADIENT_CACHE_MAX_SIZE / 4)
+    return;
+
+  if (gradient_cache == NULL)
+    gradient_cache = g_hash_table_new_full (gradient_key_hash,
+                                            gradient_key_equal,
+                                            NULL, cached_gradient_free);
+
+  while (gradient_cache_lru.tail &&
+         gradient_cache_size + size > GRADIENT_CACHE_MAX_SIZE)
+    {
+      CachedGradient *oldest = gradient_cache_lru.tail->data;
+
+      g_hash_table_remove (gradient_cache, &oldest->key);
+    }
+
+  gradient = g_slice_new (CachedGradient);
+  gradient->key = *key;
+  gradient->key.colors = g_memdup (key->colors,
+                                   sizeof (GdkRGBA) * key->n_colors);
+  gradient->pixbuf = g_object_ref (pixbuf);
+  gradient->size = size;
+
+  g_queue_push_head (&gradient_cache_lru, gradient);
+  gradient->link = gradient_cache_lru.head;
+  gradient_cache_size += size;
+
+  g_hash_table_insert (gradient_cache, &gradient->key, gradient);
+}
+
 LOCAL_SYMBOL GdkPixbuf*
 meta_gradient_spec_render (const MetaGradientSpec *spec,
                            GtkStyleContext        *style,
@@ -1032,6 +1427,7 @@ meta_gradient_spec_render (const MetaGradientSpec *spec,
   GSList *tmp;
   int i;
   GdkPixbuf *pixbuf;
+  GradientKey key;
 
   n_colors = g_slist_length (spec->color_specs);
 
@@ -1050,9 +1446,21 @@ meta_gradient_spec_render (const MetaGradientSpec *spec,
       ++i;
     }
 
-  pixbuf = meta_gradient_create_multi (width, height,
-                                       colors, n_colors,
-                                       spec->type);
+  key.type = spec->type;
+  key.n_colors = n_colors;
+  key.colors = colors;
+  key.width = width;
+  key.height = height;
+
+  pixbuf = gradient_cache_lookup (&key);
+  if (pixbuf == NULL)
+    {
+      pixbuf = meta_gradient_create_multi (width, height,
+                                           colors, n_colors,
+                                           spec->type);
+      if (pixbuf)
+        gradient_cache_insert (&key, pixbuf);
+    }
 
   g_free (colors);
 
@@ -2650,17 +3058,446 @@ pos_eval_helper (PosToken                   *tokens,
   return TRUE;
 }
 
-/*
- *   expr = int | double | expr * expr | expr / expr |
- *          expr + expr | expr - expr | (expr)
+/* Compiling expressions.
  *
- *   so very not worth fooling with bison, yet so very painful by hand.
+ * pos_compile_helper() follows pos_eval_helper() step by step, but
+ * where that computes values this builds postfix code: operands are
+ * pushed, and operators applied to the two topmost values. Operators
+ * whose operands are both constant are applied right away. Variables
+ * become slots in the environment, so evaluating the code needs no
+ * lookups at all. Whatever pos_eval_helper() would fail on is not
+ * compiled, so that the interpreter reports it.
  */
+
+static const char * const pos_variable_names[POS_VAR_LAST] = {
+  "width",
+  "height",
+  "object_width",
+  "object_height",
+  "left_width",
+  "right_width",
+  "top_height",
+  "bottom_height",
+  "mini_icon_width",
+  "mini_icon_height",
+  "icon_width",
+  "icon_height",
+  "title_width",
+  "title_height",
+  "frame_x_center",
+  "frame_y_center"
+};
+
+static gboolean compile_expressions = TRUE;
+
 /*
- * Evaluates an expression.
- *
- * \param spec  The expression to evaluate.
- * \param env   The environment context to evaluate the expression in.
+ * An operand or operator while compiling; operands are code that
+ * leaves a single value on the stack.
+ */
+typedef struct
+{
+  gboolean is_operator;
+  PosOperatorType op;
+  GArray *code;
+} PosCompileItem;
+
+static gboolean
+pos_instr_is_constant (const PosInstr *instr)
+{
+  return instr->type == POS_INSTR_INT || instr->type == POS_INSTR_DOUBLE;
+}
+
+static void
+pos_instr_to_expr (const PosInstr *instr,
+                   PosExpr        *expr)
+{
+  if (instr->type == POS_INSTR_INT)
+    {
+      expr->type = POS_EXPR_INT;
+      expr->d.int_val = instr->d.int_val;
+    }
+  else
+    {
+      expr->type = POS_EXPR_DOUBLE;
+      expr->d.double_val = instr->d.double_val;
+    }
+}
+
+/* Combines two operands; *a takes the result, b is freed */
+static void
+pos_compile_operation (PosCompileItem  *a,
+                       PosCompileItem  *b,
+                       PosOperatorType  op)
+{
+  PosInstr instr;
+
+  if (a->code->len == 1 && b->code->len == 1 &&
+      pos_instr_is_constant (&g_array_index (a->code, PosInstr, 0)) &&
+      pos_instr_is_constant (&g_array_index (b->code, PosInstr, 0)))
+    {
+      PosExpr ea, eb;
+
+      pos_instr_to_expr (&g_array_index (a->code, PosInstr, 0), &ea);
+      pos_instr_to_expr (&g_array_index (b->code, PosInstr, 0), &eb);
+
+      /* If it fails, leave it for evaluation to report */
+      if (do_operation (&ea, &eb, op, NULL))
+        {
+          PosInstr *result = &g_array_index (a->code, PosInstr, 0);
+
+          if (ea.type == POS_EXPR_INT)
+            {
+              result->type = POS_INSTR_INT;
+              result->d.int_val = ea.d.int_val;
+            }
+          else
+            {
+              result->type = POS_INSTR_DOUBLE;
+              result->d.double_val = ea.d.double_val;
+            }
+
+          g_array_free (b->code, TRUE);
+          b->code = NULL;
+          return;
+        }
+    }
+
+  g_array_append_vals (a->code, b->code->data, b->code->len);
+  g_array_free (b->code, TRUE);
+  b->code = NULL;
+
+  instr.type = POS_INSTR_OPERATOR;
+  instr.d.op = op;
+  g_array_append_val (a->code, instr);
+}
+
+static gboolean
+pos_compile_operations (PosCompileItem *items,
+                        int            *n_items,
+                        int             precedence)
+{
+  int i;
+
+  /* The same walk as do_operations() */
+  i = 1;
+  while (i < *n_items)
+    {
+      gboolean compress;
+
+      if (items[i-1].is_operator ||
+          !items[i].is_operator ||
+          i == (*n_items - 1) ||
+          items[i+1].is_operator)
+        return FALSE;
+
+      compress = FALSE;
+
+      switch (items[i].op)
+        {
+        case POS_OP_DIVIDE:
+        case POS_OP_MOD:
+        case POS_OP_MULTIPLY:
+          compress = precedence == 2;
+          break;
+        case POS_OP_ADD:
+        case POS_OP_SUBTRACT:
+          compress = precedence == 1;
+          break;
+        case POS_OP_MAX:
+        case POS_OP_MIN:
+          compress = precedence == 0;
+          break;
+        case POS_OP_NONE:
+          break;
+        }
+
+      if (compress)
+        {
+          pos_compile_operation (&items[i-1], &items[i+1], items[i].op);
+
+          if ((i+2) < *n_items)
+            g_memmove (&items[i], &items[i+2],
+                       sizeof (PosCompileItem) * (*n_items - i - 2));
+
+          *n_items -= 2;
+        }
+      else
+        i += 2;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+pos_compile_helper (PosToken  *tokens,
+                    int        n_tokens,
+                    GArray   **code_p)
+{
+  PosCompileItem items[MAX_EXPRS];
+  int n_items;
+  int paren_level;
+  int first_paren;
+  int precedence;
+  int i, j;
+  PosInstr instr;
+
+  first_paren = 0;
+  paren_level = 0;
+  n_items = 0;
+  for (i = 0; i < n_tokens; i++)
+    {
+      PosToken *t = &tokens[i];
+
+      if (n_items >= MAX_EXPRS)
+        goto fail;
+
+      if (paren_level == 0)
+        {
+          switch (t->type)
+            {
+            case POS_TOKEN_INT:
+              instr.type = POS_INSTR_INT;
+              instr.d.int_val = t->d.i.val;
+              break;
+
+            case POS_TOKEN_DOUBLE:
+              instr.type = POS_INSTR_DOUBLE;
+              instr.d.double_val = t->d.d.val;
+              break;
+
+            case POS_TOKEN_VARIABLE:
+              instr.type = POS_INSTR_VARIABLE;
+              for (j = 0; j < POS_VAR_LAST; j++)
+                if (strcmp (t->d.v.name, pos_variable_names[j]) == 0)
+                  break;
+              if (j == POS_VAR_LAST)
+                goto fail;
+              instr.d.var = j;
+              break;
+
+            case POS_TOKEN_OPERATOR:
+              items[n_items].is_operator = TRUE;
+              items[n_items].op = t->d.o.op;
+              items[n_items].code = NULL;
+              ++n_items;
+              continue;
+
+            case POS_TOKEN_OPEN_PAREN:
+              ++paren_level;
+              first_paren = i;
+              continue;
+
+            case POS_TOKEN_CLOSE_PAREN:
+            default:
+              goto fail;
+            }
+
+          items[n_items].is_operator = FALSE;
+          items[n_items].code = g_array_new (FALSE, FALSE, sizeof (PosInstr));
+          g_array_append_val (items[n_items].code, instr);
+          ++n_items;
+        }
+      else
+        {
+          if (t->type == POS_TOKEN_OPEN_PAREN)
+            ++paren_level;
+          else if (t->type == POS_TOKEN_CLOSE_PAREN)
+            {
+              if (paren_level == 1)
+                {
+                  items[n_items].is_operator = FALSE;
+                  if (!pos_compile_helper (&tokens[first_paren+1],
+                                           i - first_paren - 1,
+                                           &items[n_items].code))
+                    goto fail;
+                  ++n_items;
+                }
+
+              --paren_level;
+            }
+        }
+    }
+
+  if (paren_level > 0 || n_items == 0)
+    goto fail;
+
+  for (precedence = 2; precedence >= 0; precedence--)
+    if (!pos_compile_operations (items, &n_items, precedence))
+      goto fail;
+
+  if (n_items != 1 || items[0].is_operator)
+    goto fail;
+
+  *code_p = items[0].code;
+  return TRUE;
+
+ fail:
+  for (i = 0; i < n_items; i++)
+    if (items[i].code)
+      g_array_free (items[i].code, TRUE);
+
+  return FALSE;
+}
+
+static void
+pos_compile (MetaDrawSpec *spec)
+{
+  GArray *code;
+  int depth, max_depth;
+  guint i;
+
+  if (!pos_compile_helper (spec->tokens, spec->n_tokens, &code))
+    return;
+
+  /* Evaluation uses a fixed size stack */
+  depth = max_depth = 0;
+  for (i = 0; i < code->len; i++)
+    {
+      if (g_array_index (code, PosInstr, i).type == POS_INSTR_OPERATOR)
+        depth -= 1;
+      else
+        depth += 1;
+      max_depth = MAX (depth, max_depth);
+    }
+
+  if (max_depth > MAX_EXPRS)
+    {
+      g_array_free (code, TRUE);
+      return;
+    }
+
+  spec->n_code = code->len;
+  spec->code = (PosInstr *) g_array_free (code, FALSE);
+}
+
+/**
+ * meta_draw_spec_compile: (skip)
+ *
+ * Compiles the tokens of @spec, for specs that were not made by
+ * meta_draw_spec_new().
+ */
+LOCAL_SYMBOL void
+meta_draw_spec_compile (MetaDrawSpec *spec)
+{
+  g_free (spec->code);
+  spec->code = NULL;
+  spec->n_code = 0;
+
+  pos_compile (spec);
+}
+
+static gboolean
+pos_exec (const PosInstr             *code,
+          int                         n_code,
+          const MetaPositionExprEnv  *env,
+          PosExpr                    *result,
+          GError                    **err)
+{
+  PosExpr stack[MAX_EXPRS];
+  int sp;
+  int i;
+
+  sp = 0;
+  for (i = 0; i < n_code; i++)
+    {
+      const PosInstr *instr = &code[i];
+      int val;
+
+      switch (instr->type)
+        {
+        case POS_INSTR_INT:
+          stack[sp].type = POS_EXPR_INT;
+          stack[sp].d.int_val = instr->d.int_val;
+          ++sp;
+          break;
+
+        case POS_INSTR_DOUBLE:
+          stack[sp].type = POS_EXPR_DOUBLE;
+          stack[sp].d.double_val = instr->d.double_val;
+          ++sp;
+          break;
+
+        case POS_INSTR_VARIABLE:
+          switch (instr->d.var)
+            {
+            case POS_VAR_WIDTH:            val = env->rect.width; break;
+            case POS_VAR_HEIGHT:           val = env->rect.height; break;
+            case POS_VAR_OBJECT_WIDTH:     val = env->object_width; break;
+            case POS_VAR_OBJECT_HEIGHT:    val = env->object_height; break;
+            case POS_VAR_LEFT_WIDTH:       val = env->left_width; break;
+            case POS_VAR_RIGHT_WIDTH:      val = env->right_width; break;
+            case POS_VAR_TOP_HEIGHT:       val = env->top_height; break;
+            case POS_VAR_BOTTOM_HEIGHT:    val = env->bottom_height; break;
+            case POS_VAR_MINI_ICON_WIDTH:  val = env->mini_icon_width; break;
+            case POS_VAR_MINI_ICON_HEIGHT: val = env->mini_icon_height; break;
+            case POS_VAR_ICON_WIDTH:       val = env->icon_width; break;
+            case POS_VAR_ICON_HEIGHT:      val = env->icon_height; break;
+            case POS_VAR_TITLE_WIDTH:      val = env->title_width; break;
+            case POS_VAR_TITLE_HEIGHT:     val = env->title_height; break;
+            case POS_VAR_FRAME_X_CENTER:   val = env->frame_x_center; break;
+            case POS_VAR_FRAME_Y_CENTER:   val = env->frame_y_center; break;
+            default:
+              g_assert_not_reached ();
+              val = 0;
+              break;
+            }
+
+          /* The object size only exists for objects with a natural size */
+          if (val < 0 &&
+              (instr->d.var == POS_VAR_OBJECT_WIDTH ||
+               instr->d.var == POS_VAR_OBJECT_HEIGHT))
+            {
+              g_set_error (err, META_THEME_ERROR,
+                           META_THEME_ERROR_UNKNOWN_VARIABLE,
+                           _("Coordinate expression had unknown variable or constant \"%s\""),
+                           pos_variable_names[instr->d.var]);
+              return FALSE;
+            }
+
+          stack[sp].type = POS_EXPR_INT;
+          stack[sp].d.int_val = val;
+          ++sp;
+          break;
+
+        case POS_INSTR_OPERATOR:
+          --sp;
+          if (!do_operation (&stack[sp-1], &stack[sp], instr->d.op, err))
+            return FALSE;
+          break;
+        }
+    }
+
+  g_assert (sp == 1);
+
+  *result = stack[0];
+
+  return TRUE;
+}
+
+/**
+ * meta_theme_set_compile_expressions:
+ * @compile: whether to evaluate expressions through their compiled code
+ *
+ * Turning this off makes every expression go through the interpreter,
+ * so that muffin-theme-viewer can compare the two.
+ */
+void
+meta_theme_set_compile_expressions (gboolean compile)
+{
+  compile_expressions = compile;
+}
+
+/*
+ *   expr = int | double | expr * expr | expr / expr |
+ *          expr + expr | expr - expr | (expr)
+ *
+ *   so very not worth fooling with bison, yet so very painful by hand.
+ */
+/*
+ * Evaluates an expression.
+ *
+ * \param spec  The expression to evaluate.
+ * \param env   The environment context to evaluate the expression in.
  * \param[out] val_p  The integer value of the expression; if the expression
  *                    is of type float, this will be rounded. If we return
  *                    FALSE because the expression is invalid, this will be
@@ -2679,10 +3516,16 @@ pos_eval (MetaDrawSpec              *spec,
           GError                   **err)
 {
   PosExpr expr;
+  gboolean ok;
 
   *val_p = 0;
 
-  if (pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
+  if (spec->code != NULL && compile_expressions)
+    ok = pos_exec (spec->code, spec->n_code, env, &expr, err);
+  else
+    ok = pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err);
+
+  if (ok)
     {
       switch (expr.type)
         {
@@ -2712,7 +3555,7 @@ pos_eval (MetaDrawSpec              *spec,
  * meta_parse_position_expression: (skip)
  *
  */
-LOCAL_SYMBOL gboolean
+gboolean
 meta_parse_position_expression (MetaDrawSpec              *spec,
                                 const MetaPositionExprEnv *env,
                                 int                       *x_return,
@@ -2804,7 +3647,12 @@ meta_theme_replace_constants (MetaTheme   *theme,
 
       if (t->type == POS_TOKEN_VARIABLE)
         {
-          if (meta_theme_lookup_int_constant (theme, t->d.v.name, &ival))
+          if (theme == NULL)
+            {
+              t->d.v.name_quark = g_quark_from_string (t->d.v.name);
+              is_constant = FALSE;
+            }
+          else if (meta_theme_lookup_int_constant (theme, t->d.v.name, &ival))
             {
               g_free (t->d.v.name);
               t->type = POS_TOKEN_INT;
@@ -2891,19 +3739,23 @@ parse_size_unchecked (MetaDrawSpec        *spec,
   return retval;
 }
 
-LOCAL_SYMBOL void
+void
 meta_draw_spec_free (MetaDrawSpec *spec)
 {
   if (!spec) return;
   free_tokens (spec->tokens, spec->n_tokens);
+  g_free (spec->code);
   g_slice_free (MetaDrawSpec, spec);
 }
 
 /**
  * meta_draw_spec_new: (skip)
  *
+ * Always returns a spec, even if @expr is not valid, in which case
+ * @error is set and evaluating the spec fails (with a warning when it
+ * is drawn) instead of giving a value.
  */
-LOCAL_SYMBOL MetaDrawSpec *
+MetaDrawSpec *
 meta_draw_spec_new (MetaTheme  *theme,
                     const char *expr,
                     GError    **error)
@@ -2912,19 +3764,21 @@ meta_draw_spec_new (MetaTheme  *theme,
 
   spec = g_slice_new0 (MetaDrawSpec);
 
-  pos_tokenize (expr, &spec->tokens, &spec->n_tokens, NULL);
+  /* Leaves no tokens, which evaluation reports as an error */
+  if (!pos_tokenize (expr, &spec->tokens, &spec->n_tokens, error))
+    return spec;
   
   spec->constant = meta_theme_replace_constants (theme, spec->tokens, 
                                                  spec->n_tokens, NULL);
+  pos_compile (spec);
+
   if (spec->constant) 
     {
-      gboolean result;
-
-      result = pos_eval (spec, NULL, &spec->value, error);
-      if (result == FALSE)
+      /* Left to be evaluated, and fail, each time it is used */
+      if (!pos_eval (spec, NULL, &spec->value, error))
         {
-          meta_draw_spec_free (spec);
-          return NULL;
+          spec->constant = FALSE;
+          spec->value = 0;
         }
     }
     
@@ -3085,6 +3939,8 @@ meta_draw_op_free (MetaDrawOp *op)
       if (op->data.image.pixbuf)
         g_object_unref (G_OBJECT (op->data.image.pixbuf));
 
+      g_free (op->data.image.filename);
+
       if (op->data.image.colorize_spec)
 	meta_color_spec_free (op->data.image.colorize_spec);
 
@@ -3445,6 +4301,220 @@ scale_and_alpha_pixbuf (GdkPixbuf             *src,
   return pixbuf;
 }
 
+/* Scaled images.
+ *
+ * Images and icons are scaled, tiled and given their alpha gradient
+ * for every draw, usually to the same few sizes, so the results are
+ * kept in an LRU keyed by everything that goes into them. Keys hold a
+ * reference on the source so its address can't be reused, and copy
+ * the alpha gradient rather than point into the theme.
+ */
+
+#define IMAGE_CACHE_MAX_SIZE (4 * 1024 * 1024)
+
+typedef struct
+{
+  GdkPixbuf *source;
+  gboolean colorized;
+  guint32 colorize_pixel;
+  int width;
+  int height;
+  MetaImageFillType fill_type;
+  guint vertical_stripes : 1;
+  guint horizontal_stripes : 1;
+  MetaGradientType alpha_type;
+  int n_alphas;
+  unsigned char *alphas;
+} ScaledImageKey;
+
+typedef struct
+{
+  ScaledImageKey key;
+  GdkPixbuf *pixbuf;
+  gsize size;
+  GList *link;
+} ScaledImage;
+
+static GHashTable *image_cache = NULL;
+static GQueue image_cache_lru = G_QUEUE_INIT;
+static gsize image_cache_size = 0;
+static guint image_cache_hits = 0;
+static guint image_cache_misses = 0;
+
+static guint
+scaled_image_key_hash (gconstpointer data)
+{
+  const ScaledImageKey *key = data;
+  guint hash;
+  int i;
+
+  hash = g_direct_hash (key->source);
+  hash = hash * 31 + key->colorize_pixel + key->colorized;
+  hash = hash * 31 + key->width;
+  hash = hash * 31 + key->height;
+  hash = hash * 31 + key->fill_type;
+  hash = hash * 31 + (key->vertical_stripes << 1 | key->horizontal_stripes);
+  hash = hash * 31 + key->alpha_type;
+
+  for (i = 0; i < key->n_alphas; i++)
+    hash = hash * 31 + key->alphas[i];
+
+  return hash;
+}
+
+static gboolean
+scaled_image_key_equal (gconstpointer a,
+                        gconstpointer b)
+{
+  const ScaledImageKey *ka = a;
+  const ScaledImageKey *kb = b;
+
+  return ka->source == kb->source &&
+         ka->colorized == kb->colorized &&
+         ka->colorize_pixel == kb->colorize_pixel &&
+         ka->width == kb->width &&
+         ka->height == kb->height &&
+         ka->fill_type == kb->fill_type &&
+         ka->vertical_stripes == kb->vertical_stripes &&
+         ka->horizontal_stripes == kb->horizontal_stripes &&
+         ka->alpha_type == kb->alpha_type &&
+         ka->n_alphas == kb->n_alphas &&
+         (ka->n_alphas == 0 ||
+          memcmp (ka->alphas, kb->alphas, ka->n_alphas) == 0);
+}
+
+static void
+scaled_image_free (gpointer data)
+{
+  ScaledImage *image = data;
+
+  g_queue_delete_link (&image_cache_lru, image->link);
+  image_cache_size -= image->size;
+
+  g_object_unref (image->key.source);
+  g_free (image->key.alphas);
+  g_object_unref (image->pixbuf);
+  g_slice_free (ScaledImage, image);
+}
+
+static void
+scaled_image_key_init (ScaledImageKey              *key,
+                       GdkPixbuf                   *source,
+                       const MetaAlphaGradientSpec *alpha_spec,
+                       MetaImageFillType            fill_type,
+                       int                          width,
+                       int                          height,
+                       gboolean                     vertical_stripes,
+                       gboolean                     horizontal_stripes)
+{
+  key->source = source;
+  key->colorized = FALSE;
+  key->colorize_pixel = 0;
+  key->width = width;
+  key->height = height;
+  key->fill_type = fill_type;
+  key->vertical_stripes = vertical_stripes != FALSE;
+  key->horizontal_stripes = horizontal_stripes != FALSE;
+
+  /* The alphas are only looked at, copies are made on insertion */
+  if (alpha_spec)
+    {
+      key->alpha_type = alpha_spec->type;
+      key->n_alphas = alpha_spec->n_alphas;
+      key->alphas = alpha_spec->alphas;
+    }
+  else
+    {
+      key->alpha_type = META_GRADIENT_LAST;
+      key->n_alphas = 0;
+      key->alphas = NULL;
+    }
+}
+
+static GdkPixbuf *
+scaled_image_lookup (const ScaledImageKey *key)
+{
+  ScaledImage *image;
+
+  if (image_cache == NULL || key->source == NULL)
+    return NULL;
+
+  image = g_hash_table_lookup (image_cache, key);
+  if (image == NULL)
+    return NULL;
+
+  image_cache_hits += 1;
+
+  g_queue_unlink (&image_cache_lru, image->link);
+  g_queue_push_head_link (&image_cache_lru, image->link);
+
+  return g_object_ref (image->pixbuf);
+}
+
+static void
+scaled_image_insert (const ScaledImageKey *key,
+                     GdkPixbuf            *pixbuf)
+{
+  ScaledImage *image;
+  gsize size;
+
+  if (key->source == NULL)
+    return;
+
+  /* Nothing was done to the source, so there's nothing to keep */
+  if (pixbuf == key->source)
+    return;
+
+  image_cache_misses += 1;
+
+  size = (gsize) gdk_pixbuf_get_rowstride (pixbuf) *
+         gdk_pixbuf_get_height (pixbuf);
+  if (size > IMAGE_CACHE_MAX_SIZE / 4)
+    return;
+
+  if (image_cache == NULL)
+    image_cache = g_hash_table_new_full (scaled_image_key_hash,
+                                         scaled_image_key_equal,
+                                         NULL, scaled_image_free);
+
+  while (image_cache_lru.tail &&
+         image_cache_size + size > IMAGE_CACHE_MAX_SIZE)
+    {
+      ScaledImage *oldest = image_cache_lru.tail->data;
+
+      g_hash_table_remove (image_cache, &oldest->key);
+    }
+
+  image = g_slice_new (ScaledImage);
+  image->key = *key;
+  image->key.source = g_object_ref (key->source);
+  image->key.alphas = g_memdup (key->alphas, key->n_alphas);
+  image->pixbuf = g_object_ref (pixbuf);
+  image->size = size;
+
+  g_queue_push_head (&image_cache_lru, image);
+  image->link = image_cache_lru.head;
+  image_cache_size += size;
+
+  g_hash_table_insert (image_cache, &image->key, image);
+}
+
+/**
+ * meta_theme_get_image_cache_stats:
+ * @hits: (out): how many scaled images came from the cache
+ * @misses: (out): how many had to be made
+ *
+ * Counts of scaled image cache use since startup, for
+ * muffin-theme-viewer's benchmark.
+ */
+void
+meta_theme_get_image_cache_stats (guint *hits,
+                                  guint *misses)
+{
+  *hits = image_cache_hits;
+  *misses = image_cache_misses;
+}
+
 static GdkPixbuf*
 draw_op_as_pixbuf (const MetaDrawOp    *op,
                    GtkStyleContext     *context,
@@ -3540,22 +4610,44 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
         pixbuf = meta_gradient_spec_render (op->data.gradient.gradient_spec,
                                             context, width, height);
 
+        /* The gradient may be shared with the cache */
         pixbuf = apply_alpha (pixbuf,
                               op->data.gradient.alpha_spec,
-                              FALSE);
+                              TRUE);
       }
       break;
 
       
     case META_DRAW_IMAGE:
       {
-	if (op->data.image.colorize_spec)
-	  {
-	    GdkRGBA color;
+        ScaledImageKey key;
+        GdkRGBA color;
+
+        /* The image failed to load when its style was looked up */
+        if (op->data.image.pixbuf == NULL)
+          break;
 
+        scaled_image_key_init (&key, op->data.image.pixbuf,
+                               op->data.image.alpha_spec,
+                               op->data.image.fill_type,
+                               width, height,
+                               op->data.image.vertical_stripes,
+                               op->data.image.horizontal_stripes);
+
+        if (op->data.image.colorize_spec)
+          {
             meta_color_spec_render (op->data.image.colorize_spec,
                                     context, &color);
-            
+            key.colorized = TRUE;
+            key.colorize_pixel = GDK_COLOR_RGB (color);
+          }
+
+        pixbuf = scaled_image_lookup (&key);
+        if (pixbuf)
+          break;
+
+	if (op->data.image.colorize_spec)
+	  {
             if (op->data.image.colorize_cache_pixbuf == NULL ||
                 op->data.image.colorize_cache_pixel != GDK_COLOR_RGB (color))
               {
@@ -3564,8 +4656,8 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
                 
                 /* const cast here */
                 ((MetaDrawOp*)op)->data.image.colorize_cache_pixbuf =
-                  colorize_pixbuf (op->data.image.pixbuf,
-                                   &color);
+                  meta_gradient_colorize_pixbuf (op->data.image.pixbuf,
+                                                 &color);
                 ((MetaDrawOp*)op)->data.image.colorize_cache_pixel =
                   GDK_COLOR_RGB (color);
               }
@@ -3589,6 +4681,9 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
                                              op->data.image.vertical_stripes,
                                              op->data.image.horizontal_stripes);
 	  }
+
+        if (pixbuf)
+          scaled_image_insert (&key, pixbuf);
         break;
       }
       
@@ -3598,20 +4693,36 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
       break;
 
     case META_DRAW_ICON:
-      if (info->mini_icon &&
-          width <= gdk_pixbuf_get_width (info->mini_icon) &&
-          height <= gdk_pixbuf_get_height (info->mini_icon))
-        pixbuf = scale_and_alpha_pixbuf (info->mini_icon,
-                                         op->data.icon.alpha_spec,
-                                         op->data.icon.fill_type,
-                                         width, height,
-                                         FALSE, FALSE);
-      else if (info->icon)
-        pixbuf = scale_and_alpha_pixbuf (info->icon,
+      {
+        ScaledImageKey key;
+        GdkPixbuf *source;
+
+        if (info->mini_icon &&
+            width <= gdk_pixbuf_get_width (info->mini_icon) &&
+            height <= gdk_pixbuf_get_height (info->mini_icon))
+          source = info->mini_icon;
+        else
+          source = info->icon;
+
+        if (source == NULL)
+          break;
+
+        scaled_image_key_init (&key, source, op->data.icon.alpha_spec,
+                               op->data.icon.fill_type, width, height,
+                               FALSE, FALSE);
+
+        pixbuf = scaled_image_lookup (&key);
+        if (pixbuf)
+          break;
+
+        pixbuf = scale_and_alpha_pixbuf (source,
                                          op->data.icon.alpha_spec,
                                          op->data.icon.fill_type,
                                          width, height,
                                          FALSE, FALSE);
+        if (pixbuf)
+          scaled_image_insert (&key, pixbuf);
+      }
       break;
 
     case META_DRAW_TITLE:
@@ -3666,6 +4777,162 @@ fill_env (MetaPositionExprEnv *env,
   env->theme = meta_current_theme;
 }
 
+/* Title layouts are shared between frames with the same title (see
+ * frames.c) and drawn over and over with the same text, so each one
+ * carries its unellipsized extents and the text it last rendered, as
+ * an alpha mask per ellipsized width. The mask doesn't depend on the
+ * colour, so focused and unfocused titles use the same one. It is
+ * only used where rendering through a mask gives the same pixels,
+ * i.e. without subpixel antialiasing and on pixel-aligned positions.
+ */
+#define N_TITLE_MASKS 2
+
+typedef struct
+{
+  int width;  /* Pango units, as in pango_layout_set_width() */
+  cairo_surface_t *surface;
+  PangoRectangle ink_rect;
+} TitleMask;
+
+typedef struct
+{
+  char *text;
+  PangoRectangle ink_rect;
+  PangoRectangle logical_rect;
+  TitleMask masks[N_TITLE_MASKS];
+  int next_mask;
+} TitleCache;
+
+static GQuark title_cache_quark = 0;
+
+static void
+title_cache_free (gpointer data)
+{
+  TitleCache *cache = data;
+  int i;
+
+  for (i = 0; i < N_TITLE_MASKS; i++)
+    if (cache->masks[i].surface)
+      cairo_surface_destroy (cache->masks[i].surface);
+
+  g_free (cache->text);
+  g_free (cache);
+}
+
+static TitleCache *
+get_title_cache (PangoLayout *layout)
+{
+  TitleCache *cache;
+  const char *text;
+  int width;
+
+  if (title_cache_quark == 0)
+    title_cache_quark = g_quark_from_static_string ("meta-title-cache");
+
+  text = pango_layout_get_text (layout);
+
+  cache = g_object_get_qdata (G_OBJECT (layout), title_cache_quark);
+  if (cache != NULL && strcmp (cache->text, text) == 0)
+    return cache;
+
+  cache = g_new0 (TitleCache, 1);
+  cache->text = g_strdup (text);
+
+  width = pango_layout_get_width (layout);
+  pango_layout_set_width (layout, -1);
+  pango_layout_get_pixel_extents (layout,
+                                  &cache->ink_rect, &cache->logical_rect);
+  pango_layout_set_width (layout, width);
+
+  g_object_set_qdata_full (G_OBJECT (layout), title_cache_quark,
+                           cache, title_cache_free);
+
+  return cache;
+}
+
+static gboolean
+title_mask_usable (cairo_t     *cr,
+                   PangoLayout *layout)
+{
+  const cairo_font_options_t *context_options;
+  cairo_font_options_t *options;
+  cairo_matrix_t matrix;
+  gboolean subpixel;
+
+  cairo_get_matrix (cr, &matrix);
+  if (matrix.xx != 1.0 || matrix.yy != 1.0 ||
+      matrix.xy != 0.0 || matrix.yx != 0.0 ||
+      matrix.x0 != floor (matrix.x0) || matrix.y0 != floor (matrix.y0))
+    return FALSE;
+
+  context_options =
+    pango_cairo_context_get_font_options (pango_layout_get_context (layout));
+  if (context_options != NULL)
+    return cairo_font_options_get_antialias (context_options) !=
+           CAIRO_ANTIALIAS_SUBPIXEL;
+
+  options = cairo_font_options_create ();
+  cairo_surface_get_font_options (cairo_get_target (cr), options);
+  subpixel = cairo_font_options_get_antialias (options) ==
+             CAIRO_ANTIALIAS_SUBPIXEL;
+  cairo_font_options_destroy (options);
+
+  return !subpixel;
+}
+
+/* Draws @layout at (@x, @y) with the current source, as
+ * pango_cairo_show_layout() would.
+ */
+static void
+show_title_layout (cairo_t     *cr,
+                   PangoLayout *layout,
+                   TitleCache  *cache,
+                   int          x,
+                   int          y)
+{
+  TitleMask *mask = NULL;
+  int width;
+  int i;
+
+  if (!title_mask_usable (cr, layout))
+    {
+      cairo_move_to (cr, x, y);
+      pango_cairo_show_layout (cr, layout);
+      return;
+    }
+
+  width = pango_layout_get_width (layout);
+
+  for (i = 0; i < N_TITLE_MASKS; i++)
+    if (cache->masks[i].surface != NULL && cache->masks[i].width == width)
+      mask = &cache->masks[i];
+
+  if (mask == NULL)
+    {
+      cairo_t *mask_cr;
+
+      mask = &cache->masks[cache->next_mask];
+      cache->next_mask = (cache->next_mask + 1) % N_TITLE_MASKS;
+
+      if (mask->surface)
+        cairo_surface_destroy (mask->surface);
+
+      pango_layout_get_pixel_extents (layout, &mask->ink_rect, NULL);
+      mask->width = width;
+      mask->surface = cairo_surface_create_similar (cairo_get_target (cr),
+                                                    CAIRO_CONTENT_ALPHA,
+                                                    MAX (mask->ink_rect.width, 1),
+                                                    MAX (mask->ink_rect.height, 1));
+
+      mask_cr = cairo_create (mask->surface);
+      cairo_move_to (mask_cr, -mask->ink_rect.x, -mask->ink_rect.y);
+      pango_cairo_show_layout (mask_cr, layout);
+      cairo_destroy (mask_cr);
+    }
+
+  cairo_mask_surface (cr, mask->surface,
+                      x + mask->ink_rect.x, y + mask->ink_rect.y);
+}
 
 /* This code was originally rendering anti-aliased using X primitives, and
  * now has been switched to draw anti-aliased using cairo. In general, the
@@ -4030,7 +5297,8 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
       if (info->title_layout)
         {
           int rx, ry;
-          PangoRectangle ink_rect, logical_rect;
+          TitleCache *cache;
+          int width;
 
           meta_color_spec_render (op->data.title.color_spec,
                                   style_gtk, &color);
@@ -4039,6 +5307,9 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
           rx = parse_x_position_unchecked (op->data.title.x, env);
           ry = parse_y_position_unchecked (op->data.title.y, env);
 
+          cache = get_title_cache (info->title_layout);
+          width = -1;
+
           if (op->data.title.ellipsize_width)
             {
               int ellipsize_width;
@@ -4048,36 +5319,31 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
               /* HACK: parse_x_position_unchecked adds in env->rect.x, subtract out again */
               ellipsize_width -= env->rect.x;
 
-              pango_layout_set_width (info->title_layout, -1);
-              pango_layout_get_pixel_extents (info->title_layout,
-                                              &ink_rect, &logical_rect);
-
               /* Pango's idea of ellipsization is with respect to the logical rect.
                * correct for this, by reducing the ellipsization width by the overflow
                * of the un-ellipsized text on the right... it's always the visual
                * right we want regardless of bidi, since since the X we pass in to
                * cairo_move_to() is always the left edge of the line.
                */
-              right_bearing = (ink_rect.x + ink_rect.width) - (logical_rect.x + logical_rect.width);
+              right_bearing = (cache->ink_rect.x + cache->ink_rect.width) -
+                              (cache->logical_rect.x + cache->logical_rect.width);
               right_bearing = MAX (right_bearing, 0);
 
               ellipsize_width -= right_bearing;
               ellipsize_width = MAX (ellipsize_width, 0);
 
               /* Only ellipsizing when necessary is a performance optimization -
-               * pango_layout_set_width() will force a relayout if it isn't the
-               * same as the current width of -1.
+               * pango_layout_set_width() forces a relayout when the width
+               * changes, so it is left as it is between draws.
                */
-              if (ellipsize_width < logical_rect.width)
-                pango_layout_set_width (info->title_layout, PANGO_SCALE * ellipsize_width);
+              if (ellipsize_width < cache->logical_rect.width)
+                width = PANGO_SCALE * ellipsize_width;
             }
 
-          cairo_move_to (cr, rx, ry);
-          pango_cairo_show_layout (cr, info->title_layout);
+          if (pango_layout_get_width (info->title_layout) != width)
+            pango_layout_set_width (info->title_layout, width);
 
-          /* Remove any ellipsization we might have set; will short-circuit
-           * if the width is already -1 */
-          pango_layout_set_width (info->title_layout, -1);
+          show_title_layout (cr, info->title_layout, cache, rx, ry);
         }
       break;
 
@@ -4176,6 +5442,10 @@ meta_draw_op_draw (const MetaDrawOp    *op,
                                 widget, cr, info, logical_region);
 }
 
+typedef struct _PieceRender PieceRender;
+
+static void piece_render_free (PieceRender *render);
+
 /**
  * meta_draw_op_list_new: (skip)
  *
@@ -4193,6 +5463,8 @@ meta_draw_op_list_new (int n_preallocs)
   op_list->n_allocated = n_preallocs;
   op_list->ops = g_new (MetaDrawOp*, op_list->n_allocated);
   op_list->n_ops = 0;
+  op_list->renders = NULL;
+  op_list->materialized = FALSE;
 
   return op_list;
 }
@@ -4217,6 +5489,9 @@ meta_draw_op_list_unref (MetaDrawOpList *op_list)
     {
       int i;
 
+      while (op_list->renders)
+        piece_render_free (op_list->renders->data);
+
       for (i = 0; i < op_list->n_ops; i++)
         meta_draw_op_free (op_list->ops[i]);
 
@@ -4586,94 +5861,641 @@ meta_frame_style_validate (MetaFrameStyle    *style,
             }
         }
     }
-  
+  
+  return TRUE;
+}
+
+static void
+button_rect (MetaButtonType           type,
+             const MetaFrameGeometry *fgeom,
+             int                      middle_background_offset,
+             GdkRectangle            *rect)
+{
+  switch (type)
+    {
+    case META_BUTTON_TYPE_LEFT_LEFT_BACKGROUND:
+      *rect = fgeom->left_left_background;
+      break;
+
+    case META_BUTTON_TYPE_LEFT_MIDDLE_BACKGROUND:
+      *rect = fgeom->left_middle_backgrounds[middle_background_offset];
+      break;
+      
+    case META_BUTTON_TYPE_LEFT_RIGHT_BACKGROUND:
+      *rect = fgeom->left_right_background;
+      break;
+
+    case META_BUTTON_TYPE_LEFT_SINGLE_BACKGROUND:
+      *rect = fgeom->left_single_background;
+      break;
+      
+    case META_BUTTON_TYPE_RIGHT_LEFT_BACKGROUND:
+      *rect = fgeom->right_left_background;
+      break;
+      
+    case META_BUTTON_TYPE_RIGHT_MIDDLE_BACKGROUND:
+      *rect = fgeom->right_middle_backgrounds[middle_background_offset];
+      break;
+      
+    case META_BUTTON_TYPE_RIGHT_RIGHT_BACKGROUND:
+      *rect = fgeom->right_right_background;
+      break;
+
+    case META_BUTTON_TYPE_RIGHT_SINGLE_BACKGROUND:
+      *rect = fgeom->right_single_background;
+      break;
+      
+    case META_BUTTON_TYPE_CLOSE:
+      *rect = fgeom->close_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_SHADE:
+      *rect = fgeom->shade_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_UNSHADE:
+      *rect = fgeom->unshade_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_ABOVE:
+      *rect = fgeom->above_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_UNABOVE:
+      *rect = fgeom->unabove_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_STICK:
+      *rect = fgeom->stick_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_UNSTICK:
+      *rect = fgeom->unstick_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_MAXIMIZE:
+      *rect = fgeom->max_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_MINIMIZE:
+      *rect = fgeom->min_rect.visible;
+      break;
+
+    case META_BUTTON_TYPE_MENU:
+      *rect = fgeom->menu_rect.visible;
+      break;
+      
+    case META_BUTTON_TYPE_LAST:
+      g_assert_not_reached ();
+      break;
+    }
+}
+
+/* Rendered frame pieces.
+ *
+ * Each op list drawn as a frame piece or button keeps a few renderings
+ * of itself, and an op list belongs to one frame style, piece and
+ * button state, so windows of the same size and state share them. A
+ * rendering is reused when every position the list's ops would be
+ * drawn at is unchanged, relative to the piece, for the same style
+ * context and state.
+ *
+ * When the piece only changes size along one axis, a rendering can
+ * also be reused as a 9-slice: every position either stays put or
+ * moves with the far edge, and the ops spanning the gap between the
+ * two groups don't change along that axis (solid fills, straight
+ * lines, gradients across the other axis). The columns (or rows) in
+ * the gap are then all the same, so the rendering is cut there and
+ * one of them repeated. Anything else is drawn again.
+ */
+
+#define PIECE_CACHE_MAX_SIZE (8 * 1024 * 1024)
+#define PIECE_RENDERS_PER_LIST 4
+
+typedef struct
+{
+  /* Positions relative to the piece, in the order the op has them */
+  int x1, x2;
+  int y1, y2;
+  /* How far the op may draw beyond them */
+  int margin;
+  /* Whether the op draws the same all along that axis when stretched */
+  guint uniform_x : 1;
+  guint uniform_y : 1;
+} PieceExtent;
+
+struct _PieceRender
+{
+  MetaDrawOpList *op_list;
+  GtkStyleContext *style_gtk;
+  GtkStateFlags state;
+  int width;
+  int height;
+  GArray *extents;
+  cairo_surface_t *surface;
+  gsize size;
+  GList *link;
+};
+
+static GQueue piece_renders = G_QUEUE_INIT;
+static gsize piece_renders_size = 0;
+
+static void
+piece_render_free (PieceRender *render)
+{
+  render->op_list->renders = g_list_remove (render->op_list->renders, render);
+  g_queue_delete_link (&piece_renders, render->link);
+  piece_renders_size -= render->size;
+
+  g_object_unref (render->style_gtk);
+  cairo_surface_destroy (render->surface);
+  g_array_free (render->extents, TRUE);
+  g_slice_free (PieceRender, render);
+}
+
+/**
+ * meta_theme_flush_piece_cache: (skip)
+ *
+ * Forgets all rendered frame pieces, for when the GTK style they were
+ * drawn with changes.
+ */
+LOCAL_SYMBOL void
+meta_theme_flush_piece_cache (void)
+{
+  while (piece_renders.tail)
+    piece_render_free (piece_renders.tail->data);
+}
+
+static gboolean
+alpha_is_uniform (const MetaAlphaGradientSpec *alpha_spec,
+                  MetaGradientType             across)
+{
+  return alpha_spec == NULL ||
+         alpha_spec->n_alphas == 1 ||
+         alpha_spec->type == across;
+}
+
+static void
+add_extent (GArray        *extents,
+            MetaRectangle  origin,
+            int x1, int y1, int x2, int y2,
+            int            margin,
+            gboolean       uniform_x,
+            gboolean       uniform_y)
+{
+  PieceExtent extent;
+
+  extent.x1 = x1 - origin.x;
+  extent.x2 = x2 - origin.x;
+  extent.y1 = y1 - origin.y;
+  extent.y2 = y2 - origin.y;
+  extent.margin = margin;
+  extent.uniform_x = uniform_x;
+  extent.uniform_y = uniform_y;
+
+  g_array_append_val (extents, extent);
+}
+
+/*
+ * Evaluates every position the ops of a list would be drawn at, the
+ * same way meta_draw_op_list_draw_with_style() does. Returns FALSE if
+ * the list draws something that isn't the same for every window, like
+ * the title or the icon.
+ */
+static gboolean
+collect_piece_extents (const MetaDrawOpList *op_list,
+                       const MetaDrawInfo   *info,
+                       MetaRectangle         rect,
+                       MetaRectangle         origin,
+                       GArray               *extents)
+{
+  MetaPositionExprEnv env;
+  int i;
+
+  fill_env (&env, info, rect);
+
+  for (i = 0; i < op_list->n_ops; i++)
+    {
+      const MetaDrawOp *op = op_list->ops[i];
+      int rx, ry, rwidth, rheight;
+
+      switch (op->type)
+        {
+        case META_DRAW_LINE:
+          {
+            int x1, y1, x2, y2;
+            gboolean dashed;
+
+            x1 = parse_x_position_unchecked (op->data.line.x1, &env);
+            y1 = parse_y_position_unchecked (op->data.line.y1, &env);
+            x2 = op->data.line.x2 ?
+              parse_x_position_unchecked (op->data.line.x2, &env) : x1;
+            y2 = op->data.line.y2 ?
+              parse_y_position_unchecked (op->data.line.y2, &env) : y1;
+
+            dashed = op->data.line.dash_on_length > 0 &&
+                     op->data.line.dash_off_length > 0;
+
+            add_extent (extents, origin, x1, y1, x2, y2,
+                        2 + op->data.line.width,
+                        y1 == y2 && !dashed, x1 == x2 && !dashed);
+          }
+          continue;
+
+        case META_DRAW_RECTANGLE:
+          rx = parse_x_position_unchecked (op->data.rectangle.x, &env);
+          ry = parse_y_position_unchecked (op->data.rectangle.y, &env);
+          rwidth = parse_size_unchecked (op->data.rectangle.width, &env);
+          rheight = parse_size_unchecked (op->data.rectangle.height, &env);
+          add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight,
+                      2, TRUE, TRUE);
+          continue;
+
+        case META_DRAW_ARC:
+          rx = parse_x_position_unchecked (op->data.arc.x, &env);
+          ry = parse_y_position_unchecked (op->data.arc.y, &env);
+          rwidth = parse_size_unchecked (op->data.arc.width, &env);
+          rheight = parse_size_unchecked (op->data.arc.height, &env);
+          add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight,
+                      2, FALSE, FALSE);
+          continue;
+
+        case META_DRAW_CLIP:
+          rx = parse_x_position_unchecked (op->data.clip.x, &env);
+          ry = parse_y_position_unchecked (op->data.clip.y, &env);
+          rwidth = parse_size_unchecked (op->data.clip.width, &env);
+          rheight = parse_size_unchecked (op->data.clip.height, &env);
+          add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight,
+                      0, TRUE, TRUE);
+          continue;
+
+        case META_DRAW_TINT:
+          rx = parse_x_position_unchecked (op->data.tint.x, &env);
+          ry = parse_y_position_unchecked (op->data.tint.y, &env);
+          rwidth = parse_size_unchecked (op->data.tint.width, &env);
+          rheight = parse_size_unchecked (op->data.tint.height, &env);
+          add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight, 1,
+                      alpha_is_uniform (op->data.tint.alpha_spec,
+                                        META_GRADIENT_VERTICAL),
+                      alpha_is_uniform (op->data.tint.alpha_spec,
+                                        META_GRADIENT_HORIZONTAL));
+          continue;
+
+        case META_DRAW_GRADIENT:
+          {
+            MetaGradientType type = op->data.gradient.gradient_spec->type;
+
+            rx = parse_x_position_unchecked (op->data.gradient.x, &env);
+            ry = parse_y_position_unchecked (op->data.gradient.y, &env);
+            rwidth = parse_size_unchecked (op->data.gradient.width, &env);
+            rheight = parse_size_unchecked (op->data.gradient.height, &env);
+            add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight, 1,
+                        type == META_GRADIENT_VERTICAL &&
+                        alpha_is_uniform (op->data.gradient.alpha_spec,
+                                          META_GRADIENT_VERTICAL),
+                        type == META_GRADIENT_HORIZONTAL &&
+                        alpha_is_uniform (op->data.gradient.alpha_spec,
+                                          META_GRADIENT_HORIZONTAL));
+          }
+          continue;
+
+        case META_DRAW_IMAGE:
+          if (op->data.image.pixbuf)
+            {
+              env.object_width = gdk_pixbuf_get_width (op->data.image.pixbuf);
+              env.object_height = gdk_pixbuf_get_height (op->data.image.pixbuf);
+            }
+
+          rwidth = parse_size_unchecked (op->data.image.width, &env);
+          rheight = parse_size_unchecked (op->data.image.height, &env);
+          rx = parse_x_position_unchecked (op->data.image.x, &env);
+          ry = parse_y_position_unchecked (op->data.image.y, &env);
+          add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight,
+                      1, FALSE, FALSE);
+          continue;
+
+        case META_DRAW_GTK_ARROW:
+          rx = parse_x_position_unchecked (op->data.gtk_arrow.x, &env);
+          ry = parse_y_position_unchecked (op->data.gtk_arrow.y, &env);
+          rwidth = parse_size_unchecked (op->data.gtk_arrow.width, &env);
+          rheight = parse_size_unchecked (op->data.gtk_arrow.height, &env);
+          add_extent (extents, origin, rx, ry,
+                      rx + MAX (rwidth, rheight), ry + MAX (rwidth, rheight),
+                      4, FALSE, FALSE);
+          continue;
+
+        case META_DRAW_GTK_BOX:
+          rx = parse_x_position_unchecked (op->data.gtk_box.x, &env);
+          ry = parse_y_position_unchecked (op->data.gtk_box.y, &env);
+          rwidth = parse_size_unchecked (op->data.gtk_box.width, &env);
+          rheight = parse_size_unchecked (op->data.gtk_box.height, &env);
+          add_extent (extents, origin, rx, ry, rx + rwidth, ry + rheight,
+                      4, FALSE, FALSE);
+          continue;
+
+        case META_DRAW_GTK_VLINE:
+          rx = parse_x_position_unchecked (op->data.gtk_vline.x, &env);
+          ry = parse_y_position_unchecked (op->data.gtk_vline.y1, &env);
+          rheight = parse_y_position_unchecked (op->data.gtk_vline.y2, &env);
+          add_extent (extents, origin, rx, ry, rx, rheight,
+                      4, FALSE, FALSE);
+          continue;
+
+        case META_DRAW_OP_LIST:
+          {
+            MetaRectangle d_rect;
+
+            d_rect.x = parse_x_position_unchecked (op->data.op_list.x, &env);
+            d_rect.y = parse_y_position_unchecked (op->data.op_list.y, &env);
+            d_rect.width = parse_size_unchecked (op->data.op_list.width, &env);
+            d_rect.height = parse_size_unchecked (op->data.op_list.height, &env);
+
+            /* The box itself only matters through what is drawn in it */
+            add_extent (extents, origin, d_rect.x, d_rect.y,
+                        d_rect.x + d_rect.width, d_rect.y + d_rect.height,
+                        0, TRUE, TRUE);
+
+            if (!collect_piece_extents (op->data.op_list.op_list, info,
+                                        d_rect, origin, extents))
+              return FALSE;
+          }
+          continue;
+
+        case META_DRAW_ICON:
+        case META_DRAW_TITLE:
+        case META_DRAW_TILE:
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/*
+ * Works out whether a rendering can stand in along one axis, where the
+ * piece grew by @delta. Values are pairs of positions per extent;
+ * *seam_start and *seam_end get the run of identical columns or rows
+ * in the rendering.
+ */
+static gboolean
+piece_axis_matches (const PieceExtent *old_extents,
+                    const PieceExtent *new_extents,
+                    guint              n_extents,
+                    gboolean           vertical,
+                    int                old_size,
+                    int                delta,
+                    int               *seam_start,
+                    int               *seam_end)
+{
+  int start, end;
+  guint i;
+
+  start = 0;
+  end = old_size;
+
+  for (i = 0; i < n_extents; i++)
+    {
+      const PieceExtent *o = &old_extents[i];
+      const PieceExtent *n = &new_extents[i];
+      int o1, o2, n1, n2;
+      gboolean fixed1, fixed2;
+
+      if (vertical)
+        {
+          o1 = o->y1; o2 = o->y2; n1 = n->y1; n2 = n->y2;
+        }
+      else
+        {
+          o1 = o->x1; o2 = o->x2; n1 = n->x1; n2 = n->x2;
+        }
+
+      if (delta == 0)
+        {
+          if (o1 != n1 || o2 != n2)
+            return FALSE;
+          continue;
+        }
+
+      if (n1 - o1 != 0 && n1 - o1 != delta)
+        return FALSE;
+      if (n2 - o2 != 0 && n2 - o2 != delta)
+        return FALSE;
+
+      fixed1 = n1 == o1;
+      fixed2 = n2 == o2;
+
+      if (fixed1 != fixed2)
+        {
+          /* Stretched: the fixed end has to come first */
+          if (!(vertical ? o->uniform_y : o->uniform_x))
+            return FALSE;
+          if ((fixed1 ? o1 : o2) > (fixed1 ? o2 : o1))
+            return FALSE;
+        }
+
+      if (fixed1)
+        start = MAX (start, o1 + o->margin);
+      else
+        end = MIN (end, o1 - o->margin);
+
+      if (fixed2)
+        start = MAX (start, o2 + o->margin);
+      else
+        end = MIN (end, o2 - o->margin);
+    }
+
+  if (delta == 0)
+    return TRUE;
+
+  /* Need one column to repeat, and the far part must not slide over
+   * the near one.
+   */
+  if (start >= end || end + delta < start)
+    return FALSE;
+
+  *seam_start = start;
+  *seam_end = end;
+
   return TRUE;
 }
 
 static void
-button_rect (MetaButtonType           type,
-             const MetaFrameGeometry *fgeom,
-             int                      middle_background_offset,
-             GdkRectangle            *rect)
+paint_piece_render (cairo_t           *cr,
+                    const PieceRender *render,
+                    MetaRectangle      rect,
+                    int                seam_x,
+                    int                seam_end_x,
+                    int                seam_y,
+                    int                seam_end_y)
 {
-  switch (type)
+  int dx = rect.width - render->width;
+  int dy = rect.height - render->height;
+  cairo_surface_t *seam;
+  cairo_pattern_t *pattern;
+  cairo_matrix_t matrix;
+
+  if (dx == 0 && dy == 0)
     {
-    case META_BUTTON_TYPE_LEFT_LEFT_BACKGROUND:
-      *rect = fgeom->left_left_background;
-      break;
+      cairo_set_source_surface (cr, render->surface, rect.x, rect.y);
+      cairo_paint (cr);
+      return;
+    }
 
-    case META_BUTTON_TYPE_LEFT_MIDDLE_BACKGROUND:
-      *rect = fgeom->left_middle_backgrounds[middle_background_offset];
-      break;
-      
-    case META_BUTTON_TYPE_LEFT_RIGHT_BACKGROUND:
-      *rect = fgeom->left_right_background;
-      break;
+  /* The near part, the far part moved along by the change in size,
+   * and the first column or row of the seam repeated in between.
+   */
+  if (dx != 0)
+    {
+      cairo_set_source_surface (cr, render->surface, rect.x, rect.y);
+      cairo_rectangle (cr, rect.x, rect.y, seam_x, rect.height);
+      cairo_fill (cr);
 
-    case META_BUTTON_TYPE_LEFT_SINGLE_BACKGROUND:
-      *rect = fgeom->left_single_background;
-      break;
-      
-    case META_BUTTON_TYPE_RIGHT_LEFT_BACKGROUND:
-      *rect = fgeom->right_left_background;
-      break;
-      
-    case META_BUTTON_TYPE_RIGHT_MIDDLE_BACKGROUND:
-      *rect = fgeom->right_middle_backgrounds[middle_background_offset];
-      break;
-      
-    case META_BUTTON_TYPE_RIGHT_RIGHT_BACKGROUND:
-      *rect = fgeom->right_right_background;
-      break;
+      cairo_set_source_surface (cr, render->surface, rect.x + dx, rect.y);
+      cairo_rectangle (cr, rect.x + seam_end_x + dx, rect.y,
+                       render->width - seam_end_x, rect.height);
+      cairo_fill (cr);
 
-    case META_BUTTON_TYPE_RIGHT_SINGLE_BACKGROUND:
-      *rect = fgeom->right_single_background;
-      break;
-      
-    case META_BUTTON_TYPE_CLOSE:
-      *rect = fgeom->close_rect.visible;
-      break;
+      seam = cairo_surface_create_for_rectangle (render->surface,
+                                                 seam_x, 0,
+                                                 1, render->height);
+      cairo_matrix_init_translate (&matrix, -(rect.x + seam_x), -rect.y);
+      cairo_rectangle (cr, rect.x + seam_x, rect.y,
+                       seam_end_x + dx - seam_x, rect.height);
+    }
+  else
+    {
+      cairo_set_source_surface (cr, render->surface, rect.x, rect.y);
+      cairo_rectangle (cr, rect.x, rect.y, rect.width, seam_y);
+      cairo_fill (cr);
 
-    case META_BUTTON_TYPE_SHADE:
-      *rect = fgeom->shade_rect.visible;
-      break;
+      cairo_set_source_surface (cr, render->surface, rect.x, rect.y + dy);
+      cairo_rectangle (cr, rect.x, rect.y + seam_end_y + dy,
+                       rect.width, render->height - seam_end_y);
+      cairo_fill (cr);
 
-    case META_BUTTON_TYPE_UNSHADE:
-      *rect = fgeom->unshade_rect.visible;
-      break;
+      seam = cairo_surface_create_for_rectangle (render->surface,
+                                                 0, seam_y,
+                                                 render->width, 1);
+      cairo_matrix_init_translate (&matrix, -rect.x, -(rect.y + seam_y));
+      cairo_rectangle (cr, rect.x, rect.y + seam_y,
+                       rect.width, seam_end_y + dy - seam_y);
+    }
 
-    case META_BUTTON_TYPE_ABOVE:
-      *rect = fgeom->above_rect.visible;
-      break;
+  pattern = cairo_pattern_create_for_surface (seam);
+  cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REPEAT);
+  cairo_pattern_set_matrix (pattern, &matrix);
+  cairo_set_source (cr, pattern);
+  cairo_fill (cr);
 
-    case META_BUTTON_TYPE_UNABOVE:
-      *rect = fgeom->unabove_rect.visible;
-      break;
+  cairo_pattern_destroy (pattern);
+  cairo_surface_destroy (seam);
+}
 
-    case META_BUTTON_TYPE_STICK:
-      *rect = fgeom->stick_rect.visible;
-      break;
+/*
+ * Draws an op list as a frame piece, from a cached rendering when
+ * there is a usable one.
+ */
+static void
+draw_piece_cached (const MetaDrawOpList *op_list,
+                   GtkStyleContext      *style_gtk,
+                   GtkWidget            *widget,
+                   cairo_t              *cr,
+                   const MetaDrawInfo   *info,
+                   MetaRectangle         rect)
+{
+  MetaDrawOpList *list = (MetaDrawOpList *) op_list;
+  GtkStateFlags state;
+  GArray *extents;
+  PieceRender *render;
+  cairo_t *render_cr;
+  GList *l;
+  gsize size;
 
-    case META_BUTTON_TYPE_UNSTICK:
-      *rect = fgeom->unstick_rect.visible;
-      break;
+  size = (gsize) rect.width * rect.height * 4;
 
-    case META_BUTTON_TYPE_MAXIMIZE:
-      *rect = fgeom->max_rect.visible;
-      break;
+  extents = g_array_new (FALSE, FALSE, sizeof (PieceExtent));
 
-    case META_BUTTON_TYPE_MINIMIZE:
-      *rect = fgeom->min_rect.visible;
-      break;
+  if (op_list->n_ops == 0 ||
+      size > PIECE_CACHE_MAX_SIZE / 4 ||
+      !collect_piece_extents (op_list, info, rect, rect, extents))
+    {
+      g_array_free (extents, TRUE);
+      meta_draw_op_list_draw_with_style (op_list, style_gtk, widget,
+                                         cr, info, rect);
+      return;
+    }
 
-    case META_BUTTON_TYPE_MENU:
-      *rect = fgeom->menu_rect.visible;
-      break;
-      
-    case META_BUTTON_TYPE_LAST:
-      g_assert_not_reached ();
-      break;
+  state = gtk_style_context_get_state (style_gtk);
+
+  for (l = list->renders; l; l = l->next)
+    {
+      int seam_x = 0, seam_end_x = 0, seam_y = 0, seam_end_y = 0;
+
+      render = l->data;
+
+      if (render->style_gtk != style_gtk ||
+          render->state != state ||
+          render->extents->len != extents->len)
+        continue;
+
+      if (rect.width != render->width && rect.height != render->height)
+        continue;
+
+      if (!piece_axis_matches ((PieceExtent *) render->extents->data,
+                               (PieceExtent *) extents->data, extents->len,
+                               FALSE, render->width,
+                               rect.width - render->width,
+                               &seam_x, &seam_end_x) ||
+          !piece_axis_matches ((PieceExtent *) render->extents->data,
+                               (PieceExtent *) extents->data, extents->len,
+                               TRUE, render->height,
+                               rect.height - render->height,
+                               &seam_y, &seam_end_y))
+        continue;
+
+      paint_piece_render (cr, render, rect,
+                          seam_x, seam_end_x, seam_y, seam_end_y);
+
+      list->renders = g_list_remove_link (list->renders, l);
+      list->renders = g_list_concat (l, list->renders);
+      g_queue_unlink (&piece_renders, render->link);
+      g_queue_push_head_link (&piece_renders, render->link);
+
+      g_array_free (extents, TRUE);
+      return;
     }
+
+  render = g_slice_new0 (PieceRender);
+  render->op_list = list;
+  render->style_gtk = g_object_ref (style_gtk);
+  render->state = state;
+  render->width = rect.width;
+  render->height = rect.height;
+  render->extents = extents;
+  render->size = size;
+  render->surface = cairo_surface_create_similar (cairo_get_target (cr),
+                                                  CAIRO_CONTENT_COLOR_ALPHA,
+                                                  rect.width, rect.height);
+
+  render_cr = cairo_create (render->surface);
+  cairo_translate (render_cr, -rect.x, -rect.y);
+  meta_draw_op_list_draw_with_style (op_list, style_gtk, widget,
+                                     render_cr, info, rect);
+  cairo_destroy (render_cr);
+
+  paint_piece_render (cr, render, rect, 0, 0, 0, 0);
+
+  if (g_list_length (list->renders) >= PIECE_RENDERS_PER_LIST)
+    piece_render_free (g_list_last (list->renders)->data);
+
+  while (piece_renders.tail &&
+         piece_renders_size + size > PIECE_CACHE_MAX_SIZE)
+    piece_render_free (piece_renders.tail->data);
+
+  list->renders = g_list_prepend (list->renders, render);
+  g_queue_push_head (&piece_renders, render);
+  render->link = piece_renders.head;
+  piece_renders_size += size;
 }
 
 LOCAL_SYMBOL LOCAL_SYMBOL void
@@ -4698,7 +6520,7 @@ meta_frame_style_draw_with_style (MetaFrameStyle          *style,
   GdkRectangle bottom_titlebar_edge;
   GdkRectangle top_titlebar_edge;
   GdkRectangle left_edge, right_edge, bottom_edge;
-  PangoRectangle logical_rect;
+  TitleCache *title_cache;
   MetaDrawInfo draw_info;
   const MetaFrameBorders *borders;
 
@@ -4749,15 +6571,13 @@ meta_frame_style_draw_with_style (MetaFrameStyle          *style,
   bottom_edge.width = visible_rect.width;
   bottom_edge.height = borders->visible.bottom;
 
-  if (title_layout)
-    pango_layout_get_pixel_extents (title_layout,
-                                    NULL, &logical_rect);
+  title_cache = title_layout ? get_title_cache (title_layout) : NULL;
 
   draw_info.mini_icon = mini_icon;
   draw_info.icon = icon;
   draw_info.title_layout = title_layout;
-  draw_info.title_layout_width = title_layout ? logical_rect.width : 0;
-  draw_info.title_layout_height = title_layout ? logical_rect.height : 0;
+  draw_info.title_layout_width = title_cache ? title_cache->logical_rect.width : 0;
+  draw_info.title_layout_height = title_cache ? title_cache->logical_rect.height : 0;
   draw_info.fgeom = fgeom;
   
   /* The enum is in the order the pieces should be rendered. */
@@ -4847,12 +6667,12 @@ meta_frame_style_draw_with_style (MetaFrameStyle          *style,
             {
               MetaRectangle m_rect;
               m_rect = meta_rect (rect.x, rect.y, rect.width, rect.height);
-              meta_draw_op_list_draw_with_style (op_list,
-                                                 style_gtk,
-                                                 widget,
-                                                 cr,
-                                                 &draw_info,
-                                                 m_rect);
+              draw_piece_cached (op_list,
+                                 style_gtk,
+                                 widget,
+                                 cr,
+                                 &draw_info,
+                                 m_rect);
             }
         }
 
@@ -4889,12 +6709,12 @@ meta_frame_style_draw_with_style (MetaFrameStyle          *style,
                       m_rect = meta_rect (rect.x, rect.y,
                                           rect.width, rect.height);
 
-                      meta_draw_op_list_draw_with_style (op_list,
-                                                         style_gtk,
-                                                         widget,
-                                                         cr,
-                                                         &draw_info,
-                                                         m_rect);
+                      draw_piece_cached (op_list,
+                                         style_gtk,
+                                         widget,
+                                         cr,
+                                         &draw_info,
+                                         m_rect);
                     }
 
                   cairo_restore (cr);
@@ -5404,6 +7224,12 @@ meta_theme_load_image (MetaTheme  *theme,
           gint test_height, test_width;
 
           test_pixbuf = gdk_pixbuf_new_from_file (full_path, error);
+          if (test_pixbuf == NULL)
+            {
+              g_free (full_path);
+              return NULL;
+            }
+
           test_height = gdk_pixbuf_get_height (test_pixbuf);
           test_width = gdk_pixbuf_get_width (test_pixbuf);
 
@@ -5433,6 +7259,276 @@ meta_theme_load_image (MetaTheme  *theme,
   return pixbuf;
 }
 
+/**
+ * meta_theme_check_image: (skip)
+ *
+ * Checks that meta_theme_load_image() has something to load, without
+ * decoding it: the file must be there and its header must be that of
+ * an image format gdk-pixbuf knows. A file damaged past its header is
+ * only found out when the image is first needed.
+ */
+LOCAL_SYMBOL gboolean
+meta_theme_check_image (MetaTheme  *theme,
+                        const char *filename,
+                        GError    **error)
+{
+  char *full_path;
+  gboolean ok = TRUE;
+  int width, height;
+
+  if (g_hash_table_lookup (theme->images_by_filename, filename))
+    return TRUE;
+
+  if (g_str_has_prefix (filename, "theme:") &&
+      META_THEME_ALLOWS (theme, META_THEME_IMAGES_FROM_ICON_THEMES))
+    {
+      if (gtk_icon_theme_has_icon (gtk_icon_theme_get_default (),
+                                   filename + 6))
+        return TRUE;
+
+      g_set_error (error, GTK_ICON_THEME_ERROR, GTK_ICON_THEME_NOT_FOUND,
+                   _("Icon '%s' not present in theme"), filename + 6);
+      return FALSE;
+    }
+
+  full_path = g_build_filename (theme->dirname, filename, NULL);
+
+  if (!g_file_test (full_path, G_FILE_TEST_IS_REGULAR))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                   _("Failed to open file '%s': No such file"), full_path);
+      ok = FALSE;
+    }
+  else if (gdk_pixbuf_get_file_info (full_path, &width, &height) == NULL)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE,
+                   _("Couldn't recognize the image file format for file '%s'"),
+                   full_path);
+      ok = FALSE;
+    }
+  else if (width <= 0 || height <= 0)
+    {
+      g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                   _("Image file '%s' has no size in its header"), full_path);
+      ok = FALSE;
+    }
+
+  g_free (full_path);
+
+  return ok;
+}
+
+static gboolean lazy_images = TRUE;
+
+/**
+ * meta_theme_set_lazy_images:
+ * @lazy: whether to load images only when a style needs them
+ *
+ * Turning this off makes the parser load every image in the theme, as
+ * it used to, so that testthemebench can compare the two.
+ */
+void
+meta_theme_set_lazy_images (gboolean lazy)
+{
+  lazy_images = lazy;
+}
+
+/**
+ * meta_theme_get_lazy_images:
+ *
+ * Returns: whether images are loaded only when a style needs them
+ */
+gboolean
+meta_theme_get_lazy_images (void)
+{
+  return lazy_images;
+}
+
+static void
+image_detect_stripes (MetaDrawOp *op)
+{
+  GdkPixbuf *pixbuf = op->data.image.pixbuf;
+  int h, w, c;
+  int pixbuf_width, pixbuf_height, pixbuf_n_channels, pixbuf_rowstride;
+  guchar *pixbuf_pixels;
+
+  pixbuf_n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+  pixbuf_width = gdk_pixbuf_get_width(pixbuf);
+  pixbuf_height = gdk_pixbuf_get_height(pixbuf);
+  pixbuf_rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  pixbuf_pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+  /* Check for horizontal stripes */
+  for (h = 0; h < pixbuf_height; h++)
+    {
+      for (w = 1; w < pixbuf_width; w++)
+        {
+          for (c = 0; c < pixbuf_n_channels; c++)
+            {
+              if (pixbuf_pixels[(h * pixbuf_rowstride) + c] !=
+                  pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
+                break;
+            }
+          if (c < pixbuf_n_channels)
+            break;
+        }
+      if (w < pixbuf_width)
+        break;
+    }
+
+  op->data.image.horizontal_stripes = h >= pixbuf_height;
+
+  /* Check for vertical stripes */
+  for (w = 0; w < pixbuf_width; w++)
+    {
+      for (h = 1; h < pixbuf_height; h++)
+        {
+          for (c = 0; c < pixbuf_n_channels; c++)
+            {
+              if (pixbuf_pixels[w + c] !=
+                  pixbuf_pixels[(h * pixbuf_rowstride) + w + c])
+                break;
+            }
+          if (c < pixbuf_n_channels)
+            break;
+        }
+      if (h < pixbuf_height)
+        break;
+    }
+
+  op->data.image.vertical_stripes = w >= pixbuf_width;
+}
+
+static void
+draw_op_load_image (MetaDrawOp *op,
+                    MetaTheme  *theme)
+{
+  GError *error = NULL;
+
+  op->data.image.pixbuf = meta_theme_load_image (theme,
+                                                 op->data.image.filename,
+                                                 theme->scale, &error);
+  if (op->data.image.pixbuf == NULL)
+    {
+      /* The op draws nothing rather than taking the theme down */
+      meta_warning (_("Could not load image \"%s\" for theme \"%s\": %s\n"),
+                    op->data.image.filename, theme->name, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  image_detect_stripes (op);
+}
+
+static void
+draw_op_list_materialize (MetaDrawOpList *op_list,
+                          MetaTheme      *theme)
+{
+  int i;
+
+  if (op_list == NULL || op_list->materialized)
+    return;
+
+  op_list->materialized = TRUE;
+
+  for (i = 0; i < op_list->n_ops; i++)
+    {
+      MetaDrawOp *op = op_list->ops[i];
+
+      switch (op->type)
+        {
+        case META_DRAW_IMAGE:
+          if (op->data.image.pixbuf == NULL && op->data.image.filename)
+            draw_op_load_image (op, theme);
+          break;
+
+        case META_DRAW_OP_LIST:
+          draw_op_list_materialize (op->data.op_list.op_list, theme);
+          break;
+
+        case META_DRAW_TILE:
+          draw_op_list_materialize (op->data.tile.op_list, theme);
+          break;
+
+        default:
+          break;
+        }
+    }
+}
+
+/* Pieces and buttons a style doesn't have come from its parents, so
+ * they are loaded too.
+ */
+static void
+frame_style_materialize (MetaFrameStyle *style,
+                         MetaTheme      *theme)
+{
+  int i, j;
+
+  for (; style != NULL && !style->materialized; style = style->parent)
+    {
+      style->materialized = TRUE;
+
+      for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+        draw_op_list_materialize (style->pieces[i], theme);
+
+      for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+        for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+          draw_op_list_materialize (style->buttons[i][j], theme);
+    }
+}
+
+/**
+ * meta_theme_load_all_images:
+ * @theme: a theme
+ *
+ * Loads every image in @theme now, instead of when the styles using
+ * them are first looked up.
+ */
+void
+meta_theme_load_all_images (MetaTheme *theme)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, theme->draw_op_lists_by_name);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    draw_op_list_materialize (value, theme);
+
+  /* Style sets can only use named styles */
+  g_hash_table_iter_init (&iter, theme->styles_by_name);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    frame_style_materialize (value, theme);
+}
+
+/**
+ * meta_theme_get_image_stats:
+ * @theme: a theme
+ * @n_images: (out): how many images @theme has loaded
+ * @bytes: (out): the size of their pixels
+ *
+ * Lets testthemebench show how much lazy image loading saves.
+ */
+void
+meta_theme_get_image_stats (MetaTheme *theme,
+                            guint     *n_images,
+                            gsize     *bytes)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  *n_images = 0;
+  *bytes = 0;
+
+  g_hash_table_iter_init (&iter, theme->images_by_filename);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      *n_images += 1;
+      *bytes += (gsize) gdk_pixbuf_get_rowstride (value) *
+                gdk_pixbuf_get_height (value);
+    }
+}
+
 static MetaFrameStyle*
 theme_get_style (MetaTheme     *theme,
                  MetaFrameType  type,
@@ -5526,6 +7622,9 @@ theme_get_style (MetaTheme     *theme,
 
   style = get_style (style_set, state, resize, focus);
 
+  if (style && !style->materialized)
+    frame_style_materialize (style, theme);
+
   return style;
 }
 
@@ -5657,7 +7756,7 @@ meta_theme_get_frame_borders (MetaTheme        *theme,
                                  borders);
 }
 
-LOCAL_SYMBOL void
+void
 meta_theme_calc_geometry (MetaTheme              *theme,
                           MetaFrameType           type,
                           int                     text_height,
@@ -499,6 +499,26 @@ meta_ui_queue_frame_draw (MetaUI *ui,
   meta_frames_queue_draw (ui->frames, xwindow);
 }
 
+LOCAL_SYMBOL gboolean
+meta_ui_frames_are_composited (MetaUI *ui)
+{
+  return ui->frames->composited;
+}
+
+LOCAL_SYMBOL void
+meta_ui_set_frames_composited (MetaUI   *ui,
+                               gboolean  composited)
+{
+  meta_frames_set_composited (ui->frames, composited);
+}
+
+LOCAL_SYMBOL cairo_surface_t *
+meta_ui_render_frame (MetaUI *ui,
+                      Window  xwindow)
+{
+  return meta_frames_render_frame (ui->frames, xwindow);
+}
+
 LOCAL_SYMBOL void
 meta_ui_set_frame_title (MetaUI     *ui,
                          Window      xwindow,
@@ -992,6 +1012,18 @@ meta_ui_window_is_widget (MetaUI *ui,
     return FALSE;
 }
 
+/* Whether GDK has a window for @xwindow, and so may want its events */
+LOCAL_SYMBOL gboolean
+meta_ui_window_is_gdk (Display *xdisplay,
+                       Window   xwindow)
+{
+  GdkDisplay *display;
+
+  display = gdk_x11_lookup_xdisplay (xdisplay);
+
+  return gdk_x11_window_lookup_for_display (display, xwindow) != NULL;
+}
+
 /* stock icon code Copyright (C) 2002 Jorn Baayen <jorn@nl.linux.org> */
 typedef struct
 {
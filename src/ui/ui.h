@@ -110,6 +110,12 @@ void meta_ui_get_corner_radiuses (MetaUI *ui,
 void meta_ui_queue_frame_draw (MetaUI *ui,
                                Window xwindow);
 
+gboolean         meta_ui_frames_are_composited (MetaUI *ui);
+void             meta_ui_set_frames_composited (MetaUI   *ui,
+                                                gboolean  composited);
+cairo_surface_t *meta_ui_render_frame          (MetaUI *ui,
+                                                Window  xwindow);
+
 void meta_ui_set_frame_title (MetaUI *ui,
                               Window xwindow,
                               const char *title);
@@ -181,6 +187,8 @@ gchar*   meta_ui_accelerator_name  (unsigned int        keysym,
                                     MetaVirtualModifier mask);
 gboolean meta_ui_window_is_widget (MetaUI *ui,
                                    Window  xwindow);
+gboolean meta_ui_window_is_gdk    (Display *xdisplay,
+                                   Window   xwindow);
 
 MetaUIDirection meta_ui_get_direction (void);
 
@@ -20,6 +20,7 @@
  */
 
 #include <gtk/gtk.h>
+#include <gdk/gdkx.h>
 
 #include <stdlib.h>
 #include <sys/types.h>
@@ -29,11 +30,12 @@
 
 static void set_up_the_evil (void);
 static void set_up_icon_windows (void);
+static void set_up_map_burst (int n_windows);
 
 static void
 usage (void)
 {
-  g_print ("wm-tester [--evil] [--icon-windows]\n");
+  g_print ("wm-tester [--evil] [--icon-windows] [--map-burst [N]]\n");
   exit (0);
 }
 
@@ -43,11 +45,13 @@ main (int argc, char **argv)
   int i;
   gboolean do_evil;
   gboolean do_icon_windows;
+  int map_burst;
   
   gtk_init (&argc, &argv);  
   
   do_evil = FALSE;
   do_icon_windows = FALSE;
+  map_burst = 0;
   
   i = 1;
   while (i < argc)
@@ -62,6 +66,12 @@ main (int argc, char **argv)
         do_evil = TRUE;
       else if (strcmp (arg, "--icon-windows") == 0)
         do_icon_windows = TRUE;
+      else if (strcmp (arg, "--map-burst") == 0)
+        {
+          map_burst = 500;
+          if (i + 1 < argc && atoi (argv[i + 1]) > 0)
+            map_burst = atoi (argv[++i]);
+        }
       else
         usage ();
       
@@ -69,7 +79,7 @@ main (int argc, char **argv)
     }
 
   /* Be sure some option was provided */
-  if (! (do_evil || do_icon_windows))
+  if (! (do_evil || do_icon_windows || map_burst > 0))
     return 1;
   
   if (do_evil)
@@ -77,6 +87,9 @@ main (int argc, char **argv)
 
   if (do_icon_windows)
     set_up_icon_windows ();
+
+  if (map_burst > 0)
+    set_up_map_burst (map_burst);
   
   gtk_main ();
 
@@ -243,3 +256,108 @@ set_up_icon_windows (void)
       ++i;
     }
 }
+
+/* Map a burst of plain X windows at once and time how long it takes
+ * the window manager to manage all of them, going by when it sets
+ * WM_STATE on each.
+ */
+static int burst_n_windows = 0;
+static int burst_n_managed = 0;
+static gint64 burst_start_time = 0;
+static GHashTable *burst_pending = NULL;
+static Atom burst_wm_state = None;
+
+static void
+report_map_burst (void)
+{
+  double elapsed;
+
+  elapsed = (g_get_monotonic_time () - burst_start_time) / 1000.0;
+
+  g_print ("%d of %d windows managed in %.1f ms (%.3f ms per window)\n",
+           burst_n_managed, burst_n_windows, elapsed,
+           burst_n_managed > 0 ? elapsed / burst_n_managed : 0.0);
+}
+
+static GdkFilterReturn
+map_burst_filter (GdkXEvent *xevent,
+                  GdkEvent  *event,
+                  gpointer   data)
+{
+  XEvent *xev = xevent;
+
+  if (xev->type == PropertyNotify &&
+      xev->xproperty.atom == burst_wm_state &&
+      xev->xproperty.state == PropertyNewValue &&
+      g_hash_table_remove (burst_pending,
+                           GUINT_TO_POINTER (xev->xproperty.window)))
+    {
+      ++burst_n_managed;
+
+      if (burst_n_managed == burst_n_windows)
+        {
+          report_map_burst ();
+          gtk_main_quit ();
+        }
+    }
+
+  return GDK_FILTER_CONTINUE;
+}
+
+static gboolean
+map_burst_timeout (gpointer data)
+{
+  g_print ("Timed out waiting for the window manager\n");
+  report_map_burst ();
+  gtk_main_quit ();
+
+  return FALSE;
+}
+
+static void
+set_up_map_burst (int n_windows)
+{
+  Display *xdisplay;
+  Window xroot;
+  Window *windows;
+  int i;
+
+  xdisplay = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+  xroot = DefaultRootWindow (xdisplay);
+  burst_wm_state = XInternAtom (xdisplay, "WM_STATE", False);
+  burst_pending = g_hash_table_new (NULL, NULL);
+  burst_n_windows = n_windows;
+
+  gdk_window_add_filter (NULL, map_burst_filter, NULL);
+
+  windows = g_new (Window, n_windows);
+
+  for (i = 0; i < n_windows; i++)
+    {
+      char *title;
+
+      windows[i] = XCreateSimpleWindow (xdisplay, xroot,
+                                        (i * 7) % 800, (i * 5) % 600,
+                                        200, 150, 0, 0, 0);
+      XSelectInput (xdisplay, windows[i], PropertyChangeMask);
+
+      title = g_strdup_printf ("Burst window %d", i);
+      XStoreName (xdisplay, windows[i], title);
+      g_free (title);
+
+      g_hash_table_add (burst_pending, GUINT_TO_POINTER (windows[i]));
+    }
+
+  XSync (xdisplay, False);
+
+  burst_start_time = g_get_monotonic_time ();
+
+  for (i = 0; i < n_windows; i++)
+    XMapWindow (xdisplay, windows[i]);
+
+  XFlush (xdisplay);
+
+  g_free (windows);
+
+  g_timeout_add_seconds (60, map_burst_timeout, NULL);
+}
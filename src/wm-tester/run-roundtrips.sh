@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Runs muffin under Xvfb with round trip accounting on, drives it with
+# test-roundtrips and prints how many round trips each window manager
+# operation made.
+#
+#   run-roundtrips.sh [-b BUDGET] MUFFIN [MUFFIN_ARGS...]
+#
+# With -b, the run fails if any operation made more round trips per
+# call on average than BUDGET allows. BUDGET has one operation per line,
+# its name and the most round trips per call, separated by white space;
+# lines starting with '#' are comments. Operations it doesn't name are
+# not checked.
+#
+# Exits 0 if the run was within budget, 1 if it wasn't or muffin didn't
+# do what test-roundtrips asked, and 2 if the run could not be made.
+
+test_roundtrips=${TEST_ROUNDTRIPS:-./test-roundtrips}
+xvfb_display=${XVFB_DISPLAY:-:99}
+n_windows=${N_WINDOWS:-3}
+budget=
+
+if test "$1" = "-b"; then
+  budget=$2
+  shift 2
+fi
+
+if test $# -lt 1; then
+  echo "Usage: $0 [-b BUDGET] MUFFIN [MUFFIN_ARGS...]" >&2
+  exit 2
+fi
+
+workdir=`mktemp -d` || exit 2
+report=$workdir/roundtrips
+xvfb_pid=
+adopt_pid=
+muffin_pid=
+
+cleanup () {
+  for pid in $muffin_pid $adopt_pid $xvfb_pid; do
+    kill $pid 2>/dev/null
+  done
+  wait 2>/dev/null
+  rm -rf "$workdir"
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+Xvfb $xvfb_display -screen 0 1280x1024x24 +extension GLX -nolisten tcp \
+  >"$workdir/xvfb.log" 2>&1 &
+xvfb_pid=$!
+
+DISPLAY=$xvfb_display
+export DISPLAY
+
+# Wait for the server by waiting for a client that can connect
+tries=0
+until xdpyinfo >/dev/null 2>&1; do
+  tries=`expr $tries + 1`
+  if test $tries -gt 50; then
+    echo "Xvfb did not start:" >&2
+    cat "$workdir/xvfb.log" >&2
+    exit 2
+  fi
+  sleep 0.1
+done
+
+# Windows that are there before muffin, for meta_screen_manage_all_windows()
+"$test_roundtrips" adopt $n_windows >"$workdir/adopt.log" &
+adopt_pid=$!
+tries=0
+until grep -q ready "$workdir/adopt.log" 2>/dev/null; do
+  tries=`expr $tries + 1`
+  if test $tries -gt 50; then
+    echo "test-roundtrips adopt did not start" >&2
+    exit 2
+  fi
+  sleep 0.1
+done
+
+MUFFIN_DEBUG_ROUNDTRIPS=1 MUFFIN_ROUNDTRIP_REPORT=$report \
+  "$@" >"$workdir/muffin.log" 2>&1 &
+muffin_pid=$!
+
+"$test_roundtrips" drive $n_windows
+drive_status=$?
+
+# muffin writes the report when it closes the display, which it does
+# on SIGTERM
+kill $muffin_pid
+wait $muffin_pid
+muffin_pid=
+
+if test ! -s "$report"; then
+  echo "muffin wrote no round trip report:" >&2
+  cat "$workdir/muffin.log" >&2
+  exit 2
+fi
+
+cat "$report"
+
+status=0
+if test $drive_status -ne 0; then
+  status=1
+fi
+
+if test -n "$budget"; then
+  awk -v report="$report" '
+    /^#/ || NF < 2 { next }
+    { budget[$1] = $2 }
+    END {
+      over = 0
+      while ((getline line < report) > 0) {
+        if (line ~ /^#/)
+          continue
+        split (line, fields, "\t")
+        op = fields[1]
+        if (!(op in budget) || fields[2] == 0)
+          continue
+        per_call = fields[3] / fields[2]
+        if (per_call > budget[op]) {
+          printf ("Over budget: %s made %.1f round trips per call, budget is %s\n", op, per_call, budget[op]) > "/dev/stderr"
+          over = 1
+        }
+      }
+      exit over
+    }' "$budget" || status=1
+fi
+
+exit $status
@@ -0,0 +1,341 @@
+/* Drives a running window manager through the operations whose round
+ * trips muffin accounts for with MUFFIN_DEBUG_ROUNDTRIPS; see
+ * run-roundtrips.sh, which runs it under Xvfb.
+ *
+ *   test-roundtrips adopt [N]  maps N windows and waits to be killed,
+ *                              for a window manager starting later to
+ *                              adopt them
+ *   test-roundtrips drive [N]  waits for a window manager, then maps N
+ *                              windows, activates each, switches
+ *                              workspace and back, starts and cancels a
+ *                              keyboard move of each and destroys them
+ *
+ * Exits 1 if the window manager didn't do what was asked in time.
+ */
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define DEFAULT_N_WINDOWS 3
+#define TIMEOUT_MS 5000
+
+#define _NET_WM_MOVERESIZE_MOVE_KEYBOARD 10
+#define _NET_WM_MOVERESIZE_CANCEL        11
+
+static Display *display;
+static Window root;
+static Atom atom_net_active_window;
+static Atom atom_net_current_desktop;
+static Atom atom_net_number_of_desktops;
+static Atom atom_net_supporting_wm_check;
+static Atom atom_net_wm_moveresize;
+static Atom atom_timestamp;
+
+static long
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+/* Reads events until one of @type arrives for @window, or the timeout
+ * runs out
+ */
+static Bool
+wait_for_event (Window  window,
+                int     type,
+                XEvent *event)
+{
+  long deadline = now_ms () + TIMEOUT_MS;
+
+  while (True)
+    {
+      struct pollfd pfd;
+      long remaining;
+
+      while (XPending (display) > 0)
+        {
+          XNextEvent (display, event);
+          if (event->type == type && event->xany.window == window)
+            return True;
+        }
+
+      remaining = deadline - now_ms ();
+      if (remaining <= 0)
+        return False;
+
+      pfd.fd = ConnectionNumber (display);
+      pfd.events = POLLIN;
+      poll (&pfd, 1, remaining);
+    }
+}
+
+static Bool
+get_cardinal (Window         window,
+              Atom           property,
+              unsigned long *value)
+{
+  Atom type;
+  int format;
+  unsigned long n_items, bytes_after;
+  unsigned char *data = NULL;
+  Bool ok = False;
+
+  if (XGetWindowProperty (display, window, property, 0, 1, False,
+                          AnyPropertyType, &type, &format, &n_items,
+                          &bytes_after, &data) == Success &&
+      data != NULL && format == 32 && n_items == 1)
+    {
+      *value = ((unsigned long *) data)[0];
+      ok = True;
+    }
+
+  if (data)
+    XFree (data);
+
+  return ok;
+}
+
+/* Waits for @property on the root window to become @value */
+static Bool
+wait_for_root_cardinal (Atom          property,
+                        unsigned long value)
+{
+  long deadline = now_ms () + TIMEOUT_MS;
+  unsigned long current;
+  XEvent event;
+
+  while (!get_cardinal (root, property, &current) || current != value)
+    {
+      if (now_ms () > deadline ||
+          !wait_for_event (root, PropertyNotify, &event))
+        return False;
+    }
+
+  return True;
+}
+
+/* The usual way for a client to get a server timestamp */
+static Time
+get_server_time (Window window)
+{
+  XEvent event;
+
+  XChangeProperty (display, window, atom_timestamp, XA_CARDINAL, 32,
+                   PropModeReplace, NULL, 0);
+  if (!wait_for_event (window, PropertyNotify, &event))
+    return CurrentTime;
+
+  return event.xproperty.time;
+}
+
+static void
+send_root_message (Window window,
+                   Atom   type,
+                   long   l0,
+                   long   l1,
+                   long   l2,
+                   long   l3)
+{
+  XEvent event;
+
+  memset (&event, 0, sizeof (event));
+  event.xclient.type = ClientMessage;
+  event.xclient.window = window;
+  event.xclient.message_type = type;
+  event.xclient.format = 32;
+  event.xclient.data.l[0] = l0;
+  event.xclient.data.l[1] = l1;
+  event.xclient.data.l[2] = l2;
+  event.xclient.data.l[3] = l3;
+
+  XSendEvent (display, root, False,
+              SubstructureRedirectMask | SubstructureNotifyMask, &event);
+  XFlush (display);
+}
+
+static Window
+create_window (int i)
+{
+  XSizeHints hints;
+  Window window;
+  char title[32];
+
+  window = XCreateSimpleWindow (display, root, 20 * i, 20 * i, 300, 200,
+                                0, 0, WhitePixel (display,
+                                                  DefaultScreen (display)));
+  XSelectInput (display, window, StructureNotifyMask | PropertyChangeMask);
+
+  snprintf (title, sizeof (title), "test-roundtrips %d", i);
+  XStoreName (display, window, title);
+
+  hints.flags = USPosition;
+  hints.x = 20 * i;
+  hints.y = 20 * i;
+  XSetWMNormalHints (display, window, &hints);
+
+  XMapWindow (display, window);
+
+  return window;
+}
+
+static int
+adopt (int n_windows)
+{
+  int i;
+
+  for (i = 0; i < n_windows; i++)
+    create_window (i);
+
+  XSync (display, False);
+  printf ("ready\n");
+  fflush (stdout);
+
+  pause ();
+  return 0;
+}
+
+static int
+drive (int n_windows)
+{
+  Window *windows;
+  unsigned long value;
+  long deadline;
+  int failures = 0;
+  int i;
+
+  /* Muffin sets this up once it has managed the screen */
+  deadline = now_ms () + TIMEOUT_MS;
+  while (!get_cardinal (root, atom_net_supporting_wm_check, &value))
+    {
+      if (now_ms () > deadline)
+        {
+          fprintf (stderr, "No window manager came up\n");
+          return 1;
+        }
+      usleep (50000);
+    }
+
+  windows = calloc (n_windows, sizeof (Window));
+
+  /* meta_window_new_with_attrs() */
+  for (i = 0; i < n_windows; i++)
+    {
+      XEvent event;
+
+      windows[i] = create_window (i);
+      if (!wait_for_event (windows[i], ReparentNotify, &event))
+        {
+          fprintf (stderr, "Window %d was never framed\n", i);
+          failures++;
+        }
+    }
+
+  /* meta_window_focus() */
+  for (i = 0; i < n_windows; i++)
+    {
+      send_root_message (windows[i], atom_net_active_window,
+                         2, get_server_time (windows[i]), 0, 0);
+      if (!wait_for_root_cardinal (atom_net_active_window, windows[i]))
+        {
+          fprintf (stderr, "Window %d was never activated\n", i);
+          failures++;
+        }
+    }
+
+  /* meta_workspace_activate() */
+  send_root_message (root, atom_net_number_of_desktops, 2, 0, 0, 0);
+  if (wait_for_root_cardinal (atom_net_number_of_desktops, 2))
+    {
+      for (i = 1; i >= 0; i--)
+        {
+          send_root_message (root, atom_net_current_desktop,
+                             i, get_server_time (windows[0]), 0, 0);
+          if (!wait_for_root_cardinal (atom_net_current_desktop, i))
+            {
+              fprintf (stderr, "Workspace %d was never activated\n", i);
+              failures++;
+            }
+        }
+    }
+  else
+    {
+      fprintf (stderr, "Couldn't get a second workspace; "
+               "not switching workspaces\n");
+    }
+
+  /* meta_display_begin_grab_op(); nothing says when the grab started,
+   * so the window manager gets a moment for each step
+   */
+  for (i = 0; i < n_windows; i++)
+    {
+      send_root_message (windows[i], atom_net_wm_moveresize,
+                         0, 0, _NET_WM_MOVERESIZE_MOVE_KEYBOARD, Button1);
+      usleep (100000);
+      send_root_message (windows[i], atom_net_wm_moveresize,
+                         0, 0, _NET_WM_MOVERESIZE_CANCEL, Button1);
+      usleep (100000);
+    }
+
+  for (i = 0; i < n_windows; i++)
+    XDestroyWindow (display, windows[i]);
+
+  XSync (display, False);
+  free (windows);
+
+  return failures > 0 ? 1 : 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  int n_windows = DEFAULT_N_WINDOWS;
+
+  if (argc < 2 || argc > 3 ||
+      (strcmp (argv[1], "adopt") != 0 && strcmp (argv[1], "drive") != 0))
+    {
+      fprintf (stderr, "Usage: test-roundtrips adopt|drive [N_WINDOWS]\n");
+      return 2;
+    }
+
+  if (argc == 3)
+    n_windows = atoi (argv[2]);
+  if (n_windows < 1)
+    n_windows = 1;
+
+  display = XOpenDisplay (NULL);
+  if (display == NULL)
+    {
+      fprintf (stderr, "Could not open display\n");
+      return 2;
+    }
+
+  root = DefaultRootWindow (display);
+  XSelectInput (display, root, PropertyChangeMask);
+
+  atom_net_active_window = XInternAtom (display, "_NET_ACTIVE_WINDOW", False);
+  atom_net_current_desktop = XInternAtom (display, "_NET_CURRENT_DESKTOP",
+                                          False);
+  atom_net_number_of_desktops = XInternAtom (display,
+                                             "_NET_NUMBER_OF_DESKTOPS",
+                                             False);
+  atom_net_supporting_wm_check = XInternAtom (display,
+                                              "_NET_SUPPORTING_WM_CHECK",
+                                              False);
+  atom_net_wm_moveresize = XInternAtom (display, "_NET_WM_MOVERESIZE", False);
+  atom_timestamp = XInternAtom (display, "_TEST_ROUNDTRIPS_TIMESTAMP", False);
+
+  if (strcmp (argv[1], "adopt") == 0)
+    return adopt (n_windows);
+  else
+    return drive (n_windows);
+}